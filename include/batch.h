@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include "scan.h"
+
+// files recovered into the output directory at once by default
+#define DEFAULT_WRITERS 4
+#define MAX_WRITERS 64
+
+// state shared by the writers of one batch recovery
+typedef struct {
+	scanSession* m_session;		// the scan results, only read while writing
+	uint64_t m_next;			// next first block candidate to claim
+	uint64_t m_recovered;
+	uint64_t m_bytes;
+	uint64_t m_filtered;
+	uint64_t m_failed;
+} batch;
+
+void setBatchWriters(uint32_t);
+void recoverBatch(scanSession*);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+
+// direct-mapped cache of device blocks keyed by block number
+typedef struct {
+	uint32_t m_blockSize;
+	uint64_t m_numSlots;
+	uint64_t* m_tags;		// block number + 1 per slot, 0 if empty
+	uint8_t* m_data;
+	uint64_t m_hits;
+	uint64_t m_misses;
+} blockCache;
+
+void initBlockCache(blockCache**, uint32_t, uint64_t);
+void freeBlockCache(blockCache**);
+const uint8_t* lookupBlock(blockCache*, uint64_t);
+void storeBlock(blockCache*, uint64_t, const uint8_t*);
+
+#endif
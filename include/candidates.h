@@ -0,0 +1,44 @@
+#ifndef CANDIDATES_H
+#define CANDIDATES_H
+
+#include <stdint.h>
+#include "segmentedArray.h"
+
+// type/confidence flags stored per candidate
+#define CANDIDATE_FIRST 1 << 0		// likely first block of a file
+#define CANDIDATE_INDIRECT 1 << 1	// likely indirect block
+#define HAS_PRIMARY_DESC 1 << 2		// primary volume descriptor found
+#define HAS_DESCRIPTOR 1 << 3		// any volume descriptor found
+#define HAS_MBR 1 << 4				// boot record found in first block
+
+// candidate blocks are stored as parallel packed arrays so 
+// searches only touch the field they need; addresses are
+// computed from the block number on demand; the high bits of
+// block numbers past 2^32 are only kept once one is added, so
+// lists of smaller volumes stay the same size
+typedef struct {
+	segmentedArray* m_blockNums;	// uint32_t low bits of block numbers
+	segmentedArray* m_blockHighs;	// uint16_t high bits, NULL until needed
+	segmentedArray* m_keys;			// uint32_t first pointer in the block
+	segmentedArray* m_flags;		// uint8_t type/confidence flags
+} candidateList;
+
+// entry of the sorted lookup index over candidate keys
+typedef struct {
+	uint32_t m_key;
+	uint32_t m_blockNum;
+} keyEntry;
+
+void initCandidates(candidateList*, uint64_t);
+void freeCandidates(candidateList*);
+void clearCandidates(candidateList*);
+void addCandidate(candidateList*, uint64_t, uint32_t, uint8_t);
+void mergeTail(candidateList*, uint64_t);
+uint64_t numCandidates(const candidateList*);
+uint64_t candidateBlock(const candidateList*, uint64_t);
+uint32_t candidateKey(const candidateList*, uint64_t);
+uint8_t candidateFlags(const candidateList*, uint64_t);
+segmentedArray* buildKeyIndex(const candidateList*, uint32_t);
+uint32_t findByKey(const segmentedArray*, uint32_t);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+// the default socket is kept in a directory only its owner can
+// enter, since the daemon writes recovered files where asked
+#define DEFAULT_SOCKET_DIR "/run/scan_drive"
+#define DEFAULT_SOCKET_PATH DEFAULT_SOCKET_DIR "/scan_drive.sock"
+#define DAEMON_CACHE_BYTES (64 * 1024 * 1024)
+#define MAX_REQUEST_SIZE 4096
+
+void runDaemon(int32_t, int32_t, uint32_t, const char*);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef EVIDENCE_CACHE_H
+#define EVIDENCE_CACHE_H
+
+#include <stdint.h>
+
+// granularity the cache stores and tracks the device in
+#define CACHE_PAGE 4096
+#define CACHE_MAGIC "SDCACHE2"
+
+// sectors hashed into the fingerprint of a device, at fixed
+// fractions of its size, so another device of the same name and
+// size is never mistaken for the one cached
+#define FINGERPRINT_SECTORS 4
+#define FINGERPRINT_SECTOR 4096
+
+// a local copy of everything read from the device, kept across
+// runs: a sparse file holding each byte read at its offset on
+// the device, and a bitmap of the pages it holds
+typedef struct {
+	int32_t m_dataFd;
+	char* m_mapPath;
+	uint8_t* m_present;		// one bit per CACHE_PAGE, set once written
+	uint64_t m_numPages;
+	uint64_t m_deviceSize;
+	uint64_t m_fingerprint;	// hash of the device's FINGERPRINT_SECTORS
+	uint64_t m_mtime;		// modification time in ns of an image, else 0
+	uint64_t m_localBytes;	// bytes served from the cache this run
+	uint64_t m_deviceBytes;	// bytes read from the device this run
+} evidenceCache;
+
+// header of the bitmap file
+typedef struct {
+	char m_magic[8];
+	uint64_t m_deviceSize;
+	uint32_t m_pageSize;
+	uint32_t m_reserved;
+	uint64_t m_fingerprint;
+	uint64_t m_mtime;
+} cacheHeader;
+
+uint32_t openEvidenceCache(evidenceCache**, const char*, const char*, const char*, int32_t);
+void closeEvidenceCache(evidenceCache**);
+int64_t readThrough(evidenceCache*, int32_t, uint8_t*, uint64_t, uint64_t);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#include <stdint.h>
+#include "segmentedArray.h"
+
+typedef int (*compareFunc)(const void*, const void*);
+
+segmentedArray* externalSort(segmentedArray*, compareFunc);
+
+#endif
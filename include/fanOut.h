@@ -0,0 +1,58 @@
+#ifndef FAN_OUT_H
+#define FAN_OUT_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define MAX_CONSUMERS 16
+
+// blocks of the window shared by consumers on their own threads,
+// the scan waits once the slowest falls this far behind
+#define FAN_OUT_SLOTS 256
+
+enum ConsumeMode {
+	CONSUME_INLINE,		// called on the scan's thread
+	CONSUME_THREADED	// called on a thread of its own
+};
+
+// called with the consumer's own state for every block the scan
+// processes, with the block, its address and its block number
+typedef void (*consume)(void*, const uint8_t*, uint64_t, uint64_t);
+
+typedef struct {
+	consume m_consume;
+	void* m_state;
+	uint32_t m_mode;
+	uint64_t m_done;		// blocks of the window consumed, if threaded
+	pthread_t m_thread;
+	struct _fan_out* m_fanOut;
+} consumer;
+
+// the analyses sharing a scan, each block read once is delivered
+// to all of them
+typedef struct _fan_out {
+	consumer m_consumers[MAX_CONSUMERS];
+	uint32_t m_count;
+	uint32_t m_numThreaded;
+
+	// window of the last FAN_OUT_SLOTS blocks, read only to the
+	// threaded consumers, allocated while their threads run
+	uint8_t* m_window;
+	uint64_t m_addrs[FAN_OUT_SLOTS];
+	uint64_t m_blockNums[FAN_OUT_SLOTS];
+	uint32_t m_blockSize;
+	uint64_t m_published;
+	uint32_t m_isRunning;
+	uint32_t m_isClosing;
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_ready;		// a block was published or the scan ended
+	pthread_cond_t m_space;		// a consumer moved on
+} fanOut;
+
+void initFanOut(fanOut**);
+void freeFanOut(fanOut**);
+uint32_t addConsumer(fanOut*, consume, void*, uint32_t);
+void deliverBlock(fanOut*, const uint8_t*, uint32_t, uint64_t, uint64_t);
+void drainFanOut(fanOut*);
+
+#endif
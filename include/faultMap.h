@@ -0,0 +1,31 @@
+#ifndef FAULT_MAP_H
+#define FAULT_MAP_H
+
+#include <stdint.h>
+
+// granularity bad regions are read again in by the final pass
+#define FAULT_SECTOR 512
+
+// after a failed read the reader skips this far ahead, doubling
+// with each failure in a row up to the most, so a dying region
+// is left behind at full speed
+#define MIN_FAULT_STRIDE (64 * 1024)
+#define MAX_FAULT_STRIDE (64 * 1024 * 1024)
+
+// a range of device addresses that could not be read, or was
+// skipped over after a read failed
+typedef struct {
+	uint64_t m_start;
+	uint64_t m_end;
+} badRange;
+
+void loadFaultMap(const char*);
+void saveFaultMap();
+void recordFault(uint64_t, uint64_t);
+void clearFaultStride();
+uint32_t findFault(uint64_t, uint64_t*);
+uint32_t isRangeBad(uint64_t, uint64_t);
+void retryFaults(int32_t, uint64_t, uint64_t);
+uint64_t faultBytes();
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef GPT_H
+#define GPT_H
+
+#include <stdint.h>
+#include "mbr.h"
+
+#define GPT_SIGNATURE "EFI PART"
+#define GPT_PROTECTIVE_TYPE 0xee
+#define GPT_HEADER_LBA 1
+
+// limits on the partition entry array a header may describe,
+// anything larger is a corrupt or crafted header
+#define MAX_GPT_ENTRIES 1024
+#define MAX_GPT_ENTRY_SIZE 4096
+
+typedef struct _gpt_header {
+	uint8_t _signature[8];
+	uint32_t _revision;
+	uint32_t _header_size;
+	uint32_t _header_crc;
+	uint32_t _reserved;
+	uint64_t _current_lba;
+	uint64_t _backup_lba;
+	uint64_t _first_usable_lba;
+	uint64_t _last_usable_lba;
+	uint8_t _disk_guid[16];
+	uint64_t _entries_lba;
+	uint32_t _num_entries;
+	uint32_t _entry_size;
+	uint32_t _entries_crc;
+} GptHeader, *pGptHeader;
+
+typedef struct _gpt_entry {
+	uint8_t _type_guid[16];
+	uint8_t _unique_guid[16];
+	uint64_t _first_lba;
+	uint64_t _last_lba;
+	uint64_t _attributes;
+	uint16_t _name[36];
+} GptEntry, *pGptEntry;
+
+uint32_t isProtectiveMBR(const pMbr);
+uint32_t listGptPartitions(int32_t, uint64_t*, uint32_t);
+
+#endif
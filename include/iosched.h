@@ -0,0 +1,24 @@
+#ifndef IOSCHED_H
+#define IOSCHED_H
+
+#include <stdint.h>
+
+// number of blocks a scan reads before giving up its turn
+// to scans of other partitions on the same spindle
+#define IO_SLOT_BLOCKS 4096
+
+// FIFO ticket lock kept in memory shared between processes
+typedef struct {
+	uint64_t m_nextTicket;
+	uint64_t m_serving;
+} turnLock;
+
+turnLock* createTurnLock();
+void lockTurn(turnLock*);
+void unlockTurn(turnLock*);
+
+void initIOScheduler(const char*);
+void acquireIOSlot();
+void releaseIOSlot();
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef IOTUNE_H
+#define IOTUNE_H
+
+#include <stdint.h>
+#include "readahead.h"
+
+// file the chosen tuning of each device is kept in, under $HOME
+// unless SCAN_DRIVE_TUNE_CACHE names another
+#define TUNE_CACHE_ENV "SCAN_DRIVE_TUNE_CACHE"
+#define DEFAULT_TUNE_CACHE ".scan_drive_tuning"
+
+// each probe reads this much from the same region of the
+// device, stopping early after TUNE_PROBE_MILLIS
+#define TUNE_PROBE_BYTES (16 * 1024 * 1024)
+#define TUNE_PROBE_MILLIS 250
+#define TUNE_PROBE_OFFSET (1024 * 1024)
+
+enum TuneMode {
+	TUNE_OFF,
+	TUNE_AUTO,		// use the cached tuning, probing if there is none
+	TUNE_PROBE		// always probe and replace the cached tuning
+};
+
+void autotuneIO(const char*, int32_t, uint32_t);
+double probeIO(int32_t, ioTuning*);
+uint32_t deviceSerial(const char*, int32_t, char*, uint32_t);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+
+// largest block size of an ext file system
+#define MAX_BLOCK_SIZE 65536
+
+// the per block work of the scan and classifiers, compiled
+// once for each common block size so its loops have fixed
+// bounds, and once for any other size
+typedef struct _block_kernels {
+	uint32_t m_blockSize;	// 0 for the kernels of any size
+
+	// whether a block of numEntries block numbers looks like
+	// an indirect block of a file system of totalBlocks
+	int32_t (*m_isIndirect)(const uint32_t*, uint32_t, uint32_t);
+
+	// whether a block is set in the bitmap of its group
+	uint32_t (*m_isAllocated)(const uint8_t*, uint32_t, uint32_t);
+
+	// whether a block of numEntries 4-byte words is all zero
+	uint32_t (*m_isZero)(const uint32_t*, uint32_t);
+} blockKernels;
+
+const blockKernels* selectKernels(uint32_t);
+
+#endif
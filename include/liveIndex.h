@@ -0,0 +1,27 @@
+#ifndef LIVE_INDEX_H
+#define LIVE_INDEX_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "candidates.h"
+#include "segmentedArray.h"
+
+// hash index over indirect block keys that can be searched while
+// the scan is still adding to it; for each key it keeps the first
+// (lowest) block added, matching findByKey on a finished scan
+typedef struct _live_index {
+	keyEntry* m_entries;		// open addressing, m_blockNum 0 if empty
+	uint64_t m_capacity;		// always a power of two
+	uint64_t m_count;
+	uint32_t m_minBlock;		// blocks below this are never added
+	segmentedArray* m_lookups;	// keyEntry of every lookup and the block found, 0 if none
+	pthread_mutex_t m_lock;
+} liveIndex;
+
+void initLiveIndex(liveIndex**, uint32_t);
+void freeLiveIndex(liveIndex**);
+void insertLive(liveIndex*, uint32_t, uint32_t);
+uint32_t lookupLive(liveIndex*, uint32_t);
+uint32_t findLive(liveIndex*, uint32_t);
+
+#endif
@@ -27,6 +27,7 @@ pMbr allocateMBR();
 pMbr readMBR(int32_t);
 void extractMBR(const uint8_t*, pMbr);
 uint64_t getPartAddr(pMbr, int32_t);
+uint32_t listPartitions(int32_t, uint64_t*, uint32_t);
 void printMBR(int32_t);
 
 
@@ -0,0 +1,10 @@
+#ifndef MULTISCAN_H
+#define MULTISCAN_H
+
+#include <stdint.h>
+
+#define MAX_PARTITIONS 128
+
+void recoverAllPartitions(int32_t, const char*, uint32_t);
+
+#endif
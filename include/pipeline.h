@@ -0,0 +1,36 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "liveIndex.h"
+#include "scan.h"
+#include "segmentedArray.h"
+
+// a file recovered while the scan was running, with the lookups
+// it made and the blocks they found at the time
+typedef struct {
+	uint64_t m_firstBlock;
+	uint64_t m_lookupStart;		// first of its lookups in the index
+	uint64_t m_lookupCount;
+} earlyFile;
+
+// state shared by the scan and the background recovery worker
+typedef struct _pipeline {
+	scanSession m_worker;		// worker's session with its own device handle
+	liveIndex* m_index;
+	segmentedArray* m_queue;	// uint64_t first blocks waiting for recovery
+	uint64_t m_queueHead;
+	segmentedArray* m_early;	// earlyFile per recovered file
+	uint64_t m_scanned;			// the last block the scan has passed
+	uint64_t m_waitFor;			// block the worker waits for the scan to pass
+	uint32_t m_isDone;
+	uint32_t m_isStarted;
+	pthread_t m_thread;
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_wake;
+} pipeline;
+
+void pipelineFiles(int32_t, int32_t, uint32_t);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// how a scan reads the device, the default of one block per
+// read with nothing in flight reads exactly what is processed
+typedef struct {
+	uint32_t m_readBytes;	// bytes per read request, 0 for one block
+	uint32_t m_readers;		// read requests kept in flight
+} ioTuning;
+
+// a chunk of the device being read ahead of the scan
+typedef struct {
+	uint64_t m_addr;
+	uint32_t m_length;
+	uint32_t m_state;
+	uint8_t* m_data;
+} readSlot;
+
+// sequential reader keeping a ring of chunks in flight, each
+// read by its own thread, ahead of the block being processed
+typedef struct {
+	int32_t m_device;
+	uint64_t m_end;			// nothing is read from here on
+	uint32_t m_chunkSize;
+	uint32_t m_numSlots;
+	readSlot* m_slots;
+	uint32_t m_head;		// slot holding the lowest address
+	uint64_t m_nextAddr;	// where the next queued chunk starts
+	uint32_t m_isPrimed;
+	uint32_t m_stop;
+	pthread_t* m_threads;
+	pthread_mutex_t m_lock;
+	pthread_cond_t m_queued;	// readers wait for a chunk to read
+	pthread_cond_t m_ready;		// the scan waits for a chunk to be read
+} readAhead;
+
+void setIOTuning(const ioTuning*);
+void getIOTuning(ioTuning*);
+readAhead* openReadAhead(int32_t, const ioTuning*, uint64_t);
+void readAheadBlock(readAhead*, uint64_t, uint8_t*, uint32_t);
+void closeReadAhead(readAhead*);
+
+#endif
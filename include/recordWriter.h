@@ -0,0 +1,29 @@
+#ifndef RECORD_WRITER_H
+#define RECORD_WRITER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define RECORD_FLUSH_BYTES (64 * 1024)
+#define RECORD_FLUSH_MILLIS 250
+#define MAX_RECORD_SIZE 512
+
+// buffers newline delimited records for a file or pipe and
+// writes them out once enough bytes or time have built up
+typedef struct {
+	int32_t m_fd;
+	char* m_buffer;
+	uint32_t m_used;
+	uint32_t m_flushBytes;
+	uint64_t m_flushNanos;
+	uint64_t m_lastFlush;	// monotonic time of last flush in ns
+	pthread_mutex_t m_lock;	// writers may be shared by scan threads
+} recordWriter;
+
+void initRecordWriter(recordWriter**, int32_t, uint32_t, uint32_t);
+void freeRecordWriter(recordWriter**);
+void writeRecord(recordWriter*, const char*, ...);
+void pollRecords(recordWriter*);
+void flushRecords(recordWriter*);
+
+#endif
@@ -3,7 +3,41 @@
 
 #include <stdint.h>
 #include "scan.h"
+#include "recordWriter.h"
+#include "tarStream.h"
 
+// how files in the output directory are named by default
+#define DEFAULT_NAME_PATTERN "recovered_%p_%b.iso"
+
+void setCandidateStream(recordWriter*);
+recordWriter* getCandidateStream();
+void streamCandidate(scanSession*, uint64_t, uint64_t, uint32_t, uint32_t);
+void streamScanComplete(scanSession*);
+void setOutputDir(const char*);
+void setOutputArchive(tarStream*);
+const char* getOutputDir();
+uint32_t setNamePattern(const char*);
+uint32_t setRecoveryFilter(const char*);
+uint32_t matchesFilter(uint64_t, uint8_t);
+void outputPath(const scanSession*, uint64_t, char*, uint32_t);
 void recoverFiles(int32_t, int32_t, uint32_t);
+void scanForFiles(scanSession*, uint64_t, uint32_t);
+void recoverMatches(scanSession*);
+void releaseMatches(scanSession*);
+void indexMatches(scanSession*);
+int64_t recoverCandidateTo(scanSession*, uint64_t, const char*);
+int64_t recoverFileTo(scanSession*, uint64_t, const char*);
+int64_t recoverToOutput(scanSession*, uint64_t, const char*);
+uint64_t readVolumeSize(scanSession*, uint64_t);
+void assembleFile(scanSession*, uint64_t);
+void initRecoveredBlocks(scanSession*);
+void addRecovered(scanSession*, uint64_t);
+uint64_t recoveredBlock(const scanSession*, uint64_t);
+uint64_t writeBlocks(scanSession*, int32_t);
+void mapBlocks(scanSession*, const uint8_t*, uint64_t, uint64_t);
+uint32_t classifyBlock(const scanSession*, const uint8_t*, uint64_t);
+int32_t isIndirectBlock(const scanSession*, const uint32_t*, uint32_t);
+uint32_t isLikelyFirstBlock(const scanSession*, const uint8_t*, uint64_t);
+uint32_t hasISOSignature(const uint8_t*);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,28 @@
+#ifndef RESCAN_H
+#define RESCAN_H
+
+#include <stdint.h>
+#include "scan.h"
+
+#define SCAN_STATE_MAGIC "SDSCAN03"
+#define FNV_OFFSET 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
+
+// header of a saved scan results file, followed by a groupPrint
+// per block group and then both candidate lists, whose block
+// numbers are 8 bytes if the partition has over 2^32 blocks
+typedef struct {
+	char m_magic[8];
+	uint64_t m_partitionAddr;
+	uint32_t m_blockSize;
+	uint32_t m_scanType;
+	uint64_t m_totalBlocks;
+	uint32_t m_hashContent;
+	uint32_t m_numGroups;
+	uint64_t m_numFirst;
+	uint64_t m_numIndirect;
+} scanStateHeader;
+
+void rescanFiles(int32_t, int32_t, uint32_t, const char*, uint32_t);
+
+#endif
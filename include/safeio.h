@@ -3,13 +3,28 @@
 
 #include <stdint.h>
 #include <fcntl.h>
+#include "evidenceCache.h"
+#include "segments.h"
+
+#define NO_DATA UINT64_MAX
 
 void exit_err(const char*);
 int32_t safeOpen(const char*, int32_t, int32_t);
 void safeSeek(int32_t, uint64_t, int32_t);
 void safeRead(int32_t, uint64_t, uint8_t*, uint32_t);
+int64_t readDevice(int32_t, uint8_t*, uint64_t, uint64_t);
+int64_t readUncached(int32_t, uint8_t*, uint64_t, uint64_t);
+int64_t readRaw(int32_t, uint8_t*, uint64_t, uint64_t);
+void setReadCache(evidenceCache*);
+void setSegmentSet(segmentSet*);
+uint64_t deviceSize(int32_t);
 void safeWrite(int32_t, uint8_t*, uint32_t);
 void readUserInput(char**);
-void printProgress(	uint32_t*, uint32_t, uint32_t);
+void printProgress(uint32_t*, uint64_t, uint64_t);
+void setProgressLabel(const char*);
+uint32_t isRegularFile(int32_t);
+uint64_t findData(int32_t, uint64_t, uint64_t*);
+uint32_t preallocateOutput(int32_t, uint64_t);
+void punchHole(int32_t, uint64_t, uint64_t);
 
 #endif
\ No newline at end of file
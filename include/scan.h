@@ -2,17 +2,119 @@
 #define SCAN_H
 
 #include <stdint.h>
+#include "blockCache.h"
+#include "candidates.h"
+#include "kernels.h"
+#include "recordWriter.h"
+#include "superblock.h"
 
 #define ALL_BLOCKS 1 << 0
 #define ALLOCATED_ONLY 1 << 1
 #define UNALLOCATED_ONLY 1 << 2
 
-typedef void (*process)(const uint8_t*, uint64_t, uint32_t);
-uint64_t scanPartitionAndProcess(int32_t, process, uint32_t);
+// ISO volume descriptors follow a 32K system area, the furthest
+// past a block that the classifiers read
+#define DESCRIPTOR_OFFSET 0x8000
 
-extern int32_t deviceID;
-extern uint64_t partition_addr;
-extern uint32_t blockSize;
-extern uint32_t totalBlocks;
+// block group descriptor flag of groups never written to
+#define BLOCK_UNINIT 0x2
 
-#endif
\ No newline at end of file
+// longest run of adjacent block bitmaps read at once
+#define MAX_BITMAP_RUN 64
+
+// the parts of a block group descriptor the scan uses
+typedef struct {
+	uint64_t m_bitmapBlock;
+	uint16_t m_flags;
+} groupDesc;
+
+// fingerprint of a block group kept with saved scan results
+typedef struct {
+	uint64_t m_bitmapHash;
+	uint64_t m_contentHash;		// hash of the scanned blocks if kept
+} groupPrint;
+
+// all state of one scan and recovery of a partition, so any 
+// number of sessions can run side by side in one process
+typedef struct _scan_session {
+	// device and partition being scanned
+	int32_t m_deviceID;
+	uint64_t m_partitionAddr;
+	uint32_t m_blockSize;
+	uint64_t m_totalBlocks;
+	uint32_t m_firstDataBlock;	// block group 0 starts here, 1 for 1K blocks
+	uint32_t m_descSize;		// size of a block group descriptor
+	uint32_t m_scanType;
+	pSBlock m_sb;
+
+	// descriptor of every block group, read with the superblock
+	groupDesc* m_groups;
+	uint32_t m_groupsPerFlex;
+
+	// bitmap of the block group currently being scanned, within
+	// a run of bitmaps read together or a zeroed bitmap for
+	// groups never written to
+	uint8_t* m_bitmap;
+	uint32_t m_currentBlockGrp;
+	uint64_t m_allocatedCount;
+	uint8_t* m_bitmapRun;
+	uint32_t m_runFirstGrp;
+	uint32_t m_runLength;
+
+	// candidates mapped by the scan and recovery state
+	candidateList m_firstBlocks;
+	candidateList m_indirectBlocks;
+	segmentedArray* m_indirectIndex;	// sorted keys of m_indirectBlocks
+	segmentedArray* m_recoveredBlocks;	// block numbers, see initRecoveredBlocks
+	uint64_t m_volumeSize;
+	uint32_t m_isQuiet;		// recovers without printing its progress
+
+	// per block work compiled for the block size
+	const struct _block_kernels* m_kernels;
+
+	// descriptor of the block being processed, read by the scan
+	// before the block, or NULL for the classifiers to read it
+	const uint8_t* m_descriptor;
+
+	// optional cache for blocks read after the scan
+	blockCache* m_cache;
+
+	// optional stream candidates are written to as found
+	recordWriter* m_records;
+
+	// optional per block group state, when m_groupMask is set
+	// only groups with a nonzero entry are scanned
+	const uint8_t* m_groupMask;
+	groupPrint* m_prints;
+
+	// set when recovering while the scan is still running, the
+	// live index then replaces m_indirectIndex for lookups
+	struct _live_index* m_liveIndex;
+	struct _pipeline* m_pipeline;
+
+	// optional analyses given every block the scan processes
+	// along with the process function, see fanOut.h
+	struct _fan_out* m_fanOut;
+} scanSession;
+
+typedef void (*process)(scanSession*, const uint8_t*, uint64_t, uint64_t);
+
+void initSession(scanSession*, int32_t);
+void freeSession(scanSession*);
+void cloneSession(scanSession*, const scanSession*);
+uint64_t scanPartitionAndProcess(scanSession*, int32_t, process, uint32_t);
+void scanPartitionAt(scanSession*, uint64_t, process, uint32_t);
+uint64_t parsePartitionAddr(scanSession*, int32_t);
+uint32_t loadSuperblock(scanSession*, uint64_t);
+uint32_t validatePartition(scanSession*, uint64_t);
+uint64_t blockAddr(const scanSession*, uint64_t);
+void readBlock(scanSession*, uint64_t, uint8_t*);
+uint32_t isBlockAllocated(scanSession*, uint64_t);
+uint32_t isAllocated(scanSession*, uint64_t, uint32_t);
+uint32_t numBlockGroups(const scanSession*);
+uint32_t blockGroupOf(const scanSession*, uint64_t);
+uint64_t groupFirstBlock(const scanSession*, uint32_t);
+const uint8_t* groupBitmap(scanSession*, uint32_t);
+uint32_t isGroupUninit(const scanSession*, uint32_t);
+
+#endif
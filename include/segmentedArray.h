@@ -0,0 +1,30 @@
+#ifndef SEG_ARR_H
+#define SEG_ARR_H
+
+#include <stdint.h>
+
+// segment k holds (1 << m_baseShift) << k items so 64-bit 
+// indices never need more than this many segments
+#define MAX_SEGMENTS 64
+
+typedef struct {
+	uint64_t m_numItems;
+	uint64_t m_capacity;
+	uint32_t m_elementSize;
+	uint32_t m_baseShift;
+	uint32_t m_numSegments;
+	uint64_t m_mappedSegments;	// bit k set if segment k is spilled
+	uint8_t* m_segments[MAX_SEGMENTS];
+	uint64_t m_spillOffsets[MAX_SEGMENTS];	// where spilled segments are in the file
+} segmentedArray;
+
+void setArrayBudget(uint64_t budget, const char* spillDir);
+uint64_t getArrayBudget();
+
+void initArray(segmentedArray** arr, uint64_t count, uint32_t elementSize);
+void freeArray(segmentedArray** arr);
+void clearArray(segmentedArray* arr);
+void* addItem(segmentedArray* arr, const void* item);
+void* getItem(const segmentedArray* arr, uint64_t index);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <stdint.h>
+
+#define MAX_SEGMENTS_IN_SET 10000
+
+// how far into the next segment is read ahead once reads pass
+// the middle of a segment, so its volume is busy before the
+// scan gets there
+#define SEGMENT_PREFETCH (16 * 1024 * 1024)
+
+// a raw image split into numbered segments (image.001,
+// image.002, ...) read as one device. Every segment has its
+// own file descriptor, only read with pread, so reads of
+// segments on different volumes run side by side
+typedef struct {
+	uint32_t m_count;
+	int32_t* m_fds;
+	uint64_t* m_starts;		// device address of each segment, then the size
+	uint8_t* m_prefetched;	// whether each segment has been read ahead
+} segmentSet;
+
+uint32_t isFirstSegment(const char*);
+void openSegmentSet(segmentSet**, const char*);
+void closeSegmentSet(segmentSet**);
+uint64_t segmentSetSize(const segmentSet*);
+int64_t readSegments(segmentSet*, uint8_t*, uint64_t, uint64_t);
+uint64_t findSegmentData(segmentSet*, uint64_t, uint64_t*);
+
+#endif
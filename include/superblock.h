@@ -5,6 +5,20 @@
 
 #define SUPERBLOCK_SIGNATURE 0xef53
 
+// ext4 volumes with more than 2^32 blocks, which also have
+// group descriptors of _desc_size bytes instead of 32
+#define FEATURE_INCOMPAT_64BIT 0x80
+#define GRP_DESC_SIZE 32
+
+// the bitmaps of every 2^_log_groups_per_flex groups are stored
+// together in the first group of the run
+#define FEATURE_INCOMPAT_FLEX_BG 0x200
+
+// group descriptors have checksums, so their BLOCK_UNINIT flags
+// can be trusted
+#define FEATURE_RO_COMPAT_GDT_CSUM 0x10
+#define FEATURE_RO_COMPAT_METADATA_CSUM 0x400
+
 typedef struct _super_block {
 	uint32_t _inode_count;
 	uint32_t _fs_size_blocks;
@@ -44,10 +58,39 @@ typedef struct _super_block {
 	uint8_t _prealloc_blocks;
 	uint8_t _prealloc_dir_blocks;
 	uint16_t _alignment;
-	uint32_t _null_padding[204];
+	uint8_t _journal_uuid[16];
+	uint32_t _journal_inode;
+	uint32_t _journal_dev;
+	uint32_t _last_orphan;
+	uint32_t _hash_seed[4];
+	uint8_t _def_hash_version;
+	uint8_t _journal_backup_type;
+	uint16_t _desc_size;
+	uint32_t _default_mount_opts;
+	uint32_t _first_meta_bg;
+	uint32_t _mkfs_time;
+	uint32_t _journal_blocks[17];
+	uint32_t _fs_size_blocks_hi;
+	uint32_t _reserved_blocks_hi;
+	uint32_t _free_blocks_hi;
+	uint16_t _min_extra_isize;
+	uint16_t _want_extra_isize;
+	uint32_t _flags;
+	uint16_t _raid_stride;
+	uint16_t _mmp_interval;
+	uint32_t _mmp_block[2];
+	uint32_t _raid_stripe_width;
+	uint8_t _log_groups_per_flex;
+	uint8_t _checksum_type;
+	uint16_t _reserved_pad;
+	uint32_t _null_padding[162];
 } SuperBlock, *pSBlock;
 
 pSBlock readSuperblock(int32_t, uint64_t);
+uint64_t superblockBlocks(const SuperBlock*);
+uint32_t superblockDescSize(const SuperBlock*);
+uint32_t superblockGroupsPerFlex(const SuperBlock*);
+uint32_t hasUninitGroups(const SuperBlock*);
 void printSuperblock(int32_t, uint32_t);
 
 #endif
\ No newline at end of file
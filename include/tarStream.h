@@ -0,0 +1,28 @@
+#ifndef TAR_STREAM_H
+#define TAR_STREAM_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define TAR_BLOCK 512
+
+// ustar fields only hold names this long and sizes under 8 GiB,
+// longer names and larger sizes go in a pax extended header
+#define TAR_NAME_SIZE 100
+#define TAR_MAX_SIZE 077777777777ULL
+
+// a pax (POSIX tar) archive written as a stream, so it can go
+// to a pipe; entries are written whole, one writer at a time
+typedef struct {
+	int32_t m_fd;
+	uint64_t m_entries;
+	uint64_t m_mtime;		// time of every entry, when the archive began
+	pthread_mutex_t m_lock;	// held from beginEntry until endEntry
+} tarStream;
+
+void openTarStream(tarStream**, int32_t);
+void closeTarStream(tarStream**);
+void beginEntry(tarStream*, const char*, uint64_t);
+void endEntry(tarStream*, uint64_t);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// spans are only recorded in the instrumented build (make trace),
+// otherwise the macros expand to nothing
+
+#ifdef TRACE
+
+#define TRACE_PATH_ENV "SCAN_DRIVE_TRACE"
+#define TRACE_COUNTERS_ENV "SCAN_DRIVE_COUNTERS"
+#define DEFAULT_TRACE_PATH "scan_drive.trace.json"
+#define NUM_COUNTERS 2		// cache misses, instructions
+
+// an open span on the stack of the thread timing it
+typedef struct {
+	uint64_t m_start;					// monotonic time in ns
+	uint64_t m_counters[NUM_COUNTERS];
+} traceSpan;
+
+void initTrace();
+void finishTrace();
+void beginSpan(traceSpan*);
+void endSpan(traceSpan*, const char*);
+
+#define TRACE_INIT() initTrace()
+#define TRACE_BEGIN(span) traceSpan span; beginSpan(&span)
+#define TRACE_END(span, name) endSpan(&span, name)
+
+#else
+
+#define TRACE_INIT()
+#define TRACE_BEGIN(span)
+#define TRACE_END(span, name)
+
+#endif
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef TRIAGE_H
+#define TRIAGE_H
+
+#include <stdint.h>
+
+#define DEFAULT_SAMPLE_FRACTION 0.01
+#define TRIAGE_PASSES 8			// sampling rounds over every block group
+#define CONFIDENCE_Z 1.96		// z score of a 95% confidence interval
+
+// running sample of one block group (stratum)
+typedef struct {
+	uint32_t m_size;		// blocks in the group
+	uint32_t m_target;		// blocks to sample in total
+	uint32_t m_taken;		// blocks sampled so far
+	uint32_t m_offset;		// start of the group's sampling permutation
+	uint32_t m_stride;		// step of the permutation, coprime to m_size
+	uint32_t m_used;		// sampled blocks that were allocated
+	uint32_t m_first;		// sampled first block candidates
+	uint32_t m_indirect;	// sampled indirect block candidates
+} stratum;
+
+void triagePartition(int32_t, int32_t, double, uint32_t);
+
+#endif
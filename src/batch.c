@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "candidates.h"
+#include "recover.h"
+#include "safeio.h"
+
+// number of files recovered into the output directory at once
+uint32_t numWriters = DEFAULT_WRITERS;
+
+void* writerThread(void*);
+void writeCandidate(batch*, scanSession*, uint64_t);
+
+/* ============================================================
+ * Sets how many files are recovered into the output directory
+ * at once.
+ *
+ * Parameters:
+ * 	count - the number of writers, from 1 to MAX_WRITERS.
+ * ========================================================= */
+void setBatchWriters(uint32_t count) {
+	numWriters = count;
+}
+
+/* ============================================================
+ * Recovers every first block candidate that passes the filter
+ * into the output directory without prompting. Each writer
+ * thread claims the next candidate and recovers it on its own
+ * handle to the device, so while one writer waits on reads of
+ * the device others are writing out the files they assembled.
+ * The session must already be indexed with indexMatches.
+ *
+ * Parameters:
+ * 	session - the session holding the scan results.
+ * ========================================================= */
+void recoverBatch(scanSession* session) {
+	uint64_t count = numCandidates(&session->m_firstBlocks);
+	if (count == 0)
+		return;
+
+	uint32_t numThreads = (numWriters < count) ? numWriters : count;
+	pthread_t threads[numThreads];
+	batch job;
+	memset(&job, 0, sizeof(job));
+	job.m_session = session;
+
+	printf("Recovering %lu candidates into %s with %u writers.\n",
+		count, getOutputDir(), numThreads);
+	for (uint32_t i = 0; i < numThreads; i++)
+		if (pthread_create(&threads[i], NULL, writerThread, &job))
+			exit_err("Failed to start writer thread");
+
+	for (uint32_t i = 0; i < numThreads; i++)
+		if (pthread_join(threads[i], NULL))
+			exit_err("Failed to wait for writer thread");
+
+	printf("\nRecovered %lu files, %lu bytes in total.\n", job.m_recovered, job.m_bytes);
+	if (job.m_filtered)
+		printf("Skipped %lu candidates not matching the filter.\n", job.m_filtered);
+	if (job.m_failed)
+		printf("Failed to open %lu output files.\n", job.m_failed);
+}
+
+/* ============================================================
+ * Body of a writer thread, recovers candidates until none are
+ * left to claim. Writers share the scan's indirect block index
+ * but each has its own recovered block list.
+ *
+ * Parameters:
+ * 	arg - the batch the writer belongs to.
+ * ========================================================= */
+void* writerThread(void* arg) {
+	batch* job = arg;
+	uint64_t count = numCandidates(&job->m_session->m_firstBlocks);
+	uint64_t index;
+
+	scanSession writer;
+	cloneSession(&writer, job->m_session);
+	writer.m_indirectIndex = job->m_session->m_indirectIndex;
+	writer.m_isQuiet = 1;
+	initRecoveredBlocks(&writer);
+
+	while ((index = __atomic_fetch_add(&job->m_next, 1, __ATOMIC_RELAXED)) < count)
+		writeCandidate(job, &writer, index);
+
+	close(writer.m_deviceID);
+	freeArray(&writer.m_recoveredBlocks);
+	freeSession(&writer);
+	return NULL;
+}
+
+/* ============================================================
+ * Recovers a single candidate into the output directory if it
+ * passes the filter, counting the result in the batch.
+ *
+ * Parameters:
+ * 	job - the batch being recovered.
+ *  writer - the writer's session.
+ *  index - the index of the first block candidate.
+ * ========================================================= */
+void writeCandidate(batch* job, scanSession* writer, uint64_t index) {
+	const candidateList* firstBlocks = &job->m_session->m_firstBlocks;
+	uint64_t firstBlock = candidateBlock(firstBlocks, index);
+	if (!matchesFilter(firstBlock, candidateFlags(firstBlocks, index))) {
+		__atomic_add_fetch(&job->m_filtered, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	char path[PATH_MAX];
+	outputPath(writer, firstBlock, path, sizeof(path));
+	int64_t written = recoverToOutput(writer, firstBlock, path);
+
+	if (written < 0) {
+		fprintf(stderr, "Failed to open %s.\n", path);
+		__atomic_add_fetch(&job->m_failed, 1, __ATOMIC_RELAXED);
+	} else {
+		printf("Recovered block %lu to %s (%ld bytes)\n", firstBlock, path, written);
+		__atomic_add_fetch(&job->m_recovered, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&job->m_bytes, written, __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockCache.h"
+#include "safeio.h"
+
+#define FAILED_ALLOC "Failed to allocate block cache.\n"
+
+/* ============================================================
+ * Allocates an empty block cache.
+ * 
+ * Parameters:
+ * 	cache - output parameter for the new cache.
+ *  blockSize - the size of each cached block in bytes.
+ *  bytes - the total memory to use for block data.
+ * ========================================================= */
+void initBlockCache(blockCache** cache, uint32_t blockSize, uint64_t bytes) {
+	*cache = malloc(sizeof(blockCache));
+	if (!(*cache))
+		exit_err(FAILED_ALLOC);
+
+	uint64_t slots = bytes / blockSize;
+	(*cache)->m_blockSize = blockSize;
+	(*cache)->m_numSlots = slots ? slots : 1;
+	(*cache)->m_tags = calloc((*cache)->m_numSlots, sizeof(uint64_t));
+	(*cache)->m_data = malloc((*cache)->m_numSlots * blockSize);
+	(*cache)->m_hits = 0;
+	(*cache)->m_misses = 0;
+
+	if (!(*cache)->m_tags || !(*cache)->m_data)
+		exit_err(FAILED_ALLOC);
+}
+
+/* ============================================================
+ * Frees the cache and all blocks held in it.
+ * 
+ * Parameters:
+ * 	cache - the cache to free, set to NULL afterwards.
+ * ========================================================= */
+void freeBlockCache(blockCache** cache) {
+	if (!(*cache))
+		return;
+	free((*cache)->m_tags);
+	free((*cache)->m_data);
+	free(*cache);
+	*cache = NULL;
+}
+
+/* ============================================================
+ * Returns the cached contents of the given block.
+ * 
+ * Parameters:
+ * 	cache - the cache to look in.
+ *  blockNum - the block number to find.
+ * 
+ * Returns:
+ * 	Returns a pointer to the cached block, or NULL on a miss.
+ * ========================================================= */
+const uint8_t* lookupBlock(blockCache* cache, uint64_t blockNum) {
+	uint64_t slot = blockNum % cache->m_numSlots;
+	if (cache->m_tags[slot] != blockNum + 1) {
+		cache->m_misses++;
+		return NULL;
+	}
+	cache->m_hits++;
+	return cache->m_data + (slot * cache->m_blockSize);
+}
+
+/* ============================================================
+ * Stores a copy of a block in the cache, replacing whichever
+ * block previously held its slot.
+ * 
+ * Parameters:
+ * 	cache - the cache to store in.
+ *  blockNum - the block number of the data.
+ *  data - the contents of the block.
+ * ========================================================= */
+void storeBlock(blockCache* cache, uint64_t blockNum, const uint8_t* data) {
+	uint64_t slot = blockNum % cache->m_numSlots;
+	cache->m_tags[slot] = blockNum + 1;
+	memcpy(cache->m_data + (slot * cache->m_blockSize), data, cache->m_blockSize);
+}
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "candidates.h"
+#include "extsort.h"
+
+int compareKeyEntries(const void*, const void*);
+void addBlockHighs(candidateList*);
+
+/* ============================================================
+ * Allocates the packed arrays backing a candidate list.
+ * 
+ * Parameters:
+ * 	list - the list to initialize.
+ *  count - the number of candidates expected.
+ * ========================================================= */
+void initCandidates(candidateList* list, uint64_t count) {
+	initArray(&list->m_blockNums, count, sizeof(uint32_t));
+	initArray(&list->m_keys, count, sizeof(uint32_t));
+	initArray(&list->m_flags, count, sizeof(uint8_t));
+	list->m_blockHighs = NULL;
+}
+
+/* ============================================================
+ * Releases the arrays backing a candidate list.
+ * 
+ * Parameters:
+ * 	list - the list to free.
+ * ========================================================= */
+void freeCandidates(candidateList* list) {
+	freeArray(&list->m_blockNums);
+	freeArray(&list->m_keys);
+	freeArray(&list->m_flags);
+	freeArray(&list->m_blockHighs);
+}
+
+/* ============================================================
+ * Removes every candidate from the list, keeping its storage.
+ * 
+ * Parameters:
+ * 	list - the list to clear.
+ * ========================================================= */
+void clearCandidates(candidateList* list) {
+	clearArray(list->m_blockNums);
+	clearArray(list->m_keys);
+	clearArray(list->m_flags);
+	freeArray(&list->m_blockHighs);
+}
+
+/* ============================================================
+ * Appends a candidate block to the list.
+ * 
+ * Parameters:
+ * 	list - the list to add to.
+ *  blockNum - the block number of the candidate.
+ *  key - the first 4-byte entry of the block (the first block 
+ *        pointer for indirect blocks).
+ *  flags - type and confidence flags for the candidate.
+ * ========================================================= */
+void addCandidate(
+	candidateList* list, 
+	uint64_t blockNum, 
+	uint32_t key, 
+	uint8_t flags
+) {
+	uint32_t low = blockNum;
+	uint16_t high = blockNum >> 32;
+	if (high && !list->m_blockHighs)
+		addBlockHighs(list);
+
+	addItem(list->m_blockNums, &low);
+	if (list->m_blockHighs)
+		addItem(list->m_blockHighs, &high);
+	addItem(list->m_keys, &key);
+	addItem(list->m_flags, &flags);
+}
+
+/* ============================================================
+ * Starts keeping the high bits of the list's block numbers,
+ * which are zero for every candidate already in it.
+ * 
+ * Parameters:
+ * 	list - the list to widen.
+ * ========================================================= */
+void addBlockHighs(candidateList* list) {
+	uint64_t count = numCandidates(list);
+	uint16_t zero = 0;
+	initArray(&list->m_blockHighs, count + 1024, sizeof(uint16_t));
+	for (uint64_t i = 0; i < count; i++)
+		addItem(list->m_blockHighs, &zero);
+}
+
+/* ============================================================
+ * Restores the block order of a list whose candidates from the
+ * given index on were added in order after the rest, such as
+ * those of blocks read again at the end of a scan.
+ * 
+ * Parameters:
+ * 	list - the list to reorder.
+ *  tailStart - the index of the first candidate added later.
+ * ========================================================= */
+void mergeTail(candidateList* list, uint64_t tailStart) {
+	uint64_t count = numCandidates(list);
+	if (tailStart == 0 || tailStart >= count
+		|| candidateBlock(list, tailStart - 1) < candidateBlock(list, tailStart))
+		return;
+
+	candidateList merged;
+	initCandidates(&merged, count + 1);
+
+	uint64_t i = 0;
+	uint64_t j = tailStart;
+	while (i < tailStart || j < count) {
+		uint32_t takeTail = j < count && (i == tailStart
+			|| candidateBlock(list, j) < candidateBlock(list, i));
+		uint64_t k = takeTail ? j++ : i++;
+		addCandidate(&merged, candidateBlock(list, k),
+			candidateKey(list, k), candidateFlags(list, k));
+	}
+
+	freeCandidates(list);
+	*list = merged;
+}
+
+/* ============================================================
+ * Returns the number of candidates in the list.
+ * ========================================================= */
+uint64_t numCandidates(const candidateList* list) {
+	return list->m_blockNums->m_numItems;
+}
+
+/* ============================================================
+ * Returns the block number of the candidate at index i.
+ * ========================================================= */
+uint64_t candidateBlock(const candidateList* list, uint64_t i) {
+	uint64_t blockNum = *(uint32_t*)getItem(list->m_blockNums, i);
+	if (list->m_blockHighs)
+		blockNum |= (uint64_t)*(uint16_t*)getItem(list->m_blockHighs, i) << 32;
+	return blockNum;
+}
+
+/* ============================================================
+ * Returns the first pointer key of the candidate at index i.
+ * ========================================================= */
+uint32_t candidateKey(const candidateList* list, uint64_t i) {
+	return *(uint32_t*)getItem(list->m_keys, i);
+}
+
+/* ============================================================
+ * Returns the type/confidence flags of the candidate at index i.
+ * ========================================================= */
+uint8_t candidateFlags(const candidateList* list, uint64_t i) {
+	return *(uint8_t*)getItem(list->m_flags, i);
+}
+
+/* ============================================================
+ * Builds a lookup index of (key, block number) pairs sorted by
+ * key then block number so the lowest numbered candidate with
+ * a given key can be found with a binary search. The index is
+ * sorted externally so it can be built within the memory 
+ * budget for any number of candidates. Block pointers are only
+ * 32 bits wide, so candidates past 2^32 can never be pointed to
+ * by a block map and are left out as well.
+ * 
+ * Parameters:
+ * 	list - the candidates to index.
+ *  minBlock - candidates below this block number are left out.
+ * 
+ * Returns:
+ * 	Returns a newly allocated array of sorted keyEntry items.
+ * ========================================================= */
+segmentedArray* buildKeyIndex(const candidateList* list, uint32_t minBlock) {
+	segmentedArray* index = NULL;
+	uint64_t count = numCandidates(list);
+	initArray(&index, count, sizeof(keyEntry));
+
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t blockNum = candidateBlock(list, i);
+		keyEntry entry = {candidateKey(list, i), blockNum};
+		if (blockNum >= minBlock && blockNum <= UINT32_MAX)
+			addItem(index, &entry);
+	}
+
+	return externalSort(index, compareKeyEntries);
+}
+
+/* ============================================================
+ * Searches a key index for the lowest numbered candidate 
+ * whose key matches the given key.
+ * 
+ * Parameters:
+ * 	index - the index built by buildKeyIndex.
+ *  key - the key to look up.
+ * 
+ * Returns:
+ * 	Returns the block number of the match, or 0 if none.
+ * ========================================================= */
+uint32_t findByKey(const segmentedArray* index, uint32_t key) {
+	uint64_t low = 0;
+	uint64_t high = index->m_numItems;
+
+	// lower bound of the key
+	while (low < high) {
+		uint64_t mid = low + ((high - low) >> 1);
+		if (((keyEntry*)getItem(index, mid))->m_key < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (low == index->m_numItems)
+		return 0;
+
+	keyEntry* entry = getItem(index, low);
+	return (entry->m_key == key) ? entry->m_blockNum : 0;
+}
+
+/* ============================================================
+ * Orders key index entries by key then block number.
+ * ========================================================= */
+int compareKeyEntries(const void* a, const void* b) {
+	const keyEntry* left = a;
+	const keyEntry* right = b;
+
+	if (left->m_key != right->m_key)
+		return (left->m_key < right->m_key) ? -1 : 1;
+	if (left->m_blockNum != right->m_blockNum)
+		return (left->m_blockNum < right->m_blockNum) ? -1 : 1;
+	return 0;
+}
@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "blockCache.h"
+#include "candidates.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+
+#define UNKNOWN_REQUEST "ERR unknown request, expected list, recover, alloc, stats or shutdown\n"
+
+int32_t openSocket(const char*);
+uint32_t serveClient(scanSession*, int32_t);
+uint32_t handleRequest(scanSession*, char*, FILE*);
+void listCandidates(scanSession*, FILE*);
+void recoverCandidate(scanSession*, const char*, FILE*);
+void reportAllocation(scanSession*, const char*, FILE*);
+
+/* ============================================================
+ * Scans the partition once and then stays resident, holding the
+ * session, its candidate index and a block cache in memory while
+ * answering requests from local clients on a Unix domain socket.
+ * Each request is a single line and each reply ends with a line
+ * starting with 'OK' or 'ERR'. The daemon runs until a client
+ * sends 'shutdown'.
+ *
+ * Parameters:
+ * 	device - the file descriptor of the device.
+ *  index - the index of the partition to scan.
+ *  scanType - flag indicating which type of blocks to map.
+ *  socketPath - the path to create the socket at.
+ * ========================================================= */
+void runDaemon(
+	int32_t device,
+	int32_t index,
+	uint32_t scanType,
+	const char* socketPath
+) {
+	scanSession session;
+	initSession(&session, device);
+
+	uint64_t addr = parsePartitionAddr(&session, index);
+	if (addr == 0) {
+		freeSession(&session);
+		return;
+	}
+
+	scanForFiles(&session, addr, scanType);
+	indexMatches(&session);
+	initBlockCache(&session.m_cache, session.m_blockSize, DAEMON_CACHE_BYTES);
+
+	// a client hanging up mid reply should not end the daemon
+	signal(SIGPIPE, SIG_IGN);
+
+	int32_t server = openSocket(socketPath);
+	printf("\nListening for requests on %s\n", socketPath);
+
+	uint32_t running = 1;
+	while (running) {
+		int32_t client = accept(server, NULL, NULL);
+		if (client < 0)
+			continue;
+		running = serveClient(&session, client);
+	}
+
+	close(server);
+	unlink(socketPath);
+	printf("Daemon shut down.\n");
+
+	releaseMatches(&session);
+	freeSession(&session);
+}
+
+/* ============================================================
+ * Creates the listening socket, replacing any stale socket
+ * file left at the path by a previous run. Only the daemon's
+ * own user can connect to it, and the default directory is
+ * created for it, refusing one another user could write to.
+ *
+ * Parameters:
+ * 	socketPath - the path to create the socket at.
+ *
+ * Returns:
+ * 	Returns the file descriptor of the listening socket.
+ * ========================================================= */
+int32_t openSocket(const char* socketPath) {
+	struct sockaddr_un local;
+	memset(&local, 0, sizeof(local));
+	local.sun_family = AF_UNIX;
+
+	if (strlen(socketPath) >= sizeof(local.sun_path))
+		exit_err("Socket path is too long");
+	strcpy(local.sun_path, socketPath);
+
+	int32_t server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+		exit_err("Failed to create socket");
+
+	if (strcmp(socketPath, DEFAULT_SOCKET_PATH) == 0) {
+		struct stat info;
+		if (mkdir(DEFAULT_SOCKET_DIR, 0700) < 0 && errno != EEXIST)
+			exit_err("Failed to create socket directory");
+		if (stat(DEFAULT_SOCKET_DIR, &info) < 0)
+			exit_err("Failed to stat socket directory");
+		if (info.st_uid != geteuid() || (info.st_mode & 022)) {
+			fprintf(stderr, "%s must be owned by this user and writable by no one else.\n",
+				DEFAULT_SOCKET_DIR);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// the socket is created without any access for others, so
+	// no client can connect before it is restricted
+	unlink(socketPath);
+	mode_t mask = umask(077);
+	int32_t bound = bind(server, (struct sockaddr*)&local, sizeof(local));
+	umask(mask);
+	if (bound < 0)
+		exit_err("Failed to bind socket");
+	if (chmod(socketPath, 0600) < 0)
+		exit_err("Failed to restrict socket");
+	if (listen(server, 8) < 0)
+		exit_err("Failed to listen on socket");
+
+	return server;
+}
+
+/* ============================================================
+ * Answers requests from a single client until it disconnects.
+ *
+ * Parameters:
+ * 	session - the resident session to query.
+ *  client - the file descriptor of the connected client.
+ *
+ * Returns:
+ * 	Returns a 0 if the client asked the daemon to shut down,
+ *  1 otherwise.
+ * ========================================================= */
+uint32_t serveClient(scanSession* session, int32_t client) {
+	FILE* in = fdopen(client, "r");
+	FILE* out = fdopen(dup(client), "w");
+	if (!in || !out)
+		exit_err("Failed to open client stream");
+
+	char request[MAX_REQUEST_SIZE];
+	uint32_t running = 1;
+
+	while (running && fgets(request, sizeof(request), in)) {
+		request[strcspn(request, "\r\n")] = '\0';
+		running = handleRequest(session, request, out);
+		fflush(out);
+	}
+
+	fclose(out);
+	fclose(in);
+	return running;
+}
+
+/* ============================================================
+ * Parses a single request line and writes its reply.
+ *
+ * Parameters:
+ * 	session - the resident session to query.
+ *  request - the request line without its newline.
+ *  out - the stream to write the reply to.
+ *
+ * Returns:
+ * 	Returns a 0 if the request was to shut down, 1 otherwise.
+ * ========================================================= */
+uint32_t handleRequest(scanSession* session, char* request, FILE* out) {
+	char* args = request + strcspn(request, " ");
+	if (*args != '\0')
+		*args++ = '\0';
+
+	if (strcmp(request, "list") == 0)
+		listCandidates(session, out);
+	else if (strcmp(request, "recover") == 0)
+		recoverCandidate(session, args, out);
+	else if (strcmp(request, "alloc") == 0)
+		reportAllocation(session, args, out);
+	else if (strcmp(request, "stats") == 0) {
+		blockCache* cache = session->m_cache;
+		fprintf(out, "OK first=%lu indirect=%lu hits=%lu misses=%lu\n",
+			numCandidates(&session->m_firstBlocks),
+			numCandidates(&session->m_indirectBlocks),
+			cache->m_hits, cache->m_misses
+		);
+	} else if (strcmp(request, "shutdown") == 0) {
+		fprintf(out, "OK\n");
+		return 0;
+	} else
+		fprintf(out, UNKNOWN_REQUEST);
+
+	return 1;
+}
+
+/* ============================================================
+ * Replies with one line per first block candidate giving its
+ * index, block number, byte address and flags.
+ *
+ * Parameters:
+ * 	session - the resident session to query.
+ *  out - the stream to write the reply to.
+ * ========================================================= */
+void listCandidates(scanSession* session, FILE* out) {
+	candidateList* list = &session->m_firstBlocks;
+	uint64_t count = numCandidates(list);
+
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t blockNum = candidateBlock(list, i);
+		fprintf(out, "%lu %lu 0x%lx 0x%x\n", i, blockNum,
+			blockAddr(session, blockNum), candidateFlags(list, i));
+	}
+	fprintf(out, "OK %lu\n", count);
+}
+
+/* ============================================================
+ * Handles 'recover <index> <path>' by writing the recovered
+ * file for the first block candidate to the path.
+ *
+ * Parameters:
+ * 	session - the resident session to query.
+ *  args - the request arguments.
+ *  out - the stream to write the reply to.
+ * ========================================================= */
+void recoverCandidate(scanSession* session, const char* args, FILE* out) {
+	uint64_t index = 0;
+	int32_t pathStart = 0;
+
+	if (sscanf(args, "%lu %n", &index, &pathStart) != 1 || !args[pathStart]) {
+		fprintf(out, "ERR usage: recover <index> <path>\n");
+		return;
+	}
+	if (index >= numCandidates(&session->m_firstBlocks)) {
+		fprintf(out, "ERR no candidate %lu\n", index);
+		return;
+	}
+
+	int64_t written = recoverCandidateTo(session, index, args + pathStart);
+	if (written < 0)
+		fprintf(out, "ERR failed to open %s\n", args + pathStart);
+	else
+		fprintf(out, "OK %ld\n", written);
+}
+
+/* ============================================================
+ * Handles 'alloc <start> <end>' by replying with each run of
+ * used or free blocks within the inclusive range, followed by
+ * the totals.
+ *
+ * Parameters:
+ * 	session - the resident session to query.
+ *  args - the request arguments.
+ *  out - the stream to write the reply to.
+ * ========================================================= */
+void reportAllocation(scanSession* session, const char* args, FILE* out) {
+	uint64_t start = 0;
+	uint64_t end = 0;
+
+	if (sscanf(args, "%lu %lu", &start, &end) != 2 || start > end) {
+		fprintf(out, "ERR usage: alloc <start> <end>\n");
+		return;
+	}
+	if (end >= session->m_totalBlocks) {
+		fprintf(out, "ERR partition has %lu blocks\n", session->m_totalBlocks);
+		return;
+	}
+
+	uint64_t used = 0;
+	uint64_t runStart = start;
+	uint32_t runAlloc = isBlockAllocated(session, start);
+
+	for (uint64_t i = start; i <= end; i++) {
+		uint32_t isAlloc = isBlockAllocated(session, i);
+		used += isAlloc;
+
+		// report the run once the status changes
+		if (isAlloc != runAlloc) {
+			fprintf(out, "%lu %lu %s\n", runStart, i - 1, runAlloc ? "used" : "free");
+			runStart = i;
+			runAlloc = isAlloc;
+		}
+	}
+	fprintf(out, "%lu %lu %s\n", runStart, end, runAlloc ? "used" : "free");
+	fprintf(out, "OK used=%lu free=%lu\n", used, end - start + 1 - used);
+}
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "evidenceCache.h"
+#include "iotune.h"
+#include "safeio.h"
+#include "faultMap.h"
+
+#define FAILED_CACHE "Failed to open evidence cache"
+#define MIB (1024 * 1024)
+
+uint32_t cacheKey(const char*, const char*, int32_t, uint64_t, char*, uint32_t);
+uint64_t fingerprintDevice(int32_t, uint64_t);
+uint64_t imageMtime(int32_t);
+uint64_t loadPresence(evidenceCache*);
+void savePresence(evidenceCache*);
+uint32_t isCached(evidenceCache*, uint64_t, uint64_t);
+void markCached(evidenceCache*, uint64_t, uint64_t);
+
+/* ============================================================
+ * Opens the cache of the device in the given directory,
+ * creating it on the first run against the device. Caches are
+ * named after the device's serial, so the device is only ever
+ * read once as long as nothing writes to it between runs. A
+ * device without a serial is only cached under a name given
+ * for it. The cache is started over if the device's size,
+ * fingerprint or, for images, modification time changed.
+ * 
+ * Parameters:
+ * 	cache - output parameter for the opened cache, NULL if the
+ *          device is not cached.
+ *  dir - the directory caches are kept in.
+ *  name - the name to cache the device under, or NULL to name
+ *         it after its serial.
+ *  deviceName - the path of the device, i.e. /dev/sdb.
+ *  device - the open device.
+ * 
+ * Returns:
+ * 	Returns a 1 if the cache was opened, 0 if the device has no
+ *  serial and no name was given.
+ * ========================================================= */
+uint32_t openEvidenceCache(
+	evidenceCache** cache,
+	const char* dir,
+	const char* name,
+	const char* deviceName,
+	int32_t device
+) {
+	char key[512];
+	char path[PATH_MAX];
+	uint64_t size = deviceSize(device);
+	*cache = NULL;
+	if (!cacheKey(name, deviceName, device, size, key, sizeof(key))) {
+		fprintf(stderr, "No serial found for %s, not caching it. "
+			"Name it with -cachekey to cache it.\n", deviceName);
+		return 0;
+	}
+
+	*cache = calloc(1, sizeof(evidenceCache));
+	if (!(*cache))
+		exit_err(FAILED_CACHE);
+	evidenceCache* opened = *cache;
+	opened->m_deviceSize = size;
+	opened->m_fingerprint = fingerprintDevice(device, size);
+	opened->m_mtime = imageMtime(device);
+	opened->m_numPages = (size + CACHE_PAGE - 1) / CACHE_PAGE;
+	opened->m_present = calloc((opened->m_numPages + 7) / 8, 1);
+	if (!opened->m_present)
+		exit_err(FAILED_CACHE);
+
+	snprintf(path, sizeof(path), "%s/%s.img", dir, key);
+	opened->m_dataFd = safeOpen(path, O_RDWR | O_CREAT, 0600);
+	snprintf(path, sizeof(path), "%s/%s.map", dir, key);
+	opened->m_mapPath = strdup(path);
+	if (!opened->m_mapPath)
+		exit_err(FAILED_CACHE);
+
+	printf("Evidence cache %s/%s holds %.1f MiB of the device.\n",
+		dir, key, (double)loadPresence(opened) / MIB);
+	return 1;
+}
+
+/* ============================================================
+ * Writes out the pages cached this run and frees the cache.
+ * Cached data is synced before the bitmap is replaced, so a
+ * run that is cut short never marks pages it did not store.
+ * 
+ * Parameters:
+ * 	cache - the cache to close, may point to NULL, set to NULL
+ *          afterwards.
+ * ========================================================= */
+void closeEvidenceCache(evidenceCache** cache) {
+	evidenceCache* closing = *cache;
+	if (!closing)
+		return;
+
+	if (fdatasync(closing->m_dataFd) < 0)
+		exit_err("Failed to sync evidence cache");
+	savePresence(closing);
+	printf("Evidence cache: %.1f MiB read locally, %.1f MiB from the device.\n",
+		(double)closing->m_localBytes / MIB, (double)closing->m_deviceBytes / MIB);
+
+	close(closing->m_dataFd);
+	free(closing->m_mapPath);
+	free(closing->m_present);
+	free(closing);
+	*cache = NULL;
+}
+
+/* ============================================================
+ * Reads from the device through the cache, like pread. A read
+ * whose pages are all cached is served from the cache file,
+ * otherwise the whole pages it covers are read from the device
+ * and stored. Safe to call from any number of threads.
+ * 
+ * Parameters:
+ * 	cache - the cache of the device.
+ *  device - the open device.
+ *  buffer - buffer for the data read.
+ *  size - the number of bytes to read.
+ *  addr - the address on the device to read from.
+ * 
+ * Returns:
+ * 	Returns the number of bytes read, short only at the end of
+ *  the device.
+ * ========================================================= */
+int64_t readThrough(
+	evidenceCache* cache,
+	int32_t device,
+	uint8_t* buffer,
+	uint64_t size,
+	uint64_t addr
+) {
+	if (addr >= cache->m_deviceSize)
+		return 0;
+	if (size > cache->m_deviceSize - addr)
+		size = cache->m_deviceSize - addr;
+
+	uint64_t firstPage = addr / CACHE_PAGE;
+	uint64_t endPage = (addr + size + CACHE_PAGE - 1) / CACHE_PAGE;
+	if (isCached(cache, firstPage, endPage)) {
+		if (pread(cache->m_dataFd, buffer, size, addr) != (ssize_t)size)
+			exit_err("Failed to read evidence cache");
+		__atomic_add_fetch(&cache->m_localBytes, size, __ATOMIC_RELAXED);
+		return size;
+	}
+
+	// whole pages are read so the next read of the rest of a
+	// page is served locally
+	uint64_t start = firstPage * CACHE_PAGE;
+	uint64_t end = endPage * CACHE_PAGE;
+	if (end > cache->m_deviceSize)
+		end = cache->m_deviceSize;
+
+	uint8_t* pages = malloc(end - start);
+	if (!pages)
+		exit_err("Failed to allocate evidence cache read");
+	int64_t length = readUncached(device, pages, end - start, start);
+
+	if (length > 0 && pwrite(cache->m_dataFd, pages, length, start) != length)
+		exit_err("Failed to write evidence cache");
+	// bad ranges read as zeroes are left uncached so they are
+	// read again once the final pass has rescued what it can
+	if ((uint64_t)length == end - start && !isRangeBad(start, end - start))
+		markCached(cache, firstPage, endPage);
+	__atomic_add_fetch(&cache->m_deviceBytes, length, __ATOMIC_RELAXED);
+
+	int64_t copied = (start + length > addr) ? start + length - addr : 0;
+	if ((uint64_t)copied > size)
+		copied = size;
+	memcpy(buffer, pages + (addr - start), copied);
+	free(pages);
+	return copied;
+}
+
+/* ============================================================
+ * Builds the name the cache of the device is kept under, from
+ * the name given or its serial and size. Image files are told
+ * apart by their inode too, since their serial is that of the
+ * device they are stored on.
+ *
+ * Returns:
+ * 	Returns a 1 if the key was built, 0 if no name was given
+ *  and the device has no serial.
+ * ========================================================= */
+uint32_t cacheKey(
+	const char* name,
+	const char* deviceName, 
+	int32_t device, 
+	uint64_t bytes, 
+	char* key, 
+	uint32_t size
+) {
+	char serial[256];
+	struct stat info;
+	if (name)
+		snprintf(serial, sizeof(serial), "%s", name);
+	else if (!deviceSerial(deviceName, device, serial, sizeof(serial)))
+		return 0;
+	if (fstat(device, &info) < 0)
+		exit_err("Failed to stat device");
+
+	for (char* c = serial; *c; c++)
+		if (*c == '/')
+			*c = '_';
+
+	if (S_ISREG(info.st_mode))
+		snprintf(key, size, "%s-%lu-%lu", serial, info.st_ino, bytes);
+	else
+		snprintf(key, size, "%s", serial);
+	return 1;
+}
+
+/* ============================================================
+ * Returns a hash of FINGERPRINT_SECTORS sectors spread evenly
+ * over the device, read from the device itself.
+ * ========================================================= */
+uint64_t fingerprintDevice(int32_t device, uint64_t bytes) {
+	uint8_t sector[FINGERPRINT_SECTOR];
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (uint32_t i = 0; i < FINGERPRINT_SECTORS; i++) {
+		uint64_t addr = bytes / FINGERPRINT_SECTORS * i;
+		addr -= addr % FINGERPRINT_SECTOR;
+		memset(sector, 0, sizeof(sector));
+		readUncached(device, sector, sizeof(sector), addr);
+		for (uint32_t b = 0; b < sizeof(sector); b++)
+			hash = (hash ^ sector[b]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+/* ============================================================
+ * Returns the modification time of an image file in
+ * nanoseconds, or 0 for a block device.
+ * ========================================================= */
+uint64_t imageMtime(int32_t device) {
+	struct stat info;
+	if (fstat(device, &info) < 0)
+		exit_err("Failed to stat device");
+	if (!S_ISREG(info.st_mode))
+		return 0;
+	return (uint64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+/* ============================================================
+ * Loads the bitmap of cached pages, starting empty if there is
+ * none or it was made for a device of another size, another
+ * fingerprint or an image since modified. The copy of a device
+ * found to differ is dropped.
+ *
+ * Returns:
+ * 	Returns the number of bytes of the device cached.
+ * ========================================================= */
+uint64_t loadPresence(evidenceCache* cache) {
+	FILE* file = fopen(cache->m_mapPath, "rb");
+	if (!file)
+		return 0;
+
+	cacheHeader header;
+	uint64_t bytes = (cache->m_numPages + 7) / 8;
+	uint32_t isValid = fread(&header, sizeof(header), 1, file) == 1
+		&& memcmp(header.m_magic, CACHE_MAGIC, 8) == 0
+		&& header.m_deviceSize == cache->m_deviceSize
+		&& header.m_pageSize == CACHE_PAGE
+		&& header.m_fingerprint == cache->m_fingerprint
+		&& header.m_mtime == cache->m_mtime
+		&& fread(cache->m_present, 1, bytes, file) == bytes;
+	fclose(file);
+
+	if (!isValid) {
+		memset(cache->m_present, 0, bytes);
+		if (ftruncate(cache->m_dataFd, 0) < 0)
+			exit_err("Failed to clear evidence cache");
+		fprintf(stderr, "Evidence cache does not match the device, starting over.\n");
+		return 0;
+	}
+
+	uint64_t pages = 0;
+	for (uint64_t i = 0; i < bytes; i++)
+		pages += __builtin_popcount(cache->m_present[i]);
+	return pages * CACHE_PAGE;
+}
+
+/* ============================================================
+ * Replaces the bitmap file with the pages cached so far,
+ * through a temporary file so it is never seen half written.
+ * ========================================================= */
+void savePresence(evidenceCache* cache) {
+	char tmpPath[PATH_MAX + 8];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cache->m_mapPath);
+	FILE* file = fopen(tmpPath, "wb");
+	if (!file) {
+		perror("Failed to save evidence cache");
+		return;
+	}
+
+	cacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, CACHE_MAGIC, 8);
+	header.m_deviceSize = cache->m_deviceSize;
+	header.m_pageSize = CACHE_PAGE;
+	header.m_fingerprint = cache->m_fingerprint;
+	header.m_mtime = cache->m_mtime;
+
+	uint64_t bytes = (cache->m_numPages + 7) / 8;
+	uint32_t isWritten = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(cache->m_present, 1, bytes, file) == bytes;
+	if (fclose(file) != 0 || !isWritten || rename(tmpPath, cache->m_mapPath) != 0)
+		perror("Failed to save evidence cache");
+}
+
+/* ============================================================
+ * Returns whether every page in [firstPage, endPage) is cached.
+ * ========================================================= */
+uint32_t isCached(evidenceCache* cache, uint64_t firstPage, uint64_t endPage) {
+	for (uint64_t page = firstPage; page < endPage; page++) {
+		uint8_t bits = __atomic_load_n(&cache->m_present[page >> 3], __ATOMIC_ACQUIRE);
+		if (!(bits & (1 << (page & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+/* ============================================================
+ * Marks the pages in [firstPage, endPage) as cached, once their
+ * data has been written to the cache file.
+ * ========================================================= */
+void markCached(evidenceCache* cache, uint64_t firstPage, uint64_t endPage) {
+	for (uint64_t page = firstPage; page < endPage; page++)
+		__atomic_fetch_or(&cache->m_present[page >> 3], 1 << (page & 7), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "extsort.h"
+#include "safeio.h"
+
+#define MIN_RUN_ITEMS 4096
+
+// a sorted run within one segment of the array being sorted
+typedef struct {
+	uint8_t* m_current;
+	uint8_t* m_end;
+} sortRun;
+
+uint64_t runLength(const segmentedArray*);
+void siftDown(sortRun*, uint32_t, uint32_t, compareFunc);
+
+/* ============================================================
+ * Sorts a segmented array with an external merge sort. Each
+ * segment is cut into runs small enough to sort within the
+ * memory budget and sorted in place; the runs are then merged
+ * into a new array. Since segments past the budget are backed 
+ * by the spill file, neither phase needs more than the budget 
+ * resident at once regardless of the number of items.
+ * 
+ * Parameters:
+ * 	items - the array to sort, freed if a new array is returned.
+ *  compare - qsort style comparison of two items.
+ * 
+ * Returns:
+ * 	Returns the sorted array.
+ * ========================================================= */
+segmentedArray* externalSort(segmentedArray* items, compareFunc compare) {
+	uint32_t elementSize = items->m_elementSize;
+	uint64_t maxRun = runLength(items);
+	uint64_t numRuns = 0;
+	uint64_t remaining = items->m_numItems;
+
+	for (uint32_t s = 0; s < items->m_numSegments && remaining; s++) {
+		uint64_t count = (uint64_t)1 << (items->m_baseShift + s);
+		numRuns += (((count < remaining) ? count : remaining) 
+			+ maxRun - 1) / maxRun;
+		remaining -= (count < remaining) ? count : remaining;
+	}
+
+	sortRun* runs = malloc(sizeof(sortRun) * (numRuns ? numRuns : 1));
+	if (!runs)
+		exit_err("Failed to allocate sort runs.");
+
+	// phase one - sort each run in place
+	uint32_t k = 0;
+	remaining = items->m_numItems;
+	for (uint32_t s = 0; s < items->m_numSegments && remaining; s++) {
+		uint64_t count = (uint64_t)1 << (items->m_baseShift + s);
+		uint64_t used = (count < remaining) ? count : remaining;
+		uint8_t* segment = items->m_segments[s];
+
+		for (uint64_t i = 0; i < used; i += maxRun) {
+			uint64_t len = (used - i < maxRun) ? used - i : maxRun;
+			runs[k].m_current = segment + (i * elementSize);
+			runs[k].m_end = runs[k].m_current + (len * elementSize);
+			qsort(runs[k].m_current, len, elementSize, compare);
+			k++;
+		}
+		remaining -= used;
+	}
+
+	if (numRuns <= 1) {
+		free(runs);
+		return items;
+	}
+
+	// phase two - k-way merge of the runs using a min-heap
+	// ordered by the next item in each run
+	segmentedArray* sorted = NULL;
+	initArray(&sorted, items->m_numItems, elementSize);
+
+	for (int64_t i = (numRuns >> 1) - 1; i >= 0; i--)
+		siftDown(runs, i, numRuns, compare);
+
+	uint32_t heapSize = numRuns;
+	while (heapSize) {
+		addItem(sorted, runs[0].m_current);
+		runs[0].m_current += elementSize;
+
+		if (runs[0].m_current == runs[0].m_end)
+			runs[0] = runs[--heapSize];
+		siftDown(runs, 0, heapSize, compare);
+	}
+
+	free(runs);
+	freeArray(&items);
+	return sorted;
+}
+
+/* ============================================================
+ * Returns the number of items that may be sorted in memory 
+ * at once under the current memory budget.
+ * 
+ * Parameters:
+ * 	items - the array being sorted.
+ * ========================================================= */
+uint64_t runLength(const segmentedArray* items) {
+	uint64_t budget = getArrayBudget();
+	if (!budget)
+		return UINT64_MAX;
+
+	// leave half of the budget for the merged output
+	uint64_t run = (budget >> 1) / items->m_elementSize;
+	return (run < MIN_RUN_ITEMS) ? MIN_RUN_ITEMS : run;
+}
+
+/* ============================================================
+ * Restores the heap property for the run at index i.
+ * 
+ * Parameters:
+ * 	runs - the heap of runs.
+ *  i - the index of the run to move down the heap.
+ *  size - the number of runs in the heap.
+ *  compare - comparison function for the items.
+ * ========================================================= */
+void siftDown(sortRun* runs, uint32_t i, uint32_t size, compareFunc compare) {
+	while (1) {
+		uint32_t smallest = i;
+		uint32_t left = (i << 1) + 1;
+		uint32_t right = left + 1;
+
+		if (left < size && 
+			compare(runs[left].m_current, runs[smallest].m_current) < 0)
+			smallest = left;
+		if (right < size && 
+			compare(runs[right].m_current, runs[smallest].m_current) < 0)
+			smallest = right;
+		if (smallest == i)
+			return;
+
+		sortRun tmp = runs[i];
+		runs[i] = runs[smallest];
+		runs[smallest] = tmp;
+		i = smallest;
+	}
+}
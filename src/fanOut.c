@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fanOut.h"
+#include "safeio.h"
+
+void startConsumers(fanOut*, uint32_t);
+void* consumerThread(void*);
+uint64_t slowestConsumer(const fanOut*);
+
+/* ============================================================
+ * Allocates a fan-out with no consumers.
+ *
+ * Parameters:
+ * 	fan - output parameter for the fan-out.
+ * ========================================================= */
+void initFanOut(fanOut** fan) {
+	*fan = calloc(1, sizeof(fanOut));
+	if (!*fan)
+		exit_err("Failed to allocate scan consumers");
+	pthread_mutex_init(&(*fan)->m_lock, NULL);
+	pthread_cond_init(&(*fan)->m_ready, NULL);
+	pthread_cond_init(&(*fan)->m_space, NULL);
+}
+
+/* ============================================================
+ * Stops the fan-out's consumer threads and frees it. The state
+ * of each consumer is left to whoever added it.
+ *
+ * Parameters:
+ * 	fan - the fan-out to free, set to NULL.
+ * ========================================================= */
+void freeFanOut(fanOut** fan) {
+	if (!*fan)
+		return;
+
+	drainFanOut(*fan);
+	pthread_mutex_destroy(&(*fan)->m_lock);
+	pthread_cond_destroy(&(*fan)->m_ready);
+	pthread_cond_destroy(&(*fan)->m_space);
+	free(*fan);
+	*fan = NULL;
+}
+
+/* ============================================================
+ * Adds a consumer to be given every block delivered from now
+ * on. Must not be called while blocks are being delivered.
+ *
+ * Parameters:
+ * 	fan - the fan-out to add to.
+ *  function - the function called for each block.
+ *  state - the consumer's own state, passed to the function.
+ *  mode - one of the ConsumeMode values. Consumers on threads
+ *         of their own see each block in the order delivered,
+ *         but only until the scan has moved FAN_OUT_SLOTS
+ *         blocks on, and may not keep the pointer.
+ *
+ * Returns:
+ * 	Returns a 1 if the consumer was added, 0 if there are
+ *  already MAX_CONSUMERS.
+ * ========================================================= */
+uint32_t addConsumer(fanOut* fan, consume function, void* state, uint32_t mode) {
+	if (fan->m_count == MAX_CONSUMERS)
+		return 0;
+
+	consumer* added = &fan->m_consumers[fan->m_count++];
+	memset(added, 0, sizeof(consumer));
+	added->m_consume = function;
+	added->m_state = state;
+	added->m_mode = mode;
+	added->m_fanOut = fan;
+	if (mode == CONSUME_THREADED)
+		fan->m_numThreaded++;
+	return 1;
+}
+
+/* ============================================================
+ * Gives a block to every consumer. Inline consumers are called
+ * straight away, for threaded ones the block is copied into the
+ * window, waiting for the slowest to free its slot first.
+ *
+ * Parameters:
+ * 	fan - the fan-out to deliver to.
+ *  block - the block read.
+ *  blockSize - the size of the block, the same until drained.
+ *  addr - the address the block was read from.
+ *  blockNum - the block number of the block.
+ * ========================================================= */
+void deliverBlock(
+	fanOut* fan,
+	const uint8_t* block,
+	uint32_t blockSize,
+	uint64_t addr,
+	uint64_t blockNum
+) {
+	for (uint32_t i = 0; i < fan->m_count; i++)
+		if (fan->m_consumers[i].m_mode == CONSUME_INLINE)
+			fan->m_consumers[i].m_consume(
+				fan->m_consumers[i].m_state, block, addr, blockNum
+			);
+
+	if (!fan->m_numThreaded)
+		return;
+	if (!fan->m_isRunning)
+		startConsumers(fan, blockSize);
+
+	// only the scan publishes, so m_published is read unlocked
+	uint64_t next = fan->m_published;
+	pthread_mutex_lock(&fan->m_lock);
+	while (next - slowestConsumer(fan) >= FAN_OUT_SLOTS)
+		pthread_cond_wait(&fan->m_space, &fan->m_lock);
+	pthread_mutex_unlock(&fan->m_lock);
+
+	uint32_t slot = next % FAN_OUT_SLOTS;
+	memcpy(fan->m_window + (uint64_t)slot * blockSize, block, blockSize);
+	fan->m_addrs[slot] = addr;
+	fan->m_blockNums[slot] = blockNum;
+
+	pthread_mutex_lock(&fan->m_lock);
+	fan->m_published = next + 1;
+	pthread_cond_broadcast(&fan->m_ready);
+	pthread_mutex_unlock(&fan->m_lock);
+}
+
+/* ============================================================
+ * Waits for the threaded consumers to finish every block
+ * delivered and stops their threads, so their state is
+ * complete. They are started again by the next delivery.
+ *
+ * Parameters:
+ * 	fan - the fan-out to drain.
+ * ========================================================= */
+void drainFanOut(fanOut* fan) {
+	if (!fan || !fan->m_isRunning)
+		return;
+
+	pthread_mutex_lock(&fan->m_lock);
+	fan->m_isClosing = 1;
+	pthread_cond_broadcast(&fan->m_ready);
+	pthread_mutex_unlock(&fan->m_lock);
+
+	for (uint32_t i = 0; i < fan->m_count; i++)
+		if (fan->m_consumers[i].m_mode == CONSUME_THREADED)
+			pthread_join(fan->m_consumers[i].m_thread, NULL);
+
+	free(fan->m_window);
+	fan->m_window = NULL;
+	fan->m_isRunning = 0;
+	fan->m_isClosing = 0;
+}
+
+/* ============================================================
+ * Allocates the window for blocks of the given size and starts
+ * a thread per threaded consumer.
+ * ========================================================= */
+void startConsumers(fanOut* fan, uint32_t blockSize) {
+	fan->m_window = malloc((uint64_t)FAN_OUT_SLOTS * blockSize);
+	if (!fan->m_window)
+		exit_err("Failed to allocate scan consumer window");
+	fan->m_blockSize = blockSize;
+	fan->m_published = 0;
+	fan->m_isRunning = 1;
+
+	for (uint32_t i = 0; i < fan->m_count; i++) {
+		consumer* c = &fan->m_consumers[i];
+		if (c->m_mode != CONSUME_THREADED)
+			continue;
+		c->m_done = 0;
+		if (pthread_create(&c->m_thread, NULL, consumerThread, c) != 0)
+			exit_err("Failed to start scan consumer");
+	}
+}
+
+/* ============================================================
+ * Runs a threaded consumer over the window, taking every block
+ * published since it last looked at once, until drained.
+ * ========================================================= */
+void* consumerThread(void* arg) {
+	consumer* self = arg;
+	fanOut* fan = self->m_fanOut;
+	uint64_t next = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&fan->m_lock);
+		while (next == fan->m_published && !fan->m_isClosing)
+			pthread_cond_wait(&fan->m_ready, &fan->m_lock);
+		uint64_t end = fan->m_published;
+		pthread_mutex_unlock(&fan->m_lock);
+		if (next == end)
+			break;
+
+		// slots up to end are not written again until m_done
+		// passes them
+		for (; next < end; next++) {
+			uint32_t slot = next % FAN_OUT_SLOTS;
+			self->m_consume(self->m_state,
+				fan->m_window + (uint64_t)slot * fan->m_blockSize,
+				fan->m_addrs[slot], fan->m_blockNums[slot]);
+		}
+
+		pthread_mutex_lock(&fan->m_lock);
+		self->m_done = next;
+		pthread_cond_signal(&fan->m_space);
+		pthread_mutex_unlock(&fan->m_lock);
+	}
+	return NULL;
+}
+
+/* ============================================================
+ * Returns the number of blocks the slowest threaded consumer
+ * has finished, the caller must hold the lock.
+ * ========================================================= */
+uint64_t slowestConsumer(const fanOut* fan) {
+	uint64_t slowest = UINT64_MAX;
+	for (uint32_t i = 0; i < fan->m_count; i++)
+		if (fan->m_consumers[i].m_mode == CONSUME_THREADED
+			&& fan->m_consumers[i].m_done < slowest)
+			slowest = fan->m_consumers[i].m_done;
+	return slowest;
+}
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "faultMap.h"
+#include "safeio.h"
+
+#define FAILED_ALLOC "Failed to allocate bad range map"
+
+// every range of the device found bad so far, sorted and
+// disjoint, shared by all readers of the device
+badRange* faults = NULL;
+uint32_t numFaults = 0;
+uint32_t faultCapacity = 0;
+uint64_t faultStride = MIN_FAULT_STRIDE;
+pthread_mutex_t faultLock = PTHREAD_MUTEX_INITIALIZER;
+
+// file the map is loaded from and saved back to, if any
+const char* faultPath = NULL;
+
+void addRange(uint64_t, uint64_t);
+void clearRange(uint64_t, uint64_t);
+uint32_t firstRangeEndingAfter(uint64_t);
+int32_t compareRanges(const void*, const void*);
+
+/* ============================================================
+ * Loads the bad ranges found by earlier runs, so they are read
+ * as zeroes straight away and only read again by the final
+ * pass, and keeps the path to save the map back to.
+ *
+ * Parameters:
+ * 	path - the map file, need not exist yet.
+ * ========================================================= */
+void loadFaultMap(const char* path) {
+	faultPath = path;
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return;
+
+	char line[128];
+	uint64_t start;
+	uint64_t end;
+	while (fgets(line, sizeof(line), file))
+		if (sscanf(line, "%lx %lx", &start, &end) == 2 && end > start)
+			addRange(start, end);
+	fclose(file);
+
+	if (numFaults)
+		printf("Loaded %u bad ranges (%lu bytes) from %s.\n", numFaults, faultBytes(), path);
+}
+
+/* ============================================================
+ * Saves the map to the file it was loaded from, one range per
+ * line as the hex addresses of its start and end.
+ * ========================================================= */
+void saveFaultMap() {
+	if (!faultPath)
+		return;
+
+	FILE* file = fopen(faultPath, "w");
+	if (!file) {
+		perror("Failed to save bad range map");
+		return;
+	}
+
+	pthread_mutex_lock(&faultLock);
+	fprintf(file, "# unreadable device ranges: start end (exclusive), hex bytes\n");
+	for (uint32_t i = 0; i < numFaults; i++)
+		fprintf(file, "0x%lx 0x%lx\n", faults[i].m_start, faults[i].m_end);
+	pthread_mutex_unlock(&faultLock);
+
+	if (fclose(file) != 0)
+		perror("Failed to save bad range map");
+}
+
+/* ============================================================
+ * Records a failed read at the given address, marking the
+ * sector it starts in and the stride after it as bad so the
+ * next reads skip past them. The stride doubles with every
+ * failure until a read succeeds.
+ *
+ * Parameters:
+ * 	addr - the address the failed read started at.
+ *  limit - the end of the device, nothing past it is marked
+ *          and failures at or past it are ignored.
+ * ========================================================= */
+void recordFault(uint64_t addr, uint64_t limit) {
+	if (addr >= limit)
+		return;
+
+	pthread_mutex_lock(&faultLock);
+	uint64_t start = addr - addr % FAULT_SECTOR;
+	uint64_t end = (limit - addr > faultStride) ? addr + faultStride : limit;
+	if (faultStride < MAX_FAULT_STRIDE)
+		faultStride <<= 1;
+	pthread_mutex_unlock(&faultLock);
+
+	fprintf(stderr, "Read failed at 0x%lx, skipping to 0x%lx.\n", addr, end);
+	addRange(start, end);
+}
+
+/* ============================================================
+ * Resets the stride after a read succeeds.
+ * ========================================================= */
+void clearFaultStride() {
+	if (__atomic_load_n(&faultStride, __ATOMIC_RELAXED) == MIN_FAULT_STRIDE)
+		return;
+	pthread_mutex_lock(&faultLock);
+	faultStride = MIN_FAULT_STRIDE;
+	pthread_mutex_unlock(&faultLock);
+}
+
+/* ============================================================
+ * Returns whether the address is in a bad range.
+ *
+ * Parameters:
+ * 	addr - the address to look up.
+ *  boundary - output parameter for the end of the bad range if
+ *             it is in one, otherwise the start of the next bad
+ *             range or UINT64_MAX if there is none.
+ * ========================================================= */
+uint32_t findFault(uint64_t addr, uint64_t* boundary) {
+	*boundary = UINT64_MAX;
+	if (!__atomic_load_n(&numFaults, __ATOMIC_ACQUIRE))
+		return 0;
+
+	pthread_mutex_lock(&faultLock);
+	uint32_t i = firstRangeEndingAfter(addr);
+	uint32_t isBad = i < numFaults && faults[i].m_start <= addr;
+	if (i < numFaults)
+		*boundary = isBad ? faults[i].m_end : faults[i].m_start;
+	pthread_mutex_unlock(&faultLock);
+	return isBad;
+}
+
+/* ============================================================
+ * Returns whether any of the given range is bad.
+ *
+ * Parameters:
+ * 	addr - the start of the range.
+ *  length - the length of the range.
+ * ========================================================= */
+uint32_t isRangeBad(uint64_t addr, uint64_t length) {
+	uint64_t boundary;
+	return findFault(addr, &boundary) || boundary < addr + length;
+}
+
+/* ============================================================
+ * The final pass over the bad ranges within the given span,
+ * reading them again one sector at a time and dropping every
+ * sector that reads from the map.
+ *
+ * Parameters:
+ * 	device - the open device.
+ *  start - the start of the span, i.e. a partition.
+ *  end - the end of the span.
+ * ========================================================= */
+void retryFaults(int32_t device, uint64_t start, uint64_t end) {
+	pthread_mutex_lock(&faultLock);
+	uint32_t count = numFaults;
+	badRange* ranges = malloc((count + 1) * sizeof(badRange));
+	if (!ranges)
+		exit_err(FAILED_ALLOC);
+	memcpy(ranges, faults, count * sizeof(badRange));
+	pthread_mutex_unlock(&faultLock);
+
+	uint8_t sector[FAULT_SECTOR];
+	uint64_t rescued = 0;
+	printf("Reading bad ranges again one sector at a time...\n");
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t from = (ranges[i].m_start > start) ? ranges[i].m_start : start;
+		uint64_t to = (ranges[i].m_end < end) ? ranges[i].m_end : end;
+
+		for (uint64_t addr = from; addr < to; addr += FAULT_SECTOR) {
+			uint64_t length = (to - addr < FAULT_SECTOR) ? to - addr : FAULT_SECTOR;
+			if (readRaw(device, sector, length, addr) >= 0) {
+				clearRange(addr, addr + length);
+				rescued += length;
+			}
+		}
+	}
+	free(ranges);
+
+	printf("Read back %lu bytes, %lu bytes of the device are still unreadable.\n",
+		rescued, faultBytes());
+}
+
+/* ============================================================
+ * Returns the total size of the bad ranges in bytes.
+ * ========================================================= */
+uint64_t faultBytes() {
+	uint64_t bytes = 0;
+	pthread_mutex_lock(&faultLock);
+	for (uint32_t i = 0; i < numFaults; i++)
+		bytes += faults[i].m_end - faults[i].m_start;
+	pthread_mutex_unlock(&faultLock);
+	return bytes;
+}
+
+/* ============================================================
+ * Adds a range to the map, merging it with any it overlaps or
+ * touches.
+ * ========================================================= */
+void addRange(uint64_t start, uint64_t end) {
+	pthread_mutex_lock(&faultLock);
+	if (numFaults == faultCapacity) {
+		faultCapacity = faultCapacity ? faultCapacity * 2 : 64;
+		faults = realloc(faults, faultCapacity * sizeof(badRange));
+		if (!faults)
+			exit_err(FAILED_ALLOC);
+	}
+	faults[numFaults].m_start = start;
+	faults[numFaults].m_end = end;
+	qsort(faults, numFaults + 1, sizeof(badRange), compareRanges);
+
+	uint32_t merged = 0;
+	for (uint32_t i = 1; i <= numFaults; i++) {
+		if (faults[i].m_start <= faults[merged].m_end) {
+			if (faults[i].m_end > faults[merged].m_end)
+				faults[merged].m_end = faults[i].m_end;
+		} else
+			faults[++merged] = faults[i];
+	}
+	__atomic_store_n(&numFaults, merged + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&faultLock);
+}
+
+/* ============================================================
+ * Removes a range from the map, splitting a bad range that
+ * holds it in two.
+ * ========================================================= */
+void clearRange(uint64_t start, uint64_t end) {
+	pthread_mutex_lock(&faultLock);
+	uint32_t i = firstRangeEndingAfter(start);
+	if (i < numFaults && faults[i].m_start < end) {
+		badRange after = { end, faults[i].m_end };
+		if (faults[i].m_start < start)
+			faults[i].m_end = start;
+		else
+			faults[i].m_start = end;
+
+		// a hole in the middle leaves the rest as a new range
+		if (faults[i].m_end == start && after.m_end > end) {
+			pthread_mutex_unlock(&faultLock);
+			addRange(after.m_start, after.m_end);
+			return;
+		}
+
+		// a range cleared completely is dropped
+		if (faults[i].m_start >= faults[i].m_end) {
+			memmove(&faults[i], &faults[i + 1], (numFaults - i - 1) * sizeof(badRange));
+			__atomic_store_n(&numFaults, numFaults - 1, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&faultLock);
+}
+
+/* ============================================================
+ * Returns the index of the first range ending after the
+ * address, the caller must hold the lock.
+ * ========================================================= */
+uint32_t firstRangeEndingAfter(uint64_t addr) {
+	uint32_t low = 0;
+	uint32_t high = numFaults;
+	while (low < high) {
+		uint32_t mid = (low + high) / 2;
+		if (faults[mid].m_end <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* ============================================================
+ * Orders ranges by their start.
+ * ========================================================= */
+int32_t compareRanges(const void* a, const void* b) {
+	uint64_t left = ((const badRange*)a)->m_start;
+	uint64_t right = ((const badRange*)b)->m_start;
+	return (left > right) - (left < right);
+}
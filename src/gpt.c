@@ -0,0 +1,75 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "gpt.h"
+#include "safeio.h"
+
+/* ============================================================
+ * Returns whether the MBR is a protective MBR, meaning the
+ * device is partitioned with a GUID partition table instead.
+ * 
+ * Parameters:
+ * 	mbr - the MBR read from the device.
+ * ========================================================= */
+uint32_t isProtectiveMBR(const pMbr mbr) {
+	return mbr->_partition_table[0]._type_code == GPT_PROTECTIVE_TYPE;
+}
+
+/* ============================================================
+ * Reads the GUID partition table of the device and lists the
+ * byte address of every used partition entry in table order.
+ * 
+ * Parameters:
+ * 	device - the descriptor of the device to read from.
+ *  addrs - output array for the partition addresses.
+ *  max - the maximum number of addresses to output.
+ * 
+ * Returns:
+ * 	Returns the number of partitions found, 0 if the device
+ *  has no valid GPT header.
+ * ========================================================= */
+uint32_t listGptPartitions(int32_t device, uint64_t* addrs, uint32_t max) {
+	uint8_t sector[SECTOR_SIZE];
+	GptHeader header;
+
+	safeRead(device, GPT_HEADER_LBA * SECTOR_SIZE, sector, SECTOR_SIZE);
+	memcpy(&header, sector, sizeof(header));
+
+	if (memcmp(header._signature, GPT_SIGNATURE, 8) != 0) {
+		fprintf(stderr, "Invalid GPT header.\n");
+		return 0;
+	}
+	if (
+		header._entry_size < sizeof(GptEntry) ||
+		header._entry_size > MAX_GPT_ENTRY_SIZE ||
+		header._entry_size % 8 != 0 ||
+		header._num_entries > MAX_GPT_ENTRIES
+	) {
+		fprintf(stderr, "Invalid GPT partition table size.\n");
+		return 0;
+	}
+
+	uint32_t found = 0;
+	uint64_t tableSize = (uint64_t)header._num_entries * header._entry_size;
+	uint8_t* table = malloc(tableSize ? tableSize : 1);
+	if (!table)
+		exit_err("Failed to allocate GPT entries");
+	safeRead(device, header._entries_lba * SECTOR_SIZE, table, tableSize);
+
+	for (uint32_t i = 0; i < header._num_entries && found < max; i++) {
+		GptEntry entry;
+		memcpy(&entry, table + (uint64_t)i * header._entry_size, sizeof(entry));
+
+		// unused entries have an all zero type guid
+		uint8_t isUsed = 0;
+		for (uint32_t b = 0; b < sizeof(entry._type_guid); b++)
+			isUsed |= entry._type_guid[b];
+
+		if (isUsed && entry._first_lba)
+			addrs[found++] = entry._first_lba * SECTOR_SIZE;
+	}
+
+	free(table);
+	return found;
+}
@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "iosched.h"
+#include "safeio.h"
+
+#define ROTATIONAL_PATH "/sys/block/%s/queue/rotational"
+#define TURN_WAIT_NS 1000000
+
+// turn shared by all scans reading from the same spindle,
+// NULL when scans may read concurrently
+turnLock* ioSlot = NULL;
+__thread uint32_t holdingSlot = 0;
+
+uint32_t isRotational(const char*);
+
+/* ============================================================
+ * Allocates a ticket lock in anonymous shared memory so it 
+ * works between threads and also across fork().
+ * 
+ * Returns:
+ * 	Returns a pointer to the new unlocked turn lock.
+ * ========================================================= */
+turnLock* createTurnLock() {
+	turnLock* lock = mmap(
+		NULL, sizeof(turnLock), PROT_READ | PROT_WRITE, 
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0
+	);
+	if (lock == MAP_FAILED)
+		exit_err("Failed to allocate turn lock");
+
+	memset(lock, 0, sizeof(turnLock));
+	return lock;
+}
+
+/* ============================================================
+ * Waits until it is the caller's turn to hold the lock. Turns 
+ * are handed out in the order they were asked for.
+ * 
+ * Parameters:
+ * 	lock - the turn lock to take.
+ * ========================================================= */
+void lockTurn(turnLock* lock) {
+	struct timespec wait = {0, TURN_WAIT_NS};
+	uint64_t ticket = __atomic_fetch_add(
+		&lock->m_nextTicket, 1, __ATOMIC_ACQ_REL
+	);
+
+	while (__atomic_load_n(&lock->m_serving, __ATOMIC_ACQUIRE) != ticket)
+		nanosleep(&wait, NULL);
+}
+
+/* ============================================================
+ * Passes the lock on to the next waiting caller.
+ * 
+ * Parameters:
+ * 	lock - the turn lock to release.
+ * ========================================================= */
+void unlockTurn(turnLock* lock) {
+	__atomic_fetch_add(&lock->m_serving, 1, __ATOMIC_RELEASE);
+}
+
+/* ============================================================
+ * Sets up I/O scheduling between scans of partitions on the
+ * given device. Rotational drives get a single shared I/O slot
+ * so only one scan reads at a time and the heads are not 
+ * thrashed between partitions; other devices are left to read
+ * concurrently.
+ * 
+ * Parameters:
+ * 	deviceName - the path of the device being scanned.
+ * ========================================================= */
+void initIOScheduler(const char* deviceName) {
+	if (!isRotational(deviceName))
+		return;
+
+	ioSlot = createTurnLock();
+}
+
+/* ============================================================
+ * Waits for the calling thread's turn to read from the device.
+ * Does nothing if I/O scheduling is not enabled.
+ * ========================================================= */
+void acquireIOSlot() {
+	if (!ioSlot || holdingSlot)
+		return;
+	lockTurn(ioSlot);
+	holdingSlot = 1;
+}
+
+/* ============================================================
+ * Gives up the calling thread's turn to read from the device.
+ * ========================================================= */
+void releaseIOSlot() {
+	if (!ioSlot || !holdingSlot)
+		return;
+	holdingSlot = 0;
+	unlockTurn(ioSlot);
+}
+
+/* ============================================================
+ * Returns whether the device is a rotational drive according
+ * to sysfs. Devices that cannot be looked up are treated as
+ * rotational to be safe.
+ * 
+ * Parameters:
+ * 	deviceName - the path of the device, i.e. /dev/sdb.
+ * ========================================================= */
+uint32_t isRotational(const char* deviceName) {
+	char path[256];
+	const char* name = strrchr(deviceName, '/');
+	snprintf(path, sizeof(path), ROTATIONAL_PATH, name ? name + 1 : deviceName);
+
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return 1;
+
+	int32_t rotational = 1;
+	if (fscanf(file, "%d", &rotational) != 1)
+		rotational = 1;
+	fclose(file);
+	return rotational != 0;
+}
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "iotune.h"
+#include "safeio.h"
+
+#define BY_ID_DIR "/dev/disk/by-id"
+#define SYSFS_DEVICE "/sys/dev/block/%u:%u/device/%s"
+#define PROBE_BLOCK 4096
+#define MAX_READERS 64
+#define MB 1e6
+
+// the grid of read sizes and reads in flight probed
+const uint32_t probeSizes[] = { 4096, 65536, 524288, 2097152 };
+const uint32_t probeReaders[] = { 1, 2, 4, 8 };
+
+void cachePath(char*, uint32_t);
+uint32_t loadTuning(const char*, const char*, ioTuning*, double*);
+void saveTuning(const char*, const char*, const ioTuning*, double);
+double timeReads(int32_t, const ioTuning*, uint64_t, uint64_t);
+uint32_t findById(const char*, char*, uint32_t);
+uint32_t readSysfsSerial(dev_t, char*, uint32_t);
+void printTuning(const char*, const ioTuning*, double, const char*);
+uint64_t elapsedNanos(const struct timespec*);
+
+/* ============================================================
+ * Picks how scans of the device read it. The tuning cached for
+ * the device's serial is used if there is one, otherwise the
+ * device is probed and the fastest tuning found is cached for
+ * later runs. The chosen tuning is printed either way.
+ *
+ * Parameters:
+ * 	deviceName - the path of the device, i.e. /dev/sdb.
+ *  device - the open device.
+ *  mode - one of the TuneMode values.
+ * ========================================================= */
+void autotuneIO(const char* deviceName, int32_t device, uint32_t mode) {
+	if (mode == TUNE_OFF)
+		return;
+
+	char serial[256];
+	char path[PATH_MAX];
+	ioTuning tuning;
+	double rate;
+
+	deviceSerial(deviceName, device, serial, sizeof(serial));
+	cachePath(path, sizeof(path));
+
+	if (mode == TUNE_AUTO && loadTuning(path, serial, &tuning, &rate))
+		printTuning(serial, &tuning, rate, "cached in");
+	else {
+		printf("\n---Probing I/O of %s---\n", serial);
+		rate = probeIO(device, &tuning);
+		saveTuning(path, serial, &tuning, rate);
+		printTuning(serial, &tuning, rate, "saved to");
+	}
+	printf("  %s\n\n", path);
+	setIOTuning(&tuning);
+}
+
+/* ============================================================
+ * Times sequential reads of the same region of the device for
+ * every read size and number of reads in flight in the probe
+ * grid, dropping the region from the page cache before each.
+ *
+ * Parameters:
+ * 	device - the open device.
+ *  best - output parameter for the fastest tuning.
+ *
+ * Returns:
+ * 	Returns the rate of the fastest tuning in bytes per second.
+ * ========================================================= */
+double probeIO(int32_t device, ioTuning* best) {
+	uint64_t size = deviceSize(device);
+
+	uint64_t start = (size > TUNE_PROBE_OFFSET + TUNE_PROBE_BYTES) ? TUNE_PROBE_OFFSET : 0;
+	uint64_t length = (size - start < TUNE_PROBE_BYTES) ? size - start : TUNE_PROBE_BYTES;
+	uint32_t numSizes = sizeof(probeSizes) / sizeof(probeSizes[0]);
+	uint32_t numReaders = sizeof(probeReaders) / sizeof(probeReaders[0]);
+	double bestRate = 0;
+
+	best->m_readBytes = 0;
+	best->m_readers = 1;
+	printf("%10s", "read size");
+	for (uint32_t r = 0; r < numReaders; r++)
+		printf("  %4u in flight", probeReaders[r]);
+	printf("\n");
+
+	for (uint32_t s = 0; s < numSizes; s++) {
+		printf("%8u K", probeSizes[s] / 1024);
+		for (uint32_t r = 0; r < numReaders; r++) {
+			ioTuning tuning = { probeSizes[s], probeReaders[r] };
+			double rate = timeReads(device, &tuning, start, length);
+			printf("  %9.1f MB/s", rate / MB);
+			fflush(stdout);
+
+			if (rate > bestRate) {
+				bestRate = rate;
+				*best = tuning;
+			}
+		}
+		printf("\n");
+	}
+	return bestRate;
+}
+
+/* ============================================================
+ * Returns a stable name for the device to cache its tuning
+ * under. Block devices are named by their /dev/disk/by-id link
+ * or the serial sysfs reports, image files by the device they
+ * are stored on.
+ *
+ * Parameters:
+ * 	deviceName - the path of the device.
+ *  device - the open device.
+ *  serial - output buffer for the name, without whitespace.
+ *  size - the size of the buffer.
+ *
+ * Returns:
+ * 	Returns a 1 if a serial was found, 0 if the device path is
+ *  used instead.
+ * ========================================================= */
+uint32_t deviceSerial(const char* deviceName, int32_t device, char* serial, uint32_t size) {
+	struct stat info;
+	if (fstat(device, &info) < 0)
+		exit_err("Failed to stat device");
+
+	uint32_t found = 1;
+	if (S_ISREG(info.st_mode))
+		snprintf(serial, size, "image-on-%u:%u", major(info.st_dev), minor(info.st_dev));
+	else if (!findById(deviceName, serial, size) && !readSysfsSerial(info.st_rdev, serial, size)) {
+		snprintf(serial, size, "%s", deviceName);
+		found = 0;
+	}
+
+	for (char* c = serial; *c; c++)
+		if (isspace((unsigned char)*c))
+			*c = '_';
+	return found;
+}
+
+/* ============================================================
+ * Builds the path of the tuning cache.
+ * ========================================================= */
+void cachePath(char* path, uint32_t size) {
+	const char* env = getenv(TUNE_CACHE_ENV);
+	const char* home = getenv("HOME");
+	if (env)
+		snprintf(path, size, "%s", env);
+	else
+		snprintf(path, size, "%s/%s", home ? home : ".", DEFAULT_TUNE_CACHE);
+}
+
+/* ============================================================
+ * Looks up the cached tuning of a device. The cache holds one
+ * line per device of its serial, read size, reads in flight
+ * and the rate measured when it was probed.
+ *
+ * Returns:
+ * 	Returns a 1 if a valid tuning was cached, 0 otherwise.
+ * ========================================================= */
+uint32_t loadTuning(const char* path, const char* serial, ioTuning* tuning, double* rate) {
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return 0;
+
+	char line[512];
+	char name[256];
+	uint32_t found = 0;
+	while (!found && fgets(line, sizeof(line), file)) {
+		if (
+			sscanf(line, "%255s %u %u %lf", name, &tuning->m_readBytes,
+				&tuning->m_readers, rate) == 4 &&
+			strcmp(name, serial) == 0
+		)
+			found = tuning->m_readBytes % PROBE_BLOCK == 0
+				&& tuning->m_readers > 0 && tuning->m_readers <= MAX_READERS;
+	}
+	fclose(file);
+	return found;
+}
+
+/* ============================================================
+ * Replaces the cached tuning of a device, keeping the others.
+ * The cache is written to a temporary file and renamed over
+ * the old one so concurrent runs never see half of it.
+ * ========================================================= */
+void saveTuning(const char* path, const char* serial, const ioTuning* tuning, double rate) {
+	char tmpPath[PATH_MAX + 8];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+	FILE* out = fopen(tmpPath, "w");
+	if (!out) {
+		perror("Failed to save I/O tuning");
+		return;
+	}
+
+	FILE* in = fopen(path, "r");
+	char line[512];
+	char name[256];
+	while (in && fgets(line, sizeof(line), in))
+		if (sscanf(line, "%255s", name) == 1 && strcmp(name, serial) != 0)
+			fputs(line, out);
+	if (in)
+		fclose(in);
+
+	fprintf(out, "%s %u %u %.0f\n", serial, tuning->m_readBytes, tuning->m_readers, rate);
+	if (fclose(out) != 0 || rename(tmpPath, path) != 0)
+		perror("Failed to save I/O tuning");
+}
+
+/* ============================================================
+ * Returns the rate in bytes per second at which a scan reads
+ * a region of the device block by block with the given
+ * tuning, after dropping the region from the page cache.
+ * Reading stops once TUNE_PROBE_MILLIS have passed.
+ * ========================================================= */
+double timeReads(int32_t device, const ioTuning* tuning, uint64_t start, uint64_t length) {
+	uint8_t block[PROBE_BLOCK];
+	uint64_t end = start + length;
+	uint64_t limit = (uint64_t)TUNE_PROBE_MILLIS * 1000000;
+	uint64_t addr = start;
+	struct timespec began;
+
+	posix_fadvise(device, start, length, POSIX_FADV_DONTNEED);
+	readAhead* reader = (tuning->m_readBytes > PROBE_BLOCK || tuning->m_readers > 1)
+		? openReadAhead(device, tuning, end) : NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &began);
+	while (addr + PROBE_BLOCK <= end) {
+		if (reader)
+			readAheadBlock(reader, addr, block, PROBE_BLOCK);
+		else
+			safeRead(device, addr, block, PROBE_BLOCK);
+		addr += PROBE_BLOCK;
+
+		if ((addr - start) % (1024 * 1024) == 0 && elapsedNanos(&began) > limit)
+			break;
+	}
+	uint64_t elapsed = elapsedNanos(&began);
+	closeReadAhead(reader);
+
+	return elapsed ? (addr - start) * 1e9 / elapsed : 0;
+}
+
+/* ============================================================
+ * Finds the name of the /dev/disk/by-id link to the device,
+ * preferring names with the model and serial over wwn- ones.
+ *
+ * Returns:
+ * 	Returns a 1 if a link was found, 0 otherwise.
+ * ========================================================= */
+uint32_t findById(const char* deviceName, char* serial, uint32_t size) {
+	char target[PATH_MAX];
+	char linkPath[PATH_MAX];
+	char resolved[PATH_MAX];
+	if (!realpath(deviceName, target))
+		return 0;
+
+	DIR* dir = opendir(BY_ID_DIR);
+	if (!dir)
+		return 0;
+
+	uint32_t found = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(linkPath, sizeof(linkPath), "%s/%s", BY_ID_DIR, entry->d_name);
+		if (!realpath(linkPath, resolved) || strcmp(resolved, target) != 0)
+			continue;
+
+		uint32_t isWwn = strncmp(entry->d_name, "wwn-", 4) == 0;
+		if (!found || !isWwn)
+			snprintf(serial, size, "%s", entry->d_name);
+		found = 1;
+		if (!isWwn)
+			break;
+	}
+	closedir(dir);
+	return found;
+}
+
+/* ============================================================
+ * Reads the serial, or failing that the world wide id, sysfs
+ * reports for a block device.
+ *
+ * Returns:
+ * 	Returns a 1 if one was read, 0 otherwise.
+ * ========================================================= */
+uint32_t readSysfsSerial(dev_t device, char* serial, uint32_t size) {
+	const char* attributes[] = { "serial", "wwid" };
+	char path[PATH_MAX];
+
+	for (uint32_t i = 0; i < 2; i++) {
+		snprintf(path, sizeof(path), SYSFS_DEVICE,
+			major(device), minor(device), attributes[i]);
+		FILE* file = fopen(path, "r");
+		if (!file)
+			continue;
+
+		uint32_t found = fgets(serial, size, file) != NULL;
+		fclose(file);
+		serial[strcspn(serial, "\n")] = '\0';
+		if (found && serial[0])
+			return 1;
+	}
+	return 0;
+}
+
+/* ============================================================
+ * Prints the tuning chosen for a device.
+ * ========================================================= */
+void printTuning(const char* serial, const ioTuning* tuning, double rate, const char* source) {
+	printf("I/O tuning for %s: %u K reads, %u in flight (%.1f MB/s), %s\n",
+		serial, tuning->m_readBytes / 1024, tuning->m_readers, rate / MB, source);
+}
+
+/* ============================================================
+ * Returns the nanoseconds passed since the given time.
+ * ========================================================= */
+uint64_t elapsedNanos(const struct timespec* since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - since->tv_sec) * 1000000000
+		+ now.tv_nsec - since->tv_nsec;
+}
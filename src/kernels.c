@@ -0,0 +1,185 @@
+#include "kernels.h"
+
+// words of a block ORed together per test for trailing zeroes
+#define ZERO_RUN 16
+
+// the kernels are written once here and always inlined into a
+// function per block size, where their bounds are constants
+#define KERNEL static inline __attribute__((always_inline))
+
+KERNEL int32_t indirectKernel(const uint32_t*, uint32_t, uint32_t);
+KERNEL uint32_t zeroesKernel(const uint32_t*, uint32_t, uint32_t);
+KERNEL uint32_t allocatedKernel(const uint8_t*, uint32_t, uint32_t);
+
+/* ============================================================
+ * Defines the kernels of one block size, which ignore the
+ * sizes they are passed in favour of their own.
+ * ========================================================= */
+#define BLOCK_KERNELS(SIZE) \
+	static int32_t isIndirect##SIZE( \
+		const uint32_t* block, uint32_t numEntries, uint32_t totalBlocks \
+	) { \
+		return indirectKernel(block, (SIZE) >> 2, totalBlocks); \
+	} \
+	static uint32_t isAllocated##SIZE( \
+		const uint8_t* bitmap, uint32_t blockNum, uint32_t numBlocksInGrp \
+	) { \
+		return allocatedKernel(bitmap, blockNum, (SIZE) << 3); \
+	} \
+	static uint32_t isZero##SIZE(const uint32_t* block, uint32_t numEntries) { \
+		return zeroesKernel(block, 0, (SIZE) >> 2); \
+	} \
+	static const blockKernels kernels##SIZE = { \
+		(SIZE), isIndirect##SIZE, isAllocated##SIZE, isZero##SIZE \
+	};
+
+BLOCK_KERNELS(1024)
+BLOCK_KERNELS(2048)
+BLOCK_KERNELS(4096)
+BLOCK_KERNELS(65536)
+
+static int32_t isIndirectAny(
+	const uint32_t* block,
+	uint32_t numEntries,
+	uint32_t totalBlocks
+) {
+	return indirectKernel(block, numEntries, totalBlocks);
+}
+
+static uint32_t isAllocatedAny(
+	const uint8_t* bitmap,
+	uint32_t blockNum,
+	uint32_t numBlocksInGrp
+) {
+	return allocatedKernel(bitmap, blockNum, numBlocksInGrp);
+}
+
+static uint32_t isZeroAny(const uint32_t* block, uint32_t numEntries) {
+	return zeroesKernel(block, 0, numEntries);
+}
+
+static const blockKernels kernelsAny = { 0, isIndirectAny, isAllocatedAny, isZeroAny };
+
+/* ============================================================
+ * Returns the kernels for a block size, those compiled for it
+ * if it is one of the common sizes or else those of any size.
+ * Called once a superblock is read.
+ *
+ * Parameters:
+ * 	blockSize - the block size of the file system.
+ * ========================================================= */
+const blockKernels* selectKernels(uint32_t blockSize) {
+	switch (blockSize) {
+	case 1024:
+		return &kernels1024;
+	case 2048:
+		return &kernels2048;
+	case 4096:
+		return &kernels4096;
+	case 65536:
+		return &kernels65536;
+	default:
+		return &kernelsAny;
+	}
+}
+
+/* ============================================================
+ * Determines whether or not the given block is an indirect
+ * file block based on heuristics; indirect blocks will store
+ * many consecutive block numbers every 4 bytes, and any empty
+ * space after will be zeroed.
+ *
+ * Parameters:
+ * 	block - a buffer containing the contents of the block to check
+ *  numEntries - the size of the block in 4-byte ints
+ *  totalBlocks - the number of blocks in the file system
+ *
+ * Returns:
+ * 	returns a 1 if the block is likely an indirect block,
+ *  or 0 if not.
+ * ========================================================= */
+KERNEL int32_t indirectKernel(
+	const uint32_t* block,
+	uint32_t numEntries,
+	uint32_t totalBlocks
+) {
+	uint32_t consecutiveNums = 0;
+	uint32_t blockAddress = *block;
+
+	if (blockAddress == 0 || blockAddress > totalBlocks)
+		return 0;
+
+	// go through the first ~5 or so addresses
+	for (uint32_t i = 1; i < 6; i++) {
+		uint32_t addr = block[i];
+
+		if (addr > totalBlocks)
+			return 0;
+
+		// check for consecutive block address
+		else if (addr == blockAddress + 1) {
+			blockAddress++;
+			consecutiveNums++;
+		}
+
+		// if address is zero then the remainder of the block
+		// must also be zero (if indirect block is only partially filled)
+		else if (addr == 0)
+			return zeroesKernel(block, i, numEntries);
+
+		// if a few consequtive addresses were already found
+		// then assume fragmentation in indirect block
+		else if (consecutiveNums >= 3)
+			return 1;
+
+		// otherwise zero the count and keep going
+		else consecutiveNums = 0;
+	}
+	return consecutiveNums > 3;
+}
+
+/* ============================================================
+ * Returns whether the entries of a block from the given one
+ * to its end are all zero. Past the first run of ZERO_RUN
+ * entries whole runs are tested at once, which compiles to
+ * vector ORs when the number of entries is known.
+ *
+ * Returns:
+ * 	returns a 1 if the range is zeroed, 0 if non-zeros found.
+ * ========================================================= */
+KERNEL uint32_t zeroesKernel(
+	const uint32_t* block,
+	uint32_t start,
+	uint32_t numEntries
+) {
+	uint32_t i = start;
+	for (; i < numEntries && i % ZERO_RUN != 0; i++)
+		if (block[i] != 0)
+			return 0;
+
+	for (; i + ZERO_RUN <= numEntries; i += ZERO_RUN) {
+		uint32_t bits = 0;
+		for (uint32_t k = 0; k < ZERO_RUN; k++)
+			bits |= block[i + k];
+		if (bits != 0)
+			return 0;
+	}
+
+	for (; i < numEntries; i++)
+		if (block[i] != 0)
+			return 0;
+	return 1;
+}
+
+/* ============================================================
+ * Returns whether the given block number is allocated in the
+ * block bitmap of its group, nonzero if it is.
+ * ========================================================= */
+KERNEL uint32_t allocatedKernel(
+	const uint8_t* bitmap,
+	uint32_t blockNum,
+	uint32_t numBlocksInGrp
+) {
+	uint32_t bitPos = blockNum % numBlocksInGrp;
+	return bitmap[bitPos >> 3] & (1 << (bitPos % 8));
+}
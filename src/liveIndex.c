@@ -0,0 +1,168 @@
+#include <stdlib.h>
+
+#include "liveIndex.h"
+#include "safeio.h"
+
+#define INITIAL_CAPACITY 4096
+#define FAILED_ALLOC "Failed to allocate live index"
+
+uint64_t slotFor(const liveIndex*, uint32_t);
+void growIndex(liveIndex*);
+uint32_t findLocked(liveIndex*, uint32_t);
+
+/* ============================================================
+ * Allocates an empty live index.
+ *
+ * Parameters:
+ * 	index - output parameter for the new index.
+ *  minBlock - the lowest block number that is indexed.
+ * ========================================================= */
+void initLiveIndex(liveIndex** index, uint32_t minBlock) {
+	*index = malloc(sizeof(liveIndex));
+	if (!(*index))
+		exit_err(FAILED_ALLOC);
+
+	(*index)->m_entries = calloc(INITIAL_CAPACITY, sizeof(keyEntry));
+	if (!(*index)->m_entries)
+		exit_err(FAILED_ALLOC);
+
+	(*index)->m_capacity = INITIAL_CAPACITY;
+	(*index)->m_count = 0;
+	(*index)->m_minBlock = minBlock;
+	initArray(&(*index)->m_lookups, 1024, sizeof(keyEntry));
+	pthread_mutex_init(&(*index)->m_lock, NULL);
+}
+
+/* ============================================================
+ * Frees the index.
+ *
+ * Parameters:
+ * 	index - the index to free, set to NULL afterwards.
+ * ========================================================= */
+void freeLiveIndex(liveIndex** index) {
+	if (!(*index))
+		return;
+	pthread_mutex_destroy(&(*index)->m_lock);
+	freeArray(&(*index)->m_lookups);
+	free((*index)->m_entries);
+	free(*index);
+	*index = NULL;
+}
+
+/* ============================================================
+ * Adds an indirect block under its key, unless a lower block
+ * was already added for the key, so the one kept is the lowest
+ * even for blocks added after the rest of a scan.
+ *
+ * Parameters:
+ * 	index - the index to add to.
+ *  key - the first pointer stored in the block.
+ *  blockNum - the block number of the indirect block.
+ * ========================================================= */
+void insertLive(liveIndex* index, uint32_t key, uint32_t blockNum) {
+	if (blockNum < index->m_minBlock || blockNum == 0)
+		return;
+
+	pthread_mutex_lock(&index->m_lock);
+	if ((index->m_count + 1) * 2 > index->m_capacity)
+		growIndex(index);
+
+	uint64_t mask = index->m_capacity - 1;
+	uint64_t slot = slotFor(index, key);
+	while (index->m_entries[slot].m_blockNum && index->m_entries[slot].m_key != key)
+		slot = (slot + 1) & mask;
+
+	if (!index->m_entries[slot].m_blockNum) {
+		index->m_entries[slot].m_key = key;
+		index->m_entries[slot].m_blockNum = blockNum;
+		index->m_count++;
+	} else if (blockNum < index->m_entries[slot].m_blockNum)
+		index->m_entries[slot].m_blockNum = blockNum;
+	pthread_mutex_unlock(&index->m_lock);
+}
+
+/* ============================================================
+ * Returns the block added for the key, recording the lookup
+ * and what it found in the index's lookups, so it can be
+ * checked again once the scan has finished.
+ *
+ * Parameters:
+ * 	index - the index to search.
+ *  key - the key to find.
+ *
+ * Returns:
+ * 	Returns the block number, or 0 if none was added yet.
+ * ========================================================= */
+uint32_t lookupLive(liveIndex* index, uint32_t key) {
+	pthread_mutex_lock(&index->m_lock);
+	keyEntry lookup = { key, findLocked(index, key) };
+	addItem(index->m_lookups, &lookup);
+	pthread_mutex_unlock(&index->m_lock);
+	return lookup.m_blockNum;
+}
+
+/* ============================================================
+ * Returns the block added for the key without recording the
+ * lookup.
+ *
+ * Parameters:
+ * 	index - the index to search.
+ *  key - the key to find.
+ *
+ * Returns:
+ * 	Returns the block number, or 0 if none was added yet.
+ * ========================================================= */
+uint32_t findLive(liveIndex* index, uint32_t key) {
+	pthread_mutex_lock(&index->m_lock);
+	uint32_t blockNum = findLocked(index, key);
+	pthread_mutex_unlock(&index->m_lock);
+	return blockNum;
+}
+
+/* ============================================================
+ * Returns the block added for the key, the caller must hold
+ * the index's lock.
+ * ========================================================= */
+uint32_t findLocked(liveIndex* index, uint32_t key) {
+	uint64_t mask = index->m_capacity - 1;
+	uint64_t slot = slotFor(index, key);
+	while (index->m_entries[slot].m_blockNum) {
+		if (index->m_entries[slot].m_key == key)
+			return index->m_entries[slot].m_blockNum;
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
+/* ============================================================
+ * Returns the home slot of a key.
+ * ========================================================= */
+uint64_t slotFor(const liveIndex* index, uint32_t key) {
+	// fibonacci hashing spreads runs of consecutive keys
+	return (key * 0x9e3779b97f4a7c15) >> 32 & (index->m_capacity - 1);
+}
+
+/* ============================================================
+ * Doubles the capacity of the index and rehashes its entries,
+ * the caller must hold the index's lock.
+ * ========================================================= */
+void growIndex(liveIndex* index) {
+	keyEntry* old = index->m_entries;
+	uint64_t oldCapacity = index->m_capacity;
+
+	index->m_capacity *= 2;
+	index->m_entries = calloc(index->m_capacity, sizeof(keyEntry));
+	if (!index->m_entries)
+		exit_err(FAILED_ALLOC);
+
+	uint64_t mask = index->m_capacity - 1;
+	for (uint64_t i = 0; i < oldCapacity; i++) {
+		if (!old[i].m_blockNum)
+			continue;
+		uint64_t slot = slotFor(index, old[i].m_key);
+		while (index->m_entries[slot].m_blockNum)
+			slot = (slot + 1) & mask;
+		index->m_entries[slot] = old[i];
+	}
+	free(old);
+}
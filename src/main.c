@@ -3,26 +3,64 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
 
+#include "batch.h"
+#include "daemon.h"
+#include "evidenceCache.h"
+#include "faultMap.h"
+#include "iotune.h"
 #include "mbr.h"
+#include "multiscan.h"
+#include "pipeline.h"
+#include "recordWriter.h"
 #include "recover.h"
+#include "rescan.h"
 #include "safeio.h"
+#include "segments.h"
+#include "segmentedArray.h"
 #include "superblock.h"
+#include "tarStream.h"
+#include "trace.h"
+#include "triage.h"
 
-#define USAGE "Usage: ./scan_drive.exe </dev/sdx> [options]\n"
+#define USAGE "Usage: ./scan_drive.exe </dev/sdx | image> [options] [settings]\n"
 #define HELP_MSG "Try ./scan_drive.exe -help for more info.\n"
+#define MIB (1024 * 1024)
 
 enum Process {
 	PRINT_MBR,
 	PRINT_SUPERBLOCK,
-	RECOVER
+	RECOVER,
+	RECOVER_ALL,
+	DAEMON,
+	TRIAGE,
+	PIPELINE
 };
 
 enum Process flag;
+const char* socketPath = DEFAULT_SOCKET_PATH;
+recordWriter* jsonStream = NULL;
+tarStream* archive = NULL;
+const char* cacheDir = NULL;
+const char* cacheName = NULL;
+const char* badMapPath = NULL;
+evidenceCache* evidence = NULL;
+segmentSet* segments = NULL;
+double sampleFraction = DEFAULT_SAMPLE_FRACTION;
+uint32_t sampleSeconds = 0;
+const char* statePath = NULL;
+uint32_t hashContent = 0;
+int32_t imagePartition = 0;
+uint32_t tuneMode = TUNE_OFF;
 
 uint32_t validateArgs(uint32_t, const char**);
+uint32_t isImagePath(const char*);
 uint32_t validateOptions(const char**);
+uint32_t parseSettings(const char**, uint32_t);
 uint32_t getPartitionIndex(const char*);
+void streamToStdout();
 void scan_drive(const char**);
 uint32_t getScanType(const char**);
 void printHelp();
@@ -36,6 +74,7 @@ int32_t main(int32_t argc, const char** argv) {
 		fprintf(stderr, HELP_MSG);
 		exit(EXIT_FAILURE);
 	}
+	TRACE_INIT();
 	scan_drive(argv);
 	return EXIT_SUCCESS;
 }
@@ -62,11 +101,11 @@ uint32_t validateArgs(uint32_t argc, const char** argv) {
 	}
 
 	// first program argument must be of the 
-	// form '/dev/sdx' or '/dev/sdxx'
+	// form '/dev/sdx' or '/dev/sdxx', or a raw image file
 	int32_t isDevice = strlen(argv[1]) > 7
 		&& strncmp("/dev/sd", argv[1], 7) == 0;
 
-	if (isDevice != 1) {
+	if (isDevice != 1 && !isImagePath(argv[1])) {
 		fprintf(stderr, "Unrecognized device name: %s\n", argv[1]);
 		return 0;
 	}
@@ -76,12 +115,28 @@ uint32_t validateArgs(uint32_t argc, const char** argv) {
 	return validateOptions(argv);
 }
 
+/* ============================================================
+ * Returns whether the path names a regular file, taken to be a
+ * raw image of a whole device.
+ * 
+ * Parameters:
+ * 	path - the path given on the command line.
+ * ========================================================= */
+uint32_t isImagePath(const char* path) {
+	struct stat info;
+	return stat(path, &info) == 0 && S_ISREG(info.st_mode);
+}
+
 /* ============================================================
  * Prints a help message to the console.
  * ========================================================= */
 void printHelp() {
 	printf("scan_drive.exe is a program designed to read any block\n");
 	printf("device to obtain info on its MBR and ext partitions to recover files.\n");
+	printf("A raw image of a device can be given in place of /dev/sdx, holes in\n");
+	printf("sparse images are skipped without being read. An image split into\n");
+	printf("segments is read as one device by giving its first segment, i.e.\n");
+	printf("image.001, the rest are found by counting up from it.\n");
 	printf("\n ----------------------------- OPTIONS -----------------------------\n");
 	printf("r - scans the drive to try and reconstruct and recover deleted files.\n\n");
 	printf("    Currently only works with .iso files.\n");
@@ -90,10 +145,88 @@ void printHelp() {
 	printf("    'all' - scans all blocks during recovery,\n"); 
 	printf("    'free' - scans only unallocated blocks,\n");
 	printf("    'used' - scans only already allocated blocks.\n\n");
+	printf("a - same as 'r' but scans every partition on the device at once.\n\n");
+	printf("    Partitions are listed from the MBR, or the GPT if present.\n");
+	printf("    Matches are recovered one partition at a time after scanning.\n");
+	printf("    Example: $ ./scan_drive.exe /dev/sdx -a free\n\n");
+	printf("d - same as 'r' but stays running after the scan to answer requests.\n\n");
+	printf("    Requests are read one per line from a Unix socket (see -sock):\n");
+	printf("    'list' - lists the first block candidates,\n");
+	printf("    'recover <n> <path>' - recovers candidate n to the path,\n");
+	printf("    'alloc <start> <end>' - reports which blocks in the range are used,\n");
+	printf("    'stats' - reports candidate counts and block cache hits,\n");
+	printf("    'shutdown' - stops the daemon.\n");
+	printf("    Example: $ ./scan_drive.exe /dev/sdx1 -d free\n\n");
+	printf("e - same as 'r' but recovers files while the scan is still running.\n\n");
+	printf("    Each file is recovered as soon as the scan has passed its last\n");
+	printf("    block, and again after the scan in the rare case a block it\n");
+	printf("    needed was found later. Requires the -out setting.\n");
+	printf("    Example: $ ./scan_drive.exe /dev/sdx1 -e free -out ./recovered\n\n");
+	printf("q - quick triage, estimates what a full scan would find from a sample.\n\n");
+	printf("    Reads a random sample of blocks from every block group and reports\n");
+	printf("    estimated used blocks, first block matches and indirect blocks\n");
+	printf("    with 95%% confidence intervals. See the -f and -s settings.\n");
+	printf("    Example: $ ./scan_drive.exe /dev/sdx1 -q -f 0.001 -s 300\n\n");
 	printf("p - prints info on the MBR or superblock.\n\n");
 	printf("    Must specify either type as 'mbr' or 'sb' for which to print as an argument.\n");
 	printf("    Example: $ ./scan_drive.exe /dev/sdx -p mbr\n");
 	printf("    Will print MBR info.\n\n");
+	printf("\n ----------------------------- SETTINGS ----------------------------\n");
+	printf("Settings follow the option and its argument.\n\n");
+	printf("-m <MiB> - memory budget for scan candidates. Candidates past the\n");
+	printf("    budget are kept in a memory-mapped temporary file instead.\n\n");
+	printf("-tmp <dir> - directory for the temporary file (default /tmp).\n\n");
+	printf("-f <fraction> - fraction of blocks sampled by 'q' (default %.2f).\n\n",
+		DEFAULT_SAMPLE_FRACTION);
+	printf("-s <seconds> - time budget for 'q'; sampling stops early once it\n");
+	printf("    is spent, after at least one block from every group is read.\n\n");
+	printf("-out <dir> - writes every recovered file to the directory as\n");
+	printf("    recovered_<partition>_<block>.iso instead of prompting for a path.\n");
+	printf("    Files are recovered %d at a time, see -writers. With '-out -' the\n",
+		DEFAULT_WRITERS);
+	printf("    files are streamed to stdout as a pax tar archive instead and\n");
+	printf("    everything else is printed to stderr.\n");
+	printf("    Example: $ ./scan_drive.exe /dev/sdx1 -r free -out - | gzip > r.tar.gz\n\n");
+	printf("-name <pattern> - names files written to -out by the pattern, where\n");
+	printf("    %%p is the partition address in hex, %%b the first block and %%a\n");
+	printf("    the file's address in hex (default %s).\n\n", DEFAULT_NAME_PATTERN);
+	printf("-filter <terms> - only recovers candidates matching every comma\n");
+	printf("    separated term: 'primary' (primary volume descriptor found),\n");
+	printf("    'mbr' (boot record found) or '<first>-<last>' (first block range).\n");
+	printf("    Example: $ ./scan_drive.exe /dev/sdx1 -r free -out ./r -filter primary\n\n");
+	printf("-writers <n> - number of files recovered to -out at once (1 to %d).\n\n",
+		MAX_WRITERS);
+	printf("-part <n> - partition of an image file to read (default 1).\n\n");
+	printf("-state <path> - file to keep the results of 'r' in. If it holds an\n");
+	printf("    earlier scan of the partition only the block groups that changed\n");
+	printf("    since are scanned again, the results are then saved back to it.\n\n");
+	printf("-hash <bitmap|content> - how block groups are compared with -state.\n");
+	printf("    'bitmap' (default) compares block bitmaps, 'content' also compares\n");
+	printf("    the scanned blocks, which reads them but skips classifying them.\n\n");
+	printf("-json <path> - streams each candidate to the file or pipe as it is\n");
+	printf("    found, one JSON record per line, ending each partition with a\n");
+	printf("    'scan_complete' record. Records are written in batches at least\n");
+	printf("    every %d ms.\n\n", RECORD_FLUSH_MILLIS);
+	printf("-tune <auto|probe> - reads the device with the read size and number\n");
+	printf("    of reads in flight that were fastest in a short probe before the\n");
+	printf("    scan. 'auto' reuses the tuning cached for the device's serial in\n");
+	printf("    ~/%s (or $%s), 'probe' always probes again.\n\n",
+		DEFAULT_TUNE_CACHE, TUNE_CACHE_ENV);
+	printf("-cache <dir> - keeps a local copy of every block read from the\n");
+	printf("    device in the directory, named after its serial, and reads\n");
+	printf("    blocks already copied by earlier runs from it instead.\n");
+	printf("    The device must not be written to between runs. A copy whose\n");
+	printf("    device no longer matches its fingerprint is started over.\n\n");
+	printf("-cachekey <name> - caches the device under the name instead of\n");
+	printf("    its serial, needed for devices without one.\n\n");
+	printf("-badmap <path> - keeps the map of device ranges that failed to\n");
+	printf("    read in the file. Reads skip ahead past each failure, further\n");
+	printf("    with each failure in a row, and the ranges skipped are read\n");
+	printf("    again a sector at a time once the scan has finished. Ranges in\n");
+	printf("    the map from earlier runs are only read in that final pass.\n\n");
+	printf("-sock <path> - socket path for the 'd' option (default %s).\n\n",
+		DEFAULT_SOCKET_PATH);
+	printf("    Example: $ ./scan_drive.exe /dev/sdx -r free -m 4096\n\n");
 }
 
 /* ============================================================
@@ -112,7 +245,23 @@ uint32_t validateOptions(const char** argv) {
 
 	if (argv[2] != NULL) {
 		if (strncmp(argv[2], "-r", 2) == 0)
-			return 1;
+			return argv[3] == NULL || parseSettings(argv, 4);
+		if (strncmp(argv[2], "-a", 2) == 0) {
+			flag = RECOVER_ALL;
+			return argv[3] == NULL || parseSettings(argv, 4);
+		}
+		if (strncmp(argv[2], "-d", 2) == 0) {
+			flag = DAEMON;
+			return argv[3] == NULL || parseSettings(argv, 4);
+		}
+		if (strncmp(argv[2], "-e", 2) == 0) {
+			flag = PIPELINE;
+			return argv[3] == NULL || parseSettings(argv, 4);
+		}
+		if (strncmp(argv[2], "-q", 2) == 0) {
+			flag = TRIAGE;
+			return parseSettings(argv, 3);
+		}
 		if (strncmp(argv[2], "-p", 2) == 0) {
 			if (argv[3] == NULL)
 				fprintf(stderr, "Unrecognized print argument.\n");
@@ -128,6 +277,138 @@ uint32_t validateOptions(const char** argv) {
 	return 1;
 }
 
+/* ============================================================
+ * Parses the settings given after the program option and its
+ * argument, each of the form '-x value'.
+ * 
+ * Parameters:
+ *  argv - string array containing the command line arguments
+ *  start - the index of the first setting in argv
+ * 
+ * Returns:
+ *  returns a 1 if all settings are valid, 0 otherwise.
+ * ========================================================= */
+uint32_t parseSettings(const char** argv, uint32_t start) {
+	uint64_t budget = 0;
+	const char* spillDir = NULL;
+
+	for (uint32_t i = start; argv[i] != NULL; i += 2) {
+		const char* value = argv[i + 1];
+		if (value == NULL) {
+			fprintf(stderr, "Missing value for setting: %s\n", argv[i]);
+			return 0;
+		}
+
+		if (strcmp(argv[i], "-m") == 0) {
+			char* end;
+			uint64_t mib = strtoull(value, &end, 10);
+			if (
+				value[0] < '0' || value[0] > '9' || *end != '\0' ||
+				mib == 0 || mib > UINT64_MAX / MIB
+			) {
+				fprintf(stderr, "Memory budget must be a positive number of MiB.\n");
+				return 0;
+			}
+			budget = mib * MIB;
+		}
+		else if (strcmp(argv[i], "-tmp") == 0)
+			spillDir = value;
+		else if (strcmp(argv[i], "-sock") == 0)
+			socketPath = value;
+		else if (strcmp(argv[i], "-f") == 0) {
+			sampleFraction = strtod(value, NULL);
+			if (sampleFraction <= 0 || sampleFraction > 1) {
+				fprintf(stderr, "Sample fraction must be in (0, 1].\n");
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-s") == 0)
+			sampleSeconds = strtoul(value, NULL, 10);
+		else if (strcmp(argv[i], "-part") == 0)
+			imagePartition = atoi(value) - 1;
+		else if (strcmp(argv[i], "-out") == 0) {
+			// a file -e recovers again would be in the archive twice
+			if (strcmp(value, "-") == 0 && flag == PIPELINE) {
+				fprintf(stderr, "Recovering during the scan cannot stream to an archive.\n");
+				return 0;
+			}
+			setOutputDir(value);
+			if (strcmp(value, "-") == 0)
+				streamToStdout();
+		}
+		else if (strcmp(argv[i], "-name") == 0) {
+			if (!setNamePattern(value)) {
+				fprintf(stderr, "Name must hold %%b or %%a, only %%p, %%b, %%a "
+					"or %%%% fields and no '/'.\n");
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-filter") == 0) {
+			if (!setRecoveryFilter(value)) {
+				fprintf(stderr, "Unrecognized filter: %s\n", value);
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-writers") == 0) {
+			uint32_t writers = strtoul(value, NULL, 10);
+			if (writers == 0 || writers > MAX_WRITERS) {
+				fprintf(stderr, "Writers must be from 1 to %d.\n", MAX_WRITERS);
+				return 0;
+			}
+			setBatchWriters(writers);
+		}
+		else if (strcmp(argv[i], "-cache") == 0)
+			cacheDir = value;
+		else if (strcmp(argv[i], "-cachekey") == 0)
+			cacheName = value;
+		else if (strcmp(argv[i], "-badmap") == 0)
+			badMapPath = value;
+		else if (strcmp(argv[i], "-state") == 0)
+			statePath = value;
+		else if (strcmp(argv[i], "-hash") == 0) {
+			if (strcmp(value, "content") == 0)
+				hashContent = 1;
+			else if (strcmp(value, "bitmap") != 0) {
+				fprintf(stderr, "Hash must be 'bitmap' or 'content'.\n");
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-tune") == 0) {
+			if (strcmp(value, "auto") == 0)
+				tuneMode = TUNE_AUTO;
+			else if (strcmp(value, "probe") == 0)
+				tuneMode = TUNE_PROBE;
+			else {
+				fprintf(stderr, "Tune must be 'auto' or 'probe'.\n");
+				return 0;
+			}
+		} else if (strcmp(argv[i], "-json") == 0) {
+			int32_t fd = safeOpen(value, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			initRecordWriter(
+				&jsonStream, fd, RECORD_FLUSH_BYTES, RECORD_FLUSH_MILLIS
+			);
+			setCandidateStream(jsonStream);
+		}
+		else {
+			fprintf(stderr, "Unrecognized setting: %s\n", argv[i]);
+			return 0;
+		}
+	}
+
+	setArrayBudget(budget, spillDir);
+	return 1;
+}
+
+/* ============================================================
+ * Streams recovered files to stdout as an archive. The archive
+ * keeps the original stdout and stdout is pointed at stderr,
+ * so nothing else printed can end up in the archive.
+ * ========================================================= */
+void streamToStdout() {
+	int32_t fd = dup(STDOUT_FILENO);
+	if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		exit_err("Failed to redirect stdout");
+
+	openTarStream(&archive, fd);
+	setOutputArchive(archive);
+}
+
 /* ============================================================
  * Reads the arguments passed to the program after validation
  * to open the device and parses program options to call the
@@ -141,14 +422,32 @@ void scan_drive(const char** argv) {
 	// obtain the pathname to the full device 
 	// (ignoring partition # if included)
 	// ex: truncate /dev/sdb1 to /dev/sdb
-	char deviceName[8];
+	// images are whole devices given with -part instead
+	uint32_t isImage = isImagePath(argv[1]);
+	char deviceName[PATH_MAX];
 	memset(deviceName, 0, sizeof(deviceName));
-	strncpy(deviceName, argv[1], 8);
+	strncpy(deviceName, argv[1], isImage ? PATH_MAX - 1 : 8);
 
 	int32_t device = safeOpen(deviceName, O_RDONLY, 0);
-	int32_t index = (flag == PRINT_MBR) 
+	if (isImage && isFirstSegment(deviceName)) {
+		openSegmentSet(&segments, deviceName);
+		setSegmentSet(segments);
+	}
+	if (badMapPath)
+		loadFaultMap(badMapPath);
+	int32_t index = (flag == PRINT_MBR || flag == RECOVER_ALL) 
 		? 0
-		: getPartitionIndex(argv[1]);
+		: isImage ? imagePartition : getPartitionIndex(argv[1]);
+
+	// only the full scans read enough to be worth tuning for
+	if (flag == RECOVER || flag == RECOVER_ALL || flag == DAEMON || flag == PIPELINE)
+		autotuneIO(deviceName, device, tuneMode);
+
+	// opened after tuning so the probe times the device itself
+	if (cacheDir) {
+		openEvidenceCache(&evidence, cacheDir, cacheName, deviceName, device);
+		setReadCache(evidence);
+	}
 
 	// perform processsing based on program arguments
 	switch(flag) {
@@ -160,10 +459,40 @@ void scan_drive(const char** argv) {
 		break;
 	case (RECOVER):
 		uint32_t scanType = getScanType(argv);
-		recoverFiles(device, index, scanType);
+		if (statePath)
+			rescanFiles(device, index, scanType, statePath, hashContent);
+		else
+			recoverFiles(device, index, scanType);
+		break;
+	case (RECOVER_ALL):
+		recoverAllPartitions(device, deviceName, getScanType(argv));
+		break;
+	case (DAEMON):
+		runDaemon(device, index, getScanType(argv), socketPath);
+		break;
+	case (TRIAGE):
+		triagePartition(device, index, sampleFraction, sampleSeconds);
+		break;
+	case (PIPELINE):
+		pipelineFiles(device, index, getScanType(argv));
 		break;
 	};
 
+	if (jsonStream) {
+		int32_t fd = jsonStream->m_fd;
+		freeRecordWriter(&jsonStream);
+		close(fd);
+	}
+	if (archive) {
+		int32_t fd = archive->m_fd;
+		closeTarStream(&archive);
+		close(fd);
+	}
+	setReadCache(NULL);
+	closeEvidenceCache(&evidence);
+	saveFaultMap();
+	setSegmentSet(NULL);
+	closeSegmentSet(&segments);
 	close(device);
 }
 
@@ -213,8 +542,13 @@ uint32_t getScanType(const char** argv) {
 	}
 
 	// scan type can be specified by
-	// "scan_drive.exe -r /dev/sdxx -t <scan_type>"
-	if (strncmp(argv[2], "-r", 2) == 0 && argv[3] != NULL) {
+	// "scan_drive.exe /dev/sdxx -r <scan_type>"
+	uint32_t isRecover = strncmp(argv[2], "-r", 2) == 0
+		|| strncmp(argv[2], "-a", 2) == 0
+		|| strncmp(argv[2], "-d", 2) == 0
+		|| strncmp(argv[2], "-e", 2) == 0;
+
+	if (isRecover && argv[3] != NULL) {
 		uint32_t type = UNALLOCATED_ONLY;
 
 		if (strncmp(argv[3], "all", 3) == 0) {
@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 #include "mbr.h"
+#include "gpt.h"
 #include "safeio.h"
 
 #define SECTOR_SIZE 512
@@ -14,6 +15,9 @@
 
 #define BLOCK_SIZE_OFFSET 24
 
+#define EXTENDED_CHS 0x05
+#define EXTENDED_LBA 0x0f
+
 /* ============================================================
  * Allocates space and returns a pointer to an mbr struct.
 
@@ -60,7 +64,7 @@ void extractMBR(const uint8_t* buffer, pMbr mbr) {
 	// cannot cast the buffer pointer directly
 	memcpy(
 		&mbr->_boot_code, 
-		&buffer, 
+		buffer, 
 		sizeof(mbr->_boot_code)
 	);
 	memcpy(
@@ -107,7 +111,50 @@ uint64_t getPartAddr(const pMbr mbr, int32_t index) {
 
 	// lba already in correct byte order
 	// ntohl not required
-	return partition->_lba * SECTOR_SIZE;
+	return (uint64_t)partition->_lba * SECTOR_SIZE;
+}
+
+/* ============================================================
+ * Lists the address of every valid partition on the device,
+ * reading the GUID partition table instead if the MBR is a
+ * protective MBR. Extended partition containers are skipped.
+ * 
+ * Arguments:
+ * 	device - descriptor of the device to read from.
+ *  addrs - output array for the partition addresses.
+ *  max - the maximum number of addresses to output.
+ * 
+ * Returns:
+ * 	Returns the number of partitions found.
+ * ========================================================= */
+uint32_t listPartitions(int32_t device, uint64_t* addrs, uint32_t max) {
+	pMbr mbr = readMBR(device);
+	uint32_t found = 0;
+
+	if (mbr->_mbr_signature != MBR_SIGNATURE) {
+		free(mbr);
+		return 0;
+	}
+
+	if (isProtectiveMBR(mbr)) {
+		free(mbr);
+		return listGptPartitions(device, addrs, max);
+	}
+
+	for (int32_t i = 0; i < 4 && found < max; i++) {
+		pTable partition = &mbr->_partition_table[i];
+		uint32_t isExtended = partition->_type_code == EXTENDED_CHS
+			|| partition->_type_code == EXTENDED_LBA;
+
+		if (partition->_type_code && partition->_num_sectors && !isExtended) {
+			uint64_t addr = getPartAddr(mbr, i);
+			if (addr)
+				addrs[found++] = addr;
+		}
+	}
+
+	free(mbr);
+	return found;
 }
 
 /* ============================================================
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "multiscan.h"
+#include "iosched.h"
+#include "mbr.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+
+// defines the work of the thread scanning one partition
+typedef struct {
+	const char* m_deviceName;
+	uint64_t m_addr;
+	uint32_t m_scanType;
+	uint32_t m_failed;
+	char m_label[32];
+} partitionTask;
+
+void* scanPartitionTask(void*);
+
+// serializes the interactive recovery of each partition
+turnLock* consoleLock = NULL;
+
+/* ============================================================
+ * Enumerates every valid partition on the device (from the MBR
+ * or GPT) and scans them all concurrently, one thread and scan
+ * session per partition so each has its own state and results. 
+ * A partition whose superblocks are invalid is reported and
+ * skipped without stopping the scans of the others.
+ * Reads from rotational drives are scheduled so only one scan 
+ * reads at a time. Once a partition is scanned its matches are
+ * recovered interactively, one partition at a time.
+ * 
+ * Parameters:
+ * 	device - the file descriptor of the device.
+ *  deviceName - the path of the device, reopened by each scan.
+ *  scanType - flag indicating which type of blocks to map.
+ * ========================================================= */
+void recoverAllPartitions(
+	int32_t device, 
+	const char* deviceName, 
+	uint32_t scanType
+) {
+	uint64_t addrs[MAX_PARTITIONS];
+	pthread_t threads[MAX_PARTITIONS];
+	partitionTask tasks[MAX_PARTITIONS];
+	uint32_t count = listPartitions(device, addrs, MAX_PARTITIONS);
+
+	if (count == 0) {
+		fprintf(stderr, "No valid partitions found on %s.\n", deviceName);
+		return;
+	}
+
+	printf("Found %d partitions - scanning all concurrently.\n", count);
+	initIOScheduler(deviceName);
+	consoleLock = createTurnLock();
+
+	for (uint32_t i = 0; i < count; i++) {
+		tasks[i].m_deviceName = deviceName;
+		tasks[i].m_addr = addrs[i];
+		tasks[i].m_scanType = scanType;
+		tasks[i].m_failed = 0;
+		snprintf(tasks[i].m_label, sizeof(tasks[i].m_label), 
+			"Partition %d", i + 1);
+
+		if (pthread_create(&threads[i], NULL, scanPartitionTask, &tasks[i]))
+			exit_err("Failed to start partition scan");
+	}
+
+	uint32_t failed = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (pthread_join(threads[i], NULL))
+			exit_err("Failed to wait for partition scan");
+		if (tasks[i].m_failed) {
+			fprintf(stderr, "Scan of partition %d failed.\n", i + 1);
+			failed++;
+		}
+	}
+	printf("\nFinished scanning %d of %d partitions.\n", count - failed, count);
+}
+
+/* ============================================================
+ * Body of the thread scanning a single partition.
+ * 
+ * Parameters:
+ * 	arg - pointer to the partitionTask to run.
+ * ========================================================= */
+void* scanPartitionTask(void* arg) {
+	partitionTask* task = arg;
+	scanSession session;
+	setProgressLabel(task->m_label);
+
+	// each scan needs its own file offset for reads
+	int32_t device = safeOpen(task->m_deviceName, O_RDONLY, 0);
+	initSession(&session, device);
+
+	// a bad partition must not exit the process with the others
+	if (!validatePartition(&session, task->m_addr)) {
+		task->m_failed = 1;
+		freeSession(&session);
+		close(device);
+		return NULL;
+	}
+	scanForFiles(&session, task->m_addr, task->m_scanType);
+
+	lockTurn(consoleLock);
+	printf("\n==================== %s ====================\n", task->m_label);
+	recoverMatches(&session);
+	if (fflush(stdout) != 0)
+		exit_err("Failed to flush stdout");
+	unlockTurn(consoleLock);
+
+	releaseMatches(&session);
+	freeSession(&session);
+	close(device);
+	return NULL;
+}
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "candidates.h"
+#include "liveIndex.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+
+void mapAndQueue(scanSession*, const uint8_t*, uint64_t, uint64_t);
+void queueFile(scanSession*, pipeline*, uint64_t);
+void startWorker(scanSession*, pipeline*);
+void* recoveryWorker(void*);
+uint64_t lastBlockOf(scanSession*, uint64_t);
+void recoverEarly(pipeline*, uint64_t);
+void finishPipeline(pipeline*);
+uint64_t recheckEarlyFiles(pipeline*);
+
+/* ============================================================
+ * Scans the partition and recovers files into the output
+ * directory while the scan is still running. Each first block
+ * found is handed to a background worker, which waits until
+ * the scan has passed every block the file can reach (ext3
+ * chains point forward) and then recovers it using a live
+ * index of the indirect blocks found so far.
+ *
+ * A lookup may find another block once the scan is complete,
+ * one that failed because its block was not reached yet, or
+ * one that found a higher block than a lower one rescued from
+ * a bad range at the end of the scan. Every lookup is checked
+ * again at the end and a file is recovered again if any now
+ * finds a different block, so the output is identical to
+ * recovering after the scan.
+ *
+ * Parameters:
+ * 	device - the file descriptor of the device to read from.
+ *  index - the index of the partition in the partition table.
+ *  scanType - flag indicating which type of blocks to map.
+ * ========================================================= */
+void pipelineFiles(int32_t device, int32_t index, uint32_t scanType) {
+	if (!getOutputDir()) {
+		fprintf(stderr, "Recovering during the scan needs an output directory.\n");
+		return;
+	}
+
+	scanSession session;
+	initSession(&session, device);
+	initCandidates(&session.m_firstBlocks, 1024);
+	initCandidates(&session.m_indirectBlocks, 16384);
+	session.m_records = getCandidateStream();
+
+	pipeline pipe;
+	memset(&pipe, 0, sizeof(pipe));
+	pipe.m_waitFor = UINT64_MAX;
+	pthread_mutex_init(&pipe.m_lock, NULL);
+	pthread_cond_init(&pipe.m_wake, NULL);
+	initArray(&pipe.m_queue, 1024, sizeof(uint64_t));
+	initArray(&pipe.m_early, 1024, sizeof(earlyFile));
+	session.m_pipeline = &pipe;
+
+	uint64_t addr = scanPartitionAndProcess(
+		&session, index, mapAndQueue, scanType
+	);
+	finishPipeline(&pipe);
+
+	if (addr) {
+		streamScanComplete(&session);
+		printf("Total First Block Matches: %lu\n", numCandidates(&session.m_firstBlocks));
+		printf("Indirect Block Count: %lu\n", numCandidates(&session.m_indirectBlocks));
+	}
+
+	if (pipe.m_isStarted) {
+		uint64_t redone = recheckEarlyFiles(&pipe);
+		printf("\nRecovered %lu files during the scan, %lu recovered again "
+			"with blocks found later.\n", pipe.m_early->m_numItems, redone);
+
+		close(pipe.m_worker.m_deviceID);
+		freeArray(&pipe.m_worker.m_recoveredBlocks);
+		freeSession(&pipe.m_worker);
+	}
+
+	freeLiveIndex(&pipe.m_index);
+	freeArray(&pipe.m_queue);
+	freeArray(&pipe.m_early);
+	pthread_cond_destroy(&pipe.m_wake);
+	pthread_mutex_destroy(&pipe.m_lock);
+	releaseMatches(&session);
+	freeSession(&session);
+}
+
+/* ============================================================
+ * Maps a scanned block like mapBlocks, adding new indirect
+ * blocks to the live index and queueing new first blocks for
+ * the worker.
+ *
+ * Parameters:
+ * 	session - the session being scanned.
+ * 	buffer - the buffer holding block data.
+ *  addr - the address the block was read from.
+ *  blockNum - the block number being mapped.
+ * ========================================================= */
+void mapAndQueue(
+	scanSession* session,
+	const uint8_t* buffer,
+	uint64_t addr,
+	uint64_t blockNum
+) {
+	pipeline* pipe = session->m_pipeline;
+	uint64_t numFirst = numCandidates(&session->m_firstBlocks);
+	uint64_t numIndirect = numCandidates(&session->m_indirectBlocks);
+	mapBlocks(session, buffer, addr, blockNum);
+
+	// indirect blocks stored in the journal within the
+	// first block group are never matched
+	if (!pipe->m_index)
+		initLiveIndex(&pipe->m_index, session->m_blockSize << 3);
+
+	// blocks past 2^32 cannot be pointed to by a block map
+	if (numCandidates(&session->m_indirectBlocks) > numIndirect && blockNum <= UINT32_MAX)
+		insertLive(pipe->m_index, *(const uint32_t*)buffer, blockNum);
+	if (
+		numCandidates(&session->m_firstBlocks) > numFirst &&
+		matchesFilter(blockNum, candidateFlags(&session->m_firstBlocks, numFirst))
+	)
+		queueFile(session, pipe, blockNum);
+
+	// wake the worker once the scan passes the block it waits for
+	if (blockNum >= __atomic_load_n(&pipe->m_waitFor, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&pipe->m_lock);
+		pipe->m_scanned = blockNum;
+		pthread_cond_broadcast(&pipe->m_wake);
+		pthread_mutex_unlock(&pipe->m_lock);
+	}
+}
+
+/* ============================================================
+ * Queues a first block for the worker, starting the worker on
+ * the first one.
+ *
+ * Parameters:
+ * 	session - the session being scanned.
+ *  pipe - the pipeline of the scan.
+ *  firstBlock - the first block of the file.
+ * ========================================================= */
+void queueFile(scanSession* session, pipeline* pipe, uint64_t firstBlock) {
+	pthread_mutex_lock(&pipe->m_lock);
+	if (!pipe->m_isStarted)
+		startWorker(session, pipe);
+	addItem(pipe->m_queue, &firstBlock);
+	pthread_cond_broadcast(&pipe->m_wake);
+	pthread_mutex_unlock(&pipe->m_lock);
+}
+
+/* ============================================================
+ * Sets up the worker's session on its own handle to the device
+ * and starts the worker thread.
+ *
+ * Parameters:
+ * 	session - the session being scanned.
+ *  pipe - the pipeline of the scan.
+ * ========================================================= */
+void startWorker(scanSession* session, pipeline* pipe) {
+	scanSession* worker = &pipe->m_worker;
+	cloneSession(worker, session);
+	worker->m_liveIndex = pipe->m_index;
+	initRecoveredBlocks(worker);
+
+	if (pthread_create(&pipe->m_thread, NULL, recoveryWorker, pipe))
+		exit_err("Failed to start recovery worker");
+	pipe->m_isStarted = 1;
+}
+
+/* ============================================================
+ * Body of the background recovery worker, recovers queued
+ * files in order until the scan is done and the queue empty.
+ *
+ * Parameters:
+ * 	arg - the pipeline of the scan.
+ * ========================================================= */
+void* recoveryWorker(void* arg) {
+	pipeline* pipe = arg;
+
+	pthread_mutex_lock(&pipe->m_lock);
+	while (1) {
+		while (pipe->m_queueHead == pipe->m_queue->m_numItems && !pipe->m_isDone)
+			pthread_cond_wait(&pipe->m_wake, &pipe->m_lock);
+		if (pipe->m_queueHead == pipe->m_queue->m_numItems)
+			break;
+
+		uint64_t firstBlock = *(uint64_t*)getItem(pipe->m_queue, pipe->m_queueHead++);
+		pthread_mutex_unlock(&pipe->m_lock);
+		uint64_t lastBlock = lastBlockOf(&pipe->m_worker, firstBlock);
+
+		pthread_mutex_lock(&pipe->m_lock);
+		__atomic_store_n(&pipe->m_waitFor, lastBlock, __ATOMIC_RELEASE);
+		while (pipe->m_scanned < lastBlock && !pipe->m_isDone)
+			pthread_cond_wait(&pipe->m_wake, &pipe->m_lock);
+		__atomic_store_n(&pipe->m_waitFor, UINT64_MAX, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&pipe->m_lock);
+
+		recoverEarly(pipe, firstBlock);
+		pthread_mutex_lock(&pipe->m_lock);
+	}
+	pthread_mutex_unlock(&pipe->m_lock);
+	return NULL;
+}
+
+/* ============================================================
+ * Returns the furthest block a file starting at the given block
+ * is expected to reach, from the volume size and the indirect
+ * blocks needed to map it, plus a block group since indirect
+ * blocks are not always placed among the data.
+ *
+ * Parameters:
+ * 	worker - the worker's session.
+ *  firstBlock - the first block of the file.
+ * ========================================================= */
+uint64_t lastBlockOf(scanSession* worker, uint64_t firstBlock) {
+	uint64_t blockSize = worker->m_blockSize;
+	uint64_t dataBlocks = (readVolumeSize(worker, firstBlock) + blockSize - 1) / blockSize;
+	uint64_t indirectBlocks = dataBlocks / (blockSize / 4 - 1) + 3;
+	uint64_t last = firstBlock + dataBlocks + indirectBlocks + (blockSize << 3);
+
+	return (last < worker->m_totalBlocks) ? last : worker->m_totalBlocks - 1;
+}
+
+/* ============================================================
+ * Recovers a file into the output directory during the scan,
+ * noting which of the live index's lookups it made.
+ *
+ * Parameters:
+ * 	pipe - the pipeline of the scan.
+ *  firstBlock - the first block of the file.
+ * ========================================================= */
+void recoverEarly(pipeline* pipe, uint64_t firstBlock) {
+	scanSession* worker = &pipe->m_worker;
+	char path[PATH_MAX];
+	outputPath(worker, firstBlock, path, sizeof(path));
+
+	earlyFile file;
+	file.m_firstBlock = firstBlock;
+	file.m_lookupStart = pipe->m_index->m_lookups->m_numItems;
+
+	if (recoverToOutput(worker, firstBlock, path) < 0)
+		fprintf(stderr, "Failed to open %s.\n", path);
+	else
+		printf("Recovered to %s\n\n", path);
+
+	file.m_lookupCount = pipe->m_index->m_lookups->m_numItems - file.m_lookupStart;
+	addItem(pipe->m_early, &file);
+}
+
+/* ============================================================
+ * Marks the scan as done and waits for the worker to recover
+ * the rest of the queue.
+ *
+ * Parameters:
+ * 	pipe - the pipeline of the scan.
+ * ========================================================= */
+void finishPipeline(pipeline* pipe) {
+	pthread_mutex_lock(&pipe->m_lock);
+	pipe->m_isDone = 1;
+	pthread_cond_broadcast(&pipe->m_wake);
+	pthread_mutex_unlock(&pipe->m_lock);
+
+	if (pipe->m_isStarted && pthread_join(pipe->m_thread, NULL))
+		exit_err("Failed to wait for recovery worker");
+}
+
+/* ============================================================
+ * Checks every lookup of the files recovered during the scan
+ * against the finished index, recovering a file again if any
+ * of its lookups would now find a different block.
+ *
+ * Parameters:
+ * 	pipe - the pipeline of a finished scan.
+ *
+ * Returns:
+ * 	Returns the number of files recovered again.
+ * ========================================================= */
+uint64_t recheckEarlyFiles(pipeline* pipe) {
+	segmentedArray* lookups = pipe->m_index->m_lookups;
+	uint64_t numEarly = pipe->m_early->m_numItems;
+	uint64_t redone = 0;
+
+	for (uint64_t i = 0; i < numEarly; i++) {
+		earlyFile* file = getItem(pipe->m_early, i);
+		uint32_t isStale = 0;
+
+		for (uint64_t k = 0; k < file->m_lookupCount && !isStale; k++) {
+			const keyEntry* lookup = getItem(lookups, file->m_lookupStart + k);
+			isStale = findLive(pipe->m_index, lookup->m_key) != lookup->m_blockNum;
+		}
+
+		if (isStale) {
+			char path[PATH_MAX];
+			outputPath(&pipe->m_worker, file->m_firstBlock, path, sizeof(path));
+			printf("Recovering %s again.\n", path);
+			recoverToOutput(&pipe->m_worker, file->m_firstBlock, path);
+			redone++;
+		}
+	}
+	return redone;
+}
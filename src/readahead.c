@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "readahead.h"
+#include "safeio.h"
+
+#define FAILED_ALLOC "Failed to allocate read ahead"
+
+enum SlotState {
+	SLOT_IDLE,		// past the end of the device
+	SLOT_QUEUED,
+	SLOT_READING,
+	SLOT_READY
+};
+
+// the tuning every scan reads with, one block at a time unless
+// set from the command line or the autotune probe
+ioTuning currentTuning = { 0, 1 };
+
+void* readerThread(void*);
+void restartAt(readAhead*, uint64_t);
+void queueSlot(readAhead*, readSlot*);
+
+/* ============================================================
+ * Sets how scans read the device from now on.
+ * ========================================================= */
+void setIOTuning(const ioTuning* tuning) {
+	currentTuning = *tuning;
+}
+
+/* ============================================================
+ * Returns how scans read the device.
+ *
+ * Parameters:
+ * 	tuning - output parameter for the tuning.
+ * ========================================================= */
+void getIOTuning(ioTuning* tuning) {
+	*tuning = currentTuning;
+}
+
+/* ============================================================
+ * Starts a reader for the device that keeps the tuning's
+ * number of chunks read in flight ahead of the blocks asked
+ * for. Nothing is read until the first block is asked for.
+ *
+ * Parameters:
+ * 	device - the device to read, only read with pread so its
+ *           offset is left alone.
+ *  tuning - the chunk size and number of chunks in flight.
+ *  end - the address nothing is read from or past.
+ *
+ * Returns:
+ * 	Returns the new reader.
+ * ========================================================= */
+readAhead* openReadAhead(int32_t device, const ioTuning* tuning, uint64_t end) {
+	readAhead* reader = calloc(1, sizeof(readAhead));
+	if (!reader)
+		exit_err(FAILED_ALLOC);
+
+	reader->m_device = device;
+	reader->m_end = end;
+	reader->m_chunkSize = tuning->m_readBytes;
+	reader->m_numSlots = tuning->m_readers ? tuning->m_readers : 1;
+	reader->m_slots = calloc(reader->m_numSlots, sizeof(readSlot));
+	reader->m_threads = calloc(reader->m_numSlots, sizeof(pthread_t));
+	if (!reader->m_slots || !reader->m_threads)
+		exit_err(FAILED_ALLOC);
+
+	pthread_mutex_init(&reader->m_lock, NULL);
+	pthread_cond_init(&reader->m_queued, NULL);
+	pthread_cond_init(&reader->m_ready, NULL);
+
+	for (uint32_t i = 0; i < reader->m_numSlots; i++) {
+		reader->m_slots[i].m_data = malloc(reader->m_chunkSize);
+		if (!reader->m_slots[i].m_data)
+			exit_err(FAILED_ALLOC);
+		if (pthread_create(&reader->m_threads[i], NULL, readerThread, reader))
+			exit_err("Failed to start reader thread");
+	}
+	return reader;
+}
+
+/* ============================================================
+ * Copies a block out of the chunks read ahead, waiting for its
+ * chunk to be read. Asking for a block outside the chunks in
+ * flight drops them and starts reading ahead from the block,
+ * so skipping forward costs one wait. Blocks past the reader's
+ * end or straddling two chunks are read directly.
+ *
+ * Parameters:
+ * 	reader - the reader.
+ *  addr - the address of the block.
+ *  block - buffer for the block's contents.
+ *  size - the size of the block.
+ * ========================================================= */
+void readAheadBlock(readAhead* reader, uint64_t addr, uint8_t* block, uint32_t size) {
+	if (addr >= reader->m_end) {
+		safeRead(reader->m_device, addr, block, size);
+		return;
+	}
+
+	pthread_mutex_lock(&reader->m_lock);
+	readSlot* head = &reader->m_slots[reader->m_head];
+	if (!reader->m_isPrimed || addr < head->m_addr || addr >= reader->m_nextAddr)
+		restartAt(reader, addr);
+
+	// chunks wholly behind the block are queued again past the
+	// last one in flight
+	head = &reader->m_slots[reader->m_head];
+	while (addr >= head->m_addr + head->m_length) {
+		while (head->m_state == SLOT_READING)
+			pthread_cond_wait(&reader->m_ready, &reader->m_lock);
+		queueSlot(reader, head);
+		reader->m_head = (reader->m_head + 1) % reader->m_numSlots;
+		head = &reader->m_slots[reader->m_head];
+	}
+
+	while (head->m_state != SLOT_READY)
+		pthread_cond_wait(&reader->m_ready, &reader->m_lock);
+	pthread_mutex_unlock(&reader->m_lock);
+
+	// only the scan requeues a ready chunk, so it can be copied
+	// from without the lock
+	if (addr + size <= head->m_addr + head->m_length)
+		memcpy(block, head->m_data + (addr - head->m_addr), size);
+	else
+		safeRead(reader->m_device, addr, block, size);
+}
+
+/* ============================================================
+ * Stops the reader's threads and frees it.
+ *
+ * Parameters:
+ * 	reader - the reader to close, may be NULL.
+ * ========================================================= */
+void closeReadAhead(readAhead* reader) {
+	if (!reader)
+		return;
+
+	pthread_mutex_lock(&reader->m_lock);
+	reader->m_stop = 1;
+	pthread_cond_broadcast(&reader->m_queued);
+	pthread_mutex_unlock(&reader->m_lock);
+
+	for (uint32_t i = 0; i < reader->m_numSlots; i++) {
+		pthread_join(reader->m_threads[i], NULL);
+		free(reader->m_slots[i].m_data);
+	}
+	pthread_cond_destroy(&reader->m_ready);
+	pthread_cond_destroy(&reader->m_queued);
+	pthread_mutex_destroy(&reader->m_lock);
+	free(reader->m_threads);
+	free(reader->m_slots);
+	free(reader);
+}
+
+/* ============================================================
+ * Body of a reader thread, reads the queued chunk with the
+ * lowest address until the reader is closed.
+ *
+ * Parameters:
+ * 	arg - the readAhead the thread reads for.
+ * ========================================================= */
+void* readerThread(void* arg) {
+	readAhead* reader = arg;
+	pthread_mutex_lock(&reader->m_lock);
+
+	while (!reader->m_stop) {
+		readSlot* slot = NULL;
+		for (uint32_t i = 0; i < reader->m_numSlots && !slot; i++) {
+			readSlot* next = &reader->m_slots[(reader->m_head + i) % reader->m_numSlots];
+			if (next->m_state == SLOT_QUEUED)
+				slot = next;
+		}
+		if (!slot) {
+			pthread_cond_wait(&reader->m_queued, &reader->m_lock);
+			continue;
+		}
+
+		slot->m_state = SLOT_READING;
+		pthread_mutex_unlock(&reader->m_lock);
+
+		// a short read at the end of an image leaves zeroes
+		int64_t length = readDevice(reader->m_device, slot->m_data, slot->m_length, slot->m_addr);
+		memset(slot->m_data + length, 0, slot->m_length - length);
+
+		pthread_mutex_lock(&reader->m_lock);
+		slot->m_state = SLOT_READY;
+		pthread_cond_broadcast(&reader->m_ready);
+	}
+
+	pthread_mutex_unlock(&reader->m_lock);
+	return NULL;
+}
+
+/* ============================================================
+ * Drops every chunk in flight and queues all of them again
+ * starting at the given address, the caller must hold the
+ * reader's lock.
+ * ========================================================= */
+void restartAt(readAhead* reader, uint64_t addr) {
+	for (uint32_t i = 0; i < reader->m_numSlots; i++)
+		while (reader->m_slots[i].m_state == SLOT_READING)
+			pthread_cond_wait(&reader->m_ready, &reader->m_lock);
+
+	reader->m_nextAddr = addr;
+	reader->m_isPrimed = 1;
+	for (uint32_t i = 0; i < reader->m_numSlots; i++)
+		queueSlot(reader, &reader->m_slots[(reader->m_head + i) % reader->m_numSlots]);
+}
+
+/* ============================================================
+ * Queues a slot to read the chunk after the last one queued,
+ * or leaves it idle past the reader's end. The caller must
+ * hold the reader's lock.
+ * ========================================================= */
+void queueSlot(readAhead* reader, readSlot* slot) {
+	uint64_t remaining = reader->m_end - reader->m_nextAddr;
+	slot->m_addr = reader->m_nextAddr;
+	slot->m_length = (remaining < reader->m_chunkSize) ? remaining : reader->m_chunkSize;
+	slot->m_state = slot->m_length ? SLOT_QUEUED : SLOT_IDLE;
+	reader->m_nextAddr += slot->m_length;
+	if (slot->m_length)
+		pthread_cond_signal(&reader->m_queued);
+}
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recordWriter.h"
+#include "safeio.h"
+
+#define NANOS_PER_MILLI 1000000
+
+uint64_t monotonicNanos();
+void flushLocked(recordWriter*);
+
+/* ============================================================
+ * Allocates a record writer for the given file descriptor.
+ *
+ * Parameters:
+ * 	writer - output parameter for the new writer.
+ *  fd - the file descriptor records are written to.
+ *  flushBytes - buffered size at which records are written out.
+ *  flushMillis - the longest a record is held before it is
+ *                written out.
+ * ========================================================= */
+void initRecordWriter(
+	recordWriter** writer,
+	int32_t fd,
+	uint32_t flushBytes,
+	uint32_t flushMillis
+) {
+	*writer = malloc(sizeof(recordWriter));
+	if (!(*writer))
+		exit_err("Failed to allocate record writer");
+
+	// leave room for one more record past the flush size
+	(*writer)->m_buffer = malloc(flushBytes + MAX_RECORD_SIZE);
+	if (!(*writer)->m_buffer)
+		exit_err("Failed to allocate record buffer");
+
+	(*writer)->m_fd = fd;
+	(*writer)->m_used = 0;
+	(*writer)->m_flushBytes = flushBytes;
+	(*writer)->m_flushNanos = (uint64_t)flushMillis * NANOS_PER_MILLI;
+	(*writer)->m_lastFlush = monotonicNanos();
+	pthread_mutex_init(&(*writer)->m_lock, NULL);
+}
+
+/* ============================================================
+ * Writes out any buffered records and frees the writer. The
+ * file descriptor is left open.
+ *
+ * Parameters:
+ * 	writer - the writer to free, set to NULL afterwards.
+ * ========================================================= */
+void freeRecordWriter(recordWriter** writer) {
+	if (!(*writer))
+		return;
+	flushRecords(*writer);
+	pthread_mutex_destroy(&(*writer)->m_lock);
+	free((*writer)->m_buffer);
+	free(*writer);
+	*writer = NULL;
+}
+
+/* ============================================================
+ * Formats a single record into the buffer, followed by a
+ * newline, writing the buffer out if a threshold is reached.
+ * Records longer than MAX_RECORD_SIZE are truncated.
+ *
+ * Parameters:
+ * 	writer - the writer to add the record to.
+ *  format - printf style format of the record.
+ * ========================================================= */
+void writeRecord(recordWriter* writer, const char* format, ...) {
+	pthread_mutex_lock(&writer->m_lock);
+
+	va_list args;
+	va_start(args, format);
+	char* next = writer->m_buffer + writer->m_used;
+	int32_t length = vsnprintf(next, MAX_RECORD_SIZE - 1, format, args);
+	va_end(args);
+
+	if (length > MAX_RECORD_SIZE - 2)
+		length = MAX_RECORD_SIZE - 2;
+	next[length] = '\n';
+	writer->m_used += length + 1;
+
+	uint32_t isDue = writer->m_used >= writer->m_flushBytes
+		|| monotonicNanos() - writer->m_lastFlush >= writer->m_flushNanos;
+	if (isDue)
+		flushLocked(writer);
+
+	pthread_mutex_unlock(&writer->m_lock);
+}
+
+/* ============================================================
+ * Writes out buffered records once they have been held for the
+ * flush interval. Called regularly while scanning so records
+ * found just before a long quiet stretch are not held back.
+ *
+ * Parameters:
+ * 	writer - the writer to check.
+ * ========================================================= */
+void pollRecords(recordWriter* writer) {
+	// cheap unlocked check, a stale read only delays the flush
+	// until the next poll
+	if (writer->m_used == 0)
+		return;
+
+	pthread_mutex_lock(&writer->m_lock);
+	if (monotonicNanos() - writer->m_lastFlush >= writer->m_flushNanos)
+		flushLocked(writer);
+	pthread_mutex_unlock(&writer->m_lock);
+}
+
+/* ============================================================
+ * Writes out all buffered records.
+ *
+ * Parameters:
+ * 	writer - the writer to flush.
+ * ========================================================= */
+void flushRecords(recordWriter* writer) {
+	pthread_mutex_lock(&writer->m_lock);
+	flushLocked(writer);
+	pthread_mutex_unlock(&writer->m_lock);
+}
+
+/* ============================================================
+ * Writes out all buffered records, the caller must hold the
+ * writer's lock.
+ *
+ * Parameters:
+ * 	writer - the writer to flush.
+ * ========================================================= */
+void flushLocked(recordWriter* writer) {
+	uint32_t written = 0;
+	while (written < writer->m_used) {
+		ssize_t result = write(
+			writer->m_fd, writer->m_buffer + written,
+			writer->m_used - written
+		);
+		if (result < 0)
+			exit_err("Failed to write records");
+		written += result;
+	}
+	writer->m_used = 0;
+	writer->m_lastFlush = monotonicNanos();
+}
+
+/* ============================================================
+ * Returns the current monotonic clock time in nanoseconds.
+ * ========================================================= */
+uint64_t monotonicNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
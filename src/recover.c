@@ -1,14 +1,23 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <ctype.h>
 
-#include "dynamicArray.h"
 #include "recover.h"
+#include "batch.h"
+#include "tarStream.h"
 #include "safeio.h"
+#include "faultMap.h"
 #include "scan.h"
+#include "candidates.h"
+#include "liveIndex.h"
 #include "mbr.h"
+#include "trace.h"
 
 #if defined(_DEBUG) || defined(DEBUG)
 #include "debug.h"
@@ -16,41 +25,232 @@
 
 #define ISO_SIGNATURE "CD001"	// volume descriptor signature
 
-// global variables
-int32_t deviceID = 0;
-uint64_t partition_addr = 0;
-uint32_t blockSize = 0;
-uint32_t totalBlocks = 0;
+typedef void (*candidateFunc)(scanSession*, uint64_t);
 
-// local
-dynamicArray* firstBlocks;
-dynamicArray* indirectBlocks;
-dynamicArray* recoveredBlocks;
-uint64_t volumeSize = 0;
-
-// defines the type of entry the dynamic arrays will contain
+// which first block candidates are recovered, set from -filter
 typedef struct {
-	uint64_t m_addr; 		// the address of the block
-	uint32_t m_blockNum; 	// its block number
-	uint32_t m_size; 		// the number of data blocks it points to
-} blockEntry;
-
-int32_t isIndirectBlock(const uint32_t*, uint32_t);
-int32_t verifyTrailingZeroes(const uint32_t*, const uint32_t*);
-void mapBlocks(const uint8_t*, uint64_t, uint32_t);
-uint32_t isLikelyFirstBlock(const uint8_t*, uint64_t);
-uint32_t hasISOSignature(const uint8_t*);
-uint64_t mapSize(const uint8_t*);
-void printMatches();
-void printMatch(const blockEntry*);
-void forEachBlock(dynamicArray*, void (*) (const blockEntry*));
-void recover(const blockEntry*);
-void recoverIndirectBlocks(uint32_t);
-uint32_t recoverIndirectFor(uint32_t, uint32_t*);
-uint32_t addBlocksFrom(const uint8_t*);
-void writeRecoveredFile();
-void writeBlocks(int32_t);
-void recordVolumeSize();
+	uint8_t m_flags;		// HAS_* flags a candidate must all have
+	uint64_t m_firstBlock;	// range its first block must lie in
+	uint64_t m_lastBlock;
+} recoveryFilter;
+
+// stream of NDJSON candidate records, NULL if not requested
+recordWriter* candidateStream = NULL;
+
+// directory files are recovered to without prompting, NULL to
+// prompt for each file
+const char* outputDir = NULL;
+
+// archive recovered files are streamed to instead of being
+// written into the output directory, NULL if not streaming
+tarStream* outputArchive = NULL;
+
+// names of files in the output directory, see setNamePattern
+const char* namePattern = DEFAULT_NAME_PATTERN;
+
+// every candidate is recovered unless a filter is set
+recoveryFilter filter = { 0, 0, UINT64_MAX };
+
+uint64_t mapSize(const scanSession*, const uint8_t*);
+void printMatches(scanSession*);
+void printMatch(scanSession*, uint64_t);
+void forEachCandidate(scanSession*, const candidateList*, candidateFunc);
+void recover(scanSession*, uint64_t);
+void printStatus(const scanSession*, const char*, ...);
+uint32_t lookupIndirect(scanSession*, uint32_t);
+void recoverIndirectBlocks(scanSession*, uint32_t);
+uint32_t recoverIndirectFor(scanSession*, uint32_t, uint32_t*);
+uint32_t addBlocksFrom(scanSession*, const uint8_t*);
+void writeRecoveredFile(scanSession*);
+uint64_t writeEntry(scanSession*, const char*);
+uint64_t copyBlocks(scanSession*, int32_t, uint64_t, uint32_t);
+void recordVolumeSize(scanSession*);
+uint64_t recoveredSize(const scanSession*);
+uint32_t isZeroBlock(const scanSession*, const uint8_t*);
+
+/* ============================================================
+ * Sets the stream every scan writes its candidates to as they
+ * are found, one JSON record per line.
+ * 
+ * Parameters:
+ * 	stream - the writer to use, or NULL to stop streaming.
+ * ========================================================= */
+void setCandidateStream(recordWriter* stream) {
+	candidateStream = stream;
+}
+
+/* ============================================================
+ * Returns the stream candidates are written to, or NULL if
+ * they are not streamed.
+ * ========================================================= */
+recordWriter* getCandidateStream() {
+	return candidateStream;
+}
+
+/* ============================================================
+ * Sets the directory every recovered file is written to
+ * without prompting the user.
+ * 
+ * Parameters:
+ * 	dir - the output directory, or NULL to prompt for each file.
+ * ========================================================= */
+void setOutputDir(const char* dir) {
+	outputDir = dir;
+}
+
+/* ============================================================
+ * Sets the archive every file recovered to the output
+ * directory is streamed to instead, as an entry named after
+ * the file.
+ * 
+ * Parameters:
+ * 	archive - the archive to use, or NULL to write files.
+ * ========================================================= */
+void setOutputArchive(tarStream* archive) {
+	outputArchive = archive;
+}
+
+/* ============================================================
+ * Returns the directory files are recovered to, or NULL if the
+ * user is prompted for each file.
+ * ========================================================= */
+const char* getOutputDir() {
+	return outputDir;
+}
+
+/* ============================================================
+ * Sets how files in the output directory are named. Patterns
+ * are copied through except for these fields:
+ * 	%p - the byte address of the partition in hex,
+ * 	%b - the first block of the file,
+ * 	%a - the byte address of the file on the device in hex,
+ * 	%% - a literal '%'.
+ * A pattern must hold %b or %a so no two files share a name.
+ * 
+ * Parameters:
+ * 	pattern - the pattern, kept rather than copied.
+ * 
+ * Returns:
+ * 	Returns a 1 if the pattern is valid, 0 otherwise.
+ * ========================================================= */
+uint32_t setNamePattern(const char* pattern) {
+	uint32_t isUnique = 0;
+	for (const char* c = pattern; *c; c++) {
+		if (*c == '/')
+			return 0;
+		if (*c != '%')
+			continue;
+
+		c++;
+		if (*c == 'b' || *c == 'a')
+			isUnique = 1;
+		else if (*c != 'p' && *c != '%')
+			return 0;
+	}
+
+	if (isUnique)
+		namePattern = pattern;
+	return isUnique;
+}
+
+/* ============================================================
+ * Restricts which first block candidates are recovered. The
+ * filter is a comma separated list of terms, all of which a
+ * candidate must match:
+ * 	'primary' - a primary volume descriptor was found,
+ * 	'mbr' - a boot record was found in its first block,
+ * 	'<first>-<last>' - its first block lies in the range.
+ * 
+ * Parameters:
+ * 	spec - the filter given on the command line.
+ * 
+ * Returns:
+ * 	Returns a 1 if the filter is valid, 0 otherwise.
+ * ========================================================= */
+uint32_t setRecoveryFilter(const char* spec) {
+	recoveryFilter parsed = { 0, 0, UINT64_MAX };
+	const char* term = spec;
+
+	while (*term) {
+		uint32_t length = strcspn(term, ",");
+		char* end;
+
+		if (length == 7 && strncmp(term, "primary", 7) == 0)
+			parsed.m_flags |= HAS_PRIMARY_DESC;
+		else if (length == 3 && strncmp(term, "mbr", 3) == 0)
+			parsed.m_flags |= HAS_MBR;
+		else if (isdigit((unsigned char)*term)) {
+			parsed.m_firstBlock = strtoull(term, &end, 10);
+			if (*end != '-' || !isdigit((unsigned char)end[1]))
+				return 0;
+			parsed.m_lastBlock = strtoull(end + 1, &end, 10);
+			if (end != term + length || parsed.m_lastBlock < parsed.m_firstBlock)
+				return 0;
+		} else
+			return 0;
+
+		term += length;
+		if (*term == ',')
+			term++;
+	}
+
+	filter = parsed;
+	return 1;
+}
+
+/* ============================================================
+ * Returns whether a first block candidate passes the filter
+ * set with setRecoveryFilter.
+ * 
+ * Parameters:
+ * 	firstBlock - the first block of the candidate.
+ *  flags - the type/confidence flags of the candidate.
+ * ========================================================= */
+uint32_t matchesFilter(uint64_t firstBlock, uint8_t flags) {
+	return (flags & filter.m_flags) == filter.m_flags
+		&& firstBlock >= filter.m_firstBlock
+		&& firstBlock <= filter.m_lastBlock;
+}
+
+/* ============================================================
+ * Formats the path a file is recovered to in the output
+ * directory, named by the pattern set with setNamePattern.
+ * Files streamed to an archive are named without a directory.
+ * 
+ * Parameters:
+ * 	session - the session the file is recovered from.
+ *  firstBlock - the first block of the file.
+ *  path - output buffer for the path.
+ *  size - the size of the buffer.
+ * ========================================================= */
+void outputPath(
+	const scanSession* session, 
+	uint64_t firstBlock, 
+	char* path, 
+	uint32_t size
+) {
+	uint32_t length = outputArchive ? 0 : snprintf(path, size, "%s/", outputDir);
+
+	for (const char* c = namePattern; *c && length < size; c++) {
+		if (*c != '%') {
+			path[length++] = *c;
+			continue;
+		}
+
+		c++;
+		if (*c == 'p')
+			length += snprintf(path + length, size - length, "%lx",
+				session->m_partitionAddr);
+		else if (*c == 'b')
+			length += snprintf(path + length, size - length, "%lu", firstBlock);
+		else if (*c == 'a')
+			length += snprintf(path + length, size - length, "%lx",
+				blockAddr(session, firstBlock));
+		else
+			path[length++] = '%';
+	}
+	path[(length < size) ? length : size - 1] = '\0';
+}
 
 /* ============================================================
  * Performs file carving looking for the first block of deleted
@@ -63,24 +263,211 @@ void recordVolumeSize();
  *  scanType - flag indicating which type of blocks to map.
  * ========================================================= */
 void recoverFiles(int32_t device, int32_t index, uint32_t scanType) {
-	deviceID = device;
-	init(&firstBlocks, 1000, sizeof(blockEntry));
-	init(&indirectBlocks, 10000, sizeof(blockEntry));
+	scanSession session;
+	initSession(&session, device);
+	initCandidates(&session.m_firstBlocks, 1024);
+	initCandidates(&session.m_indirectBlocks, 16384);
+	session.m_records = candidateStream;
 
 	uint64_t addr = scanPartitionAndProcess(
-		index, mapBlocks, scanType
+		&session, index, mapBlocks, scanType
 	);
 
 	// if invalid partition do nothing
 	if (addr) {
-		printMatches();
-		init(&recoveredBlocks, 100000, sizeof(blockEntry));
-		printf("\nBeginning Recovery Process...\n\n");
-		forEachBlock(firstBlocks, recover);
+		streamScanComplete(&session);
+		recoverMatches(&session);
 	}
+	releaseMatches(&session);
+	freeSession(&session);
+}
+
+/* ============================================================
+ * Scans the partition at the given address and maps out the
+ * first block and indirect block candidates into the session
+ * without starting recovery.
+ * 
+ * Parameters:
+ * 	session - an initialized session for the device to read.
+ *  addr - the byte address of the partition.
+ *  scanType - flag indicating which type of blocks to map.
+ * ========================================================= */
+void scanForFiles(scanSession* session, uint64_t addr, uint32_t scanType) {
+	initCandidates(&session->m_firstBlocks, 1024);
+	initCandidates(&session->m_indirectBlocks, 16384);
+	session->m_records = candidateStream;
+	scanPartitionAt(session, addr, mapBlocks, scanType);
+	streamScanComplete(session);
+}
+
+/* ============================================================
+ * Lists the first block candidates found by the session's scan
+ * and attempts to recover each of them that passes the filter,
+ * prompting for each in turn or, with an output directory,
+ * recovering them all into it with a pool of writers.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ * ========================================================= */
+void recoverMatches(scanSession* session) {
+	printMatches(session);
+	indexMatches(session);
+	printf("\nBeginning Recovery Process...\n\n");
+	if (outputDir)
+		recoverBatch(session);
+	else
+		forEachCandidate(session, &session->m_firstBlocks, recover);
+}
+
+/* ============================================================
+ * Builds the lookup index over the session's indirect block
+ * candidates so files can be recovered.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ * ========================================================= */
+void indexMatches(scanSession* session) {
+	// indirect blocks stored in the journal within the
+	// first block group are never matched
+	session->m_indirectIndex = buildKeyIndex(
+		&session->m_indirectBlocks, session->m_blockSize << 3
+	);
+	initRecoveredBlocks(session);
+}
+
+/* ============================================================
+ * Allocates the list of blocks recovered for a file. Block
+ * numbers are stored in 4 bytes unless the partition has more
+ * than 2^32 blocks, so smaller volumes use no more memory.
+ * 
+ * Parameters:
+ * 	session - a session with its superblock loaded.
+ * ========================================================= */
+void initRecoveredBlocks(scanSession* session) {
+	uint32_t size = (session->m_totalBlocks > UINT32_MAX) 
+		? sizeof(uint64_t) : sizeof(uint32_t);
+	initArray(&session->m_recoveredBlocks, 131072, size);
+}
+
+/* ============================================================
+ * Appends a block to the list of blocks recovered for a file.
+ * 
+ * Parameters:
+ * 	session - the session recovering the file.
+ *  blockNum - the block number to add.
+ * ========================================================= */
+void addRecovered(scanSession* session, uint64_t blockNum) {
+	if (session->m_recoveredBlocks->m_elementSize == sizeof(uint64_t))
+		addItem(session->m_recoveredBlocks, &blockNum);
+	else {
+		uint32_t narrow = blockNum;
+		addItem(session->m_recoveredBlocks, &narrow);
+	}
+}
 
-	free(firstBlocks);
-	free(indirectBlocks);
+/* ============================================================
+ * Returns the block at index i of the blocks recovered for a
+ * file.
+ * ========================================================= */
+uint64_t recoveredBlock(const scanSession* session, uint64_t i) {
+	const void* item = getItem(session->m_recoveredBlocks, i);
+	if (session->m_recoveredBlocks->m_elementSize == sizeof(uint64_t))
+		return *(const uint64_t*)item;
+	return *(const uint32_t*)item;
+}
+
+/* ============================================================
+ * Recovers a single first block candidate straight to the 
+ * given path without prompting. The session must already be 
+ * indexed with indexMatches.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ *  index - the index of the first block candidate to recover.
+ *  path - the path of the file to write.
+ * 
+ * Returns:
+ * 	Returns the number of bytes written, or -1 if the file
+ *  could not be opened.
+ * ========================================================= */
+int64_t recoverCandidateTo(
+	scanSession* session, 
+	uint64_t index, 
+	const char* path
+) {
+	uint64_t firstBlock = candidateBlock(&session->m_firstBlocks, index);
+	return recoverFileTo(session, firstBlock, path);
+}
+
+/* ============================================================
+ * Recovers the file starting at the given first block straight
+ * to the given path without prompting.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ *  firstBlock - the first block of the file.
+ *  path - the path of the file to write.
+ * 
+ * Returns:
+ * 	Returns the number of bytes written, or -1 if the file
+ *  could not be opened.
+ * ========================================================= */
+int64_t recoverFileTo(
+	scanSession* session, 
+	uint64_t firstBlock, 
+	const char* path
+) {
+	int32_t flags = O_WRONLY | O_CREAT | O_TRUNC;
+	int32_t file = open(path, flags, S_IRUSR | S_IWUSR);
+	if (file < 0)
+		return -1;
+
+	assembleFile(session, firstBlock);
+	uint64_t written = writeBlocks(session, file);
+	clearArray(session->m_recoveredBlocks);
+	close(file);
+	return written;
+}
+
+/* ============================================================
+ * Recovers the file starting at the given first block into
+ * the output directory, or as the next entry of the output
+ * archive if one is set.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ *  firstBlock - the first block of the file.
+ *  path - the path from outputPath.
+ * 
+ * Returns:
+ * 	Returns the number of bytes written, or -1 if the file
+ *  could not be opened.
+ * ========================================================= */
+int64_t recoverToOutput(
+	scanSession* session, 
+	uint64_t firstBlock, 
+	const char* path
+) {
+	if (!outputArchive)
+		return recoverFileTo(session, firstBlock, path);
+
+	assembleFile(session, firstBlock);
+	uint64_t written = writeEntry(session, path);
+	clearArray(session->m_recoveredBlocks);
+	return written;
+}
+
+/* ============================================================
+ * Frees the candidate lists and indexes held by the session.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ * ========================================================= */
+void releaseMatches(scanSession* session) {
+	freeCandidates(&session->m_firstBlocks);
+	freeCandidates(&session->m_indirectBlocks);
+	freeArray(&session->m_indirectIndex);
+	freeArray(&session->m_recoveredBlocks);
 }
 
 /* ============================================================
@@ -89,32 +476,47 @@ void recoverFiles(int32_t device, int32_t index, uint32_t scanType) {
  * of being an actual first block match.
  * 
  * Parameters:
- * 	firstBlock - the first block entry to perform file carving on.
+ * 	session - the session holding the scan results.
+ * 	index - the index of the first block candidate to perform 
+ *          file carving on.
+ * ========================================================= */
+void recover(scanSession* session, uint64_t index) {
+	const candidateList* firstBlocks = &session->m_firstBlocks;
+	uint64_t firstBlock = candidateBlock(firstBlocks, index);
+	if (!matchesFilter(firstBlock, candidateFlags(firstBlocks, index)))
+		return;
+
+	assembleFile(session, firstBlock);
+	writeRecoveredFile(session);
+
+	// clear list for next recovered file
+	clearArray(session->m_recoveredBlocks);
+}
+
+/* ============================================================
+ * Fills the session's recovered block list with the data 
+ * blocks of the file starting at the given first block
+ * candidate. Block pointers are 32 bits, so only the direct
+ * blocks of a file starting past 2^32 can be recovered.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ * 	firstBlock - the first block of the file.
  * ========================================================= */
-void recover(const blockEntry* firstBlock) {
-	printf("First Block Recovered: %d\n", firstBlock->m_blockNum);
+void assembleFile(scanSession* session, uint64_t firstBlock) {
+	printStatus(session, "First Block Recovered: %lu\n", firstBlock);
 
 	// assume first 12 direct pointers are contiguous and
 	// add to recovered list
-	for (uint32_t i = 0; i < 12; i++) {
-		blockEntry block = {
-			firstBlock->m_addr + (i * blockSize), 
-			firstBlock->m_blockNum + i, 
-			0
-		};
-		addItem(&recoveredBlocks, &block);
-	}
+	for (uint32_t i = 0; i < 12; i++)
+		addRecovered(session, firstBlock + i);
 
 	// now go through indirect blocks and try to match
 	// them in sequence assuming the first address
 	// pointed to follows from the previous, etc.
-	uint32_t next = firstBlock->m_blockNum + 12;
-	recoverIndirectBlocks(next);
-	writeRecoveredFile();
-
-	// clear list fr next recovered file
-	//free(recoveredBlocks);
-	//init(&recoveredBlocks, 100000, sizeof(blockEntry));
+	uint64_t next = firstBlock + 12;
+	if (next <= UINT32_MAX)
+		recoverIndirectBlocks(session, next);
 }
 
 /* ============================================================
@@ -123,27 +525,31 @@ void recover(const blockEntry* firstBlock) {
  * after the first 12 direct pointers.
  * 
  * Parameters:
+ * 	session - the session holding the scan results.
  * 	nextBlock - the next expected block number to be found
  *              in the single indirect pointer.
  * ========================================================= */
-void recoverIndirectBlocks(uint32_t nextBlock) {
+void recoverIndirectBlocks(scanSession* session, uint32_t nextBlock) {
 	uint32_t lastEntry = 0; // next expected block number across ptrs
 
-	printf("Recovering single indirect pointer: ");
-	recoverIndirectFor(nextBlock, &lastEntry);
-	printf("Recovering double indirect pointer: ");
-	recoverIndirectFor(lastEntry + 1, &lastEntry);
-	printf("Recovering triple indirect pointer: ");
-	recoverIndirectFor(lastEntry + 1, &lastEntry);
+	printStatus(session, "Recovering single indirect pointer: ");
+	recoverIndirectFor(session, nextBlock, &lastEntry);
+	printStatus(session, "Recovering double indirect pointer: ");
+	recoverIndirectFor(session, lastEntry + 1, &lastEntry);
+	printStatus(session, "Recovering triple indirect pointer: ");
+	recoverIndirectFor(session, lastEntry + 1, &lastEntry);
 }
 
 /* ============================================================
- * Recovers data blocks from the next indirect block by scanning
- * all of the mapped indirect blocks for a block address that 
- * matches the next anticipated block number.
+ * Recovers data blocks from the next indirect block by looking
+ * up the mapped indirect block whose first pointer matches the
+ * next anticipated block number in the sorted key index. Only
+ * the matching block is read back from the device.
  * 
  * Parameters:
- * 	firstBlock - the first block entry to perform file carving on.
+ * 	session - the session holding the scan results.
+ * 	nextBlockNum - the block number the indirect block must 
+ *                 point to first.
  *  lastEntry - output parameter for the block number of the last 
  * 				indirect block read in the recursive tree traversal.
  * 
@@ -151,41 +557,54 @@ void recoverIndirectBlocks(uint32_t nextBlock) {
  * 	Returns the block number of the indirect block pointing to
  *  the given block number, and the last data block entry
  * ========================================================= */
-uint32_t recoverIndirectFor(uint32_t nextBlockNum, uint32_t* lastEntryOut) {
+uint32_t recoverIndirectFor(
+	scanSession* session, 
+	uint32_t nextBlockNum, 
+	uint32_t* lastEntryOut
+) {
 	if (nextBlockNum == 1)
 		return 0; // end of the line, file has nore more blocks
 
-	uint32_t containsBlock;
-	uint32_t isInJournal;
-	uint8_t buffer[blockSize];
+	uint8_t buffer[session->m_blockSize];
 
-	for (uint32_t i = 0; i < indirectBlocks->m_numItems; i++) {
-		blockEntry* entry = getItem(&indirectBlocks, i);
-		safeRead(deviceID, entry->m_addr, buffer, blockSize);
-
-		// check for expected block number at first entry
-		// and that the indirect block is not stored in the journal
-		// within the first block group
-		containsBlock = *((uint32_t*)buffer) == nextBlockNum;
-		isInJournal = entry->m_blockNum < (blockSize << 3);
-
-		if (containsBlock && !isInJournal) {
-			// if this is the correct indirect block then
-			// recursively travserse back up to the root of the indirect
-			// tree and add all data blocks with depth first traversal
-			if (!recoverIndirectFor(entry->m_blockNum, lastEntryOut)) {
-				printf("Found -> %d\n", entry->m_blockNum);
-				printf("Mapping data blocks...");
-				fflush(stdout);
-				*lastEntryOut = addBlocksFrom(buffer);
-				printf("\r                        ");
-				printf("\rComplete!\n");
-			}
+	// check for expected block number at first entry, the
+	// index already excludes blocks stored in the journal
+	uint32_t blockNum = lookupIndirect(session, nextBlockNum);
+	if (!blockNum)
+		return 0;
 
-			return entry->m_blockNum;
-		}
+	// if this is the correct indirect block then
+	// recursively travserse back up to the root of the indirect
+	// tree and add all data blocks with depth first traversal
+	if (!recoverIndirectFor(session, blockNum, lastEntryOut)) {
+		printStatus(session, "Found -> %d\n", blockNum);
+		printStatus(session, "Mapping data blocks...");
+		readBlock(session, blockNum, buffer);
+		*lastEntryOut = addBlocksFrom(session, buffer);
+		printStatus(session, "\r                        ");
+		printStatus(session, "\rComplete!\n");
 	}
-	return 0;
+
+	return blockNum;
+}
+
+/* ============================================================
+ * Returns the lowest indirect block candidate whose first 
+ * pointer is the given key, from the live index if the session
+ * is recovering while the scan runs.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
+ * 	key - the block number the indirect block must point to.
+ * 
+ * Returns:
+ * 	Returns the block number of the indirect block, or 0 if
+ *  there is none.
+ * ========================================================= */
+uint32_t lookupIndirect(scanSession* session, uint32_t key) {
+	if (session->m_liveIndex)
+		return lookupLive(session->m_liveIndex, key);
+	return findByKey(session->m_indirectIndex, key);
 }
 
 /* ============================================================
@@ -196,6 +615,7 @@ uint32_t recoverIndirectFor(uint32_t nextBlockNum, uint32_t* lastEntryOut) {
  * correct order.
  * 
  * Parameters:
+ * 	session - the session holding the scan results.
  * 	block - the contents of the indirect block in the tree, 
  *           or the root.
  * 
@@ -203,7 +623,8 @@ uint32_t recoverIndirectFor(uint32_t nextBlockNum, uint32_t* lastEntryOut) {
  * 	Returns the last block address in the last indirect block
  *  traversed.
  * ========================================================= */
-uint32_t addBlocksFrom(const uint8_t* block) {
+uint32_t addBlocksFrom(scanSession* session, const uint8_t* block) {
+	uint32_t blockSize = session->m_blockSize;
 	uint8_t buffer[blockSize];
 	const uint32_t* start = (uint32_t*) block;
 	const uint32_t* end = (uint32_t*) (block + blockSize);
@@ -214,23 +635,19 @@ uint32_t addBlocksFrom(const uint8_t* block) {
 		if (nextBlockNum) {
 			// if the next block number is not zero then read it
 			// and add to list
-			uint64_t addr = partition_addr + 
-				(nextBlockNum * (uint64_t) blockSize);
-			safeRead(deviceID, addr, buffer, blockSize);
+			readBlock(session, nextBlockNum, buffer);
 
 			// if this entry is also an indirect block then add its blocks
-			if (isIndirectBlock((uint32_t*)buffer, blockSize >> 2)) {
-				uint32_t lastEntry = addBlocksFrom(buffer);
+			if (isIndirectBlock(session, (uint32_t*)buffer, blockSize >> 2)) {
+				uint32_t lastEntry = addBlocksFrom(session, buffer);
 
 				// return the last entry from the final recursive call
 				if (i + 1 == end) 
 					return lastEntry; 
 			}
 			// otherwise write this block to the recovered list
-			else {
-				blockEntry block = {addr, nextBlockNum, blockSize};
-				addItem(&recoveredBlocks, &block);
-			}
+			else
+				addRecovered(session, nextBlockNum);
 		}
 	}
 
@@ -243,59 +660,75 @@ uint32_t addBlocksFrom(const uint8_t* block) {
 /* ============================================================
  * Prints each likely first block found during scan along
  * with what signatures were located.
+ * 
+ * Parameters:
+ * 	session - the session holding the scan results.
  * ========================================================= */
-void printMatches() {
-	printf("Total First Block Matches: %d\n", firstBlocks->m_numItems);
-	printf("Indirect Block Count: %d\n", indirectBlocks->m_numItems);
+void printMatches(scanSession* session) {
+	printf(
+		"Total First Block Matches: %lu\n", 
+		numCandidates(&session->m_firstBlocks)
+	);
+	printf(
+		"Indirect Block Count: %lu\n", 
+		numCandidates(&session->m_indirectBlocks)
+	);
 	printf("\nListing potential starting blocks for recovered files.\n");
-	forEachBlock(firstBlocks, printMatch);
+	forEachCandidate(session, &session->m_firstBlocks, printMatch);
 }
 
 /* ============================================================
  * Prints information about a first block match.
  *
  * Parameters:
- * 	item - the entry to print information on.
+ * 	session - the session holding the scan results.
+ * 	index - the index of the first block candidate to print.
  * ========================================================= */
-void printMatch(const blockEntry* item) {
-		if (item->m_size) {
+void printMatch(scanSession* session, uint64_t index) {
+		const candidateList* firstBlocks = &session->m_firstBlocks;
+		if (candidateFlags(firstBlocks, index) & CANDIDATE_FIRST) {
+			uint64_t blockNum = candidateBlock(firstBlocks, index);
 			printf("\n[High Liklihood]: ----------------------\n");
-			printf("Address      - %0lx\n", item->m_addr);
-			printf("Block Number - %d\n", item->m_blockNum);
+			printf("Address      - %0lx\n", blockAddr(session, blockNum));
+			printf("Block Number - %lu\n", blockNum);
 			printf("----------------------------------------\n");
 		}
 }
 
 /* ============================================================
- * Loops through each block in the given dynamic array and
- * processes each with the function pointer func.
+ * Loops through each candidate in the given list and
+ * processes each index with the function pointer func.
  * 
  * Parameters:
- *	blocks - the list of blocks to process.
+ * 	session - the session the candidates belong to.
+ *	blocks - the list of candidates to process.
  *	func - the function to process each with.
  * ========================================================= */
-void forEachBlock(
-	dynamicArray* blocks, 
-	void (*func) (const blockEntry*)
+void forEachCandidate(
+	scanSession* session,
+	const candidateList* blocks, 
+	candidateFunc func
 ) {
-	for (uint32_t i = 0; i < blocks->m_numItems; i++) {
-		blockEntry* block = getItem(&blocks, i);
-		func(block);
-	}
+	uint64_t count = numCandidates(blocks);
+	for (uint64_t i = 0; i < count; i++)
+		func(session, i);
 }
 
 /* ============================================================
  * Writes the recovered blocks to a new file, prompts the user
  * for the file path and name.
+ * 
+ * Parameters:
+ * 	session - the session holding the recovered blocks.
  * ========================================================= */
-void writeRecoveredFile() {
+void writeRecoveredFile(scanSession* session) {
 	char* response = NULL;
 	int32_t flags = O_WRONLY | O_CREAT;
 	int32_t permissions = S_IRUSR | S_IWUSR;
 	int32_t file = -1;
 
 	printf("\nFile Recovered!\n");
-	printf("Recovered %d blocks.\n", recoveredBlocks->m_numItems);
+	printf("Recovered %lu blocks.\n", session->m_recoveredBlocks->m_numItems);
 	printf("\nWrite recovered file back to new location? (y/n)");
 
 	// determine if user wants to recover file
@@ -316,178 +749,364 @@ void writeRecoveredFile() {
 		} while(file < 0);
 
 		// write the recovered blocks to a new file
-		writeBlocks(file);
+		writeBlocks(session, file);
 	}
 
 	free(response);
 }
 
+/* ============================================================
+ * Prints a step of a file's recovery unless the session
+ * recovers quietly, flushing so partial lines show at once.
+ * 
+ * Parameters:
+ * 	session - the session recovering the file.
+ * 	format - printf style format of the message.
+ * ========================================================= */
+void printStatus(const scanSession* session, const char* format, ...) {
+	if (session->m_isQuiet)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	fflush(stdout);
+}
+
 /* ============================================================
  * Writes the recovered blocks to the given file descriptor
- * reading/writing out one at a time.
+ * reading/writing out one at a time. A regular file is
+ * allocated at its final size up front and blocks of zeroes
+ * are skipped over, leaving holes that read back the same.
+ * 
+ * Parameters:
+ * 	session - the session holding the recovered blocks.
+ * 	outFile - the file descriptor to write to.
+ * 
+ * Returns:
+ * 	Returns the number of bytes written.
+ * ========================================================= */
+uint64_t writeBlocks(scanSession* session, int32_t outFile) {
+	recordVolumeSize(session);
+	uint64_t fileSize = recoveredSize(session);
+	uint32_t isSparse = preallocateOutput(outFile, fileSize);
+	return copyBlocks(session, outFile, fileSize, isSparse);
+}
+
+/* ============================================================
+ * Streams the recovered blocks to the output archive as one
+ * entry, sized by the volume size of the file read from its
+ * primary volume descriptor. The archive is held until the
+ * whole entry is written.
+ * 
+ * Parameters:
+ * 	session - the session holding the recovered blocks.
+ * 	name - the name of the entry.
+ * 
+ * Returns:
+ * 	Returns the number of bytes of the file written.
  * ========================================================= */
-void writeBlocks(int32_t outFile) {
+uint64_t writeEntry(scanSession* session, const char* name) {
+	recordVolumeSize(session);
+	uint64_t fileSize = recoveredSize(session);
+
+	beginEntry(outputArchive, name, fileSize);
+	uint64_t written = copyBlocks(session, outputArchive->m_fd, fileSize, 0);
+	endEntry(outputArchive, written);
+	return written;
+}
+
+/* ============================================================
+ * Copies the recovered blocks to the file descriptor at its
+ * current offset, trimming the last block to the file size.
+ * Blocks in the bad range map are written as zeroes.
+ * 
+ * Parameters:
+ * 	session - the session holding the recovered blocks.
+ * 	outFile - the file descriptor to write to.
+ *  fileSize - the size of the file, from recoveredSize.
+ *  isSparse - whether blocks of zeroes are seeked over rather
+ *             than written, only for preallocated regular files.
+ * 
+ * Returns:
+ * 	Returns the number of bytes written.
+ * ========================================================= */
+uint64_t copyBlocks(
+	scanSession* session, 
+	int32_t outFile, 
+	uint64_t fileSize, 
+	uint32_t isSparse
+) {
+	uint32_t blockSize = session->m_blockSize;
+	uint64_t numBlocks = session->m_recoveredBlocks->m_numItems;
 	uint8_t buffer[blockSize];
 	uint64_t sizeWritten = 0;
+	uint64_t skipped = 0;		// zeroes skipped since the last write
+	uint64_t holeBytes = 0;
+	uint64_t badBlocks = 0;
 	uint32_t current_progress = 0;
+	TRACE_BEGIN(span);
 
-	recordVolumeSize();
-	printf("Writing data to file...\n");
+	uint64_t fileStart = isSparse ? lseek(outFile, 0, SEEK_CUR) : 0;
+	printStatus(session, "Writing data to file...\n");
 
-	for (uint32_t i = 0; i < recoveredBlocks->m_numItems; i++) {
-		printProgress(&current_progress, i, recoveredBlocks->m_numItems);
+	for (uint64_t i = 0; i < numBlocks; i++) {
+		if (!session->m_isQuiet)
+			printProgress(&current_progress, i, numBlocks);
 
-		blockEntry* block = getItem(&recoveredBlocks, i);
-		safeRead(deviceID, block->m_addr, buffer, blockSize);
+		uint64_t blockNum = recoveredBlock(session, i);
+		if (isRangeBad(blockAddr(session, blockNum), blockSize)) {
+			memset(buffer, 0, blockSize);
+			badBlocks++;
+		} else
+			readBlock(session, blockNum, buffer);
 
 		// for the very last block trim the end to match
 		// the actual file by reading primary volume descriptor
 		// for volume size.
-		if (i + 1 == recoveredBlocks->m_numItems) {
-			uint64_t difference = volumeSize - sizeWritten;
-
-			if (difference > 0 && difference < blockSize) {
-				safeWrite(outFile, buffer, difference);
-				sizeWritten += difference;
-				break;
-			}
+		uint32_t size = (i + 1 == numBlocks) ? fileSize - sizeWritten : blockSize;
+
+		if (isSparse && isZeroBlock(session, buffer)) {
+			safeSeek(outFile, size, SEEK_CUR);
+			skipped += size;
+			holeBytes += size;
+		} else {
+			punchHole(outFile, fileStart + sizeWritten - skipped, skipped);
+			skipped = 0;
+			safeWrite(outFile, buffer, size);
 		}
-
-		safeWrite(outFile, buffer, blockSize);
-		sizeWritten += (uint64_t)blockSize;
+		sizeWritten += size;
 	}
-	printf("\nWrote %ld total bytes.\n", sizeWritten);
+	punchHole(outFile, fileStart + sizeWritten - skipped, skipped);
+
+	printStatus(session, "\nWrote %ld total bytes.\n", sizeWritten);
+	if (holeBytes)
+		printStatus(session, "Left %lu bytes of zeroes as holes.\n", holeBytes);
+	if (badBlocks)
+		printStatus(session, "%lu blocks could not be read, left as zeroes.\n", badBlocks);
+	TRACE_END(span, "copyBlocks");
+	return sizeWritten;
+}
+
+/* ============================================================
+ * Returns the size of the file made of the recovered blocks,
+ * with the last block trimmed to the volume size recorded by
+ * recordVolumeSize if it ends within it.
+ * 
+ * Parameters:
+ * 	session - the session holding the recovered blocks.
+ * ========================================================== */
+uint64_t recoveredSize(const scanSession* session) {
+	uint64_t blockSize = session->m_blockSize;
+	uint64_t wholeSize = session->m_recoveredBlocks->m_numItems * blockSize;
+	if (wholeSize == 0)
+		return 0;
+
+	uint64_t lastStart = wholeSize - blockSize;
+	uint64_t volumeSize = session->m_volumeSize;
+	return (volumeSize > lastStart && volumeSize - lastStart < blockSize) 
+		? volumeSize : wholeSize;
+}
+
+/* ============================================================
+ * Returns whether a block is all zeroes, with the kernel
+ * compiled for the session's block size.
+ * 
+ * Parameters:
+ * 	session - the session the block was read in.
+ * 	block - a buffer containing the contents of the block.
+ * ========================================================== */
+uint32_t isZeroBlock(const scanSession* session, const uint8_t* block) {
+	return session->m_kernels->m_isZero(
+		(const uint32_t*)block, session->m_blockSize >> 2
+	);
 }
 
 /* ============================================================
  * Reads the primary vlume descriptor of the recovered file
  * to get the file volume size recorded in the file header.
+ * 
+ * Parameters:
+ * 	session - the session holding the recovered blocks.
  * ========================================================== */
-void recordVolumeSize() {
-	blockEntry* first = getItem(&recoveredBlocks, 0);
-	uint64_t primaryDescAddr = first->m_addr + 0x8000;
+void recordVolumeSize(scanSession* session) {
+	session->m_volumeSize = readVolumeSize(session, recoveredBlock(session, 0));
+}
+
+/* ============================================================
+ * Reads the size of the ISO volume starting at the given block
+ * from its primary volume descriptor.
+ * 
+ * Parameters:
+ * 	session - the session the volume is read from.
+ *  first - the first block of the volume.
+ * 
+ * Returns:
+ * 	Returns the size of the volume in bytes.
+ * ========================================================= */
+uint64_t readVolumeSize(scanSession* session, uint64_t first) {
+	uint64_t primaryDescAddr = blockAddr(session, first) + DESCRIPTOR_OFFSET;
 	uint8_t buffer[2048]; // vol. desc are always 2048 bytes
-	safeRead(deviceID, primaryDescAddr, buffer, 2048);
+	safeRead(session->m_deviceID, primaryDescAddr, buffer, 2048);
 
 	uint32_t offsetVolSize = 80;
 	uint32_t offsetBlockSize = 128;
 	uint32_t logicalSizeInBlocks = *(uint32_t*)(buffer + offsetVolSize);
 	uint16_t logicalBlockSize = *(uint16_t*)(buffer + offsetBlockSize);
 
-	printf("Volume Space Size: 0x%x\n", logicalSizeInBlocks);
-	printf("Logical Block Size: 0x%x\n", logicalBlockSize);
-	volumeSize = (uint64_t)logicalSizeInBlocks 
-		* (uint64_t)logicalBlockSize;
+	printStatus(session, "Volume Space Size: 0x%x\n", logicalSizeInBlocks);
+	printStatus(session, "Logical Block Size: 0x%x\n", logicalBlockSize);
+	return (uint64_t)logicalSizeInBlocks * (uint64_t)logicalBlockSize;
 }
 
 /* ============================================================
  * Maps out each block that is either a potential first block
  * for a deleted file adding it to a list, or adds a tuple
- * of (block number, total size pointed to) to a different list
+ * of (block number, first block pointer) to a different list
  * in preperation for putting data blocks back together.
  * 
  * Parameters:
+ * 	session - the session to add candidates to.
  * 	buffer - the buffer holding block data.
  *  addr - the address the block was read from.
  *  blockNum - the block number being mapped.
  * ========================================================= */
 void mapBlocks(
+	scanSession* session,
 	const uint8_t* buffer, 
 	uint64_t addr,
-	uint32_t blockNum
+	uint64_t blockNum
 ) {
-	uint32_t isMatch = isLikelyFirstBlock(buffer, addr);
-	if (isMatch) {
-		// direct block - m_size field contains flag for
-		// which header was found - either MBR or volume
-		// descriptor or both.
-		blockEntry first = {addr, blockNum, isMatch};
-		addItem(&firstBlocks, &first);
-
-	} else if (isIndirectBlock((uint32_t*)buffer, blockSize >> 2)) {
-		// skip mapping size, may be useful optimization later
-		// but recovery works without
-		uint32_t size = 1;
-		// map out how many data blocks the indirect block points to
-		// uint32_t size = mapSize(buffer);
-
-		blockEntry indirect = {addr, blockNum, size};
-		addItem(&indirectBlocks, &indirect);
-	}
+	const uint32_t* entries = (const uint32_t*)buffer;
+	uint32_t type = classifyBlock(session, buffer, addr);
+	if (type & CANDIDATE_FIRST) {
+		// direct block - flags record which header was 
+		// found - either MBR or volume descriptor or both.
+		addCandidate(&session->m_firstBlocks, blockNum, *entries, type);
+		if (session->m_records)
+			streamCandidate(session, addr, blockNum, *entries, type);
+
+	} else if (type & CANDIDATE_INDIRECT) {
+		// the first pointer is kept as the search key so
+		// recovery can match indirect blocks without rereading
+		// them from the device
+		addCandidate(
+			&session->m_indirectBlocks, blockNum, 
+			*entries, CANDIDATE_INDIRECT
+		);
+		if (session->m_records)
+			streamCandidate(
+				session, addr, blockNum, *entries, CANDIDATE_INDIRECT
+			);
+	} else if (session->m_records)
+		pollRecords(session->m_records);
 }
 
 /* ============================================================
- * Determines whether or not the given block is an indirect
- * file block based on heuristics; indirect blocks will store
- * many consecutive block numbers every 4 bytes, and any empty
- * space after will be zeroed.
+ * Runs the block classifiers over a single block.
  * 
  * Parameters:
- * 	block - a buffer containing the contents of the block to check
- *  size - the size of the block in 4-byte ints
+ * 	session - the session the block was read in.
+ * 	buffer - the buffer holding block data.
+ *  addr - the address the block was read from.
  * 
  * Returns:
- * 	returns a 1 if the block is likely an indirect block,
- *  or 0 if not.
+ * 	Returns the candidate flags of the block if it is likely
+ *  a first block or an indirect block, or 0 if neither.
  * ========================================================= */
-int32_t isIndirectBlock(const uint32_t* block, uint32_t size) {
-	uint32_t consecutiveNums = 0;
-	uint32_t blockAddress = *block;
-
-	if (blockAddress == 0 || blockAddress > totalBlocks)
-		return 0;
-
-	// go through the first ~5 or so addresses
-	for (uint32_t i = 1; i < 6; i++) {
-		const uint32_t* addr = block + i;
-
-		if (*addr > totalBlocks)
-			return 0;
+uint32_t classifyBlock(
+	const scanSession* session, 
+	const uint8_t* buffer, 
+	uint64_t addr
+) {
+	TRACE_BEGIN(span);
+	uint32_t type = isLikelyFirstBlock(session, buffer, addr);
 
-		// check for consecutive block address
-		else if (*addr == blockAddress + 1) {
-			blockAddress++;
-			consecutiveNums++;
-		}
+	const uint32_t* entries = (const uint32_t*)buffer;
+	if (!type && isIndirectBlock(session, entries, session->m_blockSize >> 2))
+		type = CANDIDATE_INDIRECT;
 
-		// if address is zero then the remainder of the block
-		// must also be zero (if indirect block is only partially filled)
-		else if (*addr == 0) 
-			return verifyTrailingZeroes(addr, block + size);
+	TRACE_END(span, "classifyBlock");
+	return type;
+}
 
-		// if a few consequtive addresses were already found
-		// then assume fragmentation in indirect block
-		else if (consecutiveNums >= 3)
-			return 1;
+/* ============================================================
+ * Writes a JSON record for a newly mapped candidate to the
+ * session's candidate stream.
+ * 
+ * Parameters:
+ * 	session - the session that found the candidate.
+ *  addr - the address the block was read from.
+ *  blockNum - the block number of the candidate.
+ *  key - the first pointer stored in the block.
+ *  flags - the type/confidence flags of the candidate.
+ * ========================================================= */
+void streamCandidate(
+	scanSession* session,
+	uint64_t addr,
+	uint64_t blockNum,
+	uint32_t key,
+	uint32_t flags
+) {
+	writeRecord(session->m_records,
+		"{\"type\":\"%s\",\"partition\":%lu,\"block\":%lu,\"address\":%lu,"
+		"\"key\":%u,\"flags\":{\"primary_desc\":%s,\"descriptor\":%s,"
+		"\"mbr\":%s}}",
+		(flags & CANDIDATE_INDIRECT) ? "indirect" : "first",
+		session->m_partitionAddr, blockNum, addr, key,
+		(flags & HAS_PRIMARY_DESC) ? "true" : "false",
+		(flags & HAS_DESCRIPTOR) ? "true" : "false",
+		(flags & HAS_MBR) ? "true" : "false"
+	);
+}
 
-		// otherwise zero the count and keep going
-		else consecutiveNums = 0;
-	}
-	return consecutiveNums > 3;
+/* ============================================================
+ * Writes a record marking the end of the session's scan with
+ * its candidate totals and flushes the stream so consumers see
+ * it straight away.
+ * 
+ * Parameters:
+ * 	session - the session that finished scanning.
+ * ========================================================= */
+void streamScanComplete(scanSession* session) {
+	if (!session->m_records)
+		return;
+
+	writeRecord(session->m_records,
+		"{\"type\":\"scan_complete\",\"partition\":%lu,"
+		"\"first\":%lu,\"indirect\":%lu}",
+		session->m_partitionAddr,
+		numCandidates(&session->m_firstBlocks),
+		numCandidates(&session->m_indirectBlocks)
+	);
+	flushRecords(session->m_records);
 }
 
 /* ============================================================
- * Returns whether the given address range is completely zeroed
- * or if other non-zero bytes are found.
+ * Determines whether or not the given block is an indirect
+ * file block, with the kernel compiled for the session's
+ * block size. Its pointers can only reach the first 2^32
+ * blocks of larger volumes.
  * 
  * Parameters:
- * 	start - The start address of the range.
- *  end - The end address of the range.
+ * 	session - the session the block was read in.
+ * 	block - a buffer containing the contents of the block to check
+ *  size - the size of the block in 4-byte ints
  * 
  * Returns:
- * 	returns a 1 if the range is zeroed, 0 if non-zeros found.
+ * 	returns a 1 if the block is likely an indirect block,
+ *  or 0 if not.
  * ========================================================= */
-int32_t verifyTrailingZeroes(
-	const uint32_t* start, 
-	const uint32_t* end
+int32_t isIndirectBlock(
+	const scanSession* session, 
+	const uint32_t* block, 
+	uint32_t size
 ) {
-	const uint32_t* current = start;
-	while (current < end) {
-		if (*(current++) != 0) {
-			return 0;
-		}
-	}
-	return 1;
+	uint64_t totalBlocks = session->m_totalBlocks;
+	return session->m_kernels->m_isIndirect(
+		block, size, (totalBlocks > UINT32_MAX) ? UINT32_MAX : totalBlocks
+	);
 }
 
 /* ============================================================
@@ -496,23 +1115,32 @@ int32_t verifyTrailingZeroes(
  * change for recovering other file types.
  * 
  * Parameters:
+ * 	session - the session the block was read in.
  * 	block - a buffer containing the data read in from the block
- * 	blockSize - the size of the buffer
  *  addr - the address the buffer was read from
  * 
  * Returns:
- * 	- returns a bitflag in the 1 position if one
- *    indicator is found
- * 
- * 	- returns a bitflag in the 2 position if a different
- *    indicator is found
- * 
- * - returns a 1 if the block is very likely to be a
- *   first block match 0 otherwise.
+ * 	- returns CANDIDATE_FIRST along with a HAS_* flag for each
+ *    indicator found if the block is very likely to be a
+ *    first block match, 0 otherwise.
  * ========================================================= */
-uint32_t isLikelyFirstBlock(const uint8_t* block, uint64_t addr) {
-	uint8_t buf[blockSize];
-	safeRead(deviceID, addr + 0x8000, buf, blockSize);
+uint32_t isLikelyFirstBlock(
+	const scanSession* session, 
+	const uint8_t* block, 
+	uint64_t addr
+) {
+	// a descriptor that could not be read is no evidence
+	if (isRangeBad(addr + DESCRIPTOR_OFFSET, session->m_blockSize))
+		return 0;
+
+	uint8_t read[session->m_blockSize];
+	const uint8_t* buf = session->m_descriptor;
+	if (!buf) {
+		safeRead(
+			session->m_deviceID, addr + DESCRIPTOR_OFFSET, read, session->m_blockSize
+		);
+		buf = read;
+	}
 
 	// look for an MBR
 	pMbr mbr = allocateMBR();
@@ -524,7 +1152,15 @@ uint32_t isLikelyFirstBlock(const uint8_t* block, uint64_t addr) {
 	uint32_t isDescriptor = hasISOSignature(buf);
 	uint32_t isPrimaryDesc = isDescriptor && (*buf == 0x01);
 
-	return isPrimaryDesc || (isDescriptor && hasMBR);
+	free(mbr);
+
+	if (!isPrimaryDesc && !(isDescriptor && hasMBR))
+		return 0;
+
+	return CANDIDATE_FIRST
+		| (isPrimaryDesc ? HAS_PRIMARY_DESC : 0)
+		| (isDescriptor ? HAS_DESCRIPTOR : 0)
+		| (hasMBR ? HAS_MBR : 0);
 }
 
 /* ============================================================
@@ -547,12 +1183,14 @@ uint32_t hasISOSignature(const uint8_t* block) {
  * provided indirect block.
  * 
  * Parameters:
+ * 	session - the session the block was read in.
  * 	block - a buffer containing data from the indirect block.
  * 
  * Returns:
  * 	- returns a 1 if the block has the signature, 0 otherwise.
  * ========================================================= */
-uint64_t mapSize(const uint8_t* block) {
+uint64_t mapSize(const scanSession* session, const uint8_t* block) {
+	uint32_t blockSize = session->m_blockSize;
 	uint32_t sizeInInts = blockSize >> 2;
 	uint32_t* current = (uint32_t*)block;
 	uint32_t* end = (uint32_t*)block + sizeInInts;
@@ -561,18 +1199,18 @@ uint64_t mapSize(const uint8_t* block) {
 	// buffer to read block pointed to and address of first entry
 	// in this indirect block
 	uint8_t buffer [blockSize];
-	uint64_t nextAddr = partition_addr + ((*current) * blockSize);
+	uint64_t nextAddr = blockAddr(session, *current);
 
 	// go through each block address in the indirect block
 	// and read/map that block
 	while (current < end && *current++) {
-		safeRead(deviceID, nextAddr, buffer, blockSize);
+		safeRead(session->m_deviceID, nextAddr, buffer, blockSize);
 
 		// if another indirect is found 
 		// (meaning this one is a double/triple)
 		// then map that block's size and add to this size
-		if (isIndirectBlock((uint32_t*)buffer, blockSize >> 2))
-			mappedSize += mapSize(buffer);
+		if (isIndirectBlock(session, (uint32_t*)buffer, blockSize >> 2))
+			mappedSize += mapSize(session, buffer);
 		else
 			mappedSize += blockSize;
 
@@ -0,0 +1,463 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rescan.h"
+#include "candidates.h"
+#include "fanOut.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+
+uint32_t findChangedGroups(scanSession*, const char*, uint32_t, uint8_t*, candidateList*, candidateList*);
+void hashBitmaps(scanSession*);
+void hashContents(void*, const uint8_t*, uint64_t, uint64_t);
+void scanHashing(scanSession*, process);
+uint64_t hashWords(uint64_t, const uint8_t*, uint32_t);
+void mergeCandidates(scanSession*, candidateList*, const candidateList*, const uint8_t*);
+uint32_t loadScanState(const char*, scanStateHeader*, groupPrint**, candidateList*, candidateList*);
+void saveScanState(const char*, scanSession*, uint32_t);
+void readCandidates(FILE*, candidateList*, uint64_t, uint32_t);
+void writeCandidates(FILE*, const candidateList*, uint32_t);
+uint32_t blockNumBytes(uint64_t);
+
+/* ============================================================
+ * Scans a partition using the results saved by an earlier scan
+ * of it. Every block group is fingerprinted by a hash of its
+ * block bitmap, and optionally a hash of the blocks the scan
+ * reads in it. Only groups whose fingerprint differs from the
+ * saved one are scanned again, the saved candidates of every
+ * other group are carried over. The merged results are saved
+ * back to the same file before recovery.
+ *
+ * Parameters:
+ * 	device - the file descriptor of the device to read from.
+ *  index - the index of the partition in the partition table.
+ *  scanType - flag indicating which type of blocks to map.
+ *  statePath - the file holding the saved scan results.
+ *  hashContent - whether to fingerprint block contents too.
+ * ========================================================= */
+void rescanFiles(
+	int32_t device,
+	int32_t index,
+	uint32_t scanType,
+	const char* statePath,
+	uint32_t hashContent
+) {
+	scanSession session;
+	initSession(&session, device);
+	initCandidates(&session.m_firstBlocks, 1024);
+	initCandidates(&session.m_indirectBlocks, 16384);
+	session.m_records = getCandidateStream();
+
+	uint64_t addr = parsePartitionAddr(&session, index);
+	if (!addr || !loadSuperblock(&session, addr)) {
+		releaseMatches(&session);
+		freeSession(&session);
+		return;
+	}
+	session.m_scanType = scanType;
+
+	uint32_t numGroups = numBlockGroups(&session);
+	uint8_t* changed = malloc(numGroups);
+	session.m_prints = malloc(numGroups * sizeof(groupPrint));
+	if (!changed || !session.m_prints)
+		exit_err("Failed to allocate block group fingerprints");
+
+	candidateList oldFirst;
+	candidateList oldIndirect;
+	initCandidates(&oldFirst, 1024);
+	initCandidates(&oldIndirect, 16384);
+
+	uint32_t numChanged = findChangedGroups(
+		&session, statePath, hashContent, changed, &oldFirst, &oldIndirect
+	);
+	printf("\nRescanning %d of %d block groups.\n", numChanged, numGroups);
+
+	// scan only the changed groups, hashing their contents
+	// again on the way if content fingerprints are kept
+	session.m_groupMask = changed;
+	if (hashContent)
+		scanHashing(&session, mapBlocks);
+	else
+		scanPartitionAt(&session, addr, mapBlocks, scanType);
+	session.m_groupMask = NULL;
+
+	mergeCandidates(&session, &session.m_firstBlocks, &oldFirst, changed);
+	mergeCandidates(&session, &session.m_indirectBlocks, &oldIndirect, changed);
+	streamScanComplete(&session);
+	saveScanState(statePath, &session, hashContent);
+	recoverMatches(&session);
+
+	freeCandidates(&oldFirst);
+	freeCandidates(&oldIndirect);
+	free(session.m_prints);
+	free(changed);
+	releaseMatches(&session);
+	freeSession(&session);
+}
+
+/* ============================================================
+ * Fingerprints every block group of the partition and marks
+ * which differ from the saved scan results, loading the saved
+ * candidates. If there are no usable saved results every group
+ * is marked as changed.
+ *
+ * Parameters:
+ * 	session - the session with the partition loaded.
+ *  statePath - the file holding the saved scan results.
+ *  hashContent - whether to fingerprint block contents too.
+ *  changed - output flag per block group, 1 if changed.
+ *  oldFirst - output list for the saved first block candidates.
+ *  oldIndirect - output list for the saved indirect candidates.
+ *
+ * Returns:
+ * 	Returns the number of changed block groups.
+ * ========================================================= */
+uint32_t findChangedGroups(
+	scanSession* session,
+	const char* statePath,
+	uint32_t hashContent,
+	uint8_t* changed,
+	candidateList* oldFirst,
+	candidateList* oldIndirect
+) {
+	uint32_t numGroups = numBlockGroups(session);
+	memset(changed, 1, numGroups);
+	hashBitmaps(session);
+
+	scanStateHeader header;
+	groupPrint* saved = NULL;
+	uint32_t isUsable = loadScanState(statePath, &header, &saved, oldFirst, oldIndirect)
+		&& header.m_partitionAddr == session->m_partitionAddr
+		&& header.m_blockSize == session->m_blockSize
+		&& header.m_totalBlocks == session->m_totalBlocks
+		&& header.m_scanType == session->m_scanType
+		&& header.m_hashContent == hashContent;
+
+	if (!isUsable) {
+		printf("No saved scan of this partition in %s.\n", statePath);
+		clearCandidates(oldFirst);
+		clearCandidates(oldIndirect);
+		free(saved);
+		return numGroups;
+	}
+
+	for (uint32_t g = 0; g < numGroups; g++)
+		changed[g] = session->m_prints[g].m_bitmapHash != saved[g].m_bitmapHash;
+
+	// groups with the same bitmap are read once to check their
+	// contents, which can change while blocks are briefly in use
+	if (hashContent) {
+		uint8_t* unchanged = malloc(numGroups);
+		if (!unchanged)
+			exit_err("Failed to allocate block group mask");
+		for (uint32_t g = 0; g < numGroups; g++)
+			unchanged[g] = !changed[g];
+
+		printf("\nChecking contents of unchanged block groups.\n");
+		session->m_groupMask = unchanged;
+		scanHashing(session, NULL);
+		session->m_groupMask = NULL;
+		free(unchanged);
+
+		for (uint32_t g = 0; g < numGroups; g++) {
+			groupPrint* print = &session->m_prints[g];
+			if (print->m_contentHash != saved[g].m_contentHash)
+				changed[g] = 1;
+
+			// changed groups are hashed again when rescanned
+			if (changed[g])
+				print->m_contentHash = FNV_OFFSET;
+		}
+	}
+
+	uint32_t numChanged = 0;
+	for (uint32_t g = 0; g < numGroups; g++)
+		numChanged += changed[g];
+
+	free(saved);
+	return numChanged;
+}
+
+/* ============================================================
+ * Sets the bitmap hash of every block group in the session's
+ * fingerprints and resets their content hashes.
+ *
+ * Parameters:
+ * 	session - the session with the partition loaded.
+ * ========================================================= */
+void hashBitmaps(scanSession* session) {
+	uint32_t numGroups = numBlockGroups(session);
+	for (uint32_t g = 0; g < numGroups; g++) {
+		const uint8_t* bitmap = groupBitmap(session, g);
+		session->m_prints[g].m_bitmapHash = hashWords(
+			FNV_OFFSET, bitmap, session->m_blockSize
+		);
+		session->m_prints[g].m_contentHash = FNV_OFFSET;
+	}
+}
+
+/* ============================================================
+ * Scans the session's partition with content hashing as a
+ * consumer on a thread of its own, alongside the given process
+ * function, so hashing adds no time to the scan's thread.
+ *
+ * Parameters:
+ * 	session - the session with the partition loaded.
+ *  process - the operation to perform on each block, or NULL
+ *            to only hash the blocks.
+ * ========================================================= */
+void scanHashing(scanSession* session, process process) {
+	fanOut* consumers;
+	initFanOut(&consumers);
+	addConsumer(consumers, hashContents, session, CONSUME_THREADED);
+
+	session->m_fanOut = consumers;
+	scanPartitionAt(session, session->m_partitionAddr, process, session->m_scanType);
+	session->m_fanOut = NULL;
+	freeFanOut(&consumers);
+}
+
+/* ============================================================
+ * Adds a scanned block to the content hash of its group. Only
+ * reads the session's layout, which is fixed during the scan,
+ * and writes the group's fingerprint, so it can run alongside
+ * the scan.
+ *
+ * Parameters:
+ * 	state - the session being scanned.
+ * 	buffer - the buffer holding block data.
+ *  addr - the address the block was read from.
+ *  blockNum - the block number being hashed.
+ * ========================================================= */
+void hashContents(
+	void* state,
+	const uint8_t* buffer,
+	uint64_t addr,
+	uint64_t blockNum
+) {
+	scanSession* session = state;
+	groupPrint* print = &session->m_prints[blockGroupOf(session, blockNum)];
+	print->m_contentHash = hashWords(
+		print->m_contentHash, buffer, session->m_blockSize
+	);
+}
+
+/* ============================================================
+ * Folds a buffer into a running FNV-1a style hash, eight bytes
+ * at a time.
+ *
+ * Parameters:
+ * 	hash - the hash so far.
+ *  data - the buffer to add, a multiple of 8 bytes long.
+ *  size - the size of the buffer in bytes.
+ *
+ * Returns:
+ * 	Returns the updated hash.
+ * ========================================================= */
+uint64_t hashWords(uint64_t hash, const uint8_t* data, uint32_t size) {
+	const uint64_t* words = (const uint64_t*)data;
+	for (uint32_t i = 0; i < size / sizeof(uint64_t); i++)
+		hash = (hash ^ words[i]) * FNV_PRIME;
+	return hash;
+}
+
+/* ============================================================
+ * Replaces the candidates found by rescanning the changed block
+ * groups with the union of those and the saved candidates of
+ * the unchanged groups. Both lists are in block order, so they
+ * are merged into a list in the same order a full scan gives.
+ * Saved candidates carried over are streamed now, those of the
+ * changed groups were streamed as the rescan found them.
+ *
+ * Parameters:
+ * 	session - the session with the partition loaded.
+ * 	fresh - the candidates from the changed groups, replaced
+ *          with the merged list.
+ *  old - the saved candidates.
+ *  changed - flag per block group, 1 if changed.
+ * ========================================================= */
+void mergeCandidates(
+	scanSession* session,
+	candidateList* fresh,
+	const candidateList* old,
+	const uint8_t* changed
+) {
+	candidateList merged;
+	uint64_t numFresh = numCandidates(fresh);
+	uint64_t numOld = numCandidates(old);
+	initCandidates(&merged, numFresh + numOld + 1);
+
+	uint64_t i = 0;
+	uint64_t j = 0;
+	while (i < numFresh || j < numOld) {
+		// saved candidates of changed groups are dropped
+		if (j < numOld && changed[blockGroupOf(session, candidateBlock(old, j))]) {
+			j++;
+			continue;
+		}
+
+		uint32_t takeOld = j < numOld && (i == numFresh
+			|| candidateBlock(old, j) < candidateBlock(fresh, i));
+		const candidateList* from = takeOld ? old : fresh;
+		uint64_t k = takeOld ? j++ : i++;
+		uint64_t blockNum = candidateBlock(from, k);
+		addCandidate(&merged, blockNum, candidateKey(from, k), candidateFlags(from, k));
+		if (takeOld && session->m_records)
+			streamCandidate(session, blockAddr(session, blockNum),
+				blockNum, candidateKey(from, k), candidateFlags(from, k));
+	}
+
+	freeCandidates(fresh);
+	*fresh = merged;
+}
+
+/* ============================================================
+ * Reads saved scan results.
+ *
+ * Parameters:
+ * 	path - the file holding the saved scan results.
+ *  header - output parameter for the file header.
+ *  prints - output parameter for the block group fingerprints,
+ *           to be freed by the caller.
+ *  first - list to add the saved first block candidates to.
+ *  indirect - list to add the saved indirect candidates to.
+ *
+ * Returns:
+ * 	Returns a 1 if the file was read, 0 if it does not exist
+ *  or is not a saved scan.
+ * ========================================================= */
+uint32_t loadScanState(
+	const char* path,
+	scanStateHeader* header,
+	groupPrint** prints,
+	candidateList* first,
+	candidateList* indirect
+) {
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return 0;
+
+	uint32_t isValid = fread(header, sizeof(scanStateHeader), 1, file) == 1
+		&& memcmp(header->m_magic, SCAN_STATE_MAGIC, 8) == 0;
+
+	if (isValid) {
+		*prints = malloc(header->m_numGroups * sizeof(groupPrint));
+		if (!(*prints))
+			exit_err("Failed to allocate block group fingerprints");
+
+		size_t count = header->m_numGroups;
+		if (fread(*prints, sizeof(groupPrint), count, file) != count)
+			exit_err("Saved scan results are truncated");
+		uint32_t blockBytes = blockNumBytes(header->m_totalBlocks);
+		readCandidates(file, first, header->m_numFirst, blockBytes);
+		readCandidates(file, indirect, header->m_numIndirect, blockBytes);
+	}
+
+	fclose(file);
+	return isValid;
+}
+
+/* ============================================================
+ * Writes the session's fingerprints and candidates to the
+ * given path. The file is replaced only once fully written.
+ *
+ * Parameters:
+ * 	path - the file to save the scan results to.
+ *  session - the session holding the scan results.
+ *  hashContent - whether content hashes were kept.
+ * ========================================================= */
+void saveScanState(const char* path, scanSession* session, uint32_t hashContent) {
+	char tempPath[strlen(path) + 5];
+	sprintf(tempPath, "%s.tmp", path);
+
+	FILE* file = fopen(tempPath, "wb");
+	if (!file)
+		exit_err("Failed to create saved scan results");
+
+	scanStateHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, SCAN_STATE_MAGIC, 8);
+	header.m_partitionAddr = session->m_partitionAddr;
+	header.m_blockSize = session->m_blockSize;
+	header.m_totalBlocks = session->m_totalBlocks;
+	header.m_scanType = session->m_scanType;
+	header.m_hashContent = hashContent;
+	header.m_numGroups = numBlockGroups(session);
+	header.m_numFirst = numCandidates(&session->m_firstBlocks);
+	header.m_numIndirect = numCandidates(&session->m_indirectBlocks);
+
+	size_t count = header.m_numGroups;
+	if (fwrite(&header, sizeof(header), 1, file) != 1
+		|| fwrite(session->m_prints, sizeof(groupPrint), count, file) != count)
+		exit_err("Failed to write saved scan results");
+	uint32_t blockBytes = blockNumBytes(session->m_totalBlocks);
+	writeCandidates(file, &session->m_firstBlocks, blockBytes);
+	writeCandidates(file, &session->m_indirectBlocks, blockBytes);
+
+	if (fclose(file) != 0 || rename(tempPath, path) != 0)
+		exit_err("Failed to write saved scan results");
+	printf("Saved scan results to %s.\n", path);
+}
+
+/* ============================================================
+ * Reads candidates saved by writeCandidates into a list.
+ *
+ * Parameters:
+ * 	file - the saved scan results positioned at the list.
+ *  list - the list to add the candidates to.
+ *  count - the number of candidates saved.
+ *  blockBytes - the size of each saved block number.
+ * ========================================================= */
+void readCandidates(
+	FILE* file, 
+	candidateList* list, 
+	uint64_t count, 
+	uint32_t blockBytes
+) {
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t blockNum = 0;
+		uint32_t key;
+		uint8_t flags;
+		uint32_t isRead = fread(&blockNum, blockBytes, 1, file)
+			&& fread(&key, sizeof(key), 1, file)
+			&& fread(&flags, sizeof(flags), 1, file);
+		if (!isRead)
+			exit_err("Saved scan results are truncated");
+		addCandidate(list, blockNum, key, flags);
+	}
+}
+
+/* ============================================================
+ * Writes every candidate in the list as its block number, key
+ * and flags.
+ *
+ * Parameters:
+ * 	file - the file to write to.
+ *  list - the list to write.
+ *  blockBytes - the size to write each block number in.
+ * ========================================================= */
+void writeCandidates(FILE* file, const candidateList* list, uint32_t blockBytes) {
+	uint64_t count = numCandidates(list);
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t blockNum = candidateBlock(list, i);
+		uint32_t key = candidateKey(list, i);
+		uint8_t flags = candidateFlags(list, i);
+		uint32_t isWritten = fwrite(&blockNum, blockBytes, 1, file)
+			&& fwrite(&key, sizeof(key), 1, file)
+			&& fwrite(&flags, sizeof(flags), 1, file);
+		if (!isWritten)
+			exit_err("Failed to write saved scan results");
+	}
+}
+
+/* ============================================================
+ * Returns the size block numbers are saved in, 4 bytes unless
+ * the partition has more than 2^32 blocks.
+ * ========================================================= */
+uint32_t blockNumBytes(uint64_t totalBlocks) {
+	return (totalBlocks > UINT32_MAX) ? sizeof(uint64_t) : sizeof(uint32_t);
+}
@@ -3,9 +3,26 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "safeio.h"
+#include "faultMap.h"
+#include "trace.h"
+
+#define LABELED_PROGRESS_STEP 10
+
+// set per thread when several scans share the terminal
+__thread const char* progressLabel = NULL;
+
+// local copy of the device every read goes through, if set
+evidenceCache* readCache = NULL;
+
+// segments of a split image read in place of the device, if set
+segmentSet* deviceSegments = NULL;
 
 /* ============================================================
  * Prints a custom error message based on errno and
@@ -42,7 +59,8 @@ int32_t safeOpen(const char* device, int32_t flags, int32_t mode) {
 /* ============================================================
  * Reads a block from the device starting from the given
  * address offset into a character array. Exits the program if
- * there is an error.
+ * there is an error, other than a media error, which leaves
+ * the unreadable part of the block zeroed.
  * 
  * Arguments:
  * 	device_id - the file descriptor to read from
@@ -56,14 +74,148 @@ void safeRead(
 	uint8_t* buffer,
 	uint32_t size
 ) {
-	safeSeek(device_id, addr, SEEK_SET);
-	if (read(device_id, buffer, size) < 0)
+	TRACE_BEGIN(span);
+	readDevice(device_id, buffer, size, addr);
+	TRACE_END(span, "safeRead");
+}
+
+/* ============================================================
+ * Reads from the device at the given address like pread,
+ * leaving its file offset alone. Exits the program if there
+ * is an error.
+ * 
+ * Arguments:
+ * 	device_id - the file descriptor to read from
+ * 	buffer - the character buffer to read data into
+ *  size - the number of bytes to read from the device
+ *  addr - the address offset to read from
+ * 
+ * Returns:
+ * 	Returns the number of bytes read, short at the end of
+ *  the device.
+ * ========================================================= */
+int64_t readDevice(int32_t device_id, uint8_t* buffer, uint64_t size, uint64_t addr) {
+	if (readCache)
+		return readThrough(readCache, device_id, buffer, size, addr);
+	return readUncached(device_id, buffer, size, addr);
+}
+
+/* ============================================================
+ * Reads from the device like readDevice but never from the
+ * read cache, from the segments of a split image if set.
+ * Ranges in the bad range map read as zeroes without touching
+ * the device, and a media error adds the range it was hit in
+ * to the map and carries on past it.
+ * 
+ * Returns:
+ * 	Returns the number of bytes read, short at the end of
+ *  the device.
+ * ========================================================= */
+int64_t readUncached(int32_t device_id, uint8_t* buffer, uint64_t size, uint64_t addr) {
+	uint64_t done = 0;
+	uint64_t boundary;
+
+	while (done < size) {
+		uint64_t at = addr + done;
+		uint64_t length = size - done;
+
+		if (findFault(at, &boundary)) {
+			if (boundary - at < length)
+				length = boundary - at;
+			memset(buffer + done, 0, length);
+			done += length;
+			continue;
+		}
+
+		// stop short of the next bad range
+		if (boundary - at < length)
+			length = boundary - at;
+
+		// nothing past the end of the device is marked bad, so
+		// a failure there ends the read like a short one
+		int64_t got = readRaw(device_id, buffer + done, length, at);
+		if (got < 0) {
+			uint64_t limit = deviceSize(device_id);
+			if (at >= limit)
+				break;
+			recordFault(at, limit);
+			continue;
+		}
+		if (got == 0)
+			break;
+		clearFaultStride();
+		done += got;
+	}
+	return done;
+}
+
+/* ============================================================
+ * Reads from the device or the segments of a split image
+ * without the bad range map, used to read bad ranges again.
+ * Exits the program if there is an error other than a media
+ * error.
+ * 
+ * Returns:
+ * 	Returns the number of bytes read, short at the end of the
+ *  device or before a media error, or -1 if a media error
+ *  stops the read before anything is read.
+ * ========================================================= */
+int64_t readRaw(int32_t device_id, uint8_t* buffer, uint64_t size, uint64_t addr) {
+	if (deviceSegments)
+		return readSegments(deviceSegments, buffer, size, addr);
+
+	ssize_t length = pread(device_id, buffer, size, addr);
+	if (length < 0 && errno == EIO)
+		return -1;
+	if (length < 0)
 		exit_err("Failed to read device");
+	return length;
+}
+
+/* ============================================================
+ * Sets the cache every read of the device goes through from
+ * now on.
+ * 
+ * Parameters:
+ * 	cache - the cache of the device, or NULL to read directly.
+ * ========================================================= */
+void setReadCache(evidenceCache* cache) {
+	readCache = cache;
+}
+
+/* ============================================================
+ * Sets the segments every read of the device is served from
+ * from now on, whichever handle to the device is read.
+ * 
+ * Parameters:
+ * 	set - the segments of a split image, or NULL to read the
+ *        device directly.
+ * ========================================================= */
+void setSegmentSet(segmentSet* set) {
+	deviceSegments = set;
+}
+
+/* ============================================================
+ * Returns the size of the device in bytes, the total size of
+ * the segments if it is a split image.
+ * 
+ * Parameters:
+ * 	device_id - the file descriptor of the device.
+ * ========================================================= */
+uint64_t deviceSize(int32_t device_id) {
+	if (deviceSegments)
+		return segmentSetSize(deviceSegments);
+
+	off_t size = lseek(device_id, 0, SEEK_END);
+	if (size < 0)
+		exit_err("Failed to find device size");
+	return size;
 }
 
 /* ============================================================
  * Writes the given buffer to the specified file, checking for
- * write errors.
+ * write errors. Short writes, as to a pipe, are continued until
+ * the whole buffer is written.
  * 
  * Arguments:
  * 	file - the file descriptor to write to
@@ -71,8 +223,13 @@ void safeRead(
  *  size - the number of bytes to write
  * ========================================================= */
 void safeWrite(int32_t file, uint8_t* buffer, uint32_t size) {
-	if (write(file, buffer, size) < 0)
-		exit_err("Failed to write recovered file.");
+	uint32_t written = 0;
+	while (written < size) {
+		ssize_t result = write(file, buffer + written, size - written);
+		if (result < 0)
+			exit_err("Failed to write recovered file.");
+		written += result;
+	}
 }
 
 /* ============================================================
@@ -124,14 +281,128 @@ void readUserInput(char** line) {
  * ========================================================= */
 void printProgress(
 	uint32_t* current, 
-	uint32_t index, 
-	uint32_t total
+	uint64_t index, 
+	uint64_t total
 ) { 
 	uint32_t percent = ((double)index / (double)total) * 100;
-	if (percent > *current) {
+
+	// labeled progress is printed on its own line in larger
+	// steps so output from concurrent scans stays readable
+	if (progressLabel && percent > *current) {
+		if (percent % LABELED_PROGRESS_STEP != 0 && percent != 100)
+			return;
+		*current = percent;
+		printf("%s: Percent done: %d%%\n", progressLabel, *current);
+		if (fflush(stdout) != 0)
+			exit_err("Failed to flush stdout");
+	} else if (percent > *current) {
 		*current = percent;
 		printf("\rPercent done: %d%%", *current);
 		if (fflush(stdout) != 0)
 			exit_err("Failed to flush stdout");
 	}
-}
\ No newline at end of file
+}
+
+/* ============================================================
+ * Sets a label to print with progress updates from the calling
+ * thread, used to tell apart scans running concurrently.
+ * 
+ * Parameters:
+ * 	label - the label to print, or NULL for none.
+ * ========================================================= */
+void setProgressLabel(const char* label) {
+	progressLabel = label;
+}
+/* ============================================================
+ * Returns whether the file descriptor refers to a regular file,
+ * such as a raw image, rather than a device.
+ * 
+ * Parameters:
+ * 	fd - the file descriptor to check.
+ * ========================================================= */
+uint32_t isRegularFile(int32_t fd) {
+	struct stat info;
+	if (fstat(fd, &info) < 0)
+		exit_err("Failed to stat input");
+	return S_ISREG(info.st_mode);
+}
+
+/* ============================================================
+ * Finds the next region of a sparse file that holds data, so
+ * holes before it can be skipped without reading them.
+ * 
+ * Parameters:
+ * 	fd - the file descriptor of a regular file.
+ *  addr - the offset to search from.
+ *  dataEnd - output parameter for the end of the data region.
+ * 
+ * Returns:
+ * 	Returns the offset of the first data at or after addr, or
+ *  NO_DATA if the rest of the file is a hole.
+ * ========================================================= */
+uint64_t findData(int32_t fd, uint64_t addr, uint64_t* dataEnd) {
+	if (deviceSegments)
+		return findSegmentData(deviceSegments, addr, dataEnd);
+
+	off_t data = lseek(fd, addr, SEEK_DATA);
+	if (data < 0) {
+		if (errno == ENXIO)
+			return NO_DATA;
+		exit_err("Failed to find data in image");
+	}
+
+	off_t hole = lseek(fd, data, SEEK_HOLE);
+	if (hole < 0)
+		exit_err("Failed to find hole in image");
+	*dataEnd = hole;
+	return data;
+}
+
+/* ============================================================
+ * Prepares a regular output file to have the given number of
+ * bytes written from its current offset with holes left for
+ * zeroes. Anything past the offset is dropped and the space
+ * for the rest is allocated up front where the file system
+ * supports it, so writes do not grow the file a block at a
+ * time.
+ * 
+ * Parameters:
+ * 	file - the file descriptor of the output.
+ *  size - the number of bytes that will be written.
+ * 
+ * Returns:
+ * 	Returns a 1 if zeroes can be skipped over instead of being
+ *  written, 0 if the output is not a regular file.
+ * ========================================================= */
+uint32_t preallocateOutput(int32_t file, uint64_t size) {
+	off_t start = lseek(file, 0, SEEK_CUR);
+	if (!isRegularFile(file) || start < 0)
+		return 0;
+
+	if (ftruncate(file, start) < 0)
+		exit_err("Failed to truncate recovered file.");
+	if (fallocate(file, 0, start, size) < 0) {
+		if (errno != EOPNOTSUPP)
+			exit_err("Failed to allocate recovered file.");
+		if (ftruncate(file, start + size) < 0)
+			exit_err("Failed to extend recovered file.");
+	}
+	return 1;
+}
+
+/* ============================================================
+ * Releases the space allocated to a range of zeroes skipped
+ * in an output file, leaving a hole. File systems that cannot
+ * punch holes keep the range allocated, which still reads
+ * back as zeroes.
+ * 
+ * Parameters:
+ * 	file - the file descriptor of the output.
+ *  addr - the offset of the range.
+ *  length - the length of the range.
+ * ========================================================= */
+void punchHole(int32_t file, uint64_t addr, uint64_t length) {
+	int32_t mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	if (length && fallocate(file, mode, addr, length) < 0 && errno != EOPNOTSUPP)
+		exit_err("Failed to punch hole in recovered file.");
+}
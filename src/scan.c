@@ -1,43 +1,113 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "scan.h"
 #include "safeio.h"
+#include "faultMap.h"
+#include "fanOut.h"
 #include "mbr.h"
+#include "gpt.h"
+#include "iosched.h"
+#include "readahead.h"
 #include "superblock.h"
+#include "trace.h"
 
 #define INVALID_PARTITION "Invalid Partition: Partition %d does not exist.\n"
 #define INVALID_MBR "Invalid MBR: Exiting program.\n"
 #define INVALID_SUPERBLOCK "Invalid superblock: Exiting program.\n"
-#define GRP_DESC_SIZE 32
-
-uint32_t scanType = ALL_BLOCKS;
-pSBlock sb = NULL;
-uint8_t* bitmap = NULL;
-uint32_t allocatedCount = 0;
-
-// -1 forces datablock bitmap to be populated on first block
-uint32_t currentBlockGrp = -1;
-
-uint64_t parsePartitionAddr(int32_t);
-void processPartition(process);
-void processBlocks(uint32_t, process);
-void printProgress(uint32_t*, uint32_t, uint32_t);
-void getBitmap(uint32_t, uint32_t);
-uint32_t isBlockIncluded(uint32_t);
+#define MAX_GPT_PARTITIONS 128
+#define MAX_DESC_SIZE 1024
+#define DESC_READ_SIZE (1024 * 1024)
+#define BG_FLAGS_OFFSET 0x12
+
+void processPartition(scanSession*, process);
+void processBlocks(scanSession*, uint64_t, process);
+void processBlock(scanSession*, process, const uint8_t*, uint64_t, uint64_t);
+const uint8_t* readDescriptor(scanSession*, uint64_t, uint8_t*);
+void rescueBlocks(scanSession*, uint64_t, segmentedArray*, process);
+void getBitmap(scanSession*, uint32_t);
+uint32_t isBlockIncluded(scanSession*, uint64_t);
 uint32_t isPowerOf(uint32_t, uint32_t);
-uint32_t isAllocated(uint32_t, uint32_t);
-uint32_t getGrpDescTableSize(uint32_t);
-uint64_t getBitmapAddr(uint32_t);
+void loadGroupDescs(scanSession*);
+void checkBackupSuperblock(scanSession*, uint32_t);
+uint32_t hasBackupSuperblock(scanSession*, uint32_t);
+void readBitmapRun(scanSession*, uint32_t);
+
+/* ============================================================
+ * Initializes an empty scan session for the given device.
+ * 
+ * Parameters:
+ *  session - the session to initialize.
+ *  device - the file descriptor of the device to scan.
+ * ========================================================= */
+void initSession(scanSession* session, int32_t device) {
+	memset(session, 0, sizeof(scanSession));
+	session->m_deviceID = device;
+	session->m_scanType = ALL_BLOCKS;
+	session->m_kernels = selectKernels(0);
+
+	// -1 forces datablock bitmap to be populated on first block
+	session->m_currentBlockGrp = -1;
+}
+
+/* ============================================================
+ * Frees everything held by a scan session. The device itself
+ * is left open.
+ * 
+ * Parameters:
+ *  session - the session to free.
+ * ========================================================= */
+void freeSession(scanSession* session) {
+	free(session->m_sb);
+	free(session->m_groups);
+	free(session->m_bitmapRun);
+	freeBlockCache(&session->m_cache);
+	session->m_sb = NULL;
+	session->m_groups = NULL;
+	session->m_bitmapRun = NULL;
+	session->m_bitmap = NULL;
+}
+
+/* ============================================================
+ * Sets up a session reading the same partition as another on
+ * its own handle to the device, so it can read blocks from
+ * another thread. Only the layout of the partition is copied,
+ * not its bitmaps, candidates or cache.
+ *
+ * Parameters:
+ *  copy - the session to set up, the caller closes its device
+ *         before freeing it.
+ *  session - a session with its superblock loaded.
+ * ========================================================= */
+void cloneSession(scanSession* copy, const scanSession* session) {
+	// reopen the device so the copy's reads have their own
+	// file offset
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", session->m_deviceID);
+
+	initSession(copy, safeOpen(path, O_RDONLY, 0));
+	copy->m_partitionAddr = session->m_partitionAddr;
+	copy->m_blockSize = session->m_blockSize;
+	copy->m_kernels = session->m_kernels;
+	copy->m_totalBlocks = session->m_totalBlocks;
+	copy->m_firstDataBlock = session->m_firstDataBlock;
+	copy->m_descSize = session->m_descSize;
+	copy->m_scanType = session->m_scanType;
+}
 
 /* ============================================================
  * Gets the correct partition address and processes each block 
- * in the partition with the given function pointer.
+ * in the partition with the given function pointer. Every block
+ * is also given to the consumers of the session's fan-out, if
+ * it has one, so further analyses cost no more reads.
  * 
  * Parameters:
+ *  session - the session to scan with.
  *  index - the index of the partition in the partition table.
- *  process - pointer to the function called for each block read.
+ *  process - pointer to the function called for each block read,
+ *            or NULL if only the session's consumers are.
  *  whichBlocks - flag indicating which blocks should be scanned.
  * 
  * Returns:
@@ -45,37 +115,192 @@ uint64_t getBitmapAddr(uint32_t);
  *  partition exists, 0 otherwise.
  * ========================================================= */
 uint64_t scanPartitionAndProcess(
+	scanSession* session,
 	int32_t index,
 	process process,
 	uint32_t whichBlocks
 ) {
-	uint64_t addr = parsePartitionAddr(index);
-	if (addr > 0) {
-		partition_addr = addr;
-		scanType = whichBlocks;
-		processPartition(process);
-		return addr;
+	uint64_t addr = parsePartitionAddr(session, index);
+	if (addr > 0)
+		scanPartitionAt(session, addr, process, whichBlocks);
+	return addr;
+}
+
+/* ============================================================
+ * Processes each block in the partition starting at the given
+ * address with the given function pointer.
+ * 
+ * Parameters:
+ *  session - the session to scan with.
+ *  addr - the byte address of the partition on the device.
+ *  process - pointer to the function called for each block read,
+ *            or NULL if only the session's consumers are.
+ *  whichBlocks - flag indicating which blocks should be scanned.
+ * ========================================================= */
+void scanPartitionAt(
+	scanSession* session,
+	uint64_t addr, 
+	process process, 
+	uint32_t whichBlocks
+) {
+	session->m_partitionAddr = addr;
+	session->m_scanType = whichBlocks;
+	processPartition(session, process);
+}
+
+/* ============================================================
+ * Returns the device address of the given block number in
+ * the partition being scanned.
+ * 
+ * Parameters:
+ *  session - the session the block belongs to.
+ *	blockNum - the block number to get the address of.
+ * ========================================================= */
+uint64_t blockAddr(const scanSession* session, uint64_t blockNum) {
+	return session->m_partitionAddr + blockNum * session->m_blockSize;
+}
+
+/* ============================================================
+ * Reads a single block of the partition, going through the
+ * session's block cache if it has one.
+ * 
+ * Parameters:
+ *  session - the session the block belongs to.
+ *	blockNum - the block number to read.
+ *  buffer - the buffer to read the block into.
+ * ========================================================= */
+void readBlock(scanSession* session, uint64_t blockNum, uint8_t* buffer) {
+	uint32_t blockSize = session->m_blockSize;
+	if (session->m_cache) {
+		const uint8_t* cached = lookupBlock(session->m_cache, blockNum);
+		if (cached) {
+			memcpy(buffer, cached, blockSize);
+			return;
+		}
 	}
-	return 0;
+
+	safeRead(session->m_deviceID, blockAddr(session, blockNum), buffer, blockSize);
+	if (session->m_cache)
+		storeBlock(session->m_cache, blockNum, buffer);
+}
+
+/* ============================================================
+ * Returns whether the given block is allocated, loading the
+ * bitmap for its block group if it is not the current one.
+ * 
+ * Parameters:
+ *  session - a session that has scanned its partition.
+ *	blockNum - the block number to check.
+ * 
+ * Returns:
+ * 	Returns a 1 if allocated, 0 otherwise.
+ * ========================================================= */
+uint32_t isBlockAllocated(scanSession* session, uint64_t blockNum) {
+	groupBitmap(session, blockGroupOf(session, blockNum));
+	return isAllocated(session, blockNum, session->m_blockSize << 3) != 0;
+}
+
+/* ============================================================
+ * Returns the number of block groups in the loaded partition.
+ * 
+ * Parameters:
+ *  session - a session with its superblock loaded.
+ * ========================================================= */
+uint32_t numBlockGroups(const scanSession* session) {
+	uint64_t numBlocksInGrp = session->m_blockSize << 3;
+	uint64_t numDataBlocks = session->m_totalBlocks - session->m_firstDataBlock;
+	return (numDataBlocks + numBlocksInGrp - 1) / numBlocksInGrp;
+}
+
+/* ============================================================
+ * Returns the number of the block group the given block is in.
+ * Block groups start at the first data block, so the boot
+ * block of a file system with 1K blocks is counted in group 0.
+ * 
+ * Parameters:
+ *  session - a session with its superblock loaded.
+ *	blockNum - the block number.
+ * ========================================================= */
+uint32_t blockGroupOf(const scanSession* session, uint64_t blockNum) {
+	if (blockNum < session->m_firstDataBlock)
+		return 0;
+	return (blockNum - session->m_firstDataBlock) / (session->m_blockSize << 3);
+}
+
+/* ============================================================
+ * Returns the number of the first block in the given block
+ * group.
+ * 
+ * Parameters:
+ *  session - a session with its superblock loaded.
+ *	grpNum - the number of the block group.
+ * ========================================================= */
+uint64_t groupFirstBlock(const scanSession* session, uint32_t grpNum) {
+	return session->m_firstDataBlock 
+		+ (uint64_t)grpNum * (session->m_blockSize << 3);
+}
+
+/* ============================================================
+ * Returns the data block bitmap of the given block group,
+ * loading it if it is not the current one.
+ * 
+ * Parameters:
+ *  session - a session with its superblock loaded.
+ *	grpNum - the number of the block group.
+ * 
+ * Returns:
+ * 	Returns the session's bitmap buffer, valid until another
+ *  block group's bitmap is loaded.
+ * ========================================================= */
+const uint8_t* groupBitmap(scanSession* session, uint32_t grpNum) {
+	if (grpNum != session->m_currentBlockGrp) {
+		session->m_currentBlockGrp = grpNum;
+		getBitmap(session, grpNum);
+	}
+	return session->m_bitmap;
+}
+
+/* ============================================================
+ * Returns whether the given block group has never been written
+ * to, in which case it is known to be empty and neither its
+ * bitmap nor its blocks are read.
+ * 
+ * Parameters:
+ *  session - a session with its superblock loaded.
+ *	grpNum - the number of the block group.
+ * ========================================================= */
+uint32_t isGroupUninit(const scanSession* session, uint32_t grpNum) {
+	return session->m_groups && (session->m_groups[grpNum].m_flags & BLOCK_UNINIT);
 }
 
 /* ============================================================
  * Checks if the given partition is valid and has an entry in
- * the MBR, and returns the partition address.
+ * the MBR, and returns the partition address. If the MBR is a
+ * protective MBR the index is into the GUID partition table.
  * 
  * Parameters:
+ *  session - the session holding the device to read.
  * 	partitionIndex - the index of the partition table entry.
  * 
  * Returns:
  * 	Returns a 64-bit byte address for the requested partition.
  *  or 0 if the mbr or partition index is invalid.
  * ========================================================= */
-uint64_t parsePartitionAddr(int32_t partitionIndex) {
-	pMbr mbr = readMBR(deviceID);
+uint64_t parsePartitionAddr(scanSession* session, int32_t partitionIndex) {
+	pMbr mbr = readMBR(session->m_deviceID);
 	uint64_t addr = 0;
 
 	if (mbr->_mbr_signature == MBR_SIGNATURE) {
-		addr = getPartAddr(mbr, partitionIndex);
+		if (isProtectiveMBR(mbr)) {
+			uint64_t addrs[MAX_GPT_PARTITIONS];
+			uint32_t count = listGptPartitions(
+				session->m_deviceID, addrs, MAX_GPT_PARTITIONS
+			);
+			if (partitionIndex >= 0 && partitionIndex < count)
+				addr = addrs[partitionIndex];
+		} else 
+			addr = getPartAddr(mbr, partitionIndex);
+
 		if (addr == 0) 
 			fprintf(stderr, INVALID_PARTITION, partitionIndex + 1);
 	} else 
@@ -91,24 +316,86 @@ uint64_t parsePartitionAddr(int32_t partitionIndex) {
  * pointer 'process'.
  * 
  * Parameters:
+ *  session - the session to scan with.
  *  process - the operation to perform on each block.
  * ========================================================= */
 void processPartition(
+	scanSession* session,
 	process process
 ) {
-	sb = readSuperblock(deviceID, partition_addr + 1024);
+	if (loadSuperblock(session, session->m_partitionAddr))
+		processBlocks(session, session->m_totalBlocks, process);
+}
+
+/* ============================================================
+ * Reads the superblock of the partition at the given address
+ * into the session and sets up its block size and count, and
+ * reads the descriptors of its block groups.
+ * 
+ * Parameters:
+ *  session - the session to load the partition into.
+ *  addr - the byte address of the partition.
+ * 
+ * Returns:
+ * 	Returns a 1 if the superblock is valid, 0 otherwise.
+ * ========================================================= */
+uint32_t loadSuperblock(scanSession* session, uint64_t addr) {
+	session->m_partitionAddr = addr;
+	free(session->m_sb);
+	session->m_sb = readSuperblock(session->m_deviceID, addr + 1024);
+	pSBlock sb = session->m_sb;
 
 	// superblock stores block size as 1024 * 2^n
 	// where n is the value stored in the block size field
-	blockSize = 1024 << sb->_block_size;
-	uint32_t numBlocks = sb->_fs_size_blocks;
-	totalBlocks = numBlocks;
-
-	if (sb->_magic_sig == SUPERBLOCK_SIGNATURE) 
-		processBlocks(numBlocks, process);
-	else
-		fprintf(stderr, INVALID_SUPERBLOCK);
-	free(sb);
+	session->m_blockSize = 1024 << sb->_block_size;
+	session->m_totalBlocks = superblockBlocks(sb);
+	session->m_firstDataBlock = sb->_first_data_block;
+	session->m_descSize = superblockDescSize(sb);
+	session->m_groupsPerFlex = superblockGroupsPerFlex(sb);
+	session->m_kernels = selectKernels(session->m_blockSize);
+
+	// bitmaps read for another partition are stale
+	session->m_currentBlockGrp = -1;
+	session->m_runLength = 0;
+
+	// descriptors are a power of two no larger than 1K
+	uint32_t descSize = session->m_descSize;
+	if (
+		sb->_magic_sig == SUPERBLOCK_SIGNATURE &&
+		session->m_blockSize <= MAX_BLOCK_SIZE &&
+		descSize <= MAX_DESC_SIZE && (descSize & (descSize - 1)) == 0 &&
+		session->m_firstDataBlock < session->m_totalBlocks
+	) {
+		loadGroupDescs(session);
+		return 1;
+	}
+
+	fprintf(stderr, INVALID_SUPERBLOCK);
+	return 0;
+}
+
+/* ============================================================
+ * Loads the partition at the given address into the session and
+ * checks the superblock copy of every group that has been
+ * written to, so a scan of it will not stop on a bad one.
+ * 
+ * Parameters:
+ *  session - the session to load the partition into.
+ *  addr - the byte address of the partition.
+ * 
+ * Returns:
+ * 	Returns a 1 if the partition can be scanned, 0 otherwise.
+ * ========================================================= */
+uint32_t validatePartition(scanSession* session, uint64_t addr) {
+	if (!loadSuperblock(session, addr))
+		return 0;
+
+	uint32_t numGroups = numBlockGroups(session);
+	for (uint32_t grp = 0; grp < numGroups; grp++) {
+		if (!isGroupUninit(session, grp) && !hasBackupSuperblock(session, grp))
+			return 0;
+	}
+	return 1;
 }
 
 /* ============================================================
@@ -117,40 +404,243 @@ void processPartition(
  * 'process'.
  * 
  * Parameters:
+ *  session - the session to scan with.
  * 	numBlocks - the number of blocks in the partition.
  *  process - the operation to perform on each block.
  * ========================================================= */
-void processBlocks(uint32_t numBlocks,process process) {
-	printf("\nPartition Address: 0x%lx\n", partition_addr);
+void processBlocks(scanSession* session, uint64_t numBlocks, process process) {
+	uint32_t blockSize = session->m_blockSize;
+	printf("\nPartition Address: 0x%lx\n", session->m_partitionAddr);
 	printf("Block Size: 0x%x\n", blockSize);
 	printf("\n---Scanning blocks---\n");
 
-	uint8_t block[blockSize];
+	static const uint8_t zeroBlock[MAX_BLOCK_SIZE];
+	uint8_t block[MAX_BLOCK_SIZE] __attribute__((aligned(64)));
 	uint32_t current_progress = 0;
-	uint64_t nextAddr = partition_addr;
+	uint64_t nextAddr = session->m_partitionAddr;
+
+	// sparse images are read around their holes, tracked as
+	// the next data region at or after nextAddr
+	uint32_t isSparse = isRegularFile(session->m_deviceID);
+	uint64_t dataStart = 0;
+	uint64_t dataEnd = 0;
+	uint64_t holeBlocks = 0;
+	uint64_t uninitBlocks = 0;
+
+	// blocks hit by read errors, or whose descriptor is, are
+	// left for the final pass over the bad ranges; the descriptor
+	// the classifiers check is read before the block is processed
+	// so a block is never processed before its bad range is known
+	uint8_t descriptor[MAX_BLOCK_SIZE];
+	segmentedArray* deferred = NULL;
+
+	// read in larger chunks ahead of the scan if tuned to
+	ioTuning tuning;
+	getIOTuning(&tuning);
+	readAhead* reader = (tuning.m_readBytes > blockSize || tuning.m_readers > 1)
+		? openReadAhead(session->m_deviceID, &tuning,
+			nextAddr + (uint64_t)numBlocks * blockSize)
+		: NULL;
 
 	// go through all blocks in the partition,
 	// running each through the processing function
 	// passed in the arguments
-	for (uint32_t i = 0; i < numBlocks; i++) {
+	for (uint64_t i = 0; i < numBlocks; i++) {
 		printProgress(&current_progress, i, numBlocks);
 
+		// jump over whole block groups left out of the scan
+		// or never written to
+		uint32_t grpNum = blockGroupOf(session, i);
+		uint32_t isUninit = isGroupUninit(session, grpNum);
+		if (isUninit || (session->m_groupMask && !session->m_groupMask[grpNum])) {
+			uint64_t nextGrp = groupFirstBlock(session, grpNum + 1);
+			if (nextGrp > numBlocks)
+				nextGrp = numBlocks;
+			if (isUninit)
+				uninitBlocks += nextGrp - i;
+			nextAddr += (nextGrp - i) * blockSize;
+			i = nextGrp - 1;
+			continue;
+		}
+
+		// take turns with scans of other partitions on the
+		// same spindle so each reads a long sequential run
+		if (i % IO_SLOT_BLOCKS == 0) {
+			releaseIOSlot();
+			acquireIOSlot();
+		}
+
+		// find the next data region once past the current one
+		if (isSparse && nextAddr >= dataEnd) {
+			dataStart = findData(session->m_deviceID, nextAddr, &dataEnd);
+			if (dataStart == NO_DATA)
+				dataEnd = NO_DATA;
+		}
+
 		// skip block if allocated/unallocated/etc. based on
 		// scan type
-		if (isBlockIncluded(i)) {
-			safeRead(deviceID, nextAddr, block, blockSize);
-			process(block, nextAddr, i);
+		if (!isBlockIncluded(session, i)) {
+			nextAddr += blockSize;
+			continue;
 		}
+
+		// blocks wholly within a hole are zero without reading
+		// them, and those too far from data for a classifier to
+		// see anything but zeroes are only given to consumers
+		uint32_t isHole = isSparse && nextAddr + blockSize <= dataStart;
+		if (isHole) {
+			holeBlocks++;
+			if (nextAddr + blockSize + DESCRIPTOR_OFFSET <= dataStart) {
+				if (session->m_fanOut)
+					deliverBlock(session->m_fanOut, zeroBlock, blockSize, nextAddr, i);
+				nextAddr += blockSize;
+				continue;
+			}
+		} else if (reader)
+			readAheadBlock(reader, nextAddr, block, blockSize);
+		else
+			safeRead(session->m_deviceID, nextAddr, block, blockSize);
+
+		if (process)
+			session->m_descriptor = readDescriptor(session, nextAddr, descriptor);
+
+		uint64_t descAddr = nextAddr + DESCRIPTOR_OFFSET;
+		if (isRangeBad(nextAddr, blockSize) || isRangeBad(descAddr, blockSize)) {
+			if (!deferred)
+				initArray(&deferred, 1024, sizeof(uint64_t));
+			addItem(deferred, &i);
+		} else
+			processBlock(session, process, isHole ? zeroBlock : block, nextAddr, i);
+		session->m_descriptor = NULL;
 		nextAddr += blockSize;
 	}
 
+	closeReadAhead(reader);
+	if (deferred) {
+		rescueBlocks(session, numBlocks, deferred, process);
+		freeArray(&deferred);
+	}
+	drainFanOut(session->m_fanOut);
+	releaseIOSlot();
 	printProgress(&current_progress, numBlocks, numBlocks);
 	printf("\n---Finished scanning---\n\n");
 
 	// another sanity check -> allocated + free should = total blocks
-	printf("Scanned %d total blocks.\n", numBlocks);
-	printf("Allocated Count: %d\n", allocatedCount);
-	printf("Free Blocks: %d\n", sb->_free_blocks);
+	pSBlock sb = session->m_sb;
+	uint64_t freeBlocks = sb->_free_blocks;
+	if (sb->_incompat_features & FEATURE_INCOMPAT_64BIT)
+		freeBlocks |= (uint64_t)sb->_free_blocks_hi << 32;
+
+	printf("Scanned %lu total blocks.\n", numBlocks);
+	if (isSparse)
+		printf("Skipped reading %lu blocks in image holes.\n", holeBlocks);
+	if (uninitBlocks)
+		printf("Skipped %lu blocks in block groups never written to.\n", uninitBlocks);
+	printf("Allocated Count: %lu\n", session->m_allocatedCount);
+	printf("Free Blocks: %lu\n", freeBlocks);
+}
+
+/* ============================================================
+ * Gives a block read by the scan to the process function, if
+ * there is one, and to each consumer added to the session.
+ * 
+ * Parameters:
+ *  session - the session doing the scan.
+ *  process - the operation to perform on each block, or NULL.
+ *  block - the block read.
+ *  addr - the address the block was read from.
+ *  blockNum - the block number of the block.
+ * ========================================================= */
+void processBlock(
+	scanSession* session,
+	process process,
+	const uint8_t* block,
+	uint64_t addr,
+	uint64_t blockNum
+) {
+	if (process)
+		process(session, block, addr, blockNum);
+	if (session->m_fanOut)
+		deliverBlock(session->m_fanOut, block, session->m_blockSize, addr, blockNum);
+}
+
+/* ============================================================
+ * Reads the descriptor the classifiers check for the block at
+ * the given address, the only read made while processing it,
+ * so a media error in it is recorded before the block is
+ * processed. Past the end of the device it reads as zeroes.
+ * 
+ * Parameters:
+ *  session - the session doing the scan.
+ *  addr - the address of the block about to be processed.
+ *  descriptor - a buffer of the block size.
+ * 
+ * Returns:
+ * 	Returns the descriptor buffer.
+ * ========================================================= */
+const uint8_t* readDescriptor(scanSession* session, uint64_t addr, uint8_t* descriptor) {
+	uint32_t blockSize = session->m_blockSize;
+	int64_t length = readDevice(
+		session->m_deviceID, descriptor, blockSize, addr + DESCRIPTOR_OFFSET
+	);
+	if (length < blockSize)
+		memset(descriptor + length, 0, blockSize - length);
+	return descriptor;
+}
+
+/* ============================================================
+ * The final pass of a scan over the blocks it left behind at
+ * bad ranges. The ranges within the partition are read again
+ * one sector at a time and every block that can now be read
+ * whole is processed, after which the candidate lists are put
+ * back in block order.
+ * 
+ * Parameters:
+ *  session - the session doing the scan.
+ * 	numBlocks - the number of blocks in the partition.
+ *  deferred - the block numbers left behind, in order.
+ *  process - the operation to perform on each block.
+ * ========================================================= */
+void rescueBlocks(
+	scanSession* session,
+	uint64_t numBlocks,
+	segmentedArray* deferred,
+	process process
+) {
+	uint32_t blockSize = session->m_blockSize;
+	uint64_t start = session->m_partitionAddr;
+	uint64_t end = start + numBlocks * blockSize + DESCRIPTOR_OFFSET;
+	uint8_t block[MAX_BLOCK_SIZE] __attribute__((aligned(64)));
+	uint64_t unreadable = 0;
+
+	printf("\n");
+	retryFaults(session->m_deviceID, start, end);
+
+	candidateList* lists[] = { &session->m_firstBlocks, &session->m_indirectBlocks };
+	uint64_t tails[2];
+	for (uint32_t k = 0; k < 2; k++)
+		tails[k] = lists[k]->m_blockNums ? numCandidates(lists[k]) : 0;
+
+	for (uint64_t j = 0; j < deferred->m_numItems; j++) {
+		uint64_t i = *(uint64_t*)getItem(deferred, j);
+		uint64_t addr = start + i * blockSize;
+		if (isRangeBad(addr, blockSize)) {
+			unreadable++;
+			continue;
+		}
+		safeRead(session->m_deviceID, addr, block, blockSize);
+		processBlock(session, process, block, addr, i);
+	}
+
+	for (uint32_t k = 0; k < 2; k++)
+		if (lists[k]->m_blockNums)
+			mergeTail(lists[k], tails[k]);
+
+	printf("Read %lu of %lu blocks left at bad ranges",
+		deferred->m_numItems - unreadable, deferred->m_numItems);
+	if (unreadable)
+		printf(", %lu could not be read", unreadable);
+	printf(".\n");
 }
 
 /* ============================================================
@@ -159,66 +649,153 @@ void processBlocks(uint32_t numBlocks,process process) {
  * based on its allocation status and scan type.
  * 
  * Parameters:
+ *  session - the session doing the scan.
  * 	blockNum - the block number of the block being scanned.
  * ========================================================= */
-uint32_t isBlockIncluded(uint32_t blockNum) {
+uint32_t isBlockIncluded(scanSession* session, uint64_t blockNum) {
 	// calc block group number of current block being scanned
-	uint64_t numBlocksInGrp = (blockSize << 3);
-	uint64_t blockGrpNum = blockNum / numBlocksInGrp;
+	uint32_t numBlocksInGrp = (session->m_blockSize << 3);
+	uint32_t blockGrpNum = blockGroupOf(session, blockNum);
 
 	// only get a new bitmap if in a different block group
-	if (blockGrpNum != currentBlockGrp) {
-		currentBlockGrp = blockGrpNum;
-		getBitmap(currentBlockGrp, blockNum);
+	if (blockGrpNum != session->m_currentBlockGrp) {
+		session->m_currentBlockGrp = blockGrpNum;
+		getBitmap(session, session->m_currentBlockGrp);
 	}
 
-	uint32_t isAlloc =  isAllocated(blockNum, numBlocksInGrp);
+	uint32_t isAlloc =  isAllocated(session, blockNum, numBlocksInGrp);
 	if (isAlloc)
-		allocatedCount++;
+		session->m_allocatedCount++;
 
-	if (scanType == ALL_BLOCKS)
+	if (session->m_scanType == ALL_BLOCKS)
 		return 1;
 
-	return (scanType == ALLOCATED_ONLY) ? isAlloc : !isAlloc;
+	return (session->m_scanType == ALLOCATED_ONLY) ? isAlloc : !isAlloc;
 }
 
 /* ============================================================
  * Returns whether the given block number is allocated in the
- * block bitmap.
+ * block bitmap. Blocks before the first data block belong to
+ * no group and are always allocated.
  *
  * Parameters:
+ *  session - the session holding the current bitmap
  *  blockNum - the block number to check
- *  blockSize - the size of the bitmap
  *  numBlocksInGrp - the size of a block group (in blocks)
  * 
  * Returns:
  * 	Returns a 1 if allocated, 0 otherwise.
  * ========================================================= */
-uint32_t isAllocated(uint32_t blockNum, uint32_t numBlocksInGrp) {
-	uint32_t bitPos = blockNum % numBlocksInGrp;
-	uint32_t bytePos = bitPos >> 3;
-	uint8_t allocationByte = *(bitmap + bytePos);
-	return allocationByte & (1 << (bitPos % 8));
+uint32_t isAllocated(
+	scanSession* session, 
+	uint64_t blockNum, 
+	uint32_t numBlocksInGrp
+) {
+	if (blockNum < session->m_firstDataBlock)
+		return 1;
+
+	uint32_t bit = (blockNum - session->m_firstDataBlock) % numBlocksInGrp;
+	return session->m_kernels->m_isAllocated(
+		session->m_bitmap, bit, numBlocksInGrp
+	);
 }
 
 /* ============================================================
- * Finds and reads the datablock bitmap into the bitmap
- * buffer so processing can check for which blocks to scan/ignore.
+ * Points the session's bitmap at the datablock bitmap of the
+ * given group so processing can check for which blocks to 
+ * scan/ignore, reading it along with the bitmaps stored after
+ * it if it is not in the last run read. Groups never written
+ * to get a zeroed bitmap without reading anything.
  * 
  * Parameters:
+ *  session - the session doing the scan.
  * 	grpNum - the number of the blockgroup to get the bitmap for.
- *  blockNum - the block number of the block being scanned.
  * ========================================================= */
-void getBitmap(uint32_t grpNum, uint32_t blockNum) {
-	// allocate the bitmap buffer if not already done
-	if (!bitmap) {
-		bitmap = (uint8_t*) malloc(blockSize);
-		if (!bitmap)
+void getBitmap(scanSession* session, uint32_t grpNum) {
+	uint32_t blockSize = session->m_blockSize;
+
+	// allocate a bitmap per group of the longest run plus the
+	// zeroed one if not already done
+	if (!session->m_bitmapRun) {
+		session->m_bitmapRun = calloc(MAX_BITMAP_RUN + 1, blockSize);
+		if (!session->m_bitmapRun)
 			exit_err("Failed to allocate space for bitmap.");
 	}
-	
-	// sanity check that block addresses/superblock copies
-	// are correct
+
+	if (isGroupUninit(session, grpNum)) {
+		session->m_bitmap = session->m_bitmapRun + (uint64_t)MAX_BITMAP_RUN * blockSize;
+		return;
+	}
+
+	checkBackupSuperblock(session, grpNum);
+	uint32_t first = session->m_runFirstGrp;
+	if (grpNum < first || grpNum >= first + session->m_runLength)
+		readBitmapRun(session, grpNum);
+
+	first = session->m_runFirstGrp;
+	session->m_bitmap = session->m_bitmapRun + (uint64_t)(grpNum - first) * blockSize;
+}
+
+/* ============================================================
+ * Reads the bitmap of the given group in one read with those
+ * of the following groups of its flex group that are stored
+ * right after it and have been written to.
+ * 
+ * Parameters:
+ *  session - the session doing the scan.
+ * 	grpNum - the number of the first blockgroup of the run.
+ * ========================================================= */
+void readBitmapRun(scanSession* session, uint32_t grpNum) {
+	const groupDesc* groups = session->m_groups;
+	uint32_t numGroups = numBlockGroups(session);
+	uint32_t maxRun = (session->m_groupsPerFlex < MAX_BITMAP_RUN) 
+		? session->m_groupsPerFlex : MAX_BITMAP_RUN;
+	TRACE_BEGIN(span);
+
+	uint32_t length = 1;
+	while (
+		length < maxRun && 
+		grpNum + length < numGroups &&
+		!isGroupUninit(session, grpNum + length) &&
+		groups[grpNum + length].m_bitmapBlock == groups[grpNum].m_bitmapBlock + length
+	)
+		length++;
+
+	uint64_t bitmapAddr = blockAddr(session, groups[grpNum].m_bitmapBlock);
+	safeRead(session->m_deviceID, bitmapAddr, 
+		session->m_bitmapRun, length * session->m_blockSize);
+	session->m_runFirstGrp = grpNum;
+	session->m_runLength = length;
+	TRACE_END(span, "loadBitmap");
+}
+
+/* ============================================================
+ * Exits if a block group that should hold a copy of the
+ * superblock does not, as a sanity check that block addresses
+ * are correct.
+ * 
+ * Parameters:
+ *  session - the session doing the scan.
+ * 	grpNum - the number of the blockgroup.
+ * ========================================================= */
+void checkBackupSuperblock(scanSession* session, uint32_t grpNum) {
+	if (!hasBackupSuperblock(session, grpNum))
+		exit(EXIT_FAILURE);
+}
+
+/* ============================================================
+ * Returns whether a block group that should hold a copy of the
+ * superblock does, printing the address of the copy if not.
+ * 
+ * Parameters:
+ *  session - the session doing the scan.
+ * 	grpNum - the number of the blockgroup.
+ * 
+ * Returns:
+ * 	Returns a 1 if the group holds no copy or a valid one, 0
+ *  otherwise.
+ * ========================================================= */
+uint32_t hasBackupSuperblock(scanSession* session, uint32_t grpNum) {
 	if (
 		grpNum == 0 || 
 		grpNum == 1 || 
@@ -226,20 +803,20 @@ void getBitmap(uint32_t grpNum, uint32_t blockNum) {
 		isPowerOf(grpNum, 5) ||
 		isPowerOf(grpNum, 7)
 	) {
-		uint64_t sbAddr = partition_addr + 
-			((uint64_t)blockNum * (uint64_t)blockSize);
-		if (grpNum == 0)
-			sbAddr += 1024;
+		// the primary superblock is always 1K into the partition
+		uint64_t sbAddr = (grpNum == 0)
+			? session->m_partitionAddr + 1024
+			: blockAddr(session, groupFirstBlock(session, grpNum));
 			
-		pSBlock s = readSuperblock(deviceID, sbAddr);
-		if (s->_magic_sig != SUPERBLOCK_SIGNATURE) {
+		pSBlock s = readSuperblock(session->m_deviceID, sbAddr);
+		uint32_t valid = (s->_magic_sig == SUPERBLOCK_SIGNATURE);
+		free(s);
+		if (!valid) {
 			fprintf(stderr, "Invalid Superblock at 0x%lx\n", sbAddr);
-			exit(EXIT_FAILURE);
+			return 0;
 		}
 	}
-
-	uint64_t bitmapAddr = getBitmapAddr(grpNum);
-	safeRead(deviceID, bitmapAddr, bitmap, blockSize);
+	return 1;
 }
 
 /* ============================================================
@@ -264,30 +841,47 @@ uint32_t isPowerOf(uint32_t num, uint32_t base) {
 }
 
 /* ============================================================
- * Returns the address of the datablock bitmap for the 
- * specified block group.
+ * Reads the descriptor of every block group into the session.
+ * The group descriptor table starts in the block after the
+ * primary superblock and is read in large sequential chunks.
+ * Groups are only taken as never written to if the descriptors
+ * are checksummed.
  *
  * Parameters:
- * 	grpNum - the number of the blockgroup to get the bitmap for.
- * 
- * Returns:
- * 	Returns a 64-bit address for the bitmap.
+ *  session - a session with its superblock loaded.
  * ========================================================= */
-uint64_t getBitmapAddr(uint32_t grpNum) {
-	uint32_t numDescPerBlock = blockSize / GRP_DESC_SIZE;
-	uint64_t grpDescAddr = partition_addr + blockSize;
-	uint8_t descriptors[blockSize];
-
-	// if group descriptor table is more than 1 block
-	// be sure to read the correct block
-	if (numDescPerBlock > grpNum) 
-		grpDescAddr += (blockSize * (grpNum / numDescPerBlock));
-	safeRead(deviceID, grpDescAddr, descriptors, blockSize);
-	
-	uint32_t offset = grpNum * GRP_DESC_SIZE;
-
-	// the first 4 bytes of the group descriptor 
-	// is the bitmap block number
-	uint32_t bitmapBlockNum = *((uint32_t*)(descriptors + offset));
-	return partition_addr + ((uint64_t)bitmapBlockNum * (uint64_t)blockSize);
+void loadGroupDescs(scanSession* session) {
+	uint32_t numGroups = numBlockGroups(session);
+	uint32_t descSize = session->m_descSize;
+	uint32_t descPerRead = DESC_READ_SIZE / descSize;
+	uint32_t trustFlags = hasUninitGroups(session->m_sb);
+	uint64_t tableAddr = blockAddr(session, session->m_firstDataBlock + 1);
+
+	free(session->m_groups);
+	session->m_groups = malloc((uint64_t)numGroups * sizeof(groupDesc));
+	uint8_t* descriptors = malloc(DESC_READ_SIZE);
+	if (!session->m_groups || !descriptors)
+		exit_err("Failed to allocate group descriptors.");
+
+	for (uint32_t grp = 0; grp < numGroups; grp++) {
+		uint32_t index = grp % descPerRead;
+		if (index == 0) {
+			uint32_t count = (numGroups - grp < descPerRead) ? numGroups - grp : descPerRead;
+			safeRead(session->m_deviceID, tableAddr + (uint64_t)grp * descSize,
+				descriptors, count * descSize);
+		}
+
+		// the first 4 bytes of the group descriptor 
+		// is the bitmap block number, its high word
+		// follows the 32 byte layout
+		const uint8_t* desc = descriptors + index * descSize;
+		groupDesc* group = &session->m_groups[grp];
+		group->m_bitmapBlock = *(const uint32_t*)desc;
+		if (descSize >= 2 * GRP_DESC_SIZE)
+			group->m_bitmapBlock |= (uint64_t)*(const uint32_t*)(desc + GRP_DESC_SIZE) << 32;
+		group->m_flags = *(const uint16_t*)(desc + BG_FLAGS_OFFSET);
+		if (!trustFlags)
+			group->m_flags &= ~BLOCK_UNINIT;
+	}
+	free(descriptors);
 }
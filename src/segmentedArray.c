@@ -0,0 +1,360 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "segmentedArray.h"
+#include "safeio.h"
+
+#define FAILED_ALLOC "Failed to allocate memory.\n"
+#define FAILED_SPILL "Failed to map spill file.\n"
+#define SPILL_TEMPLATE "/scan_spill_XXXXXX"
+
+// memory budget shared by all arrays, 0 keeps everything in RAM
+uint64_t memoryBudget = 0;
+uint64_t memoryUsed = 0;
+char spillPath[4096] = "/tmp";
+
+// a range of the spill file that backs no segment
+typedef struct {
+	uint64_t m_offset;
+	uint64_t m_bytes;
+} spillExtent;
+
+// temporary file that backs segments allocated past the budget,
+// with its freed ranges sorted by offset so they can be reused
+int32_t spillFile = -1;
+uint64_t spillSize = 0;
+spillExtent* freeExtents = NULL;
+uint32_t numFreeExtents = 0;
+uint32_t freeExtentCapacity = 0;
+
+// guards the budget and spill file shared by arrays in all threads
+pthread_mutex_t budgetLock = PTHREAD_MUTEX_INITIALIZER;
+
+int32_t createSpillFile();
+void addSegment(segmentedArray*);
+uint8_t* mapSpillSegment(uint64_t, uint64_t*);
+uint64_t takeSpillExtent(uint64_t);
+void releaseSpillExtent(uint64_t, uint64_t);
+uint64_t segmentBytes(const segmentedArray*, uint32_t);
+
+/* ============================================================
+ * Sets the memory budget for all segmented arrays. Segments
+ * that would take the total allocated memory over the budget
+ * are instead backed by a growable memory-mapped temporary 
+ * file in the given directory so the kernel can write them 
+ * back under memory pressure.
+ * 
+ * Parameters:
+ * 	budget - the budget in bytes, or 0 for no limit.
+ *  spillDir - the directory to create the spill file in.
+ * ========================================================= */
+void setArrayBudget(uint64_t budget, const char* spillDir) {
+	memoryBudget = budget;
+	if (spillDir)
+		snprintf(spillPath, sizeof(spillPath), "%s", spillDir);
+}
+
+/* ============================================================
+ * Returns the configured memory budget in bytes (0 if none).
+ * ========================================================= */
+uint64_t getArrayBudget() {
+	return memoryBudget;
+}
+
+/* ============================================================
+ * Creates an anonymous temporary file in the spill directory.
+ * The file is unlinked immediately so it is removed when
+ * closed or when the program exits.
+ * 
+ * Returns:
+ * 	Returns the descriptor of the new temporary file.
+ * ========================================================= */
+int32_t createSpillFile() {
+	char name[sizeof(spillPath) + sizeof(SPILL_TEMPLATE)];
+	snprintf(name, sizeof(name), "%s%s", spillPath, SPILL_TEMPLATE);
+
+	int32_t file = mkstemp(name);
+	if (file < 0)
+		exit_err("Failed to create spill file");
+	unlink(name);
+	return file;
+}
+
+/* ============================================================
+ * Allocates an empty segmented array. Items are stored in a
+ * list of segments where each new segment doubles the total
+ * capacity, so growing never moves (or copies) existing items
+ * and pointers returned by getItem remain valid until the
+ * array is freed.
+ * 
+ * Parameters:
+ * 	arr - output parameter for the newly allocated array.
+ *  count - the number of items expected, rounded up to a power
+ *          of 2 to size the first segment.
+ *  elementSize - the size in bytes of each item.
+ * ========================================================= */
+void initArray(segmentedArray** arr, uint64_t count, uint32_t elementSize) {
+	*arr = malloc(sizeof(segmentedArray));
+	if (!(*arr))
+		exit_err(FAILED_ALLOC);
+	memset(*arr, 0, sizeof(segmentedArray));
+
+	uint32_t shift = 0;
+	while (((uint64_t)1 << shift) < count)
+		shift++;
+
+	(*arr)->m_elementSize = elementSize;
+	(*arr)->m_baseShift = shift;
+}
+
+/* ============================================================
+ * Releases every segment along with the array itself.
+ * 
+ * Parameters:
+ * 	arr - the array to free, set to NULL afterwards.
+ * ========================================================= */
+void freeArray(segmentedArray** arr) {
+	if (!(*arr))
+		return;
+
+	pthread_mutex_lock(&budgetLock);
+	for (uint32_t i = 0; i < (*arr)->m_numSegments; i++) {
+		uint64_t bytes = segmentBytes(*arr, i);
+		if ((*arr)->m_mappedSegments & ((uint64_t)1 << i)) {
+			// release the backing space in the spill file too
+			madvise((*arr)->m_segments[i], bytes, MADV_REMOVE);
+			munmap((*arr)->m_segments[i], bytes);
+			releaseSpillExtent((*arr)->m_spillOffsets[i], bytes);
+		} else {
+			free((*arr)->m_segments[i]);
+			memoryUsed -= bytes;
+		}
+	}
+	pthread_mutex_unlock(&budgetLock);
+	free(*arr);
+	*arr = NULL;
+}
+
+/* ============================================================
+ * Empties the array while keeping its segments allocated so
+ * the memory can be reused by following calls to addItem.
+ * 
+ * Parameters:
+ * 	arr - the array to clear.
+ * ========================================================= */
+void clearArray(segmentedArray* arr) {
+	arr->m_numItems = 0;
+}
+
+/* ============================================================
+ * Appends a copy of the given item to the end of the array,
+ * allocating a new segment if the current ones are full.
+ * 
+ * Parameters:
+ * 	arr - the array to add to.
+ *  item - pointer to the item to copy in.
+ * 
+ * Returns:
+ * 	Returns the address the item was stored at.
+ * ========================================================= */
+void* addItem(segmentedArray* arr, const void* item) {
+	if (arr->m_numItems == arr->m_capacity)
+		addSegment(arr);
+
+	void* address = getItem(arr, arr->m_numItems);
+	memcpy(address, item, arr->m_elementSize);
+	arr->m_numItems++;
+	return address;
+}
+
+/* ============================================================
+ * Returns the address of the item at the given index. Segment
+ * k starts at index base * (2^k - 1) so the segment can be 
+ * found from the highest set bit of (index / base) + 1.
+ * 
+ * Parameters:
+ * 	arr - the array to read from.
+ *  index - the index of the item.
+ * 
+ * Returns:
+ * 	Returns a pointer to the item in its segment.
+ * ========================================================= */
+void* getItem(const segmentedArray* arr, uint64_t index) {
+	uint64_t base = (uint64_t)1 << arr->m_baseShift;
+	uint64_t quotient = (index >> arr->m_baseShift) + 1;
+	uint32_t segment = 63 - __builtin_clzll(quotient);
+	uint64_t offset = index + base - (base << segment);
+	return arr->m_segments[segment] + (offset * arr->m_elementSize);
+}
+
+/* ============================================================
+ * Allocates the next segment, doubling the array capacity.
+ * Segments are never zeroed since every slot is written by
+ * addItem before it can be read. If a memory budget is set
+ * and the segment does not fit in it the segment is mapped 
+ * from the spill file instead.
+ * 
+ * Parameters:
+ * 	arr - the array to grow.
+ * ========================================================= */
+void addSegment(segmentedArray* arr) {
+	uint32_t segment = arr->m_numSegments;
+	if (segment + arr->m_baseShift >= MAX_SEGMENTS)
+		exit_err(FAILED_ALLOC);
+
+	uint64_t count = (uint64_t)1 << (arr->m_baseShift + segment);
+	uint64_t bytes = segmentBytes(arr, segment);
+
+	pthread_mutex_lock(&budgetLock);
+	if (memoryBudget && memoryUsed + bytes > memoryBudget) {
+		arr->m_segments[segment] = mapSpillSegment(bytes, &arr->m_spillOffsets[segment]);
+		arr->m_mappedSegments |= (uint64_t)1 << segment;
+	} else {
+		arr->m_segments[segment] = malloc(bytes);
+		if (!arr->m_segments[segment])
+			exit_err(FAILED_ALLOC);
+		memoryUsed += bytes;
+	}
+	pthread_mutex_unlock(&budgetLock);
+
+	arr->m_numSegments++;
+	arr->m_capacity += count;
+}
+
+/* ============================================================
+ * Maps a region of the spill file into memory, reusing a range
+ * freed by an earlier segment if one is large enough.
+ * 
+ * Parameters:
+ * 	bytes - the size of the region, a multiple of the page size.
+ *  offset - set to the offset of the region in the spill file.
+ * 
+ * Returns:
+ * 	Returns the address of the mapped region.
+ * ========================================================= */
+uint8_t* mapSpillSegment(uint64_t bytes, uint64_t* offset) {
+	if (spillFile < 0)
+		spillFile = createSpillFile();
+
+	*offset = takeSpillExtent(bytes);
+	void* addr = mmap(
+		NULL, bytes, PROT_READ | PROT_WRITE, 
+		MAP_SHARED, spillFile, *offset
+	);
+	if (addr == MAP_FAILED)
+		exit_err(FAILED_SPILL);
+
+	return (uint8_t*)addr;
+}
+
+/* ============================================================
+ * Takes a range of the spill file from the first freed range
+ * large enough to hold it, or grows the file by it if none is.
+ * 
+ * Parameters:
+ * 	bytes - the size of the range.
+ * 
+ * Returns:
+ * 	Returns the offset of the range in the spill file.
+ * ========================================================= */
+uint64_t takeSpillExtent(uint64_t bytes) {
+	for (uint32_t i = 0; i < numFreeExtents; i++) {
+		spillExtent* extent = &freeExtents[i];
+		if (extent->m_bytes < bytes)
+			continue;
+
+		uint64_t offset = extent->m_offset;
+		extent->m_offset += bytes;
+		extent->m_bytes -= bytes;
+		if (extent->m_bytes == 0) {
+			numFreeExtents--;
+			memmove(extent, extent + 1, (numFreeExtents - i) * sizeof(spillExtent));
+		}
+		return offset;
+	}
+
+	if (ftruncate(spillFile, spillSize + bytes) < 0)
+		exit_err("Failed to grow spill file");
+
+	uint64_t offset = spillSize;
+	spillSize += bytes;
+	return offset;
+}
+
+/* ============================================================
+ * Returns a range of the spill file to the freed ranges,
+ * merging it with its neighbours. Freed space at the end of
+ * the file is cut off so the file shrinks back to nothing once
+ * no segment is spilled.
+ * 
+ * Parameters:
+ * 	offset - the offset of the range in the spill file.
+ *  bytes - the size of the range.
+ * ========================================================= */
+void releaseSpillExtent(uint64_t offset, uint64_t bytes) {
+	uint32_t i = 0;
+	while (i < numFreeExtents && freeExtents[i].m_offset < offset)
+		i++;
+
+	uint32_t joinsPrev = (i > 0 && 
+		freeExtents[i - 1].m_offset + freeExtents[i - 1].m_bytes == offset);
+	uint32_t joinsNext = (i < numFreeExtents && 
+		offset + bytes == freeExtents[i].m_offset);
+
+	if (joinsPrev && joinsNext) {
+		freeExtents[i - 1].m_bytes += bytes + freeExtents[i].m_bytes;
+		numFreeExtents--;
+		memmove(&freeExtents[i], &freeExtents[i + 1], 
+			(numFreeExtents - i) * sizeof(spillExtent));
+	} else if (joinsPrev)
+		freeExtents[i - 1].m_bytes += bytes;
+	else if (joinsNext) {
+		freeExtents[i].m_offset = offset;
+		freeExtents[i].m_bytes += bytes;
+	} else {
+		if (numFreeExtents == freeExtentCapacity) {
+			uint32_t capacity = freeExtentCapacity ? freeExtentCapacity * 2 : 16;
+			spillExtent* grown = realloc(freeExtents, capacity * sizeof(spillExtent));
+			if (!grown)
+				exit_err(FAILED_ALLOC);
+			freeExtents = grown;
+			freeExtentCapacity = capacity;
+		}
+		memmove(&freeExtents[i + 1], &freeExtents[i], 
+			(numFreeExtents - i) * sizeof(spillExtent));
+		freeExtents[i].m_offset = offset;
+		freeExtents[i].m_bytes = bytes;
+		numFreeExtents++;
+	}
+
+	spillExtent* last = &freeExtents[numFreeExtents - 1];
+	if (last->m_offset + last->m_bytes == spillSize) {
+		spillSize = last->m_offset;
+		numFreeExtents--;
+		if (ftruncate(spillFile, spillSize) < 0)
+			exit_err("Failed to shrink spill file");
+	}
+}
+
+/* ============================================================
+ * Returns the size in bytes of the given segment, rounded up
+ * to a whole number of pages so it can be mapped from the 
+ * spill file.
+ * 
+ * Parameters:
+ * 	arr - the array the segment belongs to.
+ *  segment - the index of the segment.
+ * ========================================================= */
+uint64_t segmentBytes(const segmentedArray* arr, uint32_t segment) {
+	uint64_t count = (uint64_t)1 << (arr->m_baseShift + segment);
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t bytes = count * arr->m_elementSize;
+	return (bytes + page - 1) & ~(page - 1);
+}
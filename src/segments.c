@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "segments.h"
+#include "safeio.h"
+
+#define FAILED_ALLOC "Failed to allocate segment set"
+
+uint32_t lastSegmentNumber(const char*, uint32_t, uint32_t);
+void checkSegmentSizes(const segmentSet*, const char*, uint32_t, uint32_t, uint32_t);
+uint32_t segmentOf(const segmentSet*, uint64_t);
+void prefetchNext(segmentSet*, uint32_t, uint64_t);
+
+/* ============================================================
+ * Returns whether the path names the first segment of a split
+ * image, ending in a numeric extension of 0 or 1 such as .001.
+ * 
+ * Parameters:
+ * 	path - the path given on the command line.
+ * ========================================================= */
+uint32_t isFirstSegment(const char* path) {
+	const char* ext = strrchr(path, '.');
+	if (!ext || !ext[1] || strchr(ext, '/'))
+		return 0;
+
+	for (const char* c = ext + 1; *c; c++)
+		if (!isdigit((unsigned char)*c))
+			return 0;
+	return atoi(ext + 1) <= 1;
+}
+
+/* ============================================================
+ * Opens every segment of a split image, counting up from the
+ * first one with the same width of extension until a segment
+ * is missing. Exits the program if a later segment exists past
+ * the missing one, since everything after the gap would be
+ * read at the wrong address, and warns of segments whose size
+ * is not that of the others.
+ * 
+ * Parameters:
+ * 	set - output parameter for the opened set.
+ *  firstPath - the path of the first segment.
+ * ========================================================= */
+void openSegmentSet(segmentSet** set, const char* firstPath) {
+	*set = calloc(1, sizeof(segmentSet));
+	segmentSet* opened = *set;
+	if (!opened)
+		exit_err(FAILED_ALLOC);
+
+	const char* ext = strrchr(firstPath, '.') + 1;
+	uint32_t baseLength = ext - firstPath;
+	uint32_t width = strlen(ext);
+	uint32_t first = atoi(ext);
+	char path[PATH_MAX];
+	struct stat info;
+
+	opened->m_fds = malloc(MAX_SEGMENTS_IN_SET * sizeof(int32_t));
+	opened->m_starts = malloc((MAX_SEGMENTS_IN_SET + 1) * sizeof(uint64_t));
+	opened->m_prefetched = calloc(MAX_SEGMENTS_IN_SET, 1);
+	if (!opened->m_fds || !opened->m_starts || !opened->m_prefetched)
+		exit_err(FAILED_ALLOC);
+
+	uint64_t size = 0;
+	for (uint32_t i = 0; i < MAX_SEGMENTS_IN_SET; i++) {
+		snprintf(path, sizeof(path), "%.*s%0*u", baseLength, firstPath, width, first + i);
+		if (stat(path, &info) < 0 || !S_ISREG(info.st_mode))
+			break;
+
+		opened->m_fds[i] = safeOpen(path, O_RDONLY, 0);
+		opened->m_starts[i] = size;
+		size += info.st_size;
+		opened->m_count++;
+	}
+	opened->m_starts[opened->m_count] = size;
+
+	uint32_t last = lastSegmentNumber(firstPath, baseLength, width);
+	if (last >= first + opened->m_count) {
+		snprintf(path, sizeof(path), "%.*s%0*u", baseLength, firstPath, width,
+			first + opened->m_count);
+		fprintf(stderr, "Segment %s is missing but segments up to %0*u exist, "
+			"%u of %u segments found.\n", path, width, last,
+			opened->m_count, last - first + 1);
+		exit(EXIT_FAILURE);
+	}
+	checkSegmentSizes(opened, firstPath, baseLength, width, first);
+
+	printf("Reading %u segments of %s (%0*u to %0*u) as one device of %lu bytes.\n",
+		opened->m_count, firstPath, width, first, width, first + opened->m_count - 1, size);
+}
+
+/* ============================================================
+ * Returns the highest number among the extensions of the same
+ * width of the segments in the first segment's directory.
+ * 
+ * Parameters:
+ * 	firstPath - the path of the first segment.
+ *  baseLength - the length of the path up to the extension.
+ *  width - the number of digits in the extension.
+ * ========================================================= */
+uint32_t lastSegmentNumber(const char* firstPath, uint32_t baseLength, uint32_t width) {
+	const char* slash = strrchr(firstPath, '/');
+	const char* base = slash ? slash + 1 : firstPath;
+	uint32_t prefixLength = firstPath + baseLength - base;
+	char dirPath[PATH_MAX];
+	snprintf(dirPath, sizeof(dirPath), "%.*s", slash ? (int)(slash - firstPath + 1) : 2,
+		slash ? firstPath : "./");
+
+	DIR* dir = opendir(dirPath);
+	if (!dir)
+		return 0;
+
+	uint32_t last = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir))) {
+		const char* name = entry->d_name;
+		if (strlen(name) != prefixLength + width || strncmp(name, base, prefixLength) != 0)
+			continue;
+
+		uint32_t isNumber = 1;
+		for (const char* c = name + prefixLength; *c; c++)
+			isNumber &= isdigit((unsigned char)*c) != 0;
+		if (isNumber && (uint32_t)atoi(name + prefixLength) > last)
+			last = atoi(name + prefixLength);
+	}
+	closedir(dir);
+	return last;
+}
+
+/* ============================================================
+ * Warns of every segment but the last whose size differs from
+ * the first's, and of a last segment larger than the first,
+ * which are signs of a truncated or mismatched segment.
+ * ========================================================= */
+void checkSegmentSizes(
+	const segmentSet* set,
+	const char* firstPath,
+	uint32_t baseLength,
+	uint32_t width,
+	uint32_t first
+) {
+	uint64_t expected = set->m_starts[1];
+	for (uint32_t i = 1; i < set->m_count; i++) {
+		uint64_t size = set->m_starts[i + 1] - set->m_starts[i];
+		uint32_t isLast = i + 1 == set->m_count;
+		if (isLast ? size > expected : size != expected)
+			fprintf(stderr, "Warning: segment %.*s%0*u is %lu bytes, the first is %lu.\n",
+				baseLength, firstPath, width, first + i, size, expected);
+	}
+}
+
+/* ============================================================
+ * Closes every segment and frees the set.
+ * 
+ * Parameters:
+ * 	set - the set to close, may point to NULL, set to NULL
+ *        afterwards.
+ * ========================================================= */
+void closeSegmentSet(segmentSet** set) {
+	if (!(*set))
+		return;
+
+	for (uint32_t i = 0; i < (*set)->m_count; i++)
+		close((*set)->m_fds[i]);
+	free((*set)->m_fds);
+	free((*set)->m_starts);
+	free((*set)->m_prefetched);
+	free(*set);
+	*set = NULL;
+}
+
+/* ============================================================
+ * Returns the total size of the segments in bytes.
+ * ========================================================= */
+uint64_t segmentSetSize(const segmentSet* set) {
+	return set->m_starts[set->m_count];
+}
+
+/* ============================================================
+ * Reads from the set like pread, splitting reads that span
+ * segments. Safe to call from any number of threads.
+ * 
+ * Parameters:
+ * 	set - the segments to read.
+ *  buffer - buffer for the data read.
+ *  size - the number of bytes to read.
+ *  addr - the address in the whole set to read from.
+ * 
+ * Returns:
+ * 	Returns the number of bytes read, short at the end of the
+ *  last segment or before a media error, or -1 if a media error
+ *  stops the read before anything is read.
+ * ========================================================= */
+int64_t readSegments(segmentSet* set, uint8_t* buffer, uint64_t size, uint64_t addr) {
+	uint64_t done = 0;
+	uint32_t segment = segmentOf(set, addr);
+
+	while (done < size && segment < set->m_count) {
+		uint64_t offset = addr + done - set->m_starts[segment];
+		uint64_t length = set->m_starts[segment + 1] - (addr + done);
+		if (length > size - done)
+			length = size - done;
+
+		prefetchNext(set, segment, offset);
+		ssize_t got = pread(set->m_fds[segment], buffer + done, length, offset);
+		if (got < 0 && errno == EIO)
+			return done ? (int64_t)done : -1;
+		if (got < 0)
+			exit_err("Failed to read segment");
+		done += got;
+
+		// a segment shorter than when it was opened ends the set
+		if ((uint64_t)got < length)
+			break;
+		segment++;
+	}
+	return done;
+}
+
+/* ============================================================
+ * Finds the next region of the set that holds data, like
+ * findData, searching on through later segments if the rest of
+ * a segment is a hole.
+ * 
+ * Parameters:
+ * 	set - the segments to search.
+ *  addr - the address to search from.
+ *  dataEnd - output parameter for the end of the data region.
+ * 
+ * Returns:
+ * 	Returns the address of the first data at or after addr, or
+ *  NO_DATA if the rest of the set is a hole.
+ * ========================================================= */
+uint64_t findSegmentData(segmentSet* set, uint64_t addr, uint64_t* dataEnd) {
+	for (uint32_t i = segmentOf(set, addr); i < set->m_count; i++) {
+		uint64_t start = set->m_starts[i];
+		uint64_t offset = (addr > start) ? addr - start : 0;
+
+		off_t data = lseek(set->m_fds[i], offset, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO)
+				continue;
+			exit_err("Failed to find data in segment");
+		}
+
+		off_t hole = lseek(set->m_fds[i], data, SEEK_HOLE);
+		if (hole < 0)
+			exit_err("Failed to find hole in segment");
+		*dataEnd = start + hole;
+		return start + data;
+	}
+	return NO_DATA;
+}
+
+/* ============================================================
+ * Returns the index of the segment holding the address, or the
+ * number of segments past the end of the set.
+ * ========================================================= */
+uint32_t segmentOf(const segmentSet* set, uint64_t addr) {
+	uint32_t low = 0;
+	uint32_t high = set->m_count;
+	while (low < high) {
+		uint32_t mid = (low + high) / 2;
+		if (set->m_starts[mid + 1] <= addr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* ============================================================
+ * Asks the kernel to start reading the head of the next
+ * segment once reads pass the middle of a segment, so a scan
+ * moving onto another volume finds it already reading.
+ * ========================================================= */
+void prefetchNext(segmentSet* set, uint32_t segment, uint64_t offset) {
+	uint64_t length = set->m_starts[segment + 1] - set->m_starts[segment];
+	uint32_t next = segment + 1;
+	if (next >= set->m_count || offset < length / 2)
+		return;
+
+	if (!__atomic_exchange_n(&set->m_prefetched[next], 1, __ATOMIC_RELAXED))
+		posix_fadvise(set->m_fds[next], 0, SEGMENT_PREFETCH, POSIX_FADV_WILLNEED);
+}
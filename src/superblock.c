@@ -4,6 +4,26 @@
 #include "safeio.h"
 #include "superblock.h"
 
+/* ============================================================
+ * Returns the number of block groups whose bitmaps are stored
+ * together, 1 unless the file system has the flex_bg feature.
+ * ========================================================= */
+uint32_t superblockGroupsPerFlex(const SuperBlock* sb) {
+	if (!(sb->_incompat_features & FEATURE_INCOMPAT_FLEX_BG) || sb->_log_groups_per_flex > 31)
+		return 1;
+	return 1u << sb->_log_groups_per_flex;
+}
+
+/* ============================================================
+ * Returns whether block groups flagged as never initialized
+ * can be trusted to be empty, which needs checksummed group
+ * descriptors.
+ * ========================================================= */
+uint32_t hasUninitGroups(const SuperBlock* sb) {
+	return (sb->_ro_features 
+		& (FEATURE_RO_COMPAT_GDT_CSUM | FEATURE_RO_COMPAT_METADATA_CSUM)) != 0;
+}
+
 /* ============================================================
  * Reads the given device to obtain superblock data from the
  * specified partition.
@@ -24,6 +44,27 @@ pSBlock readSuperblock(int32_t device, uint64_t partAddr) {
 	return superblock;
 }
 
+/* ============================================================
+ * Returns the number of blocks in the file system, including
+ * the high word ext4 keeps when it has the 64bit feature.
+ * ========================================================= */
+uint64_t superblockBlocks(const SuperBlock* sb) {
+	uint64_t count = sb->_fs_size_blocks;
+	if (sb->_incompat_features & FEATURE_INCOMPAT_64BIT)
+		count |= (uint64_t)sb->_fs_size_blocks_hi << 32;
+	return count;
+}
+
+/* ============================================================
+ * Returns the size of a block group descriptor, 32 bytes
+ * unless the file system has the 64bit feature.
+ * ========================================================= */
+uint32_t superblockDescSize(const SuperBlock* sb) {
+	if (sb->_incompat_features & FEATURE_INCOMPAT_64BIT && sb->_desc_size > GRP_DESC_SIZE)
+		return sb->_desc_size;
+	return GRP_DESC_SIZE;
+}
+
 /* ============================================================
  * Reads the given device to obtain superblock data from the
  * specified partition and prints the data. Displays an error
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tarStream.h"
+#include "safeio.h"
+
+#define PAX_SIZE 1024
+
+void writeHeader(tarStream*, const char*, uint64_t, char);
+void padEntry(tarStream*, uint64_t);
+uint32_t addPaxRecord(char*, uint32_t, const char*, const char*);
+
+/* ============================================================
+ * Starts an archive written to the given file descriptor.
+ *
+ * Parameters:
+ * 	archive - output parameter for the new archive.
+ *  fd - the file or pipe the archive is written to.
+ * ========================================================= */
+void openTarStream(tarStream** archive, int32_t fd) {
+	*archive = malloc(sizeof(tarStream));
+	if (!(*archive))
+		exit_err("Failed to allocate archive");
+
+	(*archive)->m_fd = fd;
+	(*archive)->m_entries = 0;
+	(*archive)->m_mtime = time(NULL);
+	pthread_mutex_init(&(*archive)->m_lock, NULL);
+}
+
+/* ============================================================
+ * Ends the archive with the two zeroed blocks that mark its
+ * end and frees it. The file descriptor is left open.
+ *
+ * Parameters:
+ * 	archive - the archive to close, set to NULL afterwards.
+ * ========================================================= */
+void closeTarStream(tarStream** archive) {
+	if (!(*archive))
+		return;
+
+	uint8_t end[2 * TAR_BLOCK];
+	memset(end, 0, sizeof(end));
+	safeWrite((*archive)->m_fd, end, sizeof(end));
+
+	pthread_mutex_destroy(&(*archive)->m_lock);
+	free(*archive);
+	*archive = NULL;
+}
+
+/* ============================================================
+ * Writes the header of a regular file entry, taking the lock
+ * of the archive until endEntry so the entry's data can be
+ * written straight to the archive's file descriptor. A pax
+ * extended header is written first if the name or size does
+ * not fit in the ustar header.
+ *
+ * Parameters:
+ * 	archive - the archive to add to.
+ *  name - the path of the entry within the archive.
+ *  size - the exact number of bytes that follow.
+ * ========================================================= */
+void beginEntry(tarStream* archive, const char* name, uint64_t size) {
+	pthread_mutex_lock(&archive->m_lock);
+
+	char pax[PAX_SIZE];
+	uint32_t paxLength = 0;
+	if (strlen(name) >= TAR_NAME_SIZE)
+		paxLength += addPaxRecord(pax + paxLength, PAX_SIZE - paxLength, "path", name);
+	if (size > TAR_MAX_SIZE) {
+		char value[24];
+		snprintf(value, sizeof(value), "%lu", size);
+		paxLength += addPaxRecord(pax + paxLength, PAX_SIZE - paxLength, "size", value);
+	}
+
+	if (paxLength) {
+		char paxName[TAR_NAME_SIZE];
+		snprintf(paxName, sizeof(paxName), "PaxHeaders/%lu", archive->m_entries);
+		writeHeader(archive, paxName, paxLength, 'x');
+		safeWrite(archive->m_fd, (uint8_t*)pax, paxLength);
+		padEntry(archive, paxLength);
+	}
+
+	writeHeader(archive, name, size, '0');
+	archive->m_entries++;
+}
+
+/* ============================================================
+ * Pads the data of the current entry to a whole block and
+ * releases the archive for the next entry.
+ *
+ * Parameters:
+ * 	archive - the archive being added to.
+ *  size - the number of bytes written since beginEntry.
+ * ========================================================= */
+void endEntry(tarStream* archive, uint64_t size) {
+	padEntry(archive, size);
+	pthread_mutex_unlock(&archive->m_lock);
+}
+
+/* ============================================================
+ * Writes zeroes after an entry's data up to the next block.
+ * ========================================================= */
+void padEntry(tarStream* archive, uint64_t size) {
+	uint8_t padding[TAR_BLOCK];
+	uint32_t remainder = size % TAR_BLOCK;
+	if (remainder) {
+		memset(padding, 0, sizeof(padding));
+		safeWrite(archive->m_fd, padding, TAR_BLOCK - remainder);
+	}
+}
+
+/* ============================================================
+ * Writes a ustar header block. Names too long for the header
+ * are cut short and sizes too large are left zero, their full
+ * values are then given by the pax header before it.
+ *
+ * Parameters:
+ * 	archive - the archive being added to.
+ *  name - the path of the entry.
+ *  size - the size of the entry's data.
+ *  type - the ustar type flag of the entry.
+ * ========================================================= */
+void writeHeader(tarStream* archive, const char* name, uint64_t size, char type) {
+	char header[TAR_BLOCK];
+	memset(header, 0, sizeof(header));
+
+	strncpy(header, name, TAR_NAME_SIZE - 1);
+	snprintf(header + 100, 8, "%07o", 0644);
+	snprintf(header + 108, 8, "%07o", 0);
+	snprintf(header + 116, 8, "%07o", 0);
+	snprintf(header + 124, 12, "%011lo", (size > TAR_MAX_SIZE) ? 0 : size);
+	snprintf(header + 136, 12, "%011lo", archive->m_mtime);
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+
+	// the checksum is taken with its own field as spaces
+	uint32_t checksum = 0;
+	memset(header + 148, ' ', 8);
+	for (uint32_t i = 0; i < TAR_BLOCK; i++)
+		checksum += (uint8_t)header[i];
+	snprintf(header + 148, 8, "%06o", checksum);
+
+	safeWrite(archive->m_fd, (uint8_t*)header, TAR_BLOCK);
+}
+
+/* ============================================================
+ * Formats a pax record, "<length> <key>=<value>\n", where the
+ * length counts the whole record including its own digits.
+ *
+ * Parameters:
+ * 	buffer - output buffer for the record.
+ *  size - the size of the buffer.
+ *  key - the keyword of the record.
+ *  value - the value of the record.
+ *
+ * Returns:
+ * 	Returns the length of the record.
+ * ========================================================= */
+uint32_t addPaxRecord(char* buffer, uint32_t size, const char* key, const char* value) {
+	uint32_t body = strlen(key) + strlen(value) + 3;	// ' ', '=' and '\n'
+	uint32_t length = body + 1;
+	while (length != body + snprintf(NULL, 0, "%u", length))
+		length = body + snprintf(NULL, 0, "%u", length);
+
+	if (length >= size)
+		exit_err("Archive entry name is too long");
+	snprintf(buffer, size, "%u %s=%s\n", length, key, value);
+	return length;
+}
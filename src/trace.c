@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "trace.h"
+#include "safeio.h"
+
+#define EVENTS_PER_THREAD 4096
+
+// a finished span waiting to be written out
+typedef struct {
+	const char* m_name;
+	uint64_t m_start;
+	uint64_t m_duration;
+	uint64_t m_counters[NUM_COUNTERS];
+} traceEvent;
+
+// spans recorded by one thread, written out when full so the
+// threads only share the file lock
+typedef struct _thread_trace {
+	uint32_t m_tid;
+	int32_t m_counterFds[NUM_COUNTERS];	// -1 if not counting
+	traceEvent m_events[EVENTS_PER_THREAD];
+	uint32_t m_numEvents;
+	struct _thread_trace* m_next;
+} threadTrace;
+
+FILE* traceFile = NULL;
+pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t traceStart = 0;
+uint32_t useCounters = 0;
+uint32_t numWritten = 0;
+uint32_t numThreads = 0;
+threadTrace* threadTraces = NULL;
+
+__thread threadTrace* localTrace = NULL;
+
+uint64_t traceNanos();
+threadTrace* getLocalTrace();
+void openCounters(threadTrace*);
+void readCounters(threadTrace*, uint64_t*);
+void flushThreadTrace(threadTrace*);
+
+/* ============================================================
+ * Opens the trace file named by SCAN_DRIVE_TRACE (or the
+ * default path) and starts recording spans. Counters are read
+ * with each span if SCAN_DRIVE_COUNTERS is set. The trace is
+ * finished when the program exits.
+ * ========================================================= */
+void initTrace() {
+	const char* path = getenv(TRACE_PATH_ENV);
+	if (!path)
+		path = DEFAULT_TRACE_PATH;
+
+	traceFile = fopen(path, "w");
+	if (!traceFile)
+		exit_err("Failed to open trace file");
+
+	fprintf(traceFile, "{\"traceEvents\":[\n");
+	useCounters = getenv(TRACE_COUNTERS_ENV) != NULL;
+	traceStart = traceNanos();
+	atexit(finishTrace);
+	printf("Writing trace to %s.\n", path);
+}
+
+/* ============================================================
+ * Writes out the spans every thread still holds and closes the
+ * trace file.
+ * ========================================================= */
+void finishTrace() {
+	pthread_mutex_lock(&traceLock);
+	if (!traceFile) {
+		pthread_mutex_unlock(&traceLock);
+		return;
+	}
+
+	while (threadTraces) {
+		threadTrace* trace = threadTraces;
+		flushThreadTrace(trace);
+		for (uint32_t i = 0; i < NUM_COUNTERS; i++)
+			if (trace->m_counterFds[i] >= 0)
+				close(trace->m_counterFds[i]);
+		threadTraces = trace->m_next;
+		free(trace);
+	}
+
+	fprintf(traceFile, "\n]}\n");
+	fclose(traceFile);
+	traceFile = NULL;
+	pthread_mutex_unlock(&traceLock);
+}
+
+/* ============================================================
+ * Starts timing a span on the calling thread. Does nothing if
+ * tracing was not started.
+ *
+ * Parameters:
+ * 	span - the span to start.
+ * ========================================================= */
+void beginSpan(traceSpan* span) {
+	if (!traceFile)
+		return;
+	readCounters(getLocalTrace(), span->m_counters);
+	span->m_start = traceNanos();
+}
+
+/* ============================================================
+ * Finishes a span and records it as a complete event, with the
+ * change in each counter while it was open.
+ *
+ * Parameters:
+ * 	span - the span started with beginSpan.
+ *  name - the name shown for the span.
+ * ========================================================= */
+void endSpan(traceSpan* span, const char* name) {
+	if (!traceFile)
+		return;
+
+	uint64_t end = traceNanos();
+	threadTrace* trace = getLocalTrace();
+	traceEvent* event = &trace->m_events[trace->m_numEvents++];
+
+	readCounters(trace, event->m_counters);
+	for (uint32_t i = 0; i < NUM_COUNTERS; i++)
+		event->m_counters[i] -= span->m_counters[i];
+	event->m_name = name;
+	event->m_start = span->m_start - traceStart;
+	event->m_duration = end - span->m_start;
+
+	if (trace->m_numEvents == EVENTS_PER_THREAD) {
+		pthread_mutex_lock(&traceLock);
+		flushThreadTrace(trace);
+		pthread_mutex_unlock(&traceLock);
+	}
+}
+
+/* ============================================================
+ * Returns the current monotonic time in nanoseconds.
+ * ========================================================= */
+uint64_t traceNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* ============================================================
+ * Returns the calling thread's span buffer, allocating and
+ * registering it on first use.
+ * ========================================================= */
+threadTrace* getLocalTrace() {
+	if (localTrace)
+		return localTrace;
+
+	localTrace = malloc(sizeof(threadTrace));
+	if (!localTrace)
+		exit_err("Failed to allocate trace buffer");
+	localTrace->m_numEvents = 0;
+	openCounters(localTrace);
+
+	pthread_mutex_lock(&traceLock);
+	localTrace->m_tid = ++numThreads;
+	localTrace->m_next = threadTraces;
+	threadTraces = localTrace;
+	pthread_mutex_unlock(&traceLock);
+	return localTrace;
+}
+
+/* ============================================================
+ * Opens the hardware counters of the calling thread as one
+ * group so they are read together. Counting is left off with
+ * a warning if the kernel refuses, e.g. when
+ * perf_event_paranoid is too strict.
+ *
+ * Parameters:
+ * 	trace - the calling thread's span buffer.
+ * ========================================================= */
+void openCounters(threadTrace* trace) {
+	static const uint64_t configs[NUM_COUNTERS] = {
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_INSTRUCTIONS
+	};
+
+	for (uint32_t i = 0; i < NUM_COUNTERS; i++)
+		trace->m_counterFds[i] = -1;
+	if (!useCounters)
+		return;
+
+	for (uint32_t i = 0; i < NUM_COUNTERS; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		trace->m_counterFds[i] = syscall(
+			SYS_perf_event_open, &attr, 0, -1, trace->m_counterFds[0], 0
+		);
+		if (trace->m_counterFds[i] < 0) {
+			perror("Failed to open hardware counters");
+			useCounters = 0;
+			for (uint32_t k = 0; k < i; k++) {
+				close(trace->m_counterFds[k]);
+				trace->m_counterFds[k] = -1;
+			}
+			return;
+		}
+	}
+}
+
+/* ============================================================
+ * Reads the current value of each counter of the calling
+ * thread, or zeroes if it is not counting.
+ *
+ * Parameters:
+ * 	trace - the calling thread's span buffer.
+ *  counters - output array of NUM_COUNTERS values.
+ * ========================================================= */
+void readCounters(threadTrace* trace, uint64_t* counters) {
+	struct {
+		uint64_t m_count;
+		uint64_t m_values[NUM_COUNTERS];
+	} group;
+
+	if (
+		trace->m_counterFds[0] < 0 ||
+		read(trace->m_counterFds[0], &group, sizeof(group)) != sizeof(group)
+	) {
+		memset(counters, 0, NUM_COUNTERS * sizeof(uint64_t));
+		return;
+	}
+	memcpy(counters, group.m_values, NUM_COUNTERS * sizeof(uint64_t));
+}
+
+/* ============================================================
+ * Writes a thread's recorded spans to the trace file as Chrome
+ * trace complete events, the caller must hold the trace lock.
+ *
+ * Parameters:
+ * 	trace - the span buffer to empty.
+ * ========================================================= */
+void flushThreadTrace(threadTrace* trace) {
+	for (uint32_t i = 0; i < trace->m_numEvents; i++) {
+		traceEvent* event = &trace->m_events[i];
+
+		// timestamps are in microseconds
+		fprintf(traceFile,
+			"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+			"\"ts\":%.3f,\"dur\":%.3f",
+			numWritten++ ? ",\n" : "", event->m_name, trace->m_tid,
+			event->m_start / 1000.0, event->m_duration / 1000.0);
+
+		if (trace->m_counterFds[0] >= 0)
+			fprintf(traceFile,
+				",\"args\":{\"cache_misses\":%lu,\"instructions\":%lu}",
+				event->m_counters[0], event->m_counters[1]);
+		fprintf(traceFile, "}");
+	}
+	trace->m_numEvents = 0;
+}
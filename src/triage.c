@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "triage.h"
+#include "candidates.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+
+void sampleGroups(scanSession*, double, uint32_t);
+void initStratum(stratum*, uint32_t, double, uint64_t*);
+uint32_t sampleStratum(scanSession*, uint32_t, stratum*, uint32_t);
+void printEstimate(const char*, const stratum*, uint32_t, size_t, uint64_t);
+uint64_t nextRandom(uint64_t*);
+uint32_t greatestDivisor(uint32_t, uint32_t);
+int32_t compareBlockNums(const void*, const void*);
+double elapsedSeconds(const struct timespec*);
+
+/* ============================================================
+ * Estimates the contents of a partition from a random sample
+ * of its blocks instead of reading all of them. The sample is
+ * stratified by block group so every part of the partition is
+ * represented, and each sampled block is run through the same
+ * classifiers as a full scan. Prints estimated counts of used
+ * blocks, first block matches and indirect blocks with 95%
+ * confidence intervals.
+ *
+ * Parameters:
+ * 	device - the file descriptor of the device.
+ *  index - the index of the partition in the partition table.
+ *  fraction - the fraction of each block group to sample.
+ *  seconds - time budget for the sample, or 0 for none.
+ * ========================================================= */
+void triagePartition(
+	int32_t device,
+	int32_t index,
+	double fraction,
+	uint32_t seconds
+) {
+	scanSession session;
+	initSession(&session, device);
+
+	uint64_t addr = parsePartitionAddr(&session, index);
+	if (addr && loadSuperblock(&session, addr))
+		sampleGroups(&session, fraction, seconds);
+
+	freeSession(&session);
+}
+
+/* ============================================================
+ * Samples every block group in several passes, each pass
+ * raising every group's sample by an equal share, so if the
+ * time budget runs out the sample is still spread over the
+ * whole partition. The first pass always completes.
+ *
+ * Parameters:
+ * 	session - the session holding the loaded partition.
+ *  fraction - the fraction of each block group to sample.
+ *  seconds - time budget for the sample, or 0 for none.
+ * ========================================================= */
+void sampleGroups(scanSession* session, double fraction, uint32_t seconds) {
+	uint64_t totalBlocks = session->m_totalBlocks;
+	uint32_t numBlocksInGrp = session->m_blockSize << 3;
+	uint32_t numGroups = numBlockGroups(session);
+
+	stratum* strata = calloc(numGroups, sizeof(stratum));
+	if (!strata)
+		exit_err("Failed to allocate sample strata");
+
+	uint64_t seed = time(NULL) ^ ((uint64_t)getpid() << 32);
+	printf("\nPartition Address: 0x%lx\n", session->m_partitionAddr);
+	printf("Sampling %.2f%% of %d block groups (seed %lu).\n",
+		fraction * 100, numGroups, seed);
+
+	uint64_t targetTotal = 0;
+	for (uint32_t g = 0; g < numGroups; g++) {
+		uint64_t size = totalBlocks - groupFirstBlock(session, g);
+		if (size > numBlocksInGrp)
+			size = numBlocksInGrp;
+		initStratum(&strata[g], size, fraction, &seed);
+
+		// groups never written to are known to be empty
+		if (isGroupUninit(session, g))
+			strata[g].m_target = 0;
+		targetTotal += strata[g].m_target;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint32_t current_progress = 0;
+	uint64_t sampled = 0;
+	uint32_t outOfTime = 0;
+
+	printf("\n---Sampling blocks---\n");
+	for (uint32_t pass = 1; pass <= TRIAGE_PASSES && !outOfTime; pass++) {
+		for (uint32_t g = 0; g < numGroups; g++) {
+			uint32_t goal = ((uint64_t)strata[g].m_target * pass
+				+ TRIAGE_PASSES - 1) / TRIAGE_PASSES;
+			sampled += sampleStratum(session, g, &strata[g], goal);
+			printProgress(&current_progress, sampled, targetTotal);
+
+			// only stop once every group has been sampled
+			if (pass > 1 && seconds && elapsedSeconds(&start) >= seconds) {
+				outOfTime = 1;
+				break;
+			}
+		}
+	}
+	printf("\n---Finished sampling---\n\n");
+
+	if (outOfTime)
+		printf("Time budget reached, stopping early.\n");
+	printf("Sampled %lu of %lu blocks (%.2f%%) in %.1f seconds.\n",
+		sampled, totalBlocks, 100.0 * sampled / totalBlocks,
+		elapsedSeconds(&start));
+
+	printf("\n%-22s %14s   %-30s\n", "", "Estimate", "95% Interval");
+	printEstimate("Used blocks:", strata, numGroups,
+		offsetof(stratum, m_used), totalBlocks);
+	printEstimate("First block matches:", strata, numGroups,
+		offsetof(stratum, m_first), totalBlocks);
+	printEstimate("Indirect blocks:", strata, numGroups,
+		offsetof(stratum, m_indirect), totalBlocks);
+
+	free(strata);
+}
+
+/* ============================================================
+ * Sets up the sampling plan of a block group. Blocks are drawn
+ * in the order of a random permutation of the group (a random
+ * start and a step coprime to the group size), so no block is
+ * sampled twice and later passes simply continue the sequence.
+ *
+ * Parameters:
+ * 	group - the stratum to set up.
+ *  size - the number of blocks in the group.
+ *  fraction - the fraction of the group to sample.
+ *  seed - the state of the random number generator.
+ * ========================================================= */
+void initStratum(stratum* group, uint32_t size, double fraction, uint64_t* seed) {
+	uint32_t target = ceil(fraction * size);
+	if (target < 1)
+		target = 1;
+	if (target > size)
+		target = size;
+
+	uint32_t stride = 1 + nextRandom(seed) % size;
+	while (greatestDivisor(stride, size) != 1)
+		stride++;
+
+	group->m_size = size;
+	group->m_target = target;
+	group->m_offset = nextRandom(seed) % size;
+	group->m_stride = stride;
+}
+
+/* ============================================================
+ * Reads and classifies the next blocks of a group's sample
+ * until the given number have been sampled. The blocks are
+ * read in ascending order to keep seeks short.
+ *
+ * Parameters:
+ * 	session - the session holding the loaded partition.
+ *  grpNum - the number of the block group.
+ *  group - the stratum of the block group.
+ *  goal - the number of blocks to have sampled.
+ *
+ * Returns:
+ * 	Returns the number of blocks sampled by this call.
+ * ========================================================= */
+uint32_t sampleStratum(
+	scanSession* session,
+	uint32_t grpNum,
+	stratum* group,
+	uint32_t goal
+) {
+	if (goal <= group->m_taken)
+		return 0;
+
+	// blocks are kept as offsets into the group so the sample
+	// stays 32 bits wide on any size of partition
+	uint32_t count = goal - group->m_taken;
+	uint32_t* offsets = malloc(count * sizeof(uint32_t));
+	if (!offsets)
+		exit_err("Failed to allocate sample");
+
+	uint64_t firstBlock = groupFirstBlock(session, grpNum);
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t step = (uint64_t)(group->m_taken + i) * group->m_stride;
+		offsets[i] = (group->m_offset + step) % group->m_size;
+	}
+	qsort(offsets, count, sizeof(uint32_t), compareBlockNums);
+
+	uint8_t block[session->m_blockSize];
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t blockNum = firstBlock + offsets[i];
+		uint64_t addr = blockAddr(session, blockNum);
+		safeRead(session->m_deviceID, addr, block, session->m_blockSize);
+
+		uint32_t type = classifyBlock(session, block, addr);
+		group->m_used += isBlockAllocated(session, blockNum);
+		group->m_first += (type & CANDIDATE_FIRST) != 0;
+		group->m_indirect += (type & CANDIDATE_INDIRECT) != 0;
+	}
+
+	group->m_taken = goal;
+	free(offsets);
+	return count;
+}
+
+/* ============================================================
+ * Prints the stratified estimate of a count over the whole
+ * partition with its 95% confidence interval. Each group's
+ * variance includes the finite population correction since
+ * groups are sampled without replacement.
+ *
+ * Parameters:
+ * 	name - the label of the estimate.
+ *  strata - the sampled block groups.
+ *  numGroups - the number of block groups.
+ *  field - offset of the sampled count within a stratum.
+ *  totalBlocks - the number of blocks in the partition.
+ * ========================================================= */
+void printEstimate(
+	const char* name,
+	const stratum* strata,
+	uint32_t numGroups,
+	size_t field,
+	uint64_t totalBlocks
+) {
+	double estimate = 0;
+	double variance = 0;
+
+	for (uint32_t g = 0; g < numGroups; g++) {
+		const stratum* group = &strata[g];
+		uint32_t hits = *(const uint32_t*)((const uint8_t*)group + field);
+		double size = group->m_size;
+		double taken = group->m_taken;
+		if (!taken)
+			continue;
+
+		double ratio = hits / taken;
+
+		estimate += size * ratio;
+		if (taken > 1) {
+			double sampleVariance = ratio * (1 - ratio) * taken / (taken - 1);
+			variance += size * size * (1 - taken / size)
+				* sampleVariance / taken;
+		}
+	}
+
+	double margin = CONFIDENCE_Z * sqrt(variance);
+	double low = fmax(estimate - margin, 0);
+	double high = fmin(estimate + margin, totalBlocks);
+	printf("%-22s %14.0f   [%.0f, %.0f]  (%.3f%% of blocks)\n",
+		name, estimate, low, high, 100 * estimate / totalBlocks);
+}
+
+/* ============================================================
+ * Returns the next value of a splitmix64 random sequence.
+ *
+ * Parameters:
+ * 	state - the state of the sequence, advanced by the call.
+ * ========================================================= */
+uint64_t nextRandom(uint64_t* state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+/* ============================================================
+ * Returns the greatest common divisor of a and b.
+ * ========================================================= */
+uint32_t greatestDivisor(uint32_t a, uint32_t b) {
+	while (b) {
+		uint32_t next = a % b;
+		a = b;
+		b = next;
+	}
+	return a;
+}
+
+/* ============================================================
+ * Orders block numbers ascending for qsort.
+ * ========================================================= */
+int32_t compareBlockNums(const void* a, const void* b) {
+	uint32_t left = *(const uint32_t*)a;
+	uint32_t right = *(const uint32_t*)b;
+	return (left > right) - (left < right);
+}
+
+/* ============================================================
+ * Returns the seconds elapsed since the given monotonic time.
+ * ========================================================= */
+double elapsedSeconds(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec)
+		+ (now.tv_nsec - start->tv_nsec) / 1e9;
+}
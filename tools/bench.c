@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "synthImage.h"
+#include "candidates.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+#include "segmentedArray.h"
+
+#define USAGE "Usage: ./bench.exe <image> [-t all|free|used] [-out dir]\n"
+#define MB 1e6
+
+// what was recovered for a planted file
+typedef struct {
+	uint64_t m_written;
+	uint64_t m_correct;		// bytes matching the planted content
+} fileResult;
+
+double seconds();
+void quiet(int32_t*);
+void restore(int32_t);
+const plantedFile* findPlanted(const imageManifest*, uint32_t);
+uint64_t countCorrect(const plantedFile*, int32_t, uint64_t);
+double rate(double, double);
+
+/* ============================================================
+ * Scans a synthetic image made by mkimage.exe and recovers
+ * every first block candidate, timing the scan, the search
+ * for each file's blocks and the writes separately, then
+ * checks the recovered files against the planted ones listed
+ * in the image's manifest.
+ * ========================================================= */
+int32_t main(int32_t argc, const char** argv) {
+	uint32_t scanType = UNALLOCATED_ONLY;
+	const char* outDir = "/tmp";
+
+	if (argc < 2 || argc % 2 != 0) {
+		fprintf(stderr, USAGE);
+		exit(EXIT_FAILURE);
+	}
+	for (int32_t i = 2; i < argc; i += 2) {
+		if (strcmp(argv[i], "-t") == 0)
+			scanType = strcmp(argv[i + 1], "all") == 0 ? ALL_BLOCKS
+				: strcmp(argv[i + 1], "used") == 0 ? ALLOCATED_ONLY
+				: UNALLOCATED_ONLY;
+		else if (strcmp(argv[i], "-out") == 0)
+			outDir = argv[i + 1];
+		else {
+			fprintf(stderr, USAGE);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	char path[PATH_MAX];
+	imageManifest* manifest = malloc(sizeof(imageManifest));
+	snprintf(path, sizeof(path), "%s%s", argv[1], MANIFEST_SUFFIX);
+	if (!manifest || !readManifest(path, manifest)) {
+		fprintf(stderr, "Failed to read manifest %s.\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	scanSession session;
+	initSession(&session, safeOpen(argv[1], O_RDONLY, 0));
+	fileResult* results = calloc(manifest->m_numFiles, sizeof(fileResult));
+	int32_t savedOut;
+
+	// the scan and recovery report progress on stdout
+	quiet(&savedOut);
+	double start = seconds();
+	uint64_t addr = parsePartitionAddr(&session, 0);
+	if (addr)
+		scanForFiles(&session, addr, scanType);
+	double scanTime = seconds() - start;
+
+	double searchTime = 0;
+	double writeTime = 0;
+	uint64_t bytesWritten = 0;
+	uint64_t numCandidatesFound = numCandidates(&session.m_firstBlocks);
+	uint64_t numExtra = 0;
+
+	if (addr) {
+		start = seconds();
+		indexMatches(&session);
+		searchTime += seconds() - start;
+	}
+
+	for (uint64_t i = 0; addr && i < numCandidatesFound; i++) {
+		uint64_t firstBlock = candidateBlock(&session.m_firstBlocks, i);
+		snprintf(path, sizeof(path), "%s/bench_%lu.iso", outDir, firstBlock);
+		int32_t file = safeOpen(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+		start = seconds();
+		assembleFile(&session, firstBlock);
+		double found = seconds();
+		uint64_t written = writeBlocks(&session, file);
+		writeTime += seconds() - found;
+		searchTime += found - start;
+		bytesWritten += written;
+		clearArray(session.m_recoveredBlocks);
+
+		const plantedFile* planted = findPlanted(manifest, firstBlock);
+		if (planted) {
+			fileResult* result = &results[planted - manifest->m_files];
+			result->m_written = written;
+			result->m_correct = countCorrect(planted, file, written);
+		} else
+			numExtra++;
+
+		close(file);
+		unlink(path);
+	}
+	restore(savedOut);
+
+	uint64_t scannedBytes = session.m_totalBlocks * session.m_blockSize;
+	uint64_t plantedBytes = 0;
+	uint64_t correctBytes = 0;
+	uint32_t numExact = 0;
+
+	printf("%-10s %-14s %10s %10s %8s\n", "block", "layout", "size", "written", "correct");
+	for (uint32_t i = 0; i < manifest->m_numFiles; i++) {
+		const plantedFile* planted = &manifest->m_files[i];
+		fileResult* result = &results[i];
+		plantedBytes += planted->m_size;
+		correctBytes += result->m_correct;
+		numExact += result->m_correct == planted->m_size
+			&& result->m_written == planted->m_size;
+
+		printf("%-10u %-14s %10lu %10lu %7.1f%%\n",
+			planted->m_firstBlock, layoutName(planted->m_layout), planted->m_size,
+			result->m_written, 100.0 * result->m_correct / planted->m_size);
+	}
+
+	printf("\nscan:   %8.1f MB in %7.3f s  %8.1f MB/s\n",
+		scannedBytes / MB, scanTime, rate(scannedBytes, scanTime));
+	printf("search: %8lu files in %5.3f s\n", numCandidatesFound, searchTime);
+	printf("write:  %8.1f MB in %7.3f s  %8.1f MB/s\n",
+		bytesWritten / MB, writeTime, rate(bytesWritten, writeTime));
+	printf("accuracy: %lu of %lu planted bytes recovered (%.1f%%), "
+		"%u of %u files exact, %lu extra candidates\n",
+		correctBytes, plantedBytes,
+		plantedBytes ? 100.0 * correctBytes / plantedBytes : 0.0,
+		numExact, manifest->m_numFiles, numExtra);
+
+	close(session.m_deviceID);
+	releaseMatches(&session);
+	freeSession(&session);
+	free(results);
+	freeManifest(manifest);
+	free(manifest);
+	return EXIT_SUCCESS;
+}
+
+/* ============================================================
+ * Returns the current monotonic time in seconds.
+ * ========================================================= */
+double seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* ============================================================
+ * Sends stdout to /dev/null, keeping the original descriptor.
+ * ========================================================= */
+void quiet(int32_t* saved) {
+	fflush(stdout);
+	*saved = dup(STDOUT_FILENO);
+	int32_t null = safeOpen("/dev/null", O_WRONLY, 0);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+}
+
+/* ============================================================
+ * Restores stdout saved by quiet.
+ * ========================================================= */
+void restore(int32_t saved) {
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+/* ============================================================
+ * Returns the planted file starting at the given block, or
+ * NULL if the block is not the start of one.
+ * ========================================================= */
+const plantedFile* findPlanted(const imageManifest* manifest, uint32_t firstBlock) {
+	for (uint32_t i = 0; i < manifest->m_numFiles; i++)
+		if (manifest->m_files[i].m_firstBlock == firstBlock)
+			return &manifest->m_files[i];
+	return NULL;
+}
+
+/* ============================================================
+ * Returns the number of bytes of a recovered file that match
+ * the planted file's content at the same offset.
+ *
+ * Parameters:
+ * 	planted - the planted file.
+ *  file - the recovered file, open for reading.
+ *  size - the size of the recovered file.
+ * ========================================================= */
+uint64_t countCorrect(const plantedFile* planted, int32_t file, uint64_t size) {
+	uint8_t expected[ISO_SECTOR];
+	uint8_t actual[ISO_SECTOR];
+	uint64_t end = (size < planted->m_size) ? size : planted->m_size;
+	uint64_t correct = 0;
+
+	for (uint64_t offset = 0; offset < end; offset += ISO_SECTOR) {
+		uint32_t length = (end - offset < ISO_SECTOR) ? end - offset : ISO_SECTOR;
+		if (pread(file, actual, length, offset) != length)
+			break;
+		fileContent(planted, offset, expected, ISO_SECTOR);
+		for (uint32_t i = 0; i < length; i++)
+			correct += expected[i] == actual[i];
+	}
+	return correct;
+}
+
+/* ============================================================
+ * Returns a rate in MB/s.
+ * ========================================================= */
+double rate(double bytes, double time) {
+	return (time > 0) ? bytes / MB / time : 0;
+}
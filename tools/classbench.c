@@ -0,0 +1,654 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+
+#include "synthImage.h"
+#include "recover.h"
+#include "safeio.h"
+#include "scan.h"
+
+#define USAGE "Usage: ./classbench.exe record <image> <corpus dir> [-n blocks]\n" \
+	"       ./classbench.exe capture <device> <corpus file> <label> <block|group> <count>\n" \
+	"       ./classbench.exe run <corpus dir> [-r repeats]\n"
+#define CORPUS_MAGIC "SDCORP01"
+#define CORPUS_SUFFIX ".corpus"
+#define DEFAULT_BLOCKS 2048
+#define DEFAULT_REPEATS 5
+
+// what the blocks of a corpus are, each classifier has one label
+// it should accept and must reject the blocks of every other
+enum Label {
+	LABEL_INDIRECT,		// indirect blocks of real files
+	LABEL_FIRST,		// first blocks of .iso files
+	LABEL_RANDOM,
+	LABEL_ZERO,
+	LABEL_TEXT,
+	LABEL_BITMAP,		// block bitmaps, for isAllocated only
+	NUM_LABELS
+};
+
+const char* labelNames[NUM_LABELS] = {
+	"indirect", "first", "random", "zero", "text", "bitmap"
+};
+
+// blocks of one kind kept in memory, each entry is a block
+// followed by the block DESCRIPTOR_OFFSET bytes past it, the
+// furthest the classifiers look
+typedef struct {
+	uint32_t m_label;
+	uint32_t m_blockSize;
+	uint32_t m_totalBlocks;	// of the file system recorded from, as far
+							// as block pointers reach
+	uint32_t m_count;
+	uint32_t m_capacity;
+	uint8_t* m_entries;
+} corpus;
+
+// header of a corpus file, followed by its entries
+typedef struct {
+	char m_magic[8];
+	uint32_t m_label;
+	uint32_t m_blockSize;
+	uint32_t m_totalBlocks;
+	uint32_t m_count;
+} corpusHeader;
+
+// one classifier pass over a corpus
+typedef struct {
+	const char* m_name;
+	uint32_t m_target;		// label the classifier should accept
+	uint64_t (*m_pass)(scanSession*, const corpus*, uint64_t, uint64_t*);
+} classifier;
+
+// totals of one classifier across every corpus
+typedef struct {
+	uint64_t m_positives;
+	uint64_t m_negatives;
+	uint64_t m_falsePositives;
+	uint64_t m_falseNegatives;
+} errorRates;
+
+int32_t record(int32_t, const char**);
+int32_t capture(int32_t, const char**);
+int32_t run(int32_t, const char**);
+void initCorpus(corpus*, uint32_t, uint32_t, uint32_t);
+uint8_t* addEntry(corpus*);
+uint8_t* entryAt(const corpus*, uint32_t);
+void recordEntry(scanSession*, corpus*, uint64_t);
+uint32_t reachableBlocks(const scanSession*);
+void writeCorpus(const char*, const corpus*);
+uint32_t readCorpus(const char*, corpus*);
+uint32_t labelOf(const char*);
+int32_t loadDevice(corpus*, uint32_t);
+uint64_t indirectPass(scanSession*, const corpus*, uint64_t, uint64_t*);
+uint64_t firstBlockPass(scanSession*, const corpus*, uint64_t, uint64_t*);
+uint64_t signaturePass(scanSession*, const corpus*, uint64_t, uint64_t*);
+uint64_t allocatedPass(scanSession*, const corpus*, uint64_t, uint64_t*);
+uint64_t nanos();
+
+const classifier classifiers[] = {
+	{ "isIndirectBlock", LABEL_INDIRECT, indirectPass },
+	{ "isLikelyFirstBlock", LABEL_FIRST, firstBlockPass },
+	{ "hasISOSignature", LABEL_FIRST, signaturePass },
+	{ "isAllocated", LABEL_BITMAP, allocatedPass }
+};
+
+/* ============================================================
+ * Records corpora of labelled blocks to files and replays them
+ * from memory through each of the block classifiers, reporting
+ * the time spent per block and how often each classifier
+ * accepts blocks it should reject and the reverse.
+ * ========================================================= */
+int32_t main(int32_t argc, const char** argv) {
+	if (argc >= 4 && strcmp(argv[1], "record") == 0)
+		return record(argc, argv);
+	if (argc == 7 && strcmp(argv[1], "capture") == 0)
+		return capture(argc, argv);
+	if (argc >= 3 && strcmp(argv[1], "run") == 0)
+		return run(argc, argv);
+
+	fprintf(stderr, USAGE);
+	exit(EXIT_FAILURE);
+}
+
+/* ============================================================
+ * Records a corpus of each label. Indirect blocks, first
+ * blocks and bitmaps are read from a synthetic image made by
+ * mkimage.exe, whose manifest says where they are, and the
+ * random, zero and text corpora are generated like its noise.
+ * ========================================================= */
+int32_t record(int32_t argc, const char** argv) {
+	uint32_t numBlocks = DEFAULT_BLOCKS;
+	if (argc % 2 != 0) {
+		fprintf(stderr, USAGE);
+		exit(EXIT_FAILURE);
+	}
+	for (int32_t i = 4; i < argc; i += 2) {
+		if (strcmp(argv[i], "-n") == 0 && atoi(argv[i + 1]) > 0)
+			numBlocks = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, USAGE);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	char path[PATH_MAX];
+	imageManifest* manifest = malloc(sizeof(imageManifest));
+	snprintf(path, sizeof(path), "%s%s", argv[2], MANIFEST_SUFFIX);
+	if (!manifest || !readManifest(path, manifest)) {
+		fprintf(stderr, "Failed to read manifest %s.\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	scanSession session;
+	initSession(&session, safeOpen(argv[2], O_RDONLY, 0));
+	if (!loadSuperblock(&session, manifest->m_partitionAddr)) {
+		fprintf(stderr, "No file system found in %s.\n", argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	uint32_t blockSize = session.m_blockSize;
+	uint32_t totalBlocks = reachableBlocks(&session);
+	corpus corpora[NUM_LABELS];
+	for (uint32_t k = 0; k < NUM_LABELS; k++)
+		initCorpus(&corpora[k], k, blockSize, totalBlocks);
+
+	for (uint32_t i = 0; i < manifest->m_numIndirect; i++)
+		recordEntry(&session, &corpora[LABEL_INDIRECT], manifest->m_indirectBlocks[i]);
+	for (uint32_t i = 0; i < manifest->m_numFiles; i++)
+		recordEntry(&session, &corpora[LABEL_FIRST], manifest->m_files[i].m_firstBlock);
+	for (uint32_t grp = 0; grp < numBlockGroups(&session); grp++)
+		memcpy(addEntry(&corpora[LABEL_BITMAP]), groupBitmap(&session, grp), blockSize);
+
+	// the image only holds a few planted files, so more first
+	// blocks are generated the same way
+	uint64_t rng = manifest->m_files[0].m_seed;
+	while (corpora[LABEL_FIRST].m_count < numBlocks / 8) {
+		plantedFile file = { 0, 1024 * 1024, synthRandom(&rng), PACKED };
+		uint8_t* entry = addEntry(&corpora[LABEL_FIRST]);
+		fileContent(&file, 0, entry, blockSize);
+		fileContent(&file, DESCRIPTOR_OFFSET, entry + blockSize, blockSize);
+	}
+
+	for (uint32_t i = 0; i < numBlocks; i++) {
+		uint8_t* entry = addEntry(&corpora[LABEL_RANDOM]);
+		randomBlock(rng, 2 * i, entry, blockSize);
+		randomBlock(rng, 2 * i + 1, entry + blockSize, blockSize);
+
+		entry = addEntry(&corpora[LABEL_TEXT]);
+		textBlock(&rng, entry, 2 * blockSize);
+
+		addEntry(&corpora[LABEL_ZERO]);
+	}
+
+	for (uint32_t k = 0; k < NUM_LABELS; k++) {
+		snprintf(path, sizeof(path), "%s/%s%s", argv[3], labelNames[k], CORPUS_SUFFIX);
+		writeCorpus(path, &corpora[k]);
+		printf("Recorded %u %s blocks to %s.\n", corpora[k].m_count, labelNames[k], path);
+		free(corpora[k].m_entries);
+	}
+
+	close(session.m_deviceID);
+	freeSession(&session);
+	freeManifest(manifest);
+	free(manifest);
+	return EXIT_SUCCESS;
+}
+
+/* ============================================================
+ * Records a run of blocks of a real device or image as one
+ * corpus, e.g. indirect blocks listed by debugfs, so
+ * classifiers can be measured on more than synthetic data.
+ * The device's first partition is used if it has a partition
+ * table, otherwise the device itself.
+ * ========================================================= */
+int32_t capture(int32_t argc, const char** argv) {
+	uint32_t label = labelOf(argv[4]);
+	uint64_t first = strtoull(argv[5], NULL, 0);
+	uint32_t count = strtoul(argv[6], NULL, 0);
+	if (label == NUM_LABELS) {
+		fprintf(stderr, "Unknown label %s.\n", argv[4]);
+		exit(EXIT_FAILURE);
+	}
+
+	scanSession session;
+	initSession(&session, safeOpen(argv[2], O_RDONLY, 0));
+	uint64_t addr = parsePartitionAddr(&session, 0);
+	if (!addr && !loadSuperblock(&session, 0)) {
+		fprintf(stderr, "No file system found in %s.\n", argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	corpus captured;
+	initCorpus(&captured, label, session.m_blockSize, reachableBlocks(&session));
+	// bitmaps are captured by block group number
+	uint64_t limit = (label == LABEL_BITMAP)
+		? numBlockGroups(&session) : session.m_totalBlocks;
+	for (uint32_t i = 0; i < count && first + i < limit; i++) {
+		if (label == LABEL_BITMAP)
+			memcpy(addEntry(&captured), groupBitmap(&session, first + i),
+				session.m_blockSize);
+		else
+			recordEntry(&session, &captured, first + i);
+	}
+
+	writeCorpus(argv[3], &captured);
+	printf("Recorded %u %s blocks to %s.\n", captured.m_count, argv[4], argv[3]);
+	free(captured.m_entries);
+	close(session.m_deviceID);
+	freeSession(&session);
+	return EXIT_SUCCESS;
+}
+
+/* ============================================================
+ * Replays every corpus in a directory through each classifier
+ * and prints the best time per block over a number of repeats
+ * and the rate of accepted blocks, then the false positive and
+ * false negative rates of each classifier. isAllocated is
+ * checked against a plain bit test of the recorded bitmaps.
+ * ========================================================= */
+int32_t run(int32_t argc, const char** argv) {
+	uint32_t repeats = DEFAULT_REPEATS;
+	if (argc % 2 != 1) {
+		fprintf(stderr, USAGE);
+		exit(EXIT_FAILURE);
+	}
+	for (int32_t i = 3; i < argc; i += 2) {
+		if (strcmp(argv[i], "-r") == 0 && atoi(argv[i + 1]) > 0)
+			repeats = atoi(argv[i + 1]);
+		else {
+			fprintf(stderr, USAGE);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	char path[PATH_MAX];
+	corpus corpora[NUM_LABELS];
+	uint32_t numLoaded = 0;
+	uint32_t blockSize = 0;
+	uint32_t totalBlocks = 0;
+
+	for (uint32_t k = 0; k < NUM_LABELS; k++) {
+		snprintf(path, sizeof(path), "%s/%s%s", argv[2], labelNames[k], CORPUS_SUFFIX);
+		if (!readCorpus(path, &corpora[k]))
+			continue;
+		if (blockSize && corpora[k].m_blockSize != blockSize) {
+			fprintf(stderr, "%s was recorded with a different block size.\n", path);
+			exit(EXIT_FAILURE);
+		}
+		blockSize = corpora[k].m_blockSize;
+		if (corpora[k].m_totalBlocks > totalBlocks)
+			totalBlocks = corpora[k].m_totalBlocks;
+		numLoaded++;
+	}
+	if (!numLoaded) {
+		fprintf(stderr, "No corpora found in %s.\n", argv[2]);
+		exit(EXIT_FAILURE);
+	}
+
+	// isLikelyFirstBlock reads past the block from the device,
+	// so the entries are also laid out in an in-memory file
+	scanSession session;
+	initSession(&session, loadDevice(corpora, numLoaded));
+	session.m_blockSize = blockSize;
+	session.m_kernels = selectKernels(blockSize);
+	session.m_totalBlocks = totalBlocks;
+
+	printf("%-20s %-10s %8s %10s %9s\n", "classifier", "corpus", "blocks", "ns/block", "accepted");
+	uint32_t numClassifiers = sizeof(classifiers) / sizeof(classifiers[0]);
+	errorRates rates[numClassifiers];
+	memset(rates, 0, sizeof(rates));
+
+	for (uint32_t c = 0; c < numClassifiers; c++) {
+		const classifier* test = &classifiers[c];
+		uint64_t firstEntry = 0;
+
+		for (uint32_t k = 0; k < NUM_LABELS; k++) {
+			const corpus* blocks = &corpora[k];
+			if (blocks->m_count == 0)
+				continue;
+
+			uint64_t start = firstEntry;
+			firstEntry += blocks->m_count;
+
+			// bitmaps only make sense to isAllocated and the
+			// other blocks only to the block classifiers
+			if ((k == LABEL_BITMAP) != (test->m_target == LABEL_BITMAP))
+				continue;
+
+			uint64_t best = UINT64_MAX;
+			uint64_t counts[2];
+			uint64_t numTested = 0;
+
+			for (uint32_t r = 0; r < repeats; r++) {
+				counts[0] = counts[1] = 0;
+				uint64_t before = nanos();
+				numTested = test->m_pass(&session, blocks, start, counts);
+				uint64_t elapsed = nanos() - before;
+				if (elapsed < best)
+					best = elapsed;
+			}
+			uint64_t accepted = counts[0];
+
+			errorRates* rate = &rates[c];
+			if (test->m_target == LABEL_BITMAP) {
+				// mismatches with the plain bit test, which is
+				// the label of every bit
+				rate->m_positives += numTested;
+				rate->m_falsePositives += counts[1] & UINT32_MAX;
+				rate->m_falseNegatives += counts[1] >> 32;
+			} else if (k == test->m_target) {
+				rate->m_positives += numTested;
+				rate->m_falseNegatives += numTested - accepted;
+			} else {
+				rate->m_negatives += numTested;
+				rate->m_falsePositives += accepted;
+			}
+
+			printf("%-20s %-10s %8lu %10.1f %8.2f%%\n",
+				test->m_name, labelNames[k], numTested,
+				(double)best / numTested, 100.0 * accepted / numTested);
+		}
+	}
+
+	printf("\n%-20s %22s %22s\n", "classifier", "false positives", "false negatives");
+	for (uint32_t c = 0; c < numClassifiers; c++) {
+		errorRates* rate = &rates[c];
+		uint64_t negatives = rate->m_negatives;
+		uint64_t positives = rate->m_positives;
+
+		// isAllocated has no negative corpus, a wrong bit either
+		// way is counted against all the bits tested
+		if (classifiers[c].m_target == LABEL_BITMAP)
+			negatives = positives;
+		printf("%-20s %12lu (%6.2f%%) %12lu (%6.2f%%)\n", classifiers[c].m_name,
+			rate->m_falsePositives,
+			negatives ? 100.0 * rate->m_falsePositives / negatives : 0.0,
+			rate->m_falseNegatives,
+			positives ? 100.0 * rate->m_falseNegatives / positives : 0.0);
+	}
+
+	close(session.m_deviceID);
+	freeSession(&session);
+	for (uint32_t k = 0; k < NUM_LABELS; k++)
+		free(corpora[k].m_entries);
+	return EXIT_SUCCESS;
+}
+
+/* ============================================================
+ * Initializes an empty corpus.
+ * ========================================================= */
+void initCorpus(corpus* blocks, uint32_t label, uint32_t blockSize, uint32_t totalBlocks) {
+	memset(blocks, 0, sizeof(corpus));
+	blocks->m_label = label;
+	blocks->m_blockSize = blockSize;
+	blocks->m_totalBlocks = totalBlocks;
+}
+
+/* ============================================================
+ * Appends a zeroed entry to a corpus and returns it.
+ * ========================================================= */
+uint8_t* addEntry(corpus* blocks) {
+	uint64_t entrySize = 2 * blocks->m_blockSize;
+
+	if (blocks->m_count == blocks->m_capacity) {
+		blocks->m_capacity = blocks->m_capacity ? blocks->m_capacity * 2 : 256;
+		blocks->m_entries = realloc(blocks->m_entries, blocks->m_capacity * entrySize);
+		if (!blocks->m_entries)
+			exit_err("Failed to allocate corpus");
+	}
+	uint8_t* entry = entryAt(blocks, blocks->m_count++);
+	memset(entry, 0, entrySize);
+	return entry;
+}
+
+/* ============================================================
+ * Returns an entry of a corpus, the block followed by the
+ * block DESCRIPTOR_OFFSET bytes past it.
+ * ========================================================= */
+uint8_t* entryAt(const corpus* blocks, uint32_t index) {
+	return blocks->m_entries + (uint64_t)index * 2 * blocks->m_blockSize;
+}
+
+/* ============================================================
+ * Returns how many blocks of the session's partition a block
+ * pointer can reach, all of them below 2^32.
+ * ========================================================= */
+uint32_t reachableBlocks(const scanSession* session) {
+	return (session->m_totalBlocks > UINT32_MAX) ? UINT32_MAX : session->m_totalBlocks;
+}
+
+/* ============================================================
+ * Appends a block of the session's partition to a corpus,
+ * with the block DESCRIPTOR_OFFSET bytes past it.
+ *
+ * Parameters:
+ * 	session - a session with its superblock loaded.
+ *  blocks - the corpus to add to.
+ *  blockNum - the block to add.
+ * ========================================================= */
+void recordEntry(scanSession* session, corpus* blocks, uint64_t blockNum) {
+	uint8_t* entry = addEntry(blocks);
+	uint64_t addr = blockAddr(session, blockNum);
+	safeRead(session->m_deviceID, addr, entry, session->m_blockSize);
+	safeRead(session->m_deviceID, addr + DESCRIPTOR_OFFSET,
+		entry + session->m_blockSize, session->m_blockSize);
+}
+
+/* ============================================================
+ * Writes a corpus to a file.
+ * ========================================================= */
+void writeCorpus(const char* path, const corpus* blocks) {
+	corpusHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.m_magic, CORPUS_MAGIC, sizeof(header.m_magic));
+	header.m_label = blocks->m_label;
+	header.m_blockSize = blocks->m_blockSize;
+	header.m_totalBlocks = blocks->m_totalBlocks;
+	header.m_count = blocks->m_count;
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		exit_err("Failed to open corpus");
+	uint64_t entrySize = 2 * blocks->m_blockSize;
+	if (
+		fwrite(&header, sizeof(header), 1, file) != 1 ||
+		fwrite(blocks->m_entries, entrySize, blocks->m_count, file) != blocks->m_count
+	)
+		exit_err("Failed to write corpus");
+	fclose(file);
+}
+
+/* ============================================================
+ * Reads a corpus written by writeCorpus.
+ *
+ * Parameters:
+ * 	path - the path of the corpus.
+ *  blocks - output parameter for the corpus, left empty if it
+ *           could not be read.
+ *
+ * Returns:
+ * 	Returns a 1 if the corpus was read, 0 otherwise.
+ * ========================================================= */
+uint32_t readCorpus(const char* path, corpus* blocks) {
+	memset(blocks, 0, sizeof(corpus));
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return 0;
+
+	corpusHeader header;
+	if (
+		fread(&header, sizeof(header), 1, file) != 1 ||
+		memcmp(header.m_magic, CORPUS_MAGIC, sizeof(header.m_magic)) != 0 ||
+		header.m_label >= NUM_LABELS || header.m_blockSize == 0
+	) {
+		fprintf(stderr, "%s is not a corpus.\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	initCorpus(blocks, header.m_label, header.m_blockSize, header.m_totalBlocks);
+	uint64_t entrySize = 2 * header.m_blockSize;
+	blocks->m_entries = malloc(header.m_count * entrySize);
+	if (header.m_count && !blocks->m_entries)
+		exit_err("Failed to allocate corpus");
+	blocks->m_count = fread(blocks->m_entries, entrySize, header.m_count, file);
+	blocks->m_capacity = header.m_count;
+	fclose(file);
+	return 1;
+}
+
+/* ============================================================
+ * Returns the label with the given name, or NUM_LABELS if
+ * there is none.
+ * ========================================================= */
+uint32_t labelOf(const char* name) {
+	uint32_t label = 0;
+	while (label < NUM_LABELS && strcmp(name, labelNames[label]) != 0)
+		label++;
+	return label;
+}
+
+/* ============================================================
+ * Lays the entries of every corpus out in an in-memory file,
+ * in label order, so entry i's block is at i times the entry
+ * stride and the block after it DESCRIPTOR_OFFSET bytes later.
+ * The space between them is left as a hole.
+ *
+ * Parameters:
+ * 	corpora - a corpus of each label, possibly empty.
+ *  numLoaded - the number of corpora that are not empty.
+ *
+ * Returns:
+ * 	Returns the descriptor of the file.
+ * ========================================================= */
+int32_t loadDevice(corpus* corpora, uint32_t numLoaded) {
+	int32_t device = memfd_create("corpora", 0);
+	if (device < 0)
+		exit_err("Failed to create in-memory device");
+
+	uint64_t entry = 0;
+	for (uint32_t k = 0; k < NUM_LABELS; k++) {
+		uint32_t blockSize = corpora[k].m_blockSize;
+		uint64_t stride = DESCRIPTOR_OFFSET + blockSize;
+
+		for (uint32_t i = 0; i < corpora[k].m_count; i++, entry++) {
+			uint8_t* block = entryAt(&corpora[k], i);
+			if (
+				pwrite(device, block, blockSize, entry * stride) != blockSize ||
+				pwrite(device, block + blockSize, blockSize,
+					entry * stride + DESCRIPTOR_OFFSET) != blockSize
+			)
+				exit_err("Failed to write in-memory device");
+		}
+	}
+	return device;
+}
+
+/* ============================================================
+ * Runs isIndirectBlock over every block of a corpus.
+ *
+ * Parameters:
+ * 	session - the session the blocks are classified in.
+ *  blocks - the corpus.
+ *  firstEntry - index of the corpus' first entry in the
+ *               in-memory device.
+ *  counts - the number of accepted blocks is added to the
+ *           first count.
+ *
+ * Returns:
+ * 	Returns the number of blocks classified.
+ * ========================================================= */
+uint64_t indirectPass(
+	scanSession* session,
+	const corpus* blocks,
+	uint64_t firstEntry,
+	uint64_t* counts
+) {
+	uint32_t numEntries = blocks->m_blockSize >> 2;
+	for (uint32_t i = 0; i < blocks->m_count; i++)
+		counts[0] += isIndirectBlock(session,
+			(const uint32_t*)entryAt(blocks, i), numEntries) != 0;
+	return blocks->m_count;
+}
+
+/* ============================================================
+ * Runs isLikelyFirstBlock over every block of a corpus, which
+ * reads the block after it from the in-memory device.
+ * ========================================================= */
+uint64_t firstBlockPass(
+	scanSession* session,
+	const corpus* blocks,
+	uint64_t firstEntry,
+	uint64_t* counts
+) {
+	uint64_t stride = DESCRIPTOR_OFFSET + blocks->m_blockSize;
+	for (uint32_t i = 0; i < blocks->m_count; i++)
+		counts[0] += isLikelyFirstBlock(session,
+			entryAt(blocks, i), (firstEntry + i) * stride) != 0;
+	return blocks->m_count;
+}
+
+/* ============================================================
+ * Runs hasISOSignature over the block DESCRIPTOR_OFFSET bytes
+ * past every block of a corpus, where a first block's primary
+ * volume descriptor is.
+ * ========================================================= */
+uint64_t signaturePass(
+	scanSession* session,
+	const corpus* blocks,
+	uint64_t firstEntry,
+	uint64_t* counts
+) {
+	for (uint32_t i = 0; i < blocks->m_count; i++)
+		counts[0] += hasISOSignature(entryAt(blocks, i) + blocks->m_blockSize) != 0;
+	return blocks->m_count;
+}
+
+/* ============================================================
+ * Runs isAllocated over every bit of every bitmap in a corpus
+ * and compares it with a plain bit test. Bits it wrongly calls
+ * allocated are added to the low half of the second count and
+ * bits it wrongly calls free to the high half.
+ *
+ * Returns:
+ * 	Returns the number of bits tested.
+ * ========================================================= */
+uint64_t allocatedPass(
+	scanSession* session,
+	const corpus* blocks,
+	uint64_t firstEntry,
+	uint64_t* counts
+) {
+	uint32_t numBlocksInGrp = blocks->m_blockSize << 3;
+	for (uint32_t i = 0; i < blocks->m_count; i++) {
+		uint8_t* bitmap = entryAt(blocks, i);
+		session->m_bitmap = bitmap;
+
+		for (uint32_t bit = 0; bit < numBlocksInGrp; bit++) {
+			uint32_t allocated = isAllocated(session, bit, numBlocksInGrp) != 0;
+			uint32_t expected = (bitmap[bit >> 3] >> (bit & 7)) & 1;
+			counts[0] += allocated;
+			if (allocated != expected)
+				counts[1] += allocated ? 1 : (uint64_t)1 << 32;
+		}
+	}
+	session->m_bitmap = NULL;
+	return (uint64_t)blocks->m_count * numBlocksInGrp;
+}
+
+/* ============================================================
+ * Returns the current monotonic time in nanoseconds.
+ * ========================================================= */
+uint64_t nanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
@@ -0,0 +1,986 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "synthImage.h"
+#include "mbr.h"
+#include "safeio.h"
+#include "superblock.h"
+
+#define USAGE "Usage: ./mkimage.exe <image> [-b blocks] [-bs block size] " \
+	"[-n files] [-max MiB] [-seed n]\n"
+#define MIB (1024 * 1024)
+#define MIN_FILE_BYTES (256 * 1024)
+
+#define GRP_DESC_SIZE 32
+#define INODE_SIZE 128
+#define INODE_TABLE_BLOCKS 8
+#define ROOT_INODE 2
+#define JOURNAL_INODE 8
+#define LOST_FOUND_INODE 11
+#define FIRST_INODE 11
+#define JOURNAL_INUM_OFFSET 0xe0
+#define JOURNAL_BLOCKS 1024
+#define JOURNAL_MAGIC 0xc03b3998
+#define JOURNAL_SUPERBLOCK_V2 4
+#define MAX_NOISE_RUN 512
+#define FEATURE_COMPAT_HAS_JOURNAL 0x4
+#define FEATURE_INCOMPAT_FILETYPE 0x2
+#define FEATURE_RO_COMPAT_SPARSE_SUPER 0x1
+
+// what a block written through a fileAlloc holds
+enum BlockKind {
+	PLANTED_DATA,	// a planted deleted .iso
+	LIVE_DATA,		// a random allocated file
+	JOURNAL_DATA	// the journal, zeroed but for its superblock
+};
+
+// noise written to every block the generator did not plant
+enum NoiseKind {
+	LIVE_RANDOM,
+	LIVE_TEXT,
+	LIVE_FILE,
+	FREE_ZERO,
+	FREE_RANDOM,
+	FREE_TEXT,
+	NUM_NOISE_KINDS
+};
+
+// state of the image being generated
+typedef struct {
+	int32_t m_fd;
+	uint64_t m_partitionAddr;
+	uint32_t m_blockSize;
+	uint32_t m_totalBlocks;
+	uint32_t m_blocksPerGroup;
+	uint32_t m_numGroups;
+	uint32_t m_firstDataBlock;
+	uint32_t m_gdtBlocks;
+	uint32_t m_inodesPerGroup;
+	uint8_t* m_taken;			// bit per block written by the generator
+	uint8_t* m_used;			// bit per block marked allocated
+	uint64_t m_rng;
+	uint32_t m_journalInode[15];
+	uint32_t* m_journalBlocks;	// data blocks of the journal
+	uint32_t m_numJournalBlocks;
+	uint32_t m_rootBlock;		// directory blocks of / and /lost+found
+	uint32_t m_lostFoundBlock;
+	uint32_t* m_plantedMeta;	// indirect blocks of planted files
+	uint32_t m_numPlantedMeta;
+} imageGen;
+
+// where the next blocks of a file being mapped are placed
+typedef struct {
+	uint32_t m_kind;
+	uint32_t m_layout;
+	uint32_t m_cursor;		// next block of an interleaved file, or of
+							// the indirect blocks after the data otherwise
+	uint32_t m_dataStart;
+	uint64_t m_splitAt;		// first data block after the gap
+	uint32_t m_gap;
+	const plantedFile* m_file;
+	uint64_t m_seed;
+} fileAlloc;
+
+void parseArgs(int32_t, const char**, imageGen*, uint32_t*, uint64_t*, uint64_t*);
+void initGen(imageGen*, const char*, uint32_t, uint32_t, uint64_t);
+uint32_t groupStart(const imageGen*, uint32_t);
+uint32_t groupEnd(const imageGen*, uint32_t);
+uint32_t groupDataStart(const imageGen*, uint32_t);
+uint32_t hasBackup(uint32_t);
+uint32_t isPowerOfBase(uint32_t, uint32_t);
+void claimBlock(imageGen*, uint32_t, uint32_t);
+uint32_t isTaken(const imageGen*, uint32_t);
+void writeBlockAt(imageGen*, uint32_t, const uint8_t*);
+uint32_t metaBlocksFor(uint64_t, uint32_t);
+void mapFile(imageGen*, fileAlloc*, uint64_t, uint32_t*);
+uint32_t buildIndirect(imageGen*, fileAlloc*, uint32_t, uint64_t*, uint64_t);
+uint32_t allocData(imageGen*, fileAlloc*, uint64_t);
+uint32_t allocMeta(imageGen*, fileAlloc*);
+void createJournal(imageGen*);
+void createDirectories(imageGen*);
+void addDirEntry(uint8_t*, uint32_t*, uint32_t, uint16_t, const char*);
+void plantFiles(imageGen*, imageManifest*, uint32_t, uint64_t);
+uint32_t placeFile(imageGen*, uint32_t, uint32_t);
+void copyIntoJournal(imageGen*);
+void fillNoise(imageGen*);
+void writeMetadata(imageGen*, uint64_t);
+void writeInodes(imageGen*);
+void writeInode(imageGen*, uint32_t, uint16_t, uint32_t, uint16_t, uint32_t, const uint32_t*);
+void writeMBR(imageGen*);
+
+/* ============================================================
+ *							MAIN
+ * ========================================================= */
+int32_t main(int32_t argc, const char** argv) {
+	imageGen gen;
+	imageManifest manifest;
+	uint32_t numFiles;
+	uint64_t maxBytes, seed;
+
+	parseArgs(argc, argv, &gen, &numFiles, &maxBytes, &seed);
+	memset(&manifest, 0, sizeof(manifest));
+
+	createJournal(&gen);
+	createDirectories(&gen);
+	plantFiles(&gen, &manifest, numFiles, maxBytes);
+	copyIntoJournal(&gen);
+	fillNoise(&gen);
+	writeMetadata(&gen, seed);
+	writeMBR(&gen);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s%s", argv[1], MANIFEST_SUFFIX);
+	manifest.m_blockSize = gen.m_blockSize;
+	manifest.m_totalBlocks = gen.m_totalBlocks;
+	manifest.m_partitionAddr = gen.m_partitionAddr;
+	manifest.m_indirectBlocks = gen.m_plantedMeta;
+	manifest.m_numIndirect = gen.m_numPlantedMeta;
+	writeManifest(path, &manifest);
+
+	printf("Wrote %s: %u blocks of %u bytes in %u groups, %u planted files.\n",
+		argv[1], gen.m_totalBlocks, gen.m_blockSize, gen.m_numGroups,
+		manifest.m_numFiles);
+	printf("Planted files are listed in %s.\n", path);
+
+	close(gen.m_fd);
+	free(gen.m_taken);
+	free(gen.m_used);
+	free(gen.m_journalBlocks);
+	free(gen.m_plantedMeta);
+	return EXIT_SUCCESS;
+}
+
+/* ============================================================
+ * Parses the program arguments and sets up the generator.
+ *
+ * Parameters:
+ * 	argc - the number of arguments.
+ * 	argv - the program arguments.
+ *  gen - the generator to set up.
+ *  numFiles - output parameter for the number of files to plant.
+ *  maxBytes - output parameter for the largest planted file.
+ *  seed - output parameter for the seed of the image.
+ * ========================================================= */
+void parseArgs(
+	int32_t argc,
+	const char** argv,
+	imageGen* gen,
+	uint32_t* numFiles,
+	uint64_t* maxBytes,
+	uint64_t* seed
+) {
+	uint32_t numBlocks = 262144;
+	uint32_t blockSize = 4096;
+	*numFiles = 8;
+	*maxBytes = 16 * MIB;
+	*seed = 1;
+
+	if (argc < 2 || argc % 2 != 0) {
+		fprintf(stderr, USAGE);
+		exit(EXIT_FAILURE);
+	}
+
+	for (int32_t i = 2; i < argc; i += 2) {
+		const char* value = argv[i + 1];
+		if (strcmp(argv[i], "-b") == 0)
+			numBlocks = strtoul(value, NULL, 10);
+		else if (strcmp(argv[i], "-bs") == 0)
+			blockSize = strtoul(value, NULL, 10);
+		else if (strcmp(argv[i], "-n") == 0)
+			*numFiles = strtoul(value, NULL, 10);
+		else if (strcmp(argv[i], "-max") == 0)
+			*maxBytes = strtoull(value, NULL, 10) * MIB;
+		else if (strcmp(argv[i], "-seed") == 0)
+			*seed = strtoull(value, NULL, 10);
+		else {
+			fprintf(stderr, USAGE);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (blockSize != 1024 && blockSize != 2048 && blockSize != 4096) {
+		fprintf(stderr, "Block size must be 1024, 2048 or 4096.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (*numFiles > MAX_PLANTED)
+		*numFiles = MAX_PLANTED;
+	if (*maxBytes < MIN_FILE_BYTES)
+		*maxBytes = MIN_FILE_BYTES;
+
+	initGen(gen, argv[1], numBlocks, blockSize, *seed);
+}
+
+/* ============================================================
+ * Creates the image file and lays out the block groups, the
+ * partition starts at PARTITION_LBA.
+ *
+ * Parameters:
+ * 	gen - the generator to set up.
+ *  path - the path of the image.
+ *  numBlocks - the size of the file system in blocks.
+ *  blockSize - the size of a block in bytes.
+ *  seed - the seed every random choice derives from.
+ * ========================================================= */
+void initGen(
+	imageGen* gen,
+	const char* path,
+	uint32_t numBlocks,
+	uint32_t blockSize,
+	uint64_t seed
+) {
+	memset(gen, 0, sizeof(imageGen));
+	gen->m_partitionAddr = (uint64_t)PARTITION_LBA * SECTOR_SIZE;
+	gen->m_blockSize = blockSize;
+	gen->m_blocksPerGroup = blockSize << 3;
+	gen->m_firstDataBlock = (blockSize == 1024) ? 1 : 0;
+	gen->m_inodesPerGroup = INODE_TABLE_BLOCKS * blockSize / INODE_SIZE;
+	gen->m_rng = seed;
+
+	// a last group too small for its own metadata is dropped
+	uint32_t groupMeta = 3 + INODE_TABLE_BLOCKS + 64;
+	uint32_t numGroups = (numBlocks - gen->m_firstDataBlock
+		+ gen->m_blocksPerGroup - 1) / gen->m_blocksPerGroup;
+	uint32_t lastStart = gen->m_firstDataBlock + (numGroups - 1) * gen->m_blocksPerGroup;
+	if (numGroups > 1 && numBlocks - lastStart < groupMeta + 64) {
+		numGroups--;
+		numBlocks = lastStart;
+	}
+	if (numBlocks < gen->m_blocksPerGroup / 2) {
+		fprintf(stderr, "Image needs at least %u blocks.\n", gen->m_blocksPerGroup / 2);
+		exit(EXIT_FAILURE);
+	}
+
+	gen->m_totalBlocks = numBlocks;
+	gen->m_numGroups = numGroups;
+	gen->m_gdtBlocks = (numGroups * GRP_DESC_SIZE + blockSize - 1) / blockSize;
+
+	gen->m_taken = calloc(numBlocks / 8 + 1, 1);
+	gen->m_used = calloc(numBlocks / 8 + 1, 1);
+	if (!gen->m_taken || !gen->m_used)
+		exit_err("Failed to allocate block maps");
+
+	gen->m_fd = safeOpen(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (ftruncate(gen->m_fd, gen->m_partitionAddr + (uint64_t)numBlocks * blockSize))
+		exit_err("Failed to size image");
+
+	// superblock copies, group descriptors, bitmaps and inode tables
+	for (uint32_t grp = 0; grp < numGroups; grp++) {
+		uint32_t start = groupStart(gen, grp);
+		for (uint32_t b = start; b < groupDataStart(gen, grp); b++)
+			claimBlock(gen, b, 1);
+	}
+	for (uint32_t b = 0; b < gen->m_firstDataBlock; b++)
+		claimBlock(gen, b, 1);
+}
+
+/* ============================================================
+ * Returns the first block of a block group.
+ * ========================================================= */
+uint32_t groupStart(const imageGen* gen, uint32_t grp) {
+	return gen->m_firstDataBlock + grp * gen->m_blocksPerGroup;
+}
+
+/* ============================================================
+ * Returns the block after the last block of a block group.
+ * ========================================================= */
+uint32_t groupEnd(const imageGen* gen, uint32_t grp) {
+	uint64_t end = (uint64_t)groupStart(gen, grp) + gen->m_blocksPerGroup;
+	return (end < gen->m_totalBlocks) ? end : gen->m_totalBlocks;
+}
+
+/* ============================================================
+ * Returns the first block of a group after its metadata; a
+ * superblock copy and the descriptors if it keeps a backup,
+ * then the block bitmap, inode bitmap and inode table.
+ * ========================================================= */
+uint32_t groupDataStart(const imageGen* gen, uint32_t grp) {
+	uint32_t start = groupStart(gen, grp);
+	if (hasBackup(grp))
+		start += 1 + gen->m_gdtBlocks;
+	return start + 2 + INODE_TABLE_BLOCKS;
+}
+
+/* ============================================================
+ * Returns whether a group keeps a copy of the superblock and
+ * descriptors, groups 0, 1 and powers of 3, 5 and 7 with the
+ * sparse_super feature.
+ * ========================================================= */
+uint32_t hasBackup(uint32_t grp) {
+	return grp == 0 || grp == 1 ||
+		isPowerOfBase(grp, 3) || isPowerOfBase(grp, 5) || isPowerOfBase(grp, 7);
+}
+
+/* ============================================================
+ * Returns if num is a power of base.
+ * ========================================================= */
+uint32_t isPowerOfBase(uint32_t num, uint32_t base) {
+	uint64_t power = 1;
+	while (power < num)
+		power *= base;
+	return power == num;
+}
+
+/* ============================================================
+ * Marks a block as written, and allocated if isUsed is set.
+ * ========================================================= */
+void claimBlock(imageGen* gen, uint32_t blockNum, uint32_t isUsed) {
+	gen->m_taken[blockNum >> 3] |= 1 << (blockNum & 7);
+	if (isUsed)
+		gen->m_used[blockNum >> 3] |= 1 << (blockNum & 7);
+}
+
+/* ============================================================
+ * Returns whether a block was already written.
+ * ========================================================= */
+uint32_t isTaken(const imageGen* gen, uint32_t blockNum) {
+	return gen->m_taken[blockNum >> 3] & (1 << (blockNum & 7));
+}
+
+/* ============================================================
+ * Writes a block of the file system to the image.
+ * ========================================================= */
+void writeBlockAt(imageGen* gen, uint32_t blockNum, const uint8_t* buffer) {
+	uint64_t addr = gen->m_partitionAddr + (uint64_t)blockNum * gen->m_blockSize;
+	if (pwrite(gen->m_fd, buffer, gen->m_blockSize, addr) != gen->m_blockSize)
+		exit_err("Failed to write image");
+}
+
+/* ============================================================
+ * Returns the number of indirect blocks needed to map a file.
+ *
+ * Parameters:
+ * 	numData - the number of data blocks in the file.
+ *  ptrs - the number of pointers in an indirect block.
+ * ========================================================= */
+uint32_t metaBlocksFor(uint64_t numData, uint32_t ptrs) {
+	if (numData <= 12)
+		return 0;
+	numData -= 12;
+	if (numData <= ptrs)
+		return 1;
+
+	numData -= ptrs;
+	uint64_t square = (uint64_t)ptrs * ptrs;
+	uint64_t doubleData = (numData < square) ? numData : square;
+	uint32_t count = 2 + (doubleData + ptrs - 1) / ptrs;
+	if (numData <= square)
+		return count;
+
+	numData -= square;
+	return count + 1 + (numData + square - 1) / square + (numData + ptrs - 1) / ptrs;
+}
+
+/* ============================================================
+ * Writes a file through the given allocator the way ext3 maps
+ * it; 12 direct blocks, then single, double and triple indirect
+ * trees, each indirect block placed before the blocks it maps.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  alloc - where to place the file's blocks.
+ *  numData - the number of data blocks in the file.
+ *  iblock - output array of the inode's 15 block pointers.
+ * ========================================================= */
+void mapFile(imageGen* gen, fileAlloc* alloc, uint64_t numData, uint32_t* iblock) {
+	uint64_t next = 0;
+	memset(iblock, 0, 15 * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < 12 && next < numData; i++)
+		iblock[i] = allocData(gen, alloc, next++);
+	for (uint32_t depth = 1; depth <= 3 && next < numData; depth++)
+		iblock[11 + depth] = buildIndirect(gen, alloc, depth, &next, numData);
+}
+
+/* ============================================================
+ * Places and writes an indirect block and the tree below it.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  alloc - where to place the file's blocks.
+ *  depth - 1 for a single indirect block, 2 double, 3 triple.
+ *  next - the index of the next data block to map, advanced
+ *         past the blocks mapped.
+ *  numData - the number of data blocks in the file.
+ *
+ * Returns:
+ * 	Returns the block number of the indirect block.
+ * ========================================================= */
+uint32_t buildIndirect(
+	imageGen* gen,
+	fileAlloc* alloc,
+	uint32_t depth,
+	uint64_t* next,
+	uint64_t numData
+) {
+	uint32_t ptrs = gen->m_blockSize >> 2;
+	uint32_t entries[ptrs];
+	uint32_t blockNum = allocMeta(gen, alloc);
+	memset(entries, 0, sizeof(entries));
+
+	for (uint32_t i = 0; i < ptrs && *next < numData; i++)
+		entries[i] = (depth == 1)
+			? allocData(gen, alloc, (*next)++)
+			: buildIndirect(gen, alloc, depth - 1, next, numData);
+
+	writeBlockAt(gen, blockNum, (uint8_t*)entries);
+	if (alloc->m_kind == PLANTED_DATA)
+		gen->m_plantedMeta[gen->m_numPlantedMeta++] = blockNum;
+	return blockNum;
+}
+
+/* ============================================================
+ * Places and writes a data block of a file.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  alloc - where to place the file's blocks.
+ *  index - the index of the block within the file.
+ *
+ * Returns:
+ * 	Returns the block number of the data block.
+ * ========================================================= */
+uint32_t allocData(imageGen* gen, fileAlloc* alloc, uint64_t index) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint8_t buffer[blockSize];
+	uint32_t blockNum;
+
+	if (alloc->m_layout == INTERLEAVED)
+		blockNum = alloc->m_cursor++;
+	else {
+		blockNum = alloc->m_dataStart + index;
+		if (index >= alloc->m_splitAt)
+			blockNum += alloc->m_gap;
+	}
+	claimBlock(gen, blockNum, alloc->m_kind != PLANTED_DATA);
+
+	switch (alloc->m_kind) {
+	case (PLANTED_DATA):
+		fileContent(alloc->m_file, index * blockSize, buffer, blockSize);
+		writeBlockAt(gen, blockNum, buffer);
+		break;
+	case (LIVE_DATA):
+		randomBlock(alloc->m_seed, index, buffer, blockSize);
+		writeBlockAt(gen, blockNum, buffer);
+		break;
+	case (JOURNAL_DATA):
+		// the image starts zeroed, only the journal superblock
+		// is written
+		gen->m_journalBlocks[index] = blockNum;
+		if (index == 0) {
+			uint32_t fields[] = {
+				JOURNAL_MAGIC, JOURNAL_SUPERBLOCK_V2, 0, blockSize,
+				gen->m_numJournalBlocks, 1
+			};
+			memset(buffer, 0, blockSize);
+			for (uint32_t i = 0; i < sizeof(fields) / 4; i++) {
+				// the journal is big endian
+				buffer[i * 4] = fields[i] >> 24;
+				buffer[i * 4 + 1] = fields[i] >> 16;
+				buffer[i * 4 + 2] = fields[i] >> 8;
+				buffer[i * 4 + 3] = fields[i];
+			}
+			writeBlockAt(gen, blockNum, buffer);
+		}
+		break;
+	}
+	return blockNum;
+}
+
+/* ============================================================
+ * Places an indirect block of a file.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  alloc - where to place the file's blocks.
+ * ========================================================= */
+uint32_t allocMeta(imageGen* gen, fileAlloc* alloc) {
+	uint32_t blockNum = alloc->m_cursor++;
+	claimBlock(gen, blockNum, alloc->m_kind != PLANTED_DATA);
+	return blockNum;
+}
+
+/* ============================================================
+ * Writes the journal at the start of the first group's data
+ * blocks, mapped by the journal inode like any other file.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ * ========================================================= */
+void createJournal(imageGen* gen) {
+	uint32_t ptrs = gen->m_blockSize >> 2;
+	uint32_t start = groupDataStart(gen, 0);
+	uint32_t space = (groupEnd(gen, 0) - start) / 2;
+
+	uint32_t numBlocks = JOURNAL_BLOCKS;
+	while (numBlocks + metaBlocksFor(numBlocks, ptrs) > space)
+		numBlocks--;
+
+	gen->m_numJournalBlocks = numBlocks;
+	gen->m_journalBlocks = malloc(numBlocks * sizeof(uint32_t));
+	if (!gen->m_journalBlocks)
+		exit_err("Failed to allocate journal");
+
+	fileAlloc alloc;
+	memset(&alloc, 0, sizeof(alloc));
+	alloc.m_kind = JOURNAL_DATA;
+	alloc.m_layout = INTERLEAVED;
+	alloc.m_cursor = start;
+	mapFile(gen, &alloc, numBlocks, gen->m_journalInode);
+}
+
+/* ============================================================
+ * Writes the blocks of the root directory and lost+found after
+ * the journal, so the image checks clean with e2fsck.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ * ========================================================= */
+void createDirectories(imageGen* gen) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint8_t buffer[blockSize];
+	uint32_t used;
+
+	gen->m_rootBlock = placeFile(gen, groupDataStart(gen, 0), 2);
+	gen->m_lostFoundBlock = gen->m_rootBlock + 1;
+	claimBlock(gen, gen->m_rootBlock, 1);
+	claimBlock(gen, gen->m_lostFoundBlock, 1);
+
+	memset(buffer, 0, blockSize);
+	used = 0;
+	addDirEntry(buffer, &used, ROOT_INODE, 12, ".");
+	addDirEntry(buffer, &used, ROOT_INODE, 12, "..");
+	addDirEntry(buffer, &used, LOST_FOUND_INODE, blockSize - used, "lost+found");
+	writeBlockAt(gen, gen->m_rootBlock, buffer);
+
+	memset(buffer, 0, blockSize);
+	used = 0;
+	addDirEntry(buffer, &used, LOST_FOUND_INODE, 12, ".");
+	addDirEntry(buffer, &used, ROOT_INODE, blockSize - used, "..");
+	writeBlockAt(gen, gen->m_lostFoundBlock, buffer);
+}
+
+/* ============================================================
+ * Appends a directory entry for a subdirectory to a directory
+ * block.
+ *
+ * Parameters:
+ * 	block - the directory block.
+ *  used - the bytes of the block used, advanced past the entry.
+ *  inodeNum - the inode the entry links to.
+ *  length - the record length of the entry.
+ *  name - the name of the entry.
+ * ========================================================= */
+void addDirEntry(
+	uint8_t* block,
+	uint32_t* used,
+	uint32_t inodeNum,
+	uint16_t length,
+	const char* name
+) {
+	uint8_t* entry = block + *used;
+	memcpy(entry, &inodeNum, 4);
+	memcpy(entry + 4, &length, 2);
+	entry[6] = strlen(name);
+	entry[7] = 2;		// directory
+	memcpy(entry + 8, name, entry[6]);
+	*used += length;
+}
+
+/* ============================================================
+ * Plants deleted .iso files spread evenly over the groups,
+ * cycling through every layout. Sizes are random up to the
+ * given maximum, and at most half a group.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  manifest - the manifest to list the planted files in.
+ *  numFiles - the number of files to plant.
+ *  maxBytes - the size of the largest file.
+ * ========================================================= */
+void plantFiles(
+	imageGen* gen,
+	imageManifest* manifest,
+	uint32_t numFiles,
+	uint64_t maxBytes
+) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint32_t ptrs = blockSize >> 2;
+	uint64_t groupBytes = (uint64_t)(gen->m_blocksPerGroup / 2) * blockSize;
+	if (maxBytes > groupBytes)
+		maxBytes = groupBytes;
+
+	// every block written for a file is an indirect block at most
+	gen->m_plantedMeta = malloc(
+		(gen->m_totalBlocks / ptrs + 3 * numFiles + 1) * sizeof(uint32_t)
+	);
+	if (!gen->m_plantedMeta)
+		exit_err("Failed to allocate indirect block list");
+
+	uint32_t cursor = groupDataStart(gen, 0);
+	for (uint32_t k = 0; k < numFiles; k++) {
+		plantedFile* file = &manifest->m_files[manifest->m_numFiles];
+		file->m_layout = k % NUM_LAYOUTS;
+		file->m_seed = synthRandom(&gen->m_rng);
+		file->m_size = MIN_FILE_BYTES;
+		if (maxBytes > MIN_FILE_BYTES)
+			file->m_size += synthRandom(&gen->m_rng) % (maxBytes - MIN_FILE_BYTES);
+		file->m_size -= file->m_size % ISO_SECTOR;
+
+		uint64_t numData = (file->m_size + blockSize - 1) / blockSize;
+		fileAlloc alloc;
+		memset(&alloc, 0, sizeof(alloc));
+		alloc.m_kind = PLANTED_DATA;
+		alloc.m_layout = file->m_layout;
+		alloc.m_file = file;
+		alloc.m_splitAt = numData;
+
+		if (file->m_layout == FRAG_DIRECT || file->m_layout == FRAG_INDIRECT) {
+			uint64_t indirectData = (numData - 12 < ptrs) ? numData - 12 : ptrs;
+			alloc.m_gap = 8 + synthRandom(&gen->m_rng) % 56;
+			alloc.m_splitAt = (file->m_layout == FRAG_DIRECT)
+				? 6 : 12 + indirectData / 2;
+		}
+
+		// spread the files over the groups after the first, which
+		// mostly holds the journal
+		uint32_t grp = (gen->m_numGroups > 1)
+			? 1 + (uint64_t)k * (gen->m_numGroups - 1) / numFiles : 0;
+		uint32_t target = groupDataStart(gen, grp);
+		if (cursor < target)
+			cursor = target;
+
+		uint32_t need = numData + metaBlocksFor(numData, ptrs) + alloc.m_gap;
+		cursor = placeFile(gen, cursor, need);
+		if (!cursor) {
+			fprintf(stderr, "Image is full, planted %u files.\n", k);
+			break;
+		}
+
+		alloc.m_dataStart = cursor;
+		alloc.m_cursor = (file->m_layout == INTERLEAVED)
+			? cursor : cursor + numData + alloc.m_gap;
+
+		uint32_t iblock[15];
+		mapFile(gen, &alloc, numData, iblock);
+		file->m_firstBlock = iblock[0];
+		manifest->m_numFiles++;
+
+		cursor += need + 16 + synthRandom(&gen->m_rng) % 240;
+	}
+}
+
+/* ============================================================
+ * Returns the first block at or after the cursor where a run
+ * of free blocks fits within a single group.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  cursor - the block to start looking from.
+ *  need - the length of the run.
+ *
+ * Returns:
+ * 	Returns the first block of the run, or 0 if none fits.
+ * ========================================================= */
+uint32_t placeFile(imageGen* gen, uint32_t cursor, uint32_t need) {
+	while (cursor < gen->m_totalBlocks) {
+		uint32_t grp = (cursor - gen->m_firstDataBlock) / gen->m_blocksPerGroup;
+		uint32_t end = groupEnd(gen, grp);
+
+		if (cursor < groupDataStart(gen, grp))
+			cursor = groupDataStart(gen, grp);
+		else if ((uint64_t)cursor + need > end)
+			cursor = end;
+		else {
+			uint32_t taken = 0;
+			for (uint32_t b = cursor; b < cursor + need && !taken; b++)
+				taken = isTaken(gen, b) ? b : 0;
+			if (!taken)
+				return cursor;
+			cursor = taken + 1;
+		}
+	}
+	return 0;
+}
+
+/* ============================================================
+ * Copies the indirect blocks of the planted files into the
+ * journal, as journaled metadata would leave them.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ * ========================================================= */
+void copyIntoJournal(imageGen* gen) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint8_t buffer[blockSize];
+
+	for (uint32_t i = 0; i < gen->m_numPlantedMeta; i++) {
+		if (i + 1 >= gen->m_numJournalBlocks)
+			break;
+		uint64_t addr = gen->m_partitionAddr
+			+ (uint64_t)gen->m_plantedMeta[i] * blockSize;
+		if (pread(gen->m_fd, buffer, blockSize, addr) != blockSize)
+			exit_err("Failed to read image");
+		writeBlockAt(gen, gen->m_journalBlocks[i + 1], buffer);
+	}
+}
+
+/* ============================================================
+ * Fills every block not yet written with runs of noise, used
+ * or free random data and text, zeroes and small live files
+ * with their own indirect blocks.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ * ========================================================= */
+void fillNoise(imageGen* gen) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint32_t ptrs = blockSize >> 2;
+	uint8_t buffer[blockSize];
+
+	uint32_t blockNum = gen->m_firstDataBlock;
+	while (blockNum < gen->m_totalBlocks) {
+		if (isTaken(gen, blockNum)) {
+			blockNum++;
+			continue;
+		}
+
+		uint32_t maxRun = 1 + synthRandom(&gen->m_rng) % MAX_NOISE_RUN;
+		uint32_t end = blockNum;
+		while (end < gen->m_totalBlocks && end - blockNum < maxRun && !isTaken(gen, end))
+			end++;
+
+		uint32_t kind = synthRandom(&gen->m_rng) % NUM_NOISE_KINDS;
+		uint64_t seed = synthRandom(&gen->m_rng);
+
+		if (kind == LIVE_FILE && end - blockNum > 16) {
+			uint32_t numData = end - blockNum;
+			while (numData + metaBlocksFor(numData, ptrs) > end - blockNum)
+				numData--;
+
+			fileAlloc alloc;
+			uint32_t iblock[15];
+			memset(&alloc, 0, sizeof(alloc));
+			alloc.m_kind = LIVE_DATA;
+			alloc.m_layout = INTERLEAVED;
+			alloc.m_cursor = blockNum;
+			alloc.m_seed = seed;
+			mapFile(gen, &alloc, numData, iblock);
+			blockNum = alloc.m_cursor;
+			continue;
+		}
+
+		for (; blockNum < end; blockNum++) {
+			uint32_t isUsed = kind == LIVE_RANDOM || kind == LIVE_TEXT || kind == LIVE_FILE;
+			claimBlock(gen, blockNum, isUsed);
+
+			if (kind == FREE_ZERO)
+				continue;
+			if (kind == LIVE_TEXT || kind == FREE_TEXT)
+				textBlock(&seed, buffer, blockSize);
+			else
+				randomBlock(seed, blockNum, buffer, blockSize);
+			writeBlockAt(gen, blockNum, buffer);
+		}
+	}
+}
+
+/* ============================================================
+ * Writes the block and inode bitmaps, the inode tables, the
+ * group descriptors and every copy of the superblock.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  seed - the seed of the image, used for its uuid.
+ * ========================================================= */
+void writeMetadata(imageGen* gen, uint64_t seed) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint32_t numGroups = gen->m_numGroups;
+	uint32_t ipg = gen->m_inodesPerGroup;
+	uint8_t buffer[blockSize];
+	uint8_t* descriptors = calloc(gen->m_gdtBlocks, blockSize);
+	if (!descriptors)
+		exit_err("Failed to allocate group descriptors");
+
+	uint32_t freeBlocks = 0;
+	for (uint32_t grp = 0; grp < numGroups; grp++) {
+		uint32_t start = groupStart(gen, grp);
+		uint32_t metaStart = groupDataStart(gen, grp) - 2 - INODE_TABLE_BLOCKS;
+		uint16_t groupFree = 0;
+
+		// block bitmap, padded with used bits past the last block
+		memset(buffer, 0xff, blockSize);
+		for (uint32_t i = 0; i < gen->m_blocksPerGroup; i++) {
+			uint32_t blockNum = start + i;
+			if (blockNum < gen->m_totalBlocks
+				&& !(gen->m_used[blockNum >> 3] & (1 << (blockNum & 7)))) {
+				buffer[i >> 3] &= ~(1 << (i & 7));
+				groupFree++;
+			}
+		}
+		writeBlockAt(gen, metaStart, buffer);
+		freeBlocks += groupFree;
+
+		// inode bitmap, the reserved inodes are in the first group
+		memset(buffer, 0xff, blockSize);
+		memset(buffer, 0, ipg / 8);
+		uint16_t usedInodes = (grp == 0) ? FIRST_INODE : 0;
+		for (uint32_t i = 0; i < usedInodes; i++)
+			buffer[i >> 3] |= 1 << (i & 7);
+		writeBlockAt(gen, metaStart + 1, buffer);
+
+		uint8_t* desc = descriptors + grp * GRP_DESC_SIZE;
+		uint32_t pointers[3] = {metaStart, metaStart + 1, metaStart + 2};
+		uint16_t freeInodes = ipg - usedInodes;
+		memcpy(desc, pointers, sizeof(pointers));
+		memcpy(desc + 12, &groupFree, 2);
+		uint16_t usedDirs = (grp == 0) ? 2 : 0;
+		memcpy(desc + 14, &freeInodes, 2);
+		memcpy(desc + 16, &usedDirs, 2);
+	}
+
+	SuperBlock sb;
+	memset(&sb, 0, sizeof(sb));
+	sb._inode_count = ipg * numGroups;
+	sb._fs_size_blocks = gen->m_totalBlocks;
+	sb._free_blocks = freeBlocks;
+	sb._free_inodes = ipg * numGroups - FIRST_INODE;
+	sb._first_data_block = gen->m_firstDataBlock;
+	sb._block_size = __builtin_ctz(blockSize >> 10);
+	sb._fragment_size = sb._block_size;
+	sb._blocks_per_group = gen->m_blocksPerGroup;
+	sb._frag_per_group = gen->m_blocksPerGroup;
+	sb._inodes_per_group = ipg;
+	sb._max_mnt_count = 0xffff;
+	sb._magic_sig = SUPERBLOCK_SIGNATURE;
+	sb._status = 1;
+	sb._errors = 1;
+	sb._revision_lvl = 1;
+	sb._first_inode = FIRST_INODE;
+	sb._inode_size = INODE_SIZE;
+	sb._compat_features = FEATURE_COMPAT_HAS_JOURNAL;
+	sb._incompat_features = FEATURE_INCOMPAT_FILETYPE;
+	sb._ro_features = FEATURE_RO_COMPAT_SPARSE_SUPER;
+	for (uint32_t i = 0; i < sizeof(sb._uuid); i += 8) {
+		uint64_t value = mixBits(seed + i);
+		memcpy(sb._uuid + i, &value, 8);
+	}
+	memcpy(sb._volume_name, "synthetic", 9);
+
+	// the journal inode number is past the fields of the struct
+	uint32_t journalInode = JOURNAL_INODE;
+	memcpy((uint8_t*)&sb + JOURNAL_INUM_OFFSET, &journalInode, 4);
+
+	for (uint32_t grp = 0; grp < numGroups; grp++) {
+		if (!hasBackup(grp))
+			continue;
+
+		// the first superblock is always 1024 bytes in, which is
+		// block 1 with 1K blocks and inside block 0 otherwise
+		uint32_t start = groupStart(gen, grp);
+		uint64_t sbAddr = gen->m_partitionAddr + (grp == 0
+			? 1024 : (uint64_t)start * blockSize);
+		sb._group_num = grp;
+		if (pwrite(gen->m_fd, &sb, sizeof(sb), sbAddr) != sizeof(sb))
+			exit_err("Failed to write superblock");
+
+		for (uint32_t i = 0; i < gen->m_gdtBlocks; i++)
+			writeBlockAt(gen, start + 1 + i, descriptors + i * blockSize);
+	}
+
+	free(descriptors);
+	writeInodes(gen);
+}
+
+/* ============================================================
+ * Writes the inodes of the root directory, the journal and
+ * lost+found into the first inode table.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ * ========================================================= */
+void writeInodes(imageGen* gen) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint32_t numJournal = gen->m_numJournalBlocks;
+	uint32_t journalBlocks = numJournal + metaBlocksFor(numJournal, blockSize >> 2);
+	uint32_t iblock[15];
+
+	// directories link to themselves and from their parent, the
+	// root also from the '..' of lost+found
+	memset(iblock, 0, sizeof(iblock));
+	iblock[0] = gen->m_rootBlock;
+	writeInode(gen, ROOT_INODE, 0x41ed, blockSize, 3, 1, iblock);
+	iblock[0] = gen->m_lostFoundBlock;
+	writeInode(gen, LOST_FOUND_INODE, 0x41c0, blockSize, 2, 1, iblock);
+
+	writeInode(gen, JOURNAL_INODE, 0x8180, numJournal * blockSize, 1,
+		journalBlocks, gen->m_journalInode);
+}
+
+/* ============================================================
+ * Writes an inode into the first inode table.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ *  inodeNum - the number of the inode.
+ *  mode - the file type and permissions.
+ *  size - the size of the file in bytes.
+ *  links - the number of links to the inode.
+ *  numBlocks - the blocks used by the file, indirect included.
+ *  iblock - the 15 block pointers of the inode.
+ * ========================================================= */
+void writeInode(
+	imageGen* gen,
+	uint32_t inodeNum,
+	uint16_t mode,
+	uint32_t size,
+	uint16_t links,
+	uint32_t numBlocks,
+	const uint32_t* iblock
+) {
+	uint32_t blockSize = gen->m_blockSize;
+	uint32_t sectors = numBlocks * (blockSize / SECTOR_SIZE);
+	uint8_t inode[INODE_SIZE];
+
+	memset(inode, 0, INODE_SIZE);
+	memcpy(inode, &mode, 2);
+	memcpy(inode + 4, &size, 4);
+	memcpy(inode + 26, &links, 2);
+	memcpy(inode + 28, &sectors, 4);
+	memcpy(inode + 40, iblock, 15 * sizeof(uint32_t));
+
+	uint32_t tableStart = groupDataStart(gen, 0) - INODE_TABLE_BLOCKS;
+	uint64_t addr = gen->m_partitionAddr + (uint64_t)tableStart * blockSize
+		+ (inodeNum - 1) * INODE_SIZE;
+	if (pwrite(gen->m_fd, inode, INODE_SIZE, addr) != INODE_SIZE)
+		exit_err("Failed to write inode");
+}
+
+/* ============================================================
+ * Writes an MBR with a single linux partition holding the
+ * file system.
+ *
+ * Parameters:
+ * 	gen - the image being generated.
+ * ========================================================= */
+void writeMBR(imageGen* gen) {
+	uint8_t mbr[SECTOR_SIZE];
+	memset(mbr, 0, SECTOR_SIZE);
+
+	PartitionTable entry;
+	memset(&entry, 0, sizeof(entry));
+	entry._type_code = 0x83;
+	entry._lba = PARTITION_LBA;
+	entry._num_sectors = (uint64_t)gen->m_totalBlocks * gen->m_blockSize / SECTOR_SIZE;
+	memcpy(mbr + 446, &entry, sizeof(entry));
+
+	uint16_t signature = MBR_SIGNATURE;
+	memcpy(mbr + 510, &signature, 2);
+	if (pwrite(gen->m_fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE)
+		exit_err("Failed to write MBR");
+}
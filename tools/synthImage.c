@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synthImage.h"
+#include "safeio.h"
+#include "scan.h"
+
+#define SYSTEM_AREA_END DESCRIPTOR_OFFSET
+#define DESCRIPTORS_END (DESCRIPTOR_OFFSET + 2 * ISO_SECTOR)
+
+const char* layoutNames[NUM_LAYOUTS] = {
+	"packed", "interleaved", "frag-direct", "frag-indirect"
+};
+
+const char* words[] = {
+	"the", "of", "block", "group", "inode", "file", "data", "recovery",
+	"partition", "journal", "and", "to", "in", "is", "deleted", "image",
+	"evidence", "case", "report", "examiner", "sector", "volume", "disk"
+};
+
+void descriptorArea(const plantedFile*, uint8_t*);
+
+/* ============================================================
+ * Returns the splitmix64 finalizer of a value, a cheap hash
+ * whose output bits all depend on every input bit.
+ * ========================================================= */
+uint64_t mixBits(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return x ^ (x >> 31);
+}
+
+/* ============================================================
+ * Advances a splitmix64 generator and returns its next value.
+ *
+ * Parameters:
+ * 	state - the generator state.
+ * ========================================================= */
+uint64_t synthRandom(uint64_t* state) {
+	*state += 0x9e3779b97f4a7c15;
+	return mixBits(*state);
+}
+
+/* ============================================================
+ * Fills a buffer with the content of a planted file at the
+ * given offset. Each 8 bytes are a hash of the seed and their
+ * offset so any block can be produced on its own. The file
+ * starts with a zeroed 32K system area followed by a primary
+ * volume descriptor and a set terminator, as an .iso does, and
+ * is zero past its size.
+ *
+ * Parameters:
+ * 	file - the planted file.
+ *  offset - byte offset into the file, a multiple of 8.
+ *  buffer - the buffer to fill.
+ *  size - the number of bytes to fill, a multiple of 8.
+ * ========================================================= */
+void fileContent(
+	const plantedFile* file,
+	uint64_t offset,
+	uint8_t* buffer,
+	uint32_t size
+) {
+	for (uint32_t i = 0; i < size; i += 8) {
+		uint64_t value = mixBits(file->m_seed ^ mixBits(offset + i));
+		memcpy(buffer + i, &value, 8);
+	}
+
+	// header areas overlapping the requested range
+	if (offset < SYSTEM_AREA_END) {
+		uint64_t end = (offset + size < SYSTEM_AREA_END)
+			? offset + size : SYSTEM_AREA_END;
+		memset(buffer, 0, end - offset);
+	}
+	if (offset < DESCRIPTORS_END && offset + size > SYSTEM_AREA_END) {
+		uint8_t area[DESCRIPTORS_END - SYSTEM_AREA_END];
+		descriptorArea(file, area);
+
+		uint64_t start = (offset > SYSTEM_AREA_END) ? offset : SYSTEM_AREA_END;
+		uint64_t end = (offset + size < DESCRIPTORS_END)
+			? offset + size : DESCRIPTORS_END;
+		memcpy(buffer + (start - offset), area + (start - SYSTEM_AREA_END), end - start);
+	}
+
+	if (offset + size > file->m_size) {
+		uint64_t start = (offset > file->m_size) ? offset : file->m_size;
+		memset(buffer + (start - offset), 0, offset + size - start);
+	}
+}
+
+/* ============================================================
+ * Fills a buffer with random bytes derived from a seed and
+ * the block's index.
+ * ========================================================= */
+void randomBlock(uint64_t seed, uint64_t index, uint8_t* buffer, uint32_t size) {
+	uint64_t base = mixBits(seed ^ mixBits(index));
+	for (uint32_t i = 0; i < size; i += 8) {
+		uint64_t value = mixBits(base + i);
+		memcpy(buffer + i, &value, 8);
+	}
+}
+
+/* ============================================================
+ * Fills a buffer with lines of random words.
+ * ========================================================= */
+void textBlock(uint64_t* rng, uint8_t* buffer, uint32_t size) {
+	uint32_t numWords = sizeof(words) / sizeof(words[0]);
+	uint32_t used = 0;
+
+	while (used < size) {
+		uint64_t pick = synthRandom(rng);
+		const char* word = words[pick % numWords];
+		uint32_t length = strlen(word);
+
+		for (uint32_t i = 0; i < length && used < size; i++)
+			buffer[used++] = word[i];
+		if (used < size)
+			buffer[used++] = (pick >> 32) % 12 ? ' ' : '\n';
+	}
+}
+
+/* ============================================================
+ * Builds the volume descriptors that follow the system area of
+ * a planted file.
+ *
+ * Parameters:
+ * 	file - the planted file.
+ *  area - output buffer of two iso sectors.
+ * ========================================================= */
+void descriptorArea(const plantedFile* file, uint8_t* area) {
+	memset(area, 0, 2 * ISO_SECTOR);
+	uint32_t sectors = file->m_size / ISO_SECTOR;
+
+	// primary volume descriptor, sizes are stored both
+	// little and big endian
+	uint8_t* primary = area;
+	primary[0] = 0x01;
+	memcpy(primary + 1, "CD001", 5);
+	primary[6] = 0x01;
+	memcpy(primary + 80, &sectors, 4);
+	primary[84] = sectors >> 24;
+	primary[85] = sectors >> 16;
+	primary[86] = sectors >> 8;
+	primary[87] = sectors;
+	primary[128] = ISO_SECTOR & 0xff;
+	primary[129] = ISO_SECTOR >> 8;
+	primary[130] = ISO_SECTOR >> 8;
+	primary[131] = ISO_SECTOR & 0xff;
+
+	uint8_t* terminator = area + ISO_SECTOR;
+	terminator[0] = 0xff;
+	memcpy(terminator + 1, "CD001", 5);
+	terminator[6] = 0x01;
+}
+
+/* ============================================================
+ * Returns the name of a layout as written in manifests.
+ * ========================================================= */
+const char* layoutName(uint32_t layout) {
+	return (layout < NUM_LAYOUTS) ? layoutNames[layout] : "unknown";
+}
+
+/* ============================================================
+ * Writes the manifest of an image as text, one planted file
+ * per line.
+ *
+ * Parameters:
+ * 	path - the path of the manifest.
+ *  manifest - the manifest to write.
+ * ========================================================= */
+void writeManifest(const char* path, const imageManifest* manifest) {
+	FILE* file = fopen(path, "w");
+	if (!file)
+		exit_err("Failed to open manifest");
+
+	fprintf(file, "block_size %u\n", manifest->m_blockSize);
+	fprintf(file, "total_blocks %u\n", manifest->m_totalBlocks);
+	fprintf(file, "partition_addr %lu\n", manifest->m_partitionAddr);
+	for (uint32_t i = 0; i < manifest->m_numFiles; i++) {
+		const plantedFile* planted = &manifest->m_files[i];
+		fprintf(file, "file %u %lu %lu %s\n",
+			planted->m_firstBlock, planted->m_size, planted->m_seed,
+			layoutName(planted->m_layout));
+	}
+	for (uint32_t i = 0; i < manifest->m_numIndirect; i++)
+		fprintf(file, "indirect %u\n", manifest->m_indirectBlocks[i]);
+	fclose(file);
+}
+
+/* ============================================================
+ * Reads the manifest of an image.
+ *
+ * Parameters:
+ * 	path - the path of the manifest.
+ *  manifest - output parameter for the manifest.
+ *
+ * Returns:
+ * 	Returns a 1 if the manifest was read, 0 otherwise.
+ * ========================================================= */
+uint32_t readManifest(const char* path, imageManifest* manifest) {
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return 0;
+
+	memset(manifest, 0, sizeof(imageManifest));
+	char line[256];
+	char name[32];
+	uint32_t blockNum;
+	uint32_t capacity = 0;
+
+	while (fgets(line, sizeof(line), file)) {
+		plantedFile* planted = &manifest->m_files[manifest->m_numFiles];
+
+		if (sscanf(line, "block_size %u", &manifest->m_blockSize) == 1)
+			continue;
+		if (sscanf(line, "total_blocks %u", &manifest->m_totalBlocks) == 1)
+			continue;
+		if (sscanf(line, "partition_addr %lu", &manifest->m_partitionAddr) == 1)
+			continue;
+		if (
+			manifest->m_numFiles < MAX_PLANTED &&
+			sscanf(line, "file %u %lu %lu %31s", &planted->m_firstBlock,
+				&planted->m_size, &planted->m_seed, name) == 4
+		) {
+			planted->m_layout = NUM_LAYOUTS;
+			for (uint32_t k = 0; k < NUM_LAYOUTS; k++)
+				if (strcmp(name, layoutNames[k]) == 0)
+					planted->m_layout = k;
+			manifest->m_numFiles++;
+		} else if (sscanf(line, "indirect %u", &blockNum) == 1) {
+			if (manifest->m_numIndirect == capacity) {
+				capacity = capacity ? capacity * 2 : 1024;
+				manifest->m_indirectBlocks = realloc(
+					manifest->m_indirectBlocks, capacity * sizeof(uint32_t)
+				);
+				if (!manifest->m_indirectBlocks)
+					exit_err("Failed to allocate manifest");
+			}
+			manifest->m_indirectBlocks[manifest->m_numIndirect++] = blockNum;
+		}
+	}
+	fclose(file);
+	return manifest->m_blockSize != 0;
+}
+
+/* ============================================================
+ * Frees the indirect block list read with a manifest.
+ * ========================================================= */
+void freeManifest(imageManifest* manifest) {
+	free(manifest->m_indirectBlocks);
+	manifest->m_indirectBlocks = NULL;
+	manifest->m_numIndirect = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef SYNTH_IMAGE_H
+#define SYNTH_IMAGE_H
+
+#include <stdint.h>
+
+#define PARTITION_LBA 2048
+#define ISO_SECTOR 2048
+#define MAX_PLANTED 1024
+#define MANIFEST_SUFFIX ".manifest"
+
+// how the blocks of a planted file are laid out
+enum Layout {
+	PACKED,			// contiguous data, indirect blocks after it
+	INTERLEAVED,	// indirect blocks between the data as ext3 allocates
+	FRAG_DIRECT,	// gap within the 12 direct blocks
+	FRAG_INDIRECT,	// gap within the blocks of the single indirect
+	NUM_LAYOUTS
+};
+
+// a deleted .iso file planted in a synthetic image, its content
+// is generated from the seed so it never has to be stored
+typedef struct {
+	uint32_t m_firstBlock;
+	uint64_t m_size;		// a multiple of the 2048 byte iso sector
+	uint64_t m_seed;
+	uint32_t m_layout;
+} plantedFile;
+
+// written next to each image so its planted files are known
+typedef struct {
+	uint32_t m_blockSize;
+	uint32_t m_totalBlocks;
+	uint64_t m_partitionAddr;
+	uint32_t m_numFiles;
+	plantedFile m_files[MAX_PLANTED];
+	uint32_t* m_indirectBlocks;		// of every planted file
+	uint32_t m_numIndirect;
+} imageManifest;
+
+uint64_t mixBits(uint64_t);
+uint64_t synthRandom(uint64_t*);
+void fileContent(const plantedFile*, uint64_t, uint8_t*, uint32_t);
+void randomBlock(uint64_t, uint64_t, uint8_t*, uint32_t);
+void textBlock(uint64_t*, uint8_t*, uint32_t);
+const char* layoutName(uint32_t);
+void writeManifest(const char*, const imageManifest*);
+uint32_t readManifest(const char*, imageManifest*);
+void freeManifest(imageManifest*);
+
+#endif